@@ -90,6 +90,7 @@ typedef enum CB_EVENT_TYPE {
   CB_EVENT_TYPE_NET_CONNECT_PRE = 20,
   CB_EVENT_TYPE_NET_CONNECT_POST = 21,
   CB_EVENT_TYPE_NET_ACCEPT = 22,
+  CB_EVENT_TYPE_NET_FLOW_SUMMARY = 23, // Connections to a tracked flow since the last summary
 
   CB_EVENT_TYPE_DNS_RESPONSE = 25,
   // CB_EVENT_TYPE_CHILDPROC_START     = 26,
@@ -289,6 +290,19 @@ typedef struct _CB_EVENT_NETWORK_CONNECT {
     #endif
 } CB_EVENT_NETWORK_CONNECT, *PCB_EVENT_NETWORK_CONNECT;
 
+// Activity on one tracked connection since the last summary.  Timestamps use the same format
+//  as the event time.
+typedef struct _CB_EVENT_NETWORK_FLOW {
+    int32_t protocol;
+    uint16_t direction;     // 1 is inbound, 2 is outbound
+    CB_SOCK_ADDR localAddr;
+    CB_SOCK_ADDR remoteAddr;
+    uint64_t count;         // Connections since the last summary
+    uint64_t total_count;   // Connections since the flow was first seen
+    uint64_t first_seen;
+    uint64_t last_seen;
+} CB_EVENT_NETWORK_FLOW, *PCB_EVENT_NETWORK_FLOW;
+
 struct dnshdr {
   u_int16_t id;
   u_int16_t flags;
@@ -414,6 +428,7 @@ typedef struct CB_EVENT {
         // CB_EVENT_DIR_DELETE     dirDelete;
 
         CB_EVENT_NETWORK_CONNECT netConnect;
+        CB_EVENT_NETWORK_FLOW netFlow;
         CB_EVENT_DNS_RESPONSE dnsResponse;
         CB_EVENT_BLOCK_RESPONSE blockResponse;
         CB_EVENT_HEARTBEAT heartbeat;
@@ -462,6 +477,23 @@ typedef struct CB_ISOLATION_MODE_CONTROL {
   uint32_t allowedIpAddresses[1];
 } CB_ISOLATION_MODE_CONTROL, *PCB_ISOLATION_MODE_CONTROL;
 
+// An allow rule for network isolation.  A rule matches a remote address within the
+//  prefix, a remote port within [portLow, portHigh] and the protocol (0 matches any).
+typedef struct CB_ISOLATION_RULE {
+  uint16_t family;        // AF_INET or AF_INET6
+  uint8_t  prefixLength;  // 0-32 for AF_INET, 0-128 for AF_INET6
+  uint8_t  protocol;      // IPPROTO_TCP, IPPROTO_UDP or 0 for any
+  uint16_t portLow;       // host order, 0 and 0xFFFF to allow any port
+  uint16_t portHigh;
+  uint8_t  addr[16];      // network order, AF_INET uses the first 4 bytes
+} CB_ISOLATION_RULE, *PCB_ISOLATION_RULE;
+
+typedef struct CB_ISOLATION_RULES_CONTROL {
+  CB_ISOLATION_MODE isolationMode;
+  uint32_t numberOfRules;
+  CB_ISOLATION_RULE rules[1];
+} CB_ISOLATION_RULES_CONTROL, *PCB_ISOLATION_RULES_CONTROL;
+
 #define PROTECTION_DISABLED 0
 #define PROTECTION_ENABLED 1
 typedef uint32_t CB_PROTECTION_ENABLED; // 1 == enabled default is enabled
@@ -505,11 +537,46 @@ typedef enum CB_DRIVER_REQUEST {
   CB_DRIVER_REQUEST_CONFIG = 15, // one way
   CB_DRIVER_REQUEST_SET_BANNED_INODE_WITHOUT_KILL = 16, // one way but called multiple times
   CB_DRIVER_REQUEST_WEBPROXY_ENABLED = 17, // one way
+  CB_DRIVER_REQUEST_PROCESS_DISCOVERY_DELTA = 18, // two way
+  CB_DRIVER_REQUEST_IGNORE_PROCESS_TREE = 19, // one way, ignore a pid and all of its descendants
+  CB_DRIVER_REQUEST_IGNORE_CGROUP = 20, // one way, uint64_t cgroup v2 id
+  CB_DRIVER_REQUEST_ISOLATION_RULES_CONTROL = 21, // one way, CB_ISOLATION_RULES_CONTROL
+  CB_DRIVER_REQUEST_EVENT_STATS = 22, // two way, CB_EVENT_STATS_SNAPSHOT
 
   CB_DRIVER_REQUEST_MAX
 
 } CB_DRIVER_REQUEST;
 
+// Request discovery of only the processes created or exec'd after since_generation.
+//  The driver returns the generation to use for the next request.
+typedef struct CB_DISCOVERY_DELTA {
+  uint64_t since_generation;
+  uint64_t generation;
+} CB_DISCOVERY_DELTA;
+
+// Event counters since the driver was enabled or the stats were last reset.  Rates come from the
+//  difference between two snapshots.
+typedef struct CB_EVENT_STATS_SNAPSHOT {
+  uint64_t timestamp;         // Same format as the event time
+  uint64_t queued_now;        // Events waiting to be read
+  uint64_t queued_total;      // Sum of the queue depth sampled at each stats interval
+  uint64_t dropped;
+  uint64_t process_dropped;
+  uint64_t total;
+  uint64_t process;
+  uint64_t modload;
+  uint64_t file;
+  uint64_t net;
+  uint64_t dns;
+  uint64_t proxy;
+  uint64_t blocked;
+  uint64_t other;
+  uint64_t user_memory;
+  uint64_t user_memory_peak;
+  uint64_t kernel_memory;
+  uint64_t kernel_memory_peak;
+} CB_EVENT_STATS_SNAPSHOT;
+
 #define CB_REQUEST_PROTOCOL_VERSION 0x1
 
 typedef struct CB_REQUEST_MESSAGE {
@@ -8,11 +8,15 @@
 #include <linux/cred.h>
 #endif
 #include <linux/signal.h>
+#include <linux/hash.h>
+#include <linux/mutex.h>
+#include <linux/cgroup.h>
 
 #include "hash-table.h"
 #include "process-tracking.h"
 #include "event-factory.h"
 #include "mem-alloc.h"
+#include "cb-test.h"
 
 typedef struct bl_table_key {
     uint64_t    device;
@@ -28,40 +32,81 @@ typedef struct banning_entry_s {
 
 #define CB_BANNING_CACHE_OBJ_SZ 64
 
+typedef enum ignore_type {
+    IGNORE_TYPE_NONE = 0,
+    IGNORE_TYPE_PID,
+    IGNORE_TYPE_UID,
+    IGNORE_TYPE_PROCESS_TREE,
+    IGNORE_TYPE_CGROUP,
+} IgnoreType;
+
+typedef struct ignore_slot {
+    uint64_t    value;
+    IgnoreType  type;
+} IgnoreSlot;
+
+// The ignore rules are checked at the top of every hook, so they are kept in an immutable
+//  open-addressed hash that is rebuilt and published with RCU on every update.  A one word
+//  bloom filter in front of it answers most misses without touching the slots, and when no
+//  rules are set the hooks only see a NULL pointer.
+typedef struct ignore_set {
+    uint64_t    bloom;
+    uint32_t    count;
+    uint32_t    mask;
+    uint32_t    type_count[IGNORE_TYPE_CGROUP + 1];
+    IgnoreSlot  slots[];
+} IgnoreSet;
+
+#define CB_SENSOR_MAX_IGNORE_RULES  1024
+
+// Limit how far up the process tree we look for an ignored ancestor
+#define IGNORE_MAX_TREE_DEPTH       32
+
 struct _banning_data
 {
     HashTbl     banning_table;
     uint32_t    protectionModeEnabled;
-    uint64_t    ignored_pid_count;
-    pid_t       ignored_pids[CB_SENSOR_MAX_PIDS];
-    int64_t     ignored_uid_count;
-    uid_t       ignored_uids[CB_SENSOR_MAX_UIDS];
+    IgnoreSet  __rcu *ignore_set;
 };
 
 void ec_banning_KillRunningBannedProcessByInode(ProcessContext *context, uint64_t device, uint64_t ino);
+bool __ec_banning_AddIgnoreRule(ProcessContext *context, IgnoreType type, uint64_t value);
+
+static DEFINE_MUTEX(s_ignore_set_lock);
 
 static struct _banning_data __read_mostly s_banning = {
     .protectionModeEnabled = PROTECTION_ENABLED,
     .banning_table = {
-        .numberOfBuckets = 8192,
+        .numberOfBuckets = 64,
+        .maxBuckets = 8192,
         .name = "banning_cache",
         .datasize = sizeof(BanningEntry),
         .key_len     = sizeof(BL_TBL_KEY),
         .key_offset  = offsetof(BanningEntry, key),
+        .rcu_lookup = true,
     }
 };
 
 bool ec_banning_initialize(ProcessContext *context)
 {
-    memset(&s_banning.ignored_pids[0], 0, sizeof(pid_t)*CB_SENSOR_MAX_PIDS);
-    memset(&s_banning.ignored_uids[0], 0xFF, sizeof(uid_t)*CB_SENSOR_MAX_PIDS);
+    RCU_INIT_POINTER(s_banning.ignore_set, NULL);
 
     return ec_hashtbl_init(&s_banning.banning_table, context);
 }
 
 void ec_banning_shutdown(ProcessContext *context)
 {
+    IgnoreSet *ignore_set;
+
     ec_hashtbl_destroy(&s_banning.banning_table, context);
+
+    mutex_lock(&s_ignore_set_lock);
+    ignore_set = rcu_dereference_protected(s_banning.ignore_set, lockdep_is_held(&s_ignore_set_lock));
+    RCU_INIT_POINTER(s_banning.ignore_set, NULL);
+    mutex_unlock(&s_ignore_set_lock);
+
+    synchronize_rcu();
+    ec_mem_free(ignore_set);
 }
 
 void ec_banning_SetProtectionState(ProcessContext *context, uint32_t new_state)
@@ -177,14 +222,46 @@ kbpbi_exit:
 #define my_siginfo siginfo
 #endif //}
 
-void ec_banning_KillRunningBannedProcessByInode(ProcessContext *context, uint64_t device, uint64_t ino)
+typedef struct banning_kill_info {
+    uint64_t           device;
+    uint64_t           inode;
+    struct my_siginfo  info;
+} BANNING_KILL_INFO;
+
+static int __ec_banning_kill_process(ProcessHandle *process_handle, void *priv, ProcessContext *context)
 {
-    pid_t pid = 0;
-    struct my_siginfo info;
+    BANNING_KILL_INFO *kill_info = (BANNING_KILL_INFO *)priv;
+    struct task_struct const *task = NULL;
+    pid_t pid = ec_process_posix_identity(process_handle)->pt_key.pid;
     int ret;
-    struct list_head *pos, *safe_del;
-    RUNNING_BANNED_INODE_S sRunningInodesToBan;
-    RUNNING_PROCESSES_TO_BAN *temp = NULL;
+
+    task = ec_find_task(pid);
+    if (task)
+    {
+        ret = send_sig_info(SIGKILL, &kill_info->info, (struct task_struct *) task);
+        if (!ret)
+        {
+            TRACE(DL_ERROR, "%s: killed process with [%llu:%llu] pid=%d", __func__, kill_info->device, kill_info->inode, pid);
+
+            // Send the event
+            ec_event_send_block(process_handle,
+                                ProcessTerminatedAfterStartup,
+                                TerminateFailureReasonNone,
+                                0,
+                                ec_process_tracking_should_track_user() ? ec_process_posix_identity(process_handle)->uid : (uid_t) -1,
+                                NULL,
+                                context);
+            return ACTION_CONTINUE;
+        }
+    }
+
+    TRACE(DL_INFO, "%s: error sending kill to process with [%llu:%llu] pid=%d", __func__, kill_info->device, kill_info->inode, pid);
+    return ACTION_CONTINUE;
+}
+
+void ec_banning_KillRunningBannedProcessByInode(ProcessContext *context, uint64_t device, uint64_t ino)
+{
+    BANNING_KILL_INFO kill_info;
 
     if (s_banning.protectionModeEnabled == PROTECTION_DISABLED)
     {
@@ -194,164 +271,271 @@ void ec_banning_KillRunningBannedProcessByInode(ProcessContext *context, uint64_
 
     TRACE(DL_ERROR, "Kill process with [%llu:%llu]", device, ino);
 
-    memset(&info, 0, sizeof(info));
-    info.si_signo = SIGKILL;
-    info.si_code = 0;
-    info.si_errno = 1234;
+    memset(&kill_info, 0, sizeof(kill_info));
+    kill_info.device = device;
+    kill_info.inode  = ino;
+    kill_info.info.si_signo = SIGKILL;
+    kill_info.info.si_code = 0;
+    kill_info.info.si_errno = 1234;
 
-    memset(&sRunningInodesToBan, 0, sizeof(RUNNING_BANNED_INODE_S));
-    sRunningInodesToBan.device = device;
-    sRunningInodesToBan.inode  = ino;
-    sRunningInodesToBan.count  = 0;
-    INIT_LIST_HEAD(&sRunningInodesToBan.BanList.list);
-
-    ec_is_process_tracked_get_state_by_inode(&sRunningInodesToBan, context);
-
-    if (!sRunningInodesToBan.count)
+    // Only the processes currently running this inode are visited
+    if (!ec_process_tracking_for_each_by_exec_inode(device, ino, __ec_banning_kill_process, &kill_info, context))
     {
         TRACE(DL_INFO, "%s: failed to find process with [%llu:%llu]", __func__, device, ino);
-        return;
     }
+}
+
+static inline uint64_t __ec_ignore_hash(IgnoreType type, uint64_t value)
+{
+    return hash_64(value ^ ((uint64_t)type << 56), 64);
+}
+
+static inline uint64_t __ec_ignore_bloom_bits(uint64_t hash)
+{
+    return (1ULL << (hash & 63)) | (1ULL << ((hash >> 6) & 63));
+}
+
+// Must be called under rcu_read_lock
+static bool __ec_ignore_set_contains(IgnoreSet *ignore_set, IgnoreType type, uint64_t value)
+{
+    uint64_t hash = __ec_ignore_hash(type, value);
+    uint64_t bits = __ec_ignore_bloom_bits(hash);
+    uint32_t i;
 
-    list_for_each(pos, &sRunningInodesToBan.BanList.list)
+    if (!ignore_set->type_count[type] || (ignore_set->bloom & bits) != bits)
     {
-        struct task_struct const *task = NULL;
-        ProcessHandle *process_handle = (ProcessHandle *)(list_entry(pos, RUNNING_PROCESSES_TO_BAN, list)->process_handle);
+        return false;
+    }
 
-        if (process_handle)
+    // The table is never more than half full, so a probe always reaches an empty slot
+    for (i = (uint32_t)(hash >> 12) & ignore_set->mask;
+         ignore_set->slots[i].type != IGNORE_TYPE_NONE;
+         i = (i + 1) & ignore_set->mask)
+    {
+        if (ignore_set->slots[i].type == type && ignore_set->slots[i].value == value)
         {
-            pid = ec_process_posix_identity(process_handle)->pt_key.pid;
-
-            task = ec_find_task(pid);
-            if (task)
-            {
-                ret = send_sig_info(SIGKILL, &info, (struct task_struct *) task);
-                if (!ret)
-                {
-                    TRACE(DL_ERROR, "%s: killed process with [%llu:%llu] pid=%d", __func__, device, ino, pid);
-
-                    // Send the event
-                    ec_event_send_block(process_handle,
-                                        ProcessTerminatedAfterStartup,
-                                        TerminateFailureReasonNone,
-                                        0,
-                                        ec_process_tracking_should_track_user() ? ec_process_posix_identity(process_handle)->uid : (uid_t) -1,
-                                        NULL,
-                                        context);
-                    continue;
-                }
-            }
+            return true;
         }
-
-        TRACE(DL_INFO, "%s: error sending kill to process with [%llu:%llu] pid=%d", __func__, device, ino, pid);
     }
+    return false;
+}
 
-    //Clean up the list
-    list_for_each_safe(pos, safe_del, &sRunningInodesToBan.BanList.list)
+static void __ec_ignore_set_insert(IgnoreSet *ignore_set, IgnoreType type, uint64_t value)
+{
+    uint64_t hash = __ec_ignore_hash(type, value);
+    uint32_t i    = (uint32_t)(hash >> 12) & ignore_set->mask;
+
+    while (ignore_set->slots[i].type != IGNORE_TYPE_NONE)
     {
-        temp = list_entry(pos, RUNNING_PROCESSES_TO_BAN, list);
-        ec_process_tracking_put_handle(temp->process_handle, context);
-        list_del(pos);
-        ec_mem_free(temp);
+        i = (i + 1) & ignore_set->mask;
     }
 
-    memset(&sRunningInodesToBan, 0, sizeof(RUNNING_BANNED_INODE_S));
+    ignore_set->slots[i].type  = type;
+    ignore_set->slots[i].value = value;
+    ignore_set->bloom         |= __ec_ignore_bloom_bits(hash);
+    ignore_set->count         += 1;
+    ignore_set->type_count[type] += 1;
 }
 
-bool ec_banning_IgnoreProcess(ProcessContext *context, pid_t pid)
+static inline uint64_t __ec_task_cgroup_id(struct task_struct *task)
 {
-    int64_t i;
-    int64_t max = s_banning.ignored_pid_count;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0) && defined(CONFIG_CGROUPS)
+    // This is the inode number of the cgroup directory on the unified (v2) hierarchy
+    return cgroup_id(task_dfl_cgroup(task));
+#else
+    return 0;
+#endif
+}
 
-    TRACE(DL_TRACE, "Test if pid=%u should be ignored count=%lld", pid, max);
+bool ec_banning_IgnoreProcess(ProcessContext *context, pid_t pid)
+{
+    bool       xcode = false;
+    IgnoreSet *ignore_set;
 
-    if (max == 0)
+    // Nothing is ignored, so do not even enter the read section
+    if (!rcu_access_pointer(s_banning.ignore_set))
     {
-        goto ignore_process_exit;
+        return false;
     }
 
-    for (i = 0; i < max; ++i)
+    rcu_read_lock();
+    ignore_set = rcu_dereference(s_banning.ignore_set);
+    TRY(ignore_set);
+
+    TRACE(DL_TRACE, "Test if pid=%u should be ignored count=%u", pid, ignore_set->count);
+
+    TRY_SET(!__ec_ignore_set_contains(ignore_set, IGNORE_TYPE_PID, pid), true);
+
+    // Tree and cgroup rules need the task.  The hooks almost always ask about the current
+    //  task, so we do not go looking for any other one.
+    TRY(pid == ec_getpid(current));
+
+    if (ignore_set->type_count[IGNORE_TYPE_PROCESS_TREE])
     {
-        if (s_banning.ignored_pids[i] == pid)
+        struct task_struct *task = current;
+        int depth;
+
+        for (depth = 0; depth < IGNORE_MAX_TREE_DEPTH && task && task->pid != 0; ++depth)
         {
-            TRACE(DL_TRACE, "Ignore pid=%u", pid);
-            return true;
+            TRY_SET(!__ec_ignore_set_contains(ignore_set, IGNORE_TYPE_PROCESS_TREE, ec_getpid(task)), true);
+            task = rcu_dereference(task->real_parent);
         }
     }
 
-ignore_process_exit:
-    return false;
+    if (ignore_set->type_count[IGNORE_TYPE_CGROUP])
+    {
+        TRY_SET(!__ec_ignore_set_contains(ignore_set, IGNORE_TYPE_CGROUP, __ec_task_cgroup_id(current)), true);
+    }
+
+CATCH_DEFAULT:
+    rcu_read_unlock();
+
+    if (xcode)
+    {
+        TRACE(DL_TRACE, "Ignore pid=%u", pid);
+    }
+    return xcode;
 }
 
 void ec_banning_SetIgnoredProcess(ProcessContext *context, pid_t pid)
 {
-    int64_t i;
-    int64_t max = s_banning.ignored_pid_count;
+    if (__ec_banning_AddIgnoreRule(context, IGNORE_TYPE_PID, pid))
+    {
+        TRACE(DL_INFO, "Adding pid=%u", pid);
+    }
+}
 
-    // Search for pid
-    for (i = 0; i < max; ++i)
+void ec_banning_SetIgnoredProcessTree(ProcessContext *context, pid_t pid)
+{
+    if (__ec_banning_AddIgnoreRule(context, IGNORE_TYPE_PROCESS_TREE, pid))
     {
-        if (s_banning.ignored_pids[i] == pid)
-        {
-            TRACE(DL_VERBOSE, "already ignoring pid=%u", pid);
-            return;
-        }
+        TRACE(DL_INFO, "Adding process tree pid=%u", pid);
     }
+}
 
-    if (max < CB_SENSOR_MAX_PIDS)
+void ec_banning_SetIgnoredCgroup(ProcessContext *context, uint64_t cgroup_id)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 7, 0) || !defined(CONFIG_CGROUPS)
+    TRACE(DL_WARNING, "cgroup id is not available on this kernel, ignoring cgroup=%llu will have no effect", cgroup_id);
+#endif
+
+    if (__ec_banning_AddIgnoreRule(context, IGNORE_TYPE_CGROUP, cgroup_id))
     {
-        s_banning.ignored_pids[max] = pid;
-        max += 1;
-        s_banning.ignored_pid_count = max;
-        TRACE(DL_INFO, "Adding pid=%u at %lld", pid, max);
+        TRACE(DL_INFO, "Adding cgroup=%llu", cgroup_id);
     }
 }
 
 bool ec_banning_IgnoreUid(ProcessContext *context, pid_t uid)
 {
-    int64_t i;
-    int64_t max = s_banning.ignored_uid_count;
+    bool       ignore = false;
+    IgnoreSet *ignore_set;
+
+    if (!rcu_access_pointer(s_banning.ignore_set))
+    {
+        return false;
+    }
 
     TRACE(DL_TRACE, "Test if uid=%u should be ignored", uid);
 
-    if (max == 0)
+    rcu_read_lock();
+    ignore_set = rcu_dereference(s_banning.ignore_set);
+    ignore = ignore_set && __ec_ignore_set_contains(ignore_set, IGNORE_TYPE_UID, (uid_t)uid);
+    rcu_read_unlock();
+
+    if (ignore)
     {
-        goto ignore_uid_exit;
+        TRACE(DL_TRACE, "Ignore uid=%u", uid);
     }
+    return ignore;
+}
+
+bool ec_banning_HasIgnoredUids(void)
+{
+    bool       has_uids;
+    IgnoreSet *ignore_set;
 
-    for (i = 0; i < max; ++i)
+    rcu_read_lock();
+    ignore_set = rcu_dereference(s_banning.ignore_set);
+    has_uids = ignore_set && ignore_set->type_count[IGNORE_TYPE_UID];
+    rcu_read_unlock();
+
+    return has_uids;
+}
+
+void ec_banning_SetIgnoredUid(ProcessContext *context, uid_t uid)
+{
+    if (__ec_banning_AddIgnoreRule(context, IGNORE_TYPE_UID, uid))
     {
-        if (s_banning.ignored_uids[i] == uid)
+        ec_logger_update_interest();
+        TRACE(DL_WARNING, "Adding uid=%u", uid);
+    }
+}
+
+// Build a copy of the current set with the new rule, and publish it in place of the old one.
+//  Returns false if the rule was already present or could not be added.
+bool __ec_banning_AddIgnoreRule(ProcessContext *context, IgnoreType type, uint64_t value)
+{
+    bool       added    = false;
+    IgnoreSet *old_set  = NULL;
+    IgnoreSet *new_set  = NULL;
+    uint32_t   count    = 0;
+    uint32_t   slots    = 8;
+    uint32_t   i;
+
+    mutex_lock(&s_ignore_set_lock);
+    old_set = rcu_dereference_protected(s_banning.ignore_set, lockdep_is_held(&s_ignore_set_lock));
+
+    if (old_set)
+    {
+        // We hold the update lock, so the set can not go away under us
+        rcu_read_lock();
+        if (__ec_ignore_set_contains(old_set, type, value))
         {
-            TRACE(DL_TRACE, "Ignore uid=%u", uid);
-            return true;
+            rcu_read_unlock();
+            TRACE(DL_VERBOSE, "already ignoring type=%d value=%llu", type, value);
+            goto CATCH_DEFAULT;
         }
+        rcu_read_unlock();
+        count = old_set->count;
     }
 
-ignore_uid_exit:
-    return false;
-}
+    TRY_MSG(count < CB_SENSOR_MAX_IGNORE_RULES, DL_WARNING, "%s: too many ignore rules", __func__);
 
-void ec_banning_SetIgnoredUid(ProcessContext *context, uid_t uid)
-{
-    int64_t i;
-    int64_t max = s_banning.ignored_uid_count;
+    // Keep the table at most half full
+    while (slots < (count + 1) * 2)
+    {
+        slots <<= 1;
+    }
 
-    // Search for uid
-    for (i = 0; i < max; ++i)
+    new_set = ec_mem_alloc(sizeof(IgnoreSet) + slots * sizeof(IgnoreSlot), context);
+    TRY(new_set);
+
+    memset(new_set, 0, sizeof(IgnoreSet) + slots * sizeof(IgnoreSlot));
+    new_set->mask = slots - 1;
+
+    if (old_set)
     {
-        if (s_banning.ignored_uids[i] == uid)
+        for (i = 0; i <= old_set->mask; ++i)
         {
-            TRACE(DL_VERBOSE, "already ignoring uid=%u", uid);
-            return;
+            if (old_set->slots[i].type != IGNORE_TYPE_NONE)
+            {
+                __ec_ignore_set_insert(new_set, old_set->slots[i].type, old_set->slots[i].value);
+            }
         }
     }
+    __ec_ignore_set_insert(new_set, type, value);
+
+    rcu_assign_pointer(s_banning.ignore_set, new_set);
+    added = true;
 
-    if (max < CB_SENSOR_MAX_UIDS)
+    // Updates are rare and come from the ioctl path, so just wait out the readers of the old set
+    if (old_set)
     {
-        s_banning.ignored_uids[max] = uid;
-        max += 1;
-        s_banning.ignored_uid_count = max;
-        TRACE(DL_WARNING, "Adding uid=%u at %lld", uid, max);
+        synchronize_rcu();
+        ec_mem_free(old_set);
     }
+
+CATCH_DEFAULT:
+    mutex_unlock(&s_ignore_set_lock);
+    return added;
 }
@@ -13,7 +13,10 @@ extern inline bool ec_banning_ClearBannedProcessInode(ProcessContext *context, u
 extern bool ec_banning_KillBannedProcessByInode(ProcessContext *context, uint64_t device, uint64_t ino);
 extern bool ec_banning_IgnoreProcess(ProcessContext *context, pid_t pid);
 extern void ec_banning_SetIgnoredProcess(ProcessContext *context, pid_t pid);
+extern void ec_banning_SetIgnoredProcessTree(ProcessContext *context, pid_t pid);
+extern void ec_banning_SetIgnoredCgroup(ProcessContext *context, uint64_t cgroup_id);
 extern bool ec_banning_IgnoreUid(ProcessContext *context, pid_t uid);
+extern bool ec_banning_HasIgnoredUids(void);
 extern void ec_banning_SetIgnoredUid(ProcessContext *context, uid_t uid);
 extern void ec_banning_ClearAllBans(ProcessContext *context);
 extern bool ec_banning_KillBannedProcessByPid(ProcessContext *context, pid_t pid);
@@ -3,8 +3,11 @@
 // Copyright (c) 2016-2019 Carbon Black, Inc. All rights reserved.
 
 #include <linux/hash.h>
+#include <linux/jhash.h>
 #include <linux/list.h>
 #include <linux/inet.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
 #include "priv.h"
 #include "mem-alloc.h"
 #include "cb-spinlock.h"
@@ -14,30 +17,52 @@
 
 CB_ISOLATION_STATS  g_cbIsolationStats;
 
+// The allow list is compiled into an immutable lookup engine which is published with RCU, so
+//  the netfilter hooks never take a lock.  Every rule lives in one open-addressed hash keyed by
+//  (family, prefix length, masked address).  A lookup masks the remote address to each prefix
+//  length that is in use, longest first, and probes the hash.  An exact host rule is just a /32
+//  or /128, so it costs a single probe.  Each hash slot points at the port/protocol ranges of
+//  the rules that share its prefix.
+typedef struct _ISOLATION_PORT_RULE {
+    UINT16  portLow;
+    UINT16  portHigh;
+    uint8_t protocol;
+} ISOLATION_PORT_RULE;
+
+typedef struct _ISOLATION_SLOT {
+    UINT32   addr[4];
+    UINT16   family;    // 0 when the slot is empty
+    uint8_t  prefixLength;
+    UINT32   firstRule;
+    UINT32   ruleCount;
+} ISOLATION_SLOT;
+
+typedef struct _ISOLATION_PREFIXES {
+    UINT32  count;
+    uint8_t lengths[129];   // Longest first
+} ISOLATION_PREFIXES;
+
+typedef struct _ISOLATION_RULES {
+    UINT32                ruleCount;
+    UINT32                mask;
+    ISOLATION_PREFIXES    prefixes4;
+    ISOLATION_PREFIXES    prefixes6;
+    ISOLATION_PORT_RULE  *portRules;
+    ISOLATION_SLOT        slots[];
+} ISOLATION_RULES, *PISOLATION_RULES;
+
 static CB_ISOLATION_MODE             CBIsolationMode = IsolationModeOff;
-static PCB_ISOLATION_MODE_CONTROL   _pCurrentCbIsolationModeControl;
-uint64_t                            _pControlLock;
+static PISOLATION_RULES __rcu       _pCurrentIsolationRules;
+static DEFINE_MUTEX(_isolationRulesLock);
 static BOOLEAN                      _isInitialized = FALSE;
 
-BOOLEAN ACQUIRE_RESOURCE(ProcessContext *context)
-{
-    if (_isInitialized == FALSE)
-    {
-        return FALSE;
-    }
-
-    ec_write_lock(&_pControlLock, context);
-    return TRUE;
-}
-
-VOID RELEASE_RESOURCE(ProcessContext *context)
-{
-    ec_write_unlock(&_pControlLock, context);
-}
+static PISOLATION_RULES __ec_BuildIsolationRules(ProcessContext *context, PCB_ISOLATION_RULE pRules, ULONG ruleCount);
+static VOID __ec_PublishIsolationRules(ProcessContext *context, PISOLATION_RULES pRules);
+static bool __ec_IsolationRulesAllow(PISOLATION_RULES pRules, UINT16 family, const UINT32 *addr, uint8_t protocol, UINT16 port);
 
 bool ec_InitializeNetworkIsolation(ProcessContext *context)
 {
-    ec_spinlock_init(&_pControlLock, context);
+    RCU_INIT_POINTER(_pCurrentIsolationRules, NULL);
     CBIsolationMode = IsolationModeOff;
     _isInitialized = TRUE;
     return true;
@@ -48,18 +73,7 @@ VOID ec_DestroyNetworkIsolation(ProcessContext *context)
     _isInitialized = FALSE;
     CBIsolationMode = IsolationModeOff;
 
-    if (ACQUIRE_RESOURCE(context))
-    {
-        if (_pCurrentCbIsolationModeControl)
-        {
-            ec_mem_free(_pCurrentCbIsolationModeControl);
-            _pCurrentCbIsolationModeControl = NULL;
-        }
-
-        RELEASE_RESOURCE(context);
-    }
-
-    ec_spinlock_destroy(&_pControlLock, context);
+    __ec_PublishIsolationRules(context, NULL);
 }
 
 VOID ec_SetNetworkIsolationMode(ProcessContext *context, CB_ISOLATION_MODE isolationMode)
@@ -87,69 +101,125 @@ VOID ec_DisableNetworkIsolation(ProcessContext *context)
     TRACE(DL_INFO, "CB ISOLATION MODE: DISABLED");
 }
 
+// Convert the legacy list of exact IPv4 addresses into rules that allow any port
+static PCB_ISOLATION_RULE __ec_ConvertIsolationModeControl(ProcessContext *context, PCB_ISOLATION_MODE_CONTROL pControl, ULONG *ruleCount)
+{
+    PCB_ISOLATION_RULE pRules = NULL;
+    ULONG              i;
+
+    *ruleCount = 0;
+    CANCEL(pControl->numberOfAllowedIpAddresses, NULL);
+
+    pRules = ec_mem_valloc(sizeof(CB_ISOLATION_RULE) * pControl->numberOfAllowedIpAddresses, context);
+    CANCEL(pRules, NULL);
+
+    // Suppressing false positive coverity issue reporting that we are using tainted variable
+    // "pControl->numberOfAllowedIpAddresses" as a loop boundary.
+    // The "allowedIpAddresses" array is allocated to accommodate "numberOfAllowedIpAddresses" entries.
+
+    // coverity[tainted_data:SUPPRESS]
+    for (i = 0; i < pControl->numberOfAllowedIpAddresses; ++i)
+    {
+        UINT32 addr = htonl(pControl->allowedIpAddresses[i]);
+
+        if (!pControl->allowedIpAddresses[i])
+        {
+            continue;
+        }
+
+        memset(&pRules[*ruleCount], 0, sizeof(CB_ISOLATION_RULE));
+        pRules[*ruleCount].family       = AF_INET;
+        pRules[*ruleCount].prefixLength = 32;
+        pRules[*ruleCount].portLow      = 0;
+        pRules[*ruleCount].portHigh     = 0xFFFF;
+        memcpy(pRules[*ruleCount].addr, &addr, sizeof(addr));
+        *ruleCount += 1;
+
+        TRACE(DL_INFO, "%s: isolation ON IP: %pI4\n", __func__, &addr);
+    }
+
+    return pRules;
+}
+
 NTSTATUS ec_ProcessIsolationIoctl(
     ProcessContext *context,
     ULONG IoControlCode,
     PVOID pBuf,
     DWORD InputBufLen)
 {
-    NTSTATUS                   xcode                   = STATUS_SUCCESS;
-    PCB_ISOLATION_MODE_CONTROL tmpIsolationModeControl = NULL;
-    DWORD                      ExpectedBufLen;
-
-    TRY_SET_MSG(IoControlCode == IOCTL_SET_ISOLATION_MODE, STATUS_INVALID_PARAMETER_4,
+    NTSTATUS                    xcode         = STATUS_SUCCESS;
+    void                       *tmpControl    = NULL;
+    PCB_ISOLATION_RULE          pRuleList     = NULL;
+    PCB_ISOLATION_RULE          pConverted    = NULL;
+    PISOLATION_RULES            pNewRules     = NULL;
+    CB_ISOLATION_MODE           isolationMode = IsolationModeOff;
+    ULONG                       ruleCount     = 0;
+    DWORD                       ExpectedBufLen;
+
+    TRY_SET_MSG(IoControlCode == IOCTL_SET_ISOLATION_MODE || IoControlCode == IOCTL_SET_ISOLATION_RULES,
+                 STATUS_INVALID_PARAMETER_4,
                  DL_WARNING, "CB_ISOLATION_MODE_CONTROL size is invalid");
 
-    tmpIsolationModeControl = (PCB_ISOLATION_MODE_CONTROL)ec_mem_alloc(InputBufLen, context);
+    TRY_SET_MSG(_isInitialized, STATUS_INSUFFICIENT_RESOURCES,
+                 DL_WARNING, "Network Isolation can't process IOCTL in uninitialized state.");
 
-    TRY_SET_MSG(tmpIsolationModeControl, STATUS_INSUFFICIENT_RESOURCES,
-                 DL_ERROR, "%s: failed to allocate memory for network isolation control\n", __func__);
+    TRY_SET_MSG(InputBufLen >= sizeof(CB_ISOLATION_MODE_CONTROL) &&
+                InputBufLen <= sizeof(CB_ISOLATION_RULES_CONTROL) + sizeof(CB_ISOLATION_RULE) * CB_ISOLATION_MAX_RULES,
+                STATUS_INVALID_PARAMETER_4,
+                DL_ERROR, "%s: invalid buffer size %u\n", __func__, InputBufLen);
 
-    TRY_STEP_SET_MSG(RESOURCE, !copy_from_user(tmpIsolationModeControl, pBuf, InputBufLen),
-                      STATUS_INSUFFICIENT_RESOURCES,
-                      DL_ERROR, "%s: failed to copy arg\n", __func__);
+    // Large allow lists do not fit in a kmalloc
+    tmpControl = ec_mem_valloc(InputBufLen, context);
 
-    // Calculate the size of the buffer we should have hold the number of addresses that user space claims is
-    //  present.  This prevents us from reading past the buffer later. (CB-8236)
-    ExpectedBufLen = sizeof(CB_ISOLATION_MODE_CONTROL) + (sizeof(DWORD) * (tmpIsolationModeControl->numberOfAllowedIpAddresses - 1));
-    TRY_SET_MSG(ExpectedBufLen <= InputBufLen, STATUS_INVALID_PARAMETER_4,
-                 DL_ERROR, "%s: the expected buffer is larger than what we received. (%d > %d)\n", __func__, ExpectedBufLen, InputBufLen);
+    TRY_SET_MSG(tmpControl, STATUS_INSUFFICIENT_RESOURCES,
+                 DL_ERROR, "%s: failed to allocate memory for network isolation control\n", __func__);
 
-    TRY_SET_MSG(ACQUIRE_RESOURCE(context), STATUS_INSUFFICIENT_RESOURCES,
-                 DL_WARNING, "Network Isolation can't process IOCTL in uninitialized state.");
+    TRY_SET_MSG(!copy_from_user(tmpControl, pBuf, InputBufLen),
+                 STATUS_INSUFFICIENT_RESOURCES,
+                 DL_ERROR, "%s: failed to copy arg\n", __func__);
 
-    if (_pCurrentCbIsolationModeControl)
+    // Calculate the size of the buffer we should have hold the number of entries that user space claims is
+    //  present.  This prevents us from reading past the buffer later. (CB-8236)
+    if (IoControlCode == IOCTL_SET_ISOLATION_MODE)
     {
-        ec_mem_free(_pCurrentCbIsolationModeControl);
-    }
-
-    _pCurrentCbIsolationModeControl = tmpIsolationModeControl;
-    tmpIsolationModeControl         = NULL;
-    ec_SetNetworkIsolationMode(context, _pCurrentCbIsolationModeControl->isolationMode);
-
-    if (_pCurrentCbIsolationModeControl->isolationMode == IsolationModeOn)
+        PCB_ISOLATION_MODE_CONTROL pControl = (PCB_ISOLATION_MODE_CONTROL)tmpControl;
+
+        TRY_SET_MSG(pControl->numberOfAllowedIpAddresses <= CB_ISOLATION_MAX_RULES, STATUS_INVALID_PARAMETER_4,
+                     DL_ERROR, "%s: too many addresses %u\n", __func__, pControl->numberOfAllowedIpAddresses);
+        ExpectedBufLen = sizeof(CB_ISOLATION_MODE_CONTROL) + (sizeof(DWORD) * (pControl->numberOfAllowedIpAddresses - 1));
+        TRY_SET_MSG(ExpectedBufLen <= InputBufLen, STATUS_INVALID_PARAMETER_4,
+                     DL_ERROR, "%s: the expected buffer is larger than what we received. (%d > %d)\n", __func__, ExpectedBufLen, InputBufLen);
+
+        isolationMode = pControl->isolationMode;
+        pConverted    = __ec_ConvertIsolationModeControl(context, pControl, &ruleCount);
+        pRuleList     = pConverted;
+        TRY_SET(pRuleList || !ruleCount, STATUS_INSUFFICIENT_RESOURCES);
+    } else
     {
-        char           str[INET_ADDRSTRLEN];
-        unsigned char *addr, i;
+        PCB_ISOLATION_RULES_CONTROL pControl = (PCB_ISOLATION_RULES_CONTROL)tmpControl;
 
-        // Suppressing false positive coverity issue reporting that we are using tainted variable
-        // "_pCurrentCbIsolationModeControl->numberOfAllowedIpAddresses" as a loop boundary.
-        // The "allowedIpAddresses" array is allocated to accommodate "numberOfAllowedIpAddresses" entries.
+        TRY_SET_MSG(pControl->numberOfRules <= CB_ISOLATION_MAX_RULES, STATUS_INVALID_PARAMETER_4,
+                     DL_ERROR, "%s: too many rules %u\n", __func__, pControl->numberOfRules);
+        ExpectedBufLen = sizeof(CB_ISOLATION_RULES_CONTROL) + (sizeof(CB_ISOLATION_RULE) * (pControl->numberOfRules - 1));
+        TRY_SET_MSG(!pControl->numberOfRules || ExpectedBufLen <= InputBufLen, STATUS_INVALID_PARAMETER_4,
+                     DL_ERROR, "%s: the expected buffer is larger than what we received. (%d > %d)\n", __func__, ExpectedBufLen, InputBufLen);
 
-        // coverity[tainted_data:SUPPRESS]
-        for (i = 0; i < _pCurrentCbIsolationModeControl->numberOfAllowedIpAddresses; ++i)
-        {
-            addr = (unsigned char *)&_pCurrentCbIsolationModeControl->allowedIpAddresses[i];
-            snprintf(str, INET_ADDRSTRLEN, "%d.%d.%d.%d", addr[3], addr[2], addr[1], addr[0]);
-            TRACE(DL_INFO, "%s: isolation ON IP: %s\n", __func__, str);
-        }
+        isolationMode = pControl->isolationMode;
+        ruleCount     = pControl->numberOfRules;
+        pRuleList     = pControl->rules;
     }
 
-CATCH_RESOURCE:
-    RELEASE_RESOURCE(context);
+    pNewRules = __ec_BuildIsolationRules(context, pRuleList, ruleCount);
+    TRY_SET_MSG(pNewRules, STATUS_INVALID_PARAMETER_4,
+                 DL_ERROR, "%s: failed to build isolation rules\n", __func__);
+
+    // The new rules must be visible before isolation is turned on
+    __ec_PublishIsolationRules(context, pNewRules);
+    ec_SetNetworkIsolationMode(context, isolationMode);
 
 CATCH_DEFAULT:
-    ec_mem_free(tmpIsolationModeControl);
+    ec_mem_free(pConverted);
+    ec_mem_free(tmpControl);
     return xcode;
 }
 
@@ -162,6 +232,8 @@ VOID ec_IsolationIntercept(ProcessContext *context,
                           ULONG remoteIpAddress,
                           CB_ISOLATION_INTERCEPT_RESULT *isolationResult)
 {
+    UINT32 addr[4] = { htonl(remoteIpAddress), 0, 0, 0 };
+    bool   allowed = false;
 
     // immediate allow if isolation mode is not on
     if (CBIsolationMode == IsolationModeOff)
@@ -170,24 +242,16 @@ VOID ec_IsolationIntercept(ProcessContext *context,
         return;
     }
 
-    // acquire shared resource
-    if (ACQUIRE_RESOURCE(context))
-    {
-        ULONG i;
+    // We do not know the port or protocol here, so only rules that allow any will match
+    rcu_read_lock();
+    allowed = __ec_IsolationRulesAllow(rcu_dereference(_pCurrentIsolationRules), AF_INET, addr, 0, 0);
+    rcu_read_unlock();
 
-        for (i = 0; i < _pCurrentCbIsolationModeControl->numberOfAllowedIpAddresses; i++)
-        {
-            ULONG allowedIpAddress = _pCurrentCbIsolationModeControl->allowedIpAddresses[i];
-
-            if (allowedIpAddress && remoteIpAddress == allowedIpAddress)
-            {
-                TRACE(DL_INFO, "ISOLATION ALLOWED: ADDR: 0x%08x", remoteIpAddress);
-                isolationResult->isolationAction = IsolationActionAllow;
-                RELEASE_RESOURCE(context);
-                return;
-            }
-        }
-        RELEASE_RESOURCE(context);
+    if (allowed)
+    {
+        TRACE(DL_INFO, "ISOLATION ALLOWED: ADDR: 0x%08x", remoteIpAddress);
+        isolationResult->isolationAction = IsolationActionAllow;
+        return;
     }
 
     TRACE(DL_INFO, "ISOLATION BLOCKED: ADDR: 0x%08x", remoteIpAddress);
@@ -202,7 +266,9 @@ VOID ec_IsolationInterceptByAddrProtoPort(
 {
     bool   isIpV4 = remoteAddr->sa_addr.sa_family == AF_INET;
     ULONG  remoteIpAddress;
+    UINT32 addr[4] = { 0 };
     UINT16 port;
+    bool   allowed = false;
 
     // immediate allow if isolation mode is not on
     if (CBIsolationMode == IsolationModeOff)
@@ -214,11 +280,13 @@ VOID ec_IsolationInterceptByAddrProtoPort(
     if (isIpV4)
     {
         remoteIpAddress = ntohl(remoteAddr->as_in4.sin_addr.s_addr);
+        addr[0] = remoteAddr->as_in4.sin_addr.s_addr;
         port = remoteAddr->as_in4.sin_port;
     } else
     {
-        // it doesn't really matter what remoteIpAddress is set for IP6 since all IP6 addresses are blocked
+        // Only used for logging
         remoteIpAddress = ntohl(*(uint32_t *)&remoteAddr->as_in6.sin6_addr.s6_addr32[0]);
+        memcpy(addr, &remoteAddr->as_in6.sin6_addr, sizeof(addr));
         port = remoteAddr->as_in6.sin6_port;
     }
 
@@ -233,31 +301,231 @@ VOID ec_IsolationInterceptByAddrProtoPort(
         return;
     }
 
-    // Our list of allowed addresses is IPv4, so just block IPv6 addresses
-    // acquire shared resource
-    if (isIpV4 && ACQUIRE_RESOURCE(context))
+    rcu_read_lock();
+    allowed = __ec_IsolationRulesAllow(rcu_dereference(_pCurrentIsolationRules),
+                                       isIpV4 ? AF_INET : AF_INET6,
+                                       addr,
+                                       (uint8_t)protocol,
+                                       ntohs(port));
+    rcu_read_unlock();
+
+    if (allowed)
+    {
+        TRACE(DL_INFO, "ISOLATION ALLOWED: By %s ADDR: 0x%08x PROTO: %s PORT: %u",
+            (isIpV4?"IPv4":"IPv6"),
+            remoteIpAddress, (protocol == IPPROTO_UDP?"UDP":"TCP"), ntohs(port));
+        isolationResult->isolationAction = IsolationActionAllow;
+        return;
+    }
+
+    TRACE(DL_INFO, "ISOLATION BLOCKED: %s ADDR: 0x%08x PROTO: %s PORT: %u",
+        (isIpV4?"IPv4":"IPv6"),
+        remoteIpAddress, (protocol == IPPROTO_UDP?"UDP":"TCP"), ntohs(port));
+    isolationResult->isolationAction = IsolationActionBlock;
+}
+
+// Swap in the new rules and free the old ones once no hook can be using them
+static VOID __ec_PublishIsolationRules(ProcessContext *context, PISOLATION_RULES pRules)
+{
+    PISOLATION_RULES pOldRules;
+
+    mutex_lock(&_isolationRulesLock);
+    pOldRules = rcu_dereference_protected(_pCurrentIsolationRules, lockdep_is_held(&_isolationRulesLock));
+    rcu_assign_pointer(_pCurrentIsolationRules, pRules);
+    mutex_unlock(&_isolationRulesLock);
+
+    if (pOldRules)
+    {
+        synchronize_rcu();
+        ec_mem_free(pOldRules);
+    }
+}
+
+static inline void __ec_IsolationMaskAddr(const UINT32 *addr, uint8_t prefixLength, UINT32 *masked)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i)
     {
-        ULONG i;
+        int bits = clamp((int)prefixLength - 32 * i, 0, 32);
 
-        for (i = 0; i < _pCurrentCbIsolationModeControl->numberOfAllowedIpAddresses; i++)
+        masked[i] = bits ? addr[i] & htonl(~0U << (32 - bits)) : 0;
+    }
+}
+
+static inline UINT32 __ec_IsolationHash(UINT16 family, uint8_t prefixLength, const UINT32 *masked)
+{
+    return jhash2(masked, 4, ((UINT32)family << 8) | prefixLength);
+}
+
+static ISOLATION_SLOT *__ec_IsolationFindSlot(PISOLATION_RULES pRules, UINT16 family, uint8_t prefixLength, const UINT32 *masked)
+{
+    UINT32 i = __ec_IsolationHash(family, prefixLength, masked) & pRules->mask;
+
+    // The table is never more than half full, so a probe always reaches an empty slot
+    for (; pRules->slots[i].family; i = (i + 1) & pRules->mask)
+    {
+        ISOLATION_SLOT *slot = &pRules->slots[i];
+
+        if (slot->family == family && slot->prefixLength == prefixLength && !memcmp(slot->addr, masked, sizeof(slot->addr)))
+        {
+            return slot;
+        }
+    }
+    return &pRules->slots[i];
+}
+
+// Must be called under rcu_read_lock
+static bool __ec_IsolationRulesAllow(PISOLATION_RULES pRules, UINT16 family, const UINT32 *addr, uint8_t protocol, UINT16 port)
+{
+    ISOLATION_PREFIXES *prefixes;
+    UINT32              i;
+
+    CANCEL(pRules, false);
+
+    prefixes = (family == AF_INET ? &pRules->prefixes4 : &pRules->prefixes6);
+
+    // Every rule is an allow rule, so the first matching prefix (the longest) decides
+    for (i = 0; i < prefixes->count; ++i)
+    {
+        UINT32          masked[4];
+        ISOLATION_SLOT *slot;
+        UINT32          r;
+
+        __ec_IsolationMaskAddr(addr, prefixes->lengths[i], masked);
+        slot = __ec_IsolationFindSlot(pRules, family, prefixes->lengths[i], masked);
+        if (!slot->family)
+        {
+            continue;
+        }
+
+        for (r = slot->firstRule; r < slot->firstRule + slot->ruleCount; ++r)
         {
-            ULONG allowedIpAddress = _pCurrentCbIsolationModeControl->allowedIpAddresses[i];
+            ISOLATION_PORT_RULE *portRule = &pRules->portRules[r];
 
-            if (allowedIpAddress && remoteIpAddress == allowedIpAddress)
+            if ((!portRule->protocol || portRule->protocol == protocol) &&
+                port >= portRule->portLow && port <= portRule->portHigh)
             {
-                TRACE(DL_INFO, "ISOLATION ALLOWED: By %s ADDR: 0x%08x PROTO: %s PORT: %u",
-                    (isIpV4?"IPv4":"IPv6"),
-                    remoteIpAddress, (protocol == IPPROTO_UDP?"UDP":"TCP"), ntohs(port));
-                isolationResult->isolationAction = IsolationActionAllow;
-                RELEASE_RESOURCE(context);
-                return;
+                return true;
             }
         }
-        RELEASE_RESOURCE(context);
     }
 
-    TRACE(DL_INFO, "ISOLATION BLOCKED: %s ADDR: 0x%08x PROTO: %s PORT: %u",
-        (isIpV4?"IPv4":"IPv6"),
-        remoteIpAddress, (protocol == IPPROTO_UDP?"UDP":"TCP"), ntohs(port));
-    isolationResult->isolationAction = IsolationActionBlock;
+    return false;
+}
+
+static int __ec_CompareIsolationRule(const void *left, const void *right)
+{
+    const CB_ISOLATION_RULE *l = (const CB_ISOLATION_RULE *)left;
+    const CB_ISOLATION_RULE *r = (const CB_ISOLATION_RULE *)right;
+
+    if (l->family != r->family)
+    {
+        return l->family - r->family;
+    }
+    if (l->prefixLength != r->prefixLength)
+    {
+        return l->prefixLength - r->prefixLength;
+    }
+    return memcmp(l->addr, r->addr, sizeof(l->addr));
+}
+
+static VOID __ec_AddIsolationPrefix(ISOLATION_PREFIXES *prefixes, uint8_t prefixLength)
+{
+    UINT32 i;
+
+    for (i = 0; i < prefixes->count; ++i)
+    {
+        if (prefixes->lengths[i] == prefixLength)
+        {
+            return;
+        }
+    }
+
+    // Keep the list sorted longest first
+    for (i = prefixes->count; i > 0 && prefixes->lengths[i - 1] < prefixLength; --i)
+    {
+        prefixes->lengths[i] = prefixes->lengths[i - 1];
+    }
+    prefixes->lengths[i] = prefixLength;
+    prefixes->count += 1;
+}
+
+// Compile the rules into a lookup engine.  The input rules are sorted in place.
+static PISOLATION_RULES __ec_BuildIsolationRules(ProcessContext *context, PCB_ISOLATION_RULE pRules, ULONG ruleCount)
+{
+    PISOLATION_RULES pNewRules = NULL;
+    UINT32           slotCount = 8;
+    size_t           size;
+    ULONG            i;
+
+    // Validate and mask every rule so equal prefixes sort next to each other
+    for (i = 0; i < ruleCount; ++i)
+    {
+        UINT32 masked[4];
+
+        TRY_MSG((pRules[i].family == AF_INET && pRules[i].prefixLength <= 32) ||
+                (pRules[i].family == AF_INET6 && pRules[i].prefixLength <= 128),
+                DL_ERROR, "%s: invalid rule %u family %u prefix %u", __func__, i, pRules[i].family, pRules[i].prefixLength);
+        TRY_MSG(pRules[i].portLow <= pRules[i].portHigh,
+                DL_ERROR, "%s: invalid rule %u port range %u-%u", __func__, i, pRules[i].portLow, pRules[i].portHigh);
+
+        if (pRules[i].family == AF_INET)
+        {
+            memset(&pRules[i].addr[4], 0, sizeof(pRules[i].addr) - 4);
+        }
+        memcpy(masked, pRules[i].addr, sizeof(masked));
+        __ec_IsolationMaskAddr(masked, pRules[i].prefixLength, masked);
+        memcpy(pRules[i].addr, masked, sizeof(masked));
+    }
+
+    sort(pRules, ruleCount, sizeof(CB_ISOLATION_RULE), __ec_CompareIsolationRule, NULL);
+
+    // Keep the table at most half full
+    while (slotCount < ruleCount * 2)
+    {
+        slotCount <<= 1;
+    }
+
+    size = sizeof(ISOLATION_RULES) + sizeof(ISOLATION_SLOT) * slotCount + sizeof(ISOLATION_PORT_RULE) * ruleCount;
+    pNewRules = ec_mem_valloc(size, context);
+    TRY(pNewRules);
+
+    memset(pNewRules, 0, size);
+    pNewRules->ruleCount     = ruleCount;
+    pNewRules->mask          = slotCount - 1;
+    pNewRules->portRules     = (ISOLATION_PORT_RULE *)&pNewRules->slots[slotCount];
+
+    for (i = 0; i < ruleCount; ++i)
+    {
+        UINT32          masked[4];
+        ISOLATION_SLOT *slot;
+
+        memcpy(masked, pRules[i].addr, sizeof(masked));
+
+        pNewRules->portRules[i].portLow  = pRules[i].portLow;
+        pNewRules->portRules[i].portHigh = pRules[i].portHigh;
+        pNewRules->portRules[i].protocol = pRules[i].protocol;
+
+        // Sorting put the rules for one prefix next to each other, so they share a slot
+        slot = __ec_IsolationFindSlot(pNewRules, pRules[i].family, pRules[i].prefixLength, masked);
+        if (!slot->family)
+        {
+            memcpy(slot->addr, masked, sizeof(slot->addr));
+            slot->family       = pRules[i].family;
+            slot->prefixLength = pRules[i].prefixLength;
+            slot->firstRule    = i;
+            __ec_AddIsolationPrefix(pRules[i].family == AF_INET ? &pNewRules->prefixes4 : &pNewRules->prefixes6,
+                                    pRules[i].prefixLength);
+        }
+        slot->ruleCount += 1;
+    }
+
+    TRACE(DL_INFO, "%s: %u isolation rules, %u IPv4 and %u IPv6 prefix lengths", __func__,
+          ruleCount, pNewRules->prefixes4.count, pNewRules->prefixes6.count);
+
+    return pNewRules;
+
+CATCH_DEFAULT:
+    return NULL;
 }
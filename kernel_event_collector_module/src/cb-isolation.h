@@ -24,6 +24,7 @@ typedef uint16_t UINT16;
 #define IOCTL_GET_VERSION         3
 #define IOCTL_GET_KERNEL_STATS    4
 #define IOCTL_SET_ISOLATION_MODE 10
+#define IOCTL_SET_ISOLATION_RULES 11
 
 
 #define IP_PROTO_UDP 17
@@ -65,6 +66,9 @@ typedef struct _CB_ISOLATION_INTERCEPT_RESULT {
 
 #define CB_ISOLATION_MODE_CONTROL_SIZE(x)   ((ULONG)(sizeof(CB_ISOLATION_MODE_CONTROL) + ((sizeof(ULONG) * x) - 1)))
 
+// Upper bound on the rules accepted by a single isolation ioctl
+#define CB_ISOLATION_MAX_RULES  65536
+
 typedef struct _CB_ISOLATION_STATS {
     BOOLEAN     isolationEnabled;
     ULONGLONG   isolationBlockedInboundIp4Packets;
@@ -13,9 +13,6 @@
 // Enable lock debug output
 // #define DEADLOCK_DBG
 
-// We have the option to use rw locks or standard spinlocks
-// #define CB_ENABLE_RWLOCK
-
 // We have the option to either disable interrupts or not
 // #define CB_ENABLE_GFP_BASED_LOCKS
 
@@ -39,8 +36,8 @@
         LOCK_SAVE(LOCK, FLAGS)
 #endif
 
+// CB_LOCK_TYPE and the CB_ENABLE_RWLOCK option live in cb-spinlock.h
 #ifdef CB_ENABLE_RWLOCK
-    #define LOCK_TYPE            rwlock_t
     #define LOCK_INIT            rwlock_init
     #define LOCK_UNLOCKED        RW_LOCK_UNLOCKED
 
@@ -57,7 +54,6 @@
     #define WRITE_CAN_LOCK(LOCK) write_can_lock(LOCK)
 #else
     // checkpatch-ignore: USE_LOCKDEP
-    #define LOCK_TYPE            spinlock_t
     #define LOCK_INIT            spin_lock_init
     #define LOCK_UNLOCKED        SPIN_LOCK_UNLOCKED
 
@@ -88,34 +84,26 @@
 
 
 
-typedef struct {
-    LOCK_TYPE sp;
-    pid_t create_pid;
-    pid_t owner_pid;
-    unsigned long flags;
-} linuxSpinlock_t;
-
-void ec_spinlock_init(uint64_t *sp, ProcessContext *context)
+void ec_embedded_lock_init(linuxSpinlock_t *spinlockp, ProcessContext *context)
 {
-    linuxSpinlock_t *new_spinlock = ec_mem_alloc(sizeof(linuxSpinlock_t), context);
+    SPINLOCK_INIT(spinlockp->sp);
+    spinlockp->create_pid = ec_gettid(current);
+    spinlockp->owner_pid  = 0;
+    spinlockp->flags      = 0;
+}
 
-    if (new_spinlock)
-    {
-        SPINLOCK_INIT(new_spinlock->sp);
-        new_spinlock->create_pid = ec_gettid(current);
-        new_spinlock->owner_pid  = 0;
-        new_spinlock->flags      = 0;
-        *sp = (uint64_t)new_spinlock;
-    } else
-    {
-        pr_err("%s failed initialize spinlock pid=%d\n", __func__, ec_gettid(current));
-        *sp = 0;
-    }
+void ec_embedded_lock_destroy(linuxSpinlock_t *spinlockp, ProcessContext *context)
+{
+    DO_FOR_DEBUG({
+        if (!WRITE_CAN_LOCK(&spinlockp->sp))
+        {
+            pr_err("%s LOCKED and being destroyed pid=%d owner=%d\n", __func__, ec_gettid(current), spinlockp->owner_pid);
+        }
+    });
 }
 
-void ec_write_lock(uint64_t *sp, ProcessContext *context)
+void ec_embedded_write_lock(linuxSpinlock_t *spinlockp, ProcessContext *context)
 {
-    linuxSpinlock_t *spinlockp = (linuxSpinlock_t *)*sp;
     pid_t tid = ec_gettid(current);
 
     DO_FOR_DEBUG({
@@ -134,10 +122,8 @@ void ec_write_lock(uint64_t *sp, ProcessContext *context)
     }
 }
 
-void ec_write_unlock(uint64_t *sp, ProcessContext *context)
+void ec_embedded_write_unlock(linuxSpinlock_t *spinlockp, ProcessContext *context)
 {
-    linuxSpinlock_t *spinlockp = (linuxSpinlock_t *)*sp;
-
     DO_FOR_DEBUG({
         if ((spinlockp->owner_pid != 0 && spinlockp->owner_pid != ec_gettid(current)) ||
             WRITE_CAN_LOCK(&spinlockp->sp))
@@ -152,9 +138,8 @@ void ec_write_unlock(uint64_t *sp, ProcessContext *context)
     WRITE_UNLOCK(&spinlockp->sp, spinlockp->flags, context);
 }
 
-void ec_read_lock(uint64_t *sp, ProcessContext *context)
+void ec_embedded_read_lock(linuxSpinlock_t *spinlockp, ProcessContext *context)
 {
-    linuxSpinlock_t *spinlockp = (linuxSpinlock_t *)*sp;
     pid_t tid = ec_gettid(current);
 
     DO_FOR_DEBUG({
@@ -173,10 +158,8 @@ void ec_read_lock(uint64_t *sp, ProcessContext *context)
     }
 }
 
-void ec_read_unlock(uint64_t *sp, ProcessContext *context)
+void ec_embedded_read_unlock(linuxSpinlock_t *spinlockp, ProcessContext *context)
 {
-    linuxSpinlock_t *spinlockp = (linuxSpinlock_t *)*sp;
-
     DO_FOR_DEBUG({
         if ((spinlockp->owner_pid != 0 && spinlockp->owner_pid != ec_gettid(current)) ||
             WRITE_CAN_LOCK(&spinlockp->sp))//If write can lock, we can not have the read lock.  (Best I can do.)
@@ -191,16 +174,46 @@ void ec_read_unlock(uint64_t *sp, ProcessContext *context)
     READ_UNLOCK(&spinlockp->sp, spinlockp->flags, context);
 }
 
+void ec_spinlock_init(uint64_t *sp, ProcessContext *context)
+{
+    linuxSpinlock_t *new_spinlock = ec_mem_alloc(sizeof(linuxSpinlock_t), context);
+
+    if (new_spinlock)
+    {
+        ec_embedded_lock_init(new_spinlock, context);
+        *sp = (uint64_t)new_spinlock;
+    } else
+    {
+        pr_err("%s failed initialize spinlock pid=%d\n", __func__, ec_gettid(current));
+        *sp = 0;
+    }
+}
+
+void ec_write_lock(uint64_t *sp, ProcessContext *context)
+{
+    ec_embedded_write_lock((linuxSpinlock_t *)*sp, context);
+}
+
+void ec_write_unlock(uint64_t *sp, ProcessContext *context)
+{
+    ec_embedded_write_unlock((linuxSpinlock_t *)*sp, context);
+}
+
+void ec_read_lock(uint64_t *sp, ProcessContext *context)
+{
+    ec_embedded_read_lock((linuxSpinlock_t *)*sp, context);
+}
+
+void ec_read_unlock(uint64_t *sp, ProcessContext *context)
+{
+    ec_embedded_read_unlock((linuxSpinlock_t *)*sp, context);
+}
+
 void ec_spinlock_destroy(uint64_t *sp, ProcessContext *context)
 {
     linuxSpinlock_t *spinlockp = (linuxSpinlock_t *)*sp;
 
-    DO_FOR_DEBUG({
-        if (!WRITE_CAN_LOCK(&spinlockp->sp))
-        {
-            pr_err("%s LOCKED and being destroyed pid=%d owner=%d\n", __func__, ec_gettid(current), spinlockp->owner_pid);
-        }
-    });
+    ec_embedded_lock_destroy(spinlockp, context);
     //  pr_err("%s sp=%p\n", __FUNCTION__, spinlockp);
     ec_mem_free((linuxSpinlock_t *)spinlockp);
 }
@@ -6,9 +6,37 @@
 
 #include "process-context.h"
 
+#include <linux/spinlock.h>
+
+// We have the option to use rw locks or standard spinlocks
+// #define CB_ENABLE_RWLOCK
+
+#ifdef CB_ENABLE_RWLOCK
+    #define CB_LOCK_TYPE         rwlock_t
+#else
+    #define CB_LOCK_TYPE         spinlock_t
+#endif
+
+typedef struct {
+    CB_LOCK_TYPE sp;
+    pid_t create_pid;
+    pid_t owner_pid;
+    unsigned long flags;
+} linuxSpinlock_t;
+
 //-------------------------------------------------
 // Linux utility functions for locking
 //
+// The uint64_t versions allocate the lock and keep a pointer to it.  The embedded versions work on a
+//  lock stored directly in the caller's structure, which saves the allocation and a pointer chase.
+//
+void ec_embedded_lock_init(linuxSpinlock_t *spinlockp, ProcessContext *context);
+void ec_embedded_lock_destroy(linuxSpinlock_t *spinlockp, ProcessContext *context);
+void ec_embedded_write_lock(linuxSpinlock_t *spinlockp, ProcessContext *context);
+void ec_embedded_write_unlock(linuxSpinlock_t *spinlockp, ProcessContext *context);
+void ec_embedded_read_lock(linuxSpinlock_t *spinlockp, ProcessContext *context);
+void ec_embedded_read_unlock(linuxSpinlock_t *spinlockp, ProcessContext *context);
+
 void ec_spinlock_init(uint64_t *sp, ProcessContext *context);
 void ec_spinlock_destroy(uint64_t *sp, ProcessContext *context);
 void ec_write_unlock(uint64_t *sp, ProcessContext *context);
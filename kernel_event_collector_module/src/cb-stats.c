@@ -26,6 +26,7 @@ static const struct _ec_procs proc_callbacks[] = {
     { "cache",                    ec_mem_cache_show,                NULL                            },
     { "events-avg",               ec_proc_show_events_avg,          NULL                            },
     { "events-detail",            ec_proc_show_events_det,          NULL                            },
+    { "events-latency",           ec_proc_show_events_lat,          NULL                            },
     { "events-reset",             NULL,                             ec_proc_show_events_rst         },
     { "net-track",                ec_net_track_show,                NULL                            },
     { "net-track-purge",          NULL,                             ec_net_track_purge              },
@@ -35,6 +36,7 @@ static const struct _ec_procs proc_callbacks[] = {
     { "mem",                      ec_proc_current_memory_avg,       NULL                            },
     { "mem-detail",               ec_proc_current_memory_det,       NULL                            },
     { "active-hooks",             ec_show_active_hooks,             NULL                            },
+    { "hook-profile",             ec_show_hook_profile,             ec_reset_hook_profile           },
     { "file-cache",               ec_path_cache_show,               NULL                            },
 
 #ifdef HOOK_SELECTOR
@@ -6,6 +6,7 @@
 
 #include "dns-parser.h"
 #include "raw_event.h"
+#include "hash-table.h"
 
 #include <linux/types.h>
 #include <net/ip.h>
@@ -24,6 +25,21 @@
 #define DNS_STATUS_EOF 10
 #define DNS_STATUS_QUESTION 11
 
+// Key of a recently reported response, see ec_dns_should_report
+typedef struct dns_report_key {
+    uint32_t name_hash;
+    uint16_t qtype;
+    uint16_t record_count;
+    uint64_t answer_hash;
+} DNS_REPORT_KEY;
+
+typedef struct dns_report_node {
+    DNS_REPORT_KEY key;
+    unsigned long  expires;
+} DNS_REPORT_NODE;
+
+bool __ec_dns_should_report(HashTbl *table, uint32_t window, CB_EVENT_DNS_RESPONSE *response, ProcessContext *context);
+
 // DNS query / reply header
 typedef struct
 {
@@ -8,11 +8,14 @@
 #include "cb-test.h"
 #include "net-helper.h"
 #include "mem-alloc.h"
+#include "hash-table.h"
 
 #include <linux/inet.h>
+#include <linux/jhash.h>
 
 //My defines
-#define MAX_UDP_DATA_SIZE 65539 //max ushort + 4 bytes from the UDP header
+// EDNS0 lets a UDP response grow past the classic 512 bytes, up to the largest UDP payload
+#define DNS_MAX_MESSAGE_SIZE 65535
 
 #define S_OK 0
 #define E_NOT_SUFFICIENT_BUFFER 1
@@ -27,47 +30,105 @@
 #define DNS_RCODE_NOERROR 0
 #define DNS_RCODE_NXDOMAIN 3
 
+// The EDNS0 pseudo record.  The top byte of its TTL holds the upper bits of the response code.
+#define QT_OPT 41
+
+// I can't imagine any legitimate packet needing to jump more than say, 20 times. In fact,
+// most probably shouldn't jump more than once, but error on the side of accepting too many
+// jumps rather than throwing out too many packets.
+#define DNS_MAX_JUMPS 20
+
+#define DNS_NAME_CACHE_SIZE 16
+
 #define  DNS_PRINT_LEVEL DL_INFO
 
+// Compressed names point back at names earlier in the packet.  We remember where each label we
+//  decode starts and the text it decoded to, so a pointer to it is a copy instead of another walk.
+typedef struct dns_name_cache_entry {
+    uint16_t    offset;
+    int16_t     len;    // -1 until the name the label belongs to is complete
+    const char *text;
+} DNS_NAME_CACHE_ENTRY;
+
+typedef struct dns_parse_state {
+    const uint8_t        *data;
+    const uint8_t        *end;
+    int                   cache_count;
+    DNS_NAME_CACHE_ENTRY  cache[DNS_NAME_CACHE_SIZE];
+} DNS_PARSE_STATE;
+
+// Recently reported responses.  A response with the same question and answers is not reported
+//  again until the smaller of its TTL and the report window has passed.
+#define DNS_REPORT_ENTRIES 4096
+
+uint32_t g_dns_report_window_secs = 60;
+
+static HashTbl __read_mostly s_dns_report_table = {
+    .numberOfBuckets = 1024,
+    .name = "dns_report_table",
+    .datasize = sizeof(DNS_REPORT_NODE),
+    .key_len     = sizeof(DNS_REPORT_KEY),
+    .key_offset  = offsetof(DNS_REPORT_NODE, key),
+    .memoryBudget = DNS_REPORT_ENTRIES * HASHTBL_ENTRY_SIZE(sizeof(DNS_REPORT_NODE)),
+    .rcu_lookup = true,
+};
+
 const char *__ec_dns_type_to_str(int dns_type);
-int __ec_dns_check_overrun(uint8_t *dns_data, uint8_t *dataPos, uint32_t dns_data_len);
-int __ec_dns_parse_name(char     *to,
-                        uint8_t  *from,
-                        uint8_t  *dns_data,
-                        uint32_t  dns_data_len,
-                        int      *_xcode);
-uint8_t *__ec_dns_parse_record(CB_DNS_RECORD *record,
-                               uint8_t       *dataPos,
-                               uint8_t       *dns_data,
-                               char          *record_name,
-                               uint32_t       dns_data_len,
-                               int            *_xcode);
+const uint8_t *__ec_dns_parse_name(char            *to,
+                                   const uint8_t   *from,
+                                   DNS_PARSE_STATE *state,
+                                   int             *_xcode);
+const uint8_t *__ec_dns_skip_name(const uint8_t *from, DNS_PARSE_STATE *state, int *_xcode);
+const uint8_t *__ec_dns_parse_record(CB_DNS_RECORD   *record,
+                                     const uint8_t   *dataPos,
+                                     DNS_PARSE_STATE *state,
+                                     int             *_xcode);
+const uint8_t *__ec_dns_skip_record(const uint8_t       *dataPos,
+                                    DNS_PARSE_STATE     *state,
+                                    dns_resource_info_t *info,
+                                    int                 *_xcode);
 void __ec_dns_print_record(CB_DNS_RECORD *record);
-int __ec_dns_name_from_dns(char *name);
+
+bool ec_dns_cache_initialize(ProcessContext *context)
+{
+    return ec_hashtbl_init(&s_dns_report_table, context);
+}
+
+void ec_dns_cache_shutdown(ProcessContext *context)
+{
+    ec_hashtbl_destroy(&s_dns_report_table, context);
+}
 
 int ec_dns_parse_data(char                *dns_data,
                    int                     dns_data_len,
                    CB_EVENT_DNS_RESPONSE  *response,
                    ProcessContext         *context)
 {
-    int             xcode  = E_UNEXPECTED;
-    uint8_t        *dataPos;
-    dns_header_t   *header;
-    dns_question_t *question;
-    int             i;
+    int              xcode  = E_UNEXPECTED;
+    const uint8_t   *dataPos;
+    dns_header_t    *header;
+    dns_question_t  *question;
+    DNS_PARSE_STATE  state;
+    int              answer_count;
+    int              extra_count;
+    int              count = 0;
+    int              i;
 
     TRY(dns_data);
-    dataPos = dns_data;
-    header = (dns_header_t *)dataPos;
-    TRY_MSG(dns_data_len >= 12 && dns_data_len <= 512, DL_COMMS, "dns_data_len %d", dns_data_len);
+    header = (dns_header_t *)dns_data;
+    TRY_MSG(dns_data_len >= sizeof(dns_header_t) && dns_data_len <= DNS_MAX_MESSAGE_SIZE,
+            DL_COMMS, "dns_data_len %d", dns_data_len);
     TRY(response);
     TRY(context);
 
-    dataPos += sizeof(dns_header_t);
-    TRY_SET(!__ec_dns_check_overrun(dns_data, dataPos, dns_data_len), E_NOT_SUFFICIENT_BUFFER);
+    state.data        = (const uint8_t *)dns_data;
+    state.end         = state.data + dns_data_len;
+    state.cache_count = 0;
+    dataPos           = state.data + sizeof(dns_header_t);
 
+    answer_count           = ntohs(header->ancount);
     response->xid          = ntohs(header->xid);
-    response->record_count = ntohs(header->ancount);
+    response->record_count = answer_count;
     response->nscount      = ntohs(header->nscount);
     response->arcount      = ntohs(header->arcount);
 
@@ -87,43 +148,76 @@ int ec_dns_parse_data(char                *dns_data,
         response->record_count = PATH_MAX / sizeof(CB_DNS_RECORD);
     }
 
+    // Make sure there was really DNS information we care about
+    TRY(response->record_count > 0);
+
     response->status = DNS_STATUS_OK;
 
-    // CID-17632
-    //  This call uses __ec_dns_check_overrun while looping over the data to properly ensure we do not overrun the packet
-    // coverity[tainted_data:SUPPRESS]
-    dataPos += __ec_dns_parse_name(response->qname, dataPos, dns_data, dns_data_len, &xcode);
+    dataPos = __ec_dns_parse_name(response->qname, dataPos, &state, &xcode);
     TRY(xcode == S_OK);
 
+    xcode = E_NOT_SUFFICIENT_BUFFER;
+    TRY(state.end - dataPos >= sizeof(*question));
     question = (dns_question_t *)dataPos;
     dataPos += sizeof(*question);
-    TRY_SET(!__ec_dns_check_overrun(dns_data, dataPos, dns_data_len), E_NOT_SUFFICIENT_BUFFER);
 
     response->qtype = ntohs(question->qtype);
 
     response->records = ec_mem_alloc(response->record_count * sizeof(CB_DNS_RECORD), context);
-    TRY(response->records);
+    TRY_SET(response->records, E_OUTOFMEMORY);
 
-    for (i = 0; i < response->record_count; i++)
+    // Parse the answers in a single pass.  A record type we do not report leaves its slot to the
+    //  next record, and answers past the ones we report are only skipped.
+    for (i = 0; i < answer_count; i++)
     {
-        // CID-17632
-        //  This call uses __ec_dns_check_overrun while looping over the data to properly ensure we do not overrun the packet
-        // coverity[tainted_data:SUPPRESS]
-        dataPos = __ec_dns_parse_record(&response->records[i], dataPos, dns_data, response->qname, dns_data_len, &xcode);
-        if (xcode != S_OK)
+        if (count < response->record_count)
         {
-            // This was not a record type we care about, so reduce the record_count and skip this.
-            //  Note: Since we already allocated the memory, we will attempt to copy it later but it
-            //        will be ignored.
-            --response->record_count;
-            continue;
+            int cache_count = state.cache_count;
+
+            // CID-17632
+            //  Every read is checked against state.end, so we do not overrun the packet
+            // coverity[tainted_data:SUPPRESS]
+            dataPos = __ec_dns_parse_record(&response->records[count], dataPos, &state, &xcode);
+            if (xcode == S_OK)
+            {
+                __ec_dns_print_record(&response->records[count]);
+                ++count;
+                continue;
+            }
+
+            // Names decoded into this slot are about to be overwritten
+            state.cache_count = cache_count;
+        } else
+        {
+            dataPos = __ec_dns_skip_record(dataPos, &state, NULL, &xcode);
         }
 
-        __ec_dns_print_record(&response->records[i]);
+        // A malformed record ends the parse, but we still report what we have
+        if (xcode != S_OK && xcode != E_NOT_SUPPORTED)
+        {
+            break;
+        }
     }
 
-    // Make sure there was really DNS information we care about
-    TRY(response->record_count > 0);
+    response->record_count = count;
+    TRY(count > 0);
+
+    // Look for the EDNS0 OPT record past the answers.  A problem here does not affect the answers.
+    extra_count = (xcode == S_OK || xcode == E_NOT_SUPPORTED) ? response->nscount + response->arcount : 0;
+    for (i = 0; i < extra_count; i++)
+    {
+        dns_resource_info_t info;
+
+        dataPos = __ec_dns_skip_record(dataPos, &state, &info, &xcode);
+        if (xcode != S_OK)
+        {
+            break;
+        }
+
+        TRY_SET_DO(info.dnstype != QT_OPT || !(info.ttl >> 24),
+                   E_INVALIDARG,
+                   { response->status = DNS_ERROR_NAME_DOES_NOT_EXIST; });
+    }
 
     xcode = S_OK;
 
@@ -131,244 +225,385 @@ CATCH_DEFAULT:
     return xcode;
 }
 
-int __ec_dns_parse_name(char     *to,
-                    uint8_t  *from,
-                    uint8_t  *dns_data,
-                    uint32_t  dns_data_len,
-                    int      *_xcode)
+static const char *__ec_dns_name_cache_find(DNS_PARSE_STATE *state, uint16_t offset, int *len)
 {
-    int32_t   xcode               = E_UNEXPECTED;
-    uint32_t  move_buf            = 0;
-    uint32_t  pos                 = 0;
-    uint32_t  move_increment      = 1;
-    uint32_t  number_times_jumped = 0;
-    uint8_t  *dataEnd             = dns_data + dns_data_len;
-    uint16_t *curWord             = (uint16_t *)(from);
-
-    TRY(to);
-    TRY(from);
-    TRY(dns_data);
-    TRY(xcode);
+    int i;
 
-    TRY_SET(!__ec_dns_check_overrun(dns_data, from, dns_data_len), E_NOT_SUFFICIENT_BUFFER);
+    for (i = 0; i < state->cache_count; ++i)
+    {
+        if (state->cache[i].offset == offset && state->cache[i].len >= 0)
+        {
+            *len = state->cache[i].len;
+            return state->cache[i].text;
+        }
+    }
+    return NULL;
+}
 
-    while (pos < DNS_MAX_NAME)
+static void __ec_dns_name_cache_add(DNS_PARSE_STATE *state, const uint8_t *label, const char *text)
+{
+    if (state->cache_count < DNS_NAME_CACHE_SIZE)
+    {
+        state->cache[state->cache_count].offset = label - state->data;
+        state->cache[state->cache_count].len    = -1;
+        state->cache[state->cache_count].text   = text;
+        ++state->cache_count;
+    }
+}
+
+// Decode the name at from into dotted form in one pass, following compression pointers.  Returns
+//  the position after the name in the record it belongs to.
+//
+// From the RFC demonstrating the use of the compression
+//
+// For example, a datagram might need to use the domain names F.ISI.ARPA,
+// FOO.F.ISI.ARPA, ARPA, and the root.  Ignoring the other fields of the
+// message, these domain names might be represented as:
+//
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 20 |           1           |           F           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 22 |           3           |           I           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 24 |           S           |           I           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 26 |           4           |           A           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 28 |           R           |           P           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 30 |           A           |           0           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 40 |           3           |           F           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 42 |           O           |           O           |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 44 | 1  1|                20                       |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 64 | 1  1|                26                       |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+// 92 |           0           |                       |
+//    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+//
+// The domain name for F.ISI.ARPA is shown at offset 20.  The domain name
+// FOO.F.ISI.ARPA is shown at offset 40; this definition uses a pointer to
+// concatenate a label for FOO to the previously defined F.ISI.ARPA.  The
+// domain name ARPA is defined at offset 64 using a pointer to the ARPA
+// component of the name F.ISI.ARPA at 20; note that this pointer relies on
+// ARPA being the last label in the string at 20.  The root domain name is
+// defined by a single octet of zeros at 92; the root domain name has no
+// labels.
+const uint8_t *__ec_dns_parse_name(char            *to,
+                                   const uint8_t   *from,
+                                   DNS_PARSE_STATE *state,
+                                   int             *_xcode)
+{
+    int            xcode       = E_UNEXPECTED;
+    const uint8_t *cur         = from;
+    const uint8_t *next        = NULL;
+    int            first_entry = state->cache_count;
+    int            jumps       = 0;
+    int            pos         = 0;
+    int            i;
+
+    while (true)
     {
-        move_buf += move_increment;
+        int label_len;
 
-        // This is a simplified check from what is done in __ec_dns_check_overrun
-        TRY_SET_MSG(from < dataEnd, DNS_ERROR_INVALID_DATA,
+        TRY_SET_MSG(cur < state->end, DNS_ERROR_INVALID_DATA,
                     DL_ERROR, "DNS name too long for buffer.");
 
-        if (*from == 0)
+        if (*cur == 0)
         {
+            next = next ? next : cur + 1;
             break;
         }
 
-        if (DNS_IS_INDIRECT(*from))
+        if (DNS_IS_INDIRECT(*cur))
         {
+            const char *suffix;
+            int         suffix_len = 0;
+            uint16_t    offset;
+
+            TRY_SET(state->end - cur >= 2, DNS_ERROR_INVALID_DATA);
+
             // Watch out for an infinite loop by counting the number of times we jump around in
-            // the same packet. This prevent one class of intentionally (or accidentally) DoS attacks
+            //  the same packet. This prevent one class of intentionally (or accidentally) DoS attacks
             //  on the endpoint.
-            //
-            // I can't imagine any legitimate packet needing to jump more than say, 20 times. In fact,
-            // most probably shouldn't jump more than once, but error on the side of accepting too many
-            // jumps rather than txcodeowing out too many packets.
-            TRY_SET_MSG(number_times_jumped++ < 20,
+            TRY_SET_MSG(jumps++ < DNS_MAX_JUMPS,
                         DNS_ERROR_INVALID_DATA,
                         DL_WARNING, "Too many jumps in dns packet");
 
-            // From the RFC demonstrating the use of the compression
-            //
-            // For example, a datagram might need to use the domain names F.ISI.ARPA,
-            // FOO.F.ISI.ARPA, ARPA, and the root.  Ignoring the other fields of the
-            // message, these domain names might be represented as:
-            //
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 20 |           1           |           F           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 22 |           3           |           I           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 24 |           S           |           I           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 26 |           4           |           A           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 28 |           R           |           P           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 30 |           A           |           0           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            //
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 40 |           3           |           F           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 42 |           O           |           O           |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 44 | 1  1|                20                       |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            //
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 64 | 1  1|                26                       |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            //
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            // 92 |           0           |                       |
-            //    +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-            //
-            // The domain name for F.ISI.ARPA is shown at offset 20.  The domain name
-            // FOO.F.ISI.ARPA is shown at offset 40; this definition uses a pointer to
-            // concatenate a label for FOO to the previously defined F.ISI.ARPA.  The
-            // domain name ARPA is defined at offset 64 using a pointer to the ARPA
-            // component of the name F.ISI.ARPA at 20; note that this pointer relies on
-            // ARPA being the last label in the string at 20.  The root domain name is
-            // defined by a single octet of zeros at 92; the root domain name has no
-            // labels.
-
-            curWord = (uint16_t *)from;
-            from    = dns_data + DNS_INDIRECT_OFFSET(ntohs(*curWord));
-
-            // move_buf indicates how many bytes current "dataPos" location should be incremented
-            // by. As soon as we make a jump to a different part of the buffer, we are no longer
-            // consuming the string segment at the current location, so at that point we want to
-            // stop the increments
-            move_buf += move_increment;
-            move_increment = 0;
-        } else
+            offset = DNS_INDIRECT_OFFSET((cur[0] << 8) | cur[1]);
+
+            // Once we jump we are no longer consuming the record at from
+            next = next ? next : cur + 2;
+
+            suffix = __ec_dns_name_cache_find(state, offset, &suffix_len);
+            if (suffix)
+            {
+                TRY_SET_MSG(pos + 1 + suffix_len < DNS_MAX_NAME, DNS_ERROR_INVALID_DATA,
+                            DL_ERROR, "DNS name too long, pos: %d", pos);
+                if (pos && suffix_len)
+                {
+                    to[pos++] = '.';
+                }
+                memcpy(&to[pos], suffix, suffix_len);
+                pos += suffix_len;
+                break;
+            }
+
+            cur = state->data + offset;
+            continue;
+        }
+
+        // The other two combinations of the high bits are reserved
+        TRY_SET(!(*cur & 0xC0), DNS_ERROR_INVALID_DATA);
+
+        label_len = *cur;
+        TRY_SET(state->end - (cur + 1) >= label_len, DNS_ERROR_INVALID_DATA);
+        TRY_SET_MSG(pos + 1 + label_len < DNS_MAX_NAME, DNS_ERROR_INVALID_DATA,
+                    DL_ERROR, "DNS name too long, pos: %d", pos);
+        TRY_SET_MSG(!memchr(cur + 1, 0, label_len), E_FAIL,
+                    DL_INFO, "Unexpected NULL detected in dns name.");
+
+        if (pos)
         {
-            to[pos++] = *(from++);
+            to[pos++] = '.';
         }
+        __ec_dns_name_cache_add(state, cur, &to[pos]);
+        memcpy(&to[pos], cur + 1, label_len);
+        pos += label_len;
+        cur += 1 + label_len;
     }
 
-    TRY_SET_MSG(pos < DNS_MAX_NAME, DNS_ERROR_INVALID_DATA,
-                DL_ERROR, "DNS name too long, pos: %d", pos);
-
     to[pos] = '\0';
 
-    xcode = __ec_dns_name_from_dns(to);
+    // Each label decoded here now starts the text of a complete name
+    for (i = first_entry; i < state->cache_count; ++i)
+    {
+        state->cache[i].len = &to[pos] - state->cache[i].text;
+    }
+
+    xcode = S_OK;
 
 CATCH_DEFAULT:
-    if (_xcode)
+    if (xcode != S_OK)
     {
-        *_xcode = xcode;
+        to[0] = '\0';
+        state->cache_count = first_entry;
     }
 
-    return move_buf;
+    *_xcode = xcode;
+    return next ? next : from;
 }
 
-int __ec_dns_name_from_dns(char *name)
+const uint8_t *__ec_dns_skip_name(const uint8_t *from, DNS_PARSE_STATE *state, int *_xcode)
 {
-    int xcode = E_UNEXPECTED;
-    size_t  i;
-
-    TRY(name);
+    int xcode = DNS_ERROR_INVALID_DATA;
 
-    for (i = 0; i < DNS_MAX_NAME && name[i] != '\0'; i++)
+    while (from < state->end)
     {
-        int num = name[i];
-        int j;
-
-        TRY_SET_MSG(num >= 0, E_FAIL, DL_INFO, "Invalid buffer length detected in dns_name_from_dns.");
-
-        for (j = 0; j < num; j++)
+        if (*from == 0)
         {
-            // Make sure we don't go past the last char which must be '\0'
-            TRY_SET(++i < (DNS_MAX_NAME - 1), E_FAIL);
-
-            name[i - 1] = name[i];
+            ++from;
+            xcode = S_OK;
+            break;
         }
 
-        TRY_SET_MSG('\0' != name[i], E_FAIL, DL_INFO, "Unexpected NULL detected in dns_name_from_dns.");
-
-        name[i] = '.';
-    }
+        if (DNS_IS_INDIRECT(*from))
+        {
+            TRY(state->end - from >= 2);
+            from += 2;
+            xcode = S_OK;
+            break;
+        }
 
-    // remove trailing '.' AND ensure the string is always NULL terminated
-    if (i > 0)
-    {
-        name[i - 1] = '\0';
+        TRY(!(*from & 0xC0));
+        from += 1 + *from;
     }
 
-    xcode = S_OK;
-
 CATCH_DEFAULT:
-    return xcode;
+    *_xcode = xcode;
+    return from;
 }
 
-uint8_t *__ec_dns_parse_record(CB_DNS_RECORD *record,
-                           uint8_t       *dataPos,
-                           uint8_t       *dns_data,
-                           char          *record_name,
-                           uint32_t       dns_data_len,
-                          int            *_xcode)
+const uint8_t *__ec_dns_parse_record(CB_DNS_RECORD   *record,
+                                     const uint8_t   *dataPos,
+                                     DNS_PARSE_STATE *state,
+                                     int             *_xcode)
 {
     int                  xcode = E_UNEXPECTED;
     dns_resource_info_t *rrHdr;
 
-    TRY(record);
-    TRY(dataPos);
-    TRY(dns_data);
-    TRY(record_name);
-    TRY(xcode);
-
     record->name[0] = 0;
-    dataPos += __ec_dns_parse_name(record->name, dataPos, dns_data, dns_data_len, &xcode);
+    dataPos = __ec_dns_parse_name(record->name, dataPos, state, &xcode);
     TRY(xcode == S_OK);
 
+    xcode = E_NOT_SUFFICIENT_BUFFER;
+    TRY(state->end - dataPos >= sizeof(*rrHdr));
     rrHdr = (dns_resource_info_t *)dataPos;
     dataPos += sizeof(*rrHdr);
 
-    TRY_SET(!__ec_dns_check_overrun(dns_data, dataPos, dns_data_len), E_NOT_SUFFICIENT_BUFFER);
-
     record->dnstype  = ntohs(rrHdr->dnstype);
     record->dnsclass = ntohs(rrHdr->dnsclass);
     record->ttl      = ntohl(rrHdr->ttl);
 
     if (record->dnstype == QT_A)
     {
-        struct in_addr *addr = (struct in_addr *)dataPos;
-
-        dataPos += sizeof(struct in_addr);
-        TRY_SET(!__ec_dns_check_overrun(dns_data, dataPos, dns_data_len), E_NOT_SUFFICIENT_BUFFER);
-        record->A.as_in4.sin_addr   = *addr;
+        TRY(state->end - dataPos >= sizeof(struct in_addr));
+        memcpy(&record->A.as_in4.sin_addr, dataPos, sizeof(struct in_addr));
         record->A.as_in4.sin_port   = 0;
         record->A.as_in4.sin_family = AF_INET;
+        dataPos += sizeof(struct in_addr);
+        xcode = S_OK;
     } else if (record->dnstype == QT_AAAA)
     {
-        struct in6_addr *addr6 = (struct in6_addr *)dataPos;
-
-        dataPos += sizeof(struct in6_addr);
-        TRY_SET(!__ec_dns_check_overrun(dns_data, dataPos, dns_data_len), E_NOT_SUFFICIENT_BUFFER);
-        memcpy(&record->AAAA.as_in6.sin6_addr, addr6, sizeof(record->AAAA.as_in6.sin6_addr));
+        TRY(state->end - dataPos >= sizeof(struct in6_addr));
+        memcpy(&record->AAAA.as_in6.sin6_addr, dataPos, sizeof(record->AAAA.as_in6.sin6_addr));
         record->AAAA.as_in6.sin6_port   = 0;
         record->AAAA.as_in6.sin6_family = AF_INET6;
+        dataPos += sizeof(struct in6_addr);
+        xcode = S_OK;
     } else if (record->dnstype == QT_CNAME)
     {
-        dataPos += __ec_dns_parse_name(record->CNAME, dataPos, dns_data, dns_data_len, &xcode);
-        TRY(xcode == S_OK);
+        dataPos = __ec_dns_parse_name(record->CNAME, dataPos, state, &xcode);
     } else
     {
         // Skip any record type that we are not interested in
         TRACE(DNS_PRINT_LEVEL, "Unhandled DNS %s Record: %s", __ec_dns_type_to_str(record->dnstype), record->name);
+        TRY(state->end - dataPos >= ntohs(rrHdr->length));
         dataPos += ntohs(rrHdr->length);
         record->name[0] = 0;
         xcode = E_NOT_SUPPORTED;
     }
 
-   TRY_SET(!__ec_dns_check_overrun(dns_data, dataPos, dns_data_len), E_NOT_SUFFICIENT_BUFFER);
-
 CATCH_DEFAULT:
-    if (_xcode)
+    *_xcode = xcode;
+    return dataPos;
+}
+
+const uint8_t *__ec_dns_skip_record(const uint8_t       *dataPos,
+                                    DNS_PARSE_STATE     *state,
+                                    dns_resource_info_t *info,
+                                    int                 *_xcode)
+{
+    int                  xcode = E_UNEXPECTED;
+    dns_resource_info_t *rrHdr;
+
+    dataPos = __ec_dns_skip_name(dataPos, state, &xcode);
+    TRY(xcode == S_OK);
+
+    xcode = E_NOT_SUFFICIENT_BUFFER;
+    TRY(state->end - dataPos >= sizeof(*rrHdr));
+    rrHdr = (dns_resource_info_t *)dataPos;
+    dataPos += sizeof(*rrHdr);
+
+    TRY(state->end - dataPos >= ntohs(rrHdr->length));
+    dataPos += ntohs(rrHdr->length);
+
+    if (info)
     {
-        *_xcode = xcode;
+        info->dnstype  = ntohs(rrHdr->dnstype);
+        info->dnsclass = ntohs(rrHdr->dnsclass);
+        info->ttl      = ntohl(rrHdr->ttl);
+        info->length   = ntohs(rrHdr->length);
     }
 
+    xcode = S_OK;
+
+CATCH_DEFAULT:
+    *_xcode = xcode;
     return dataPos;
 }
 
-int __ec_dns_check_overrun(uint8_t *dns_data, uint8_t *dataPos, uint32_t dns_data_len)
+// The answer hash does not depend on record order, since resolvers rotate the answers
+static void __ec_dns_report_key(CB_EVENT_DNS_RESPONSE *response, DNS_REPORT_KEY *key, uint32_t *ttl)
 {
-    return dataPos < dns_data || (uintptr_t)dataPos > ((uintptr_t)dns_data + dns_data_len)
-           ? E_NOT_SUFFICIENT_BUFFER
-           : S_OK;
+    int i;
+
+    memset(key, 0, sizeof(*key));
+    key->name_hash    = jhash(response->qname, strnlen(response->qname, DNS_MAX_NAME), 0);
+    key->qtype        = response->qtype;
+    key->record_count = response->record_count;
+
+    for (i = 0; i < response->record_count; ++i)
+    {
+        CB_DNS_RECORD *record = &response->records[i];
+        uint32_t       value  = 0;
+        uint32_t       hash;
+
+        if (record->dnstype == QT_A)
+        {
+            value = jhash(&record->A.as_in4.sin_addr, sizeof(struct in_addr), 0);
+        } else if (record->dnstype == QT_AAAA)
+        {
+            value = jhash(&record->AAAA.as_in6.sin6_addr, sizeof(struct in6_addr), 0);
+        } else if (record->dnstype == QT_CNAME)
+        {
+            value = jhash(record->CNAME, strnlen(record->CNAME, DNS_MAX_NAME), 0);
+        }
+
+        hash = jhash_3words(jhash(record->name, strnlen(record->name, DNS_MAX_NAME), 0), value, record->dnstype, 0);
+        key->answer_hash += ((uint64_t)hash << 32) | jhash_1word(hash, key->name_hash);
+
+        *ttl = min(*ttl, record->ttl);
+    }
+}
+
+// Returns false if an identical response was reported recently
+bool ec_dns_should_report(CB_EVENT_DNS_RESPONSE *response, ProcessContext *context)
+{
+    return __ec_dns_should_report(&s_dns_report_table, g_dns_report_window_secs, response, context);
+}
+
+// Checks and records a response in table, which lets the tests use their own table
+bool __ec_dns_should_report(HashTbl *table, uint32_t window, CB_EVENT_DNS_RESPONSE *response, ProcessContext *context)
+{
+    DNS_REPORT_KEY   key;
+    DNS_REPORT_NODE *node;
+    bool             report;
+
+    CANCEL(window && response && response->record_count, true);
+
+    __ec_dns_report_key(response, &key, &window);
+
+    // A response that may not be cached is always reported
+    CANCEL(window, true);
+
+    node = ec_hashtbl_find(table, &key, context);
+    if (node)
+    {
+        report = time_after(jiffies, READ_ONCE(node->expires));
+        if (report)
+        {
+            WRITE_ONCE(node->expires, jiffies + window * HZ);
+        }
+        ec_hashtbl_put(table, node, context);
+        return report;
+    }
+
+    node = ec_hashtbl_alloc(table, context);
+    CANCEL(node, true);
+
+    memcpy(&node->key, &key, sizeof(key));
+    node->expires = jiffies + window * HZ;
+
+    if (ec_hashtbl_add_safe(table, node, context) < 0)
+    {
+        // Another CPU added the same response first
+        ec_hashtbl_free(table, node, context);
+    } else
+    {
+        ec_hashtbl_put(table, node, context);
+    }
+
+    return true;
 }
 
 void __ec_dns_print_record(CB_DNS_RECORD *record)
@@ -7,6 +7,12 @@
 #include "process-context.h"
 #include "raw_event.h"
 
+extern uint32_t g_dns_report_window_secs;
+
+bool ec_dns_cache_initialize(ProcessContext *context);
+void ec_dns_cache_shutdown(ProcessContext *context);
+bool ec_dns_should_report(CB_EVENT_DNS_RESPONSE *response, ProcessContext *context);
+
 int ec_dns_parse_data(
     char                  *dns_data,
     int                    dns_data_len,
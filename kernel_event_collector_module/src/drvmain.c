@@ -22,6 +22,7 @@
 #include "tests/run-tests.h"
 #include "path-cache.h"
 #include "event-factory.h"
+#include "dns-parser.h"
 
 #ifdef HOOK_SELECTOR
 #define HOOK_MASK  0x0000000000000000
@@ -39,9 +40,13 @@ bool     g_exiting __read_mostly;
 uint32_t g_max_queue_size = DEFAULT_QUEUE_SIZE * 3;
 uint32_t ec_prsock_buflen __read_mostly;
 bool     g_run_self_tests __read_mostly;
+bool     g_run_benchmarks __read_mostly;
 bool     g_enable_hook_tracking __read_mostly;
+bool     g_enable_hook_profiling __read_mostly;
+bool     g_enable_latency_stats __read_mostly;
 bool     g_enable_mem_cache_tracking __read_mostly;
 bool     g_process_tracking_ref_debug __read_mostly;
+bool     g_process_op_stats __read_mostly;
 bool     g_path_cache_ref_debug __read_mostly;
 bool     g_panic_on_error __read_mostly;
 
@@ -57,9 +62,13 @@ module_param_named(traceLevel, g_traceLevel, uint, S_IRUSR | S_IWUSR | S_IRGRP |
 module_param_named(max_queue_size, g_max_queue_size, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(ec_prsock_buflen, ec_prsock_buflen, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(run_self_tests, g_run_self_tests, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(run_benchmarks, g_run_benchmarks, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(enable_hook_tracking, g_enable_hook_tracking, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(enable_hook_profiling, g_enable_hook_profiling, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(enable_latency_stats, g_enable_latency_stats, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(enable_mem_cache_tracking, g_enable_mem_cache_tracking, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(process_tracking_ref_debug, g_process_tracking_ref_debug, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(process_op_stats, g_process_op_stats, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(path_cache_ref_debug, g_path_cache_ref_debug, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(panic_on_error, g_panic_on_error, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 
@@ -68,8 +77,13 @@ module_param_string(enableHooks, enableHooksStr, HOOK_MASK_LEN,
                     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 
 module_param_named(file_path_buckets, g_file_path_buckets, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(file_path_budget_kb, g_file_path_budget_kb, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(file_tracking_buckets, g_file_tracking_buckets, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 module_param_named(enable_path_cache, g_enable_path_cache, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(net_track_budget_kb, g_net_track_budget_kb, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(net_flow_report_secs, g_net_flow_report_secs, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(dns_report_window_secs, g_dns_report_window_secs, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+module_param_named(webproxy_first_segment_only, g_webproxy_first_segment_only, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 
 // checkpatch-no-ignore: SYMBOLIC_PERMS
 
@@ -514,21 +528,18 @@ bool ec_enable_module(ProcessContext *context)
             g_module_state_info.module_state = ModuleStateEnabling;
             ec_write_unlock(&g_module_state_info.module_state_lock, context);
 
+            if (!ec_sensor_enable_module_initialize_memory(context))
             {
-                DECLARE_ATOMIC_CONTEXT(atomic_context, ec_getpid(current));
+                TRACE(DL_ERROR,
+                      "Call ec_sensor_enable_module_initialize_memory failed");
 
-                if (!ec_sensor_enable_module_initialize_memory(context))
-                {
-                    TRACE(DL_ERROR,
-                          "Call ec_sensor_enable_module_initialize_memory failed");
-
-                    ec_set_module_state(context, ModuleStateDisabled);
-                    return false;
-                }
-
-                ec_enumerate_and_track_all_tasks(&atomic_context);
+                ec_set_module_state(context, ModuleStateDisabled);
+                return false;
             }
 
+            // This sets up its own atomic contexts for the parts that run under rcu_read_lock
+            ec_enumerate_and_track_all_tasks(context);
+
             ec_set_module_state(context, ModuleStateEnabled);
             g_module_state_info.module_enabled = true;
             ec_event_send_discover_flush(context);
@@ -550,6 +561,7 @@ static struct subsystem_init s_module_enable[] = {
     SUBSYSTEM_INIT(ec_logger_initialize,              ec_logger_shutdown),
     SUBSYSTEM_INIT(ec_process_tracking_initialize,    ec_process_tracking_shutdown),
     SUBSYSTEM_INIT(ec_net_tracking_initialize,        ec_net_tracking_shutdown),
+    SUBSYSTEM_INIT(ec_dns_cache_initialize,           ec_dns_cache_shutdown),
     SUBSYSTEM_INIT(ec_netfilter_initialize,           ec_netfilter_cleanup),
     SUBSYSTEM_INIT(ec_network_hooks_initialize,       ec_network_hooks_shutdown),
     SUBSYSTEM_INIT(ec_banning_initialize,             ec_banning_shutdown),
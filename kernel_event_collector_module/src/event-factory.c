@@ -21,6 +21,15 @@ const char *ec_StartAction_ToString(int start_action)
     return "??";
 }
 
+PCB_EVENT ec_factory_alloc_event_inline(
+    ProcessHandle * process_handle,
+    CB_EVENT_TYPE   eventType,
+    size_t          inline_size,
+    int             trace_level,
+    const char     *type_msg,
+    const char     *status_msg,
+    ProcessContext *context);
+
 PCB_EVENT ec_factory_alloc_event(
     ProcessHandle * process_handle,
     CB_EVENT_TYPE   eventType,
@@ -28,6 +37,19 @@ PCB_EVENT ec_factory_alloc_event(
     const char     *type_msg,
     const char     *status_msg,
     ProcessContext *context)
+{
+    return ec_factory_alloc_event_inline(process_handle, eventType, 0, trace_level, type_msg, status_msg, context);
+}
+
+// inline_size reserves room for strings that will be added with ec_event_strdup
+PCB_EVENT ec_factory_alloc_event_inline(
+    ProcessHandle * process_handle,
+    CB_EVENT_TYPE   eventType,
+    size_t          inline_size,
+    int             trace_level,
+    const char     *type_msg,
+    const char     *status_msg,
+    ProcessContext *context)
 {
     PCB_EVENT event = NULL;
 
@@ -38,14 +60,14 @@ PCB_EVENT ec_factory_alloc_event(
               (status_msg ? status_msg : ""),
               SAFE_STRING(ec_process_path(process_handle)),
               ec_process_posix_identity(process_handle)->posix_details.pid,
-              ec_process_posix_identity(process_handle)->posix_parent_details.pid,
+              ec_process_posix_identity(process_handle)->lineage->parent.pid,
               ec_process_exec_identity(process_handle)->exec_details.pid,
               ec_process_exec_identity(process_handle)->exec_details.start_time,
               ec_process_exec_identity(process_handle)->exec_parent_details.pid);
     }
 
     // This will return a NULL event if we are configured to not send this event type
-    event = ec_alloc_event(eventType, context);
+    event = ec_alloc_event_inline(eventType, inline_size, context);
 
     // We still call this even for a NULL event to give the process_tracking a chance
     //  to clean up any private data
@@ -190,7 +212,7 @@ void ec_event_send_exit(
               event ? "<SENT>" : "<IGNORED>",
               SAFE_STRING(ec_process_path(process_handle)),
               ec_process_posix_identity(process_handle)->posix_details.pid,
-              ec_process_posix_identity(process_handle)->posix_parent_details.pid,
+              ec_process_posix_identity(process_handle)->lineage->parent.pid,
               ec_process_exec_identity(process_handle)->exec_details.pid,
               ec_process_exec_identity(process_handle)->exec_details.start_time,
               ec_process_exec_identity(process_handle)->exec_parent_details.pid);
@@ -203,7 +225,7 @@ void ec_event_send_block(
     uint32_t        reason,
     uint32_t        details,
     uid_t           uid,
-    char           *cmdline,
+    PathData       *path_data,
     ProcessContext *context)
 {
     PCB_EVENT event = ec_factory_alloc_event(
@@ -222,10 +244,11 @@ void ec_event_send_block(
     event->blockResponse.failureReasonDetails = 0;
     event->blockResponse.uid                  = uid;
 
-    if (cmdline)
+    // The path is shared with the path cache and read when the event is copied out
+    if (path_data && path_data->path)
     {
-        event->blockResponse.path = ec_mem_strdup(cmdline, context);
-        event->blockResponse.path_size = ec_mem_size(event->blockResponse.path);
+        event->blockResponse.path = ec_mem_get(path_data->path, context);
+        event->blockResponse.path_size = ec_mem_size(path_data->path);
     }
 
     ec_send_event(event, context);
@@ -288,7 +311,7 @@ void ec_event_send_modload(
     uint64_t         device,
     uint64_t         inode,
     int64_t          base_address,
-    char            *path,
+    PathData        *path_data,
     ProcessContext  *context)
 {
     char status_message[MSG_SIZE + 1];
@@ -331,10 +354,10 @@ void ec_event_send_modload(
     event->moduleLoad.inode         = inode;
     event->moduleLoad.baseaddress   = base_address;
 
-    if (path)
+    if (path_data && path_data->path)
     {
-        event->moduleLoad.path = ec_mem_strdup(path, context);
-        event->moduleLoad.path_size = ec_mem_size(event->moduleLoad.path);
+        event->moduleLoad.path = ec_mem_get(path_data->path, context);
+        event->moduleLoad.path_size = ec_mem_size(path_data->path);
     }
 
     ec_send_event(event, context);
@@ -352,9 +375,10 @@ void ec_event_send_net_proxy(
     void             *sk,
     ProcessContext   *context)
 {
-    PCB_EVENT event = ec_factory_alloc_event(
+    PCB_EVENT event = ec_factory_alloc_event_inline(
         process_handle,
         net_event_type,
+        actual_server ? strlen(actual_server) + 1 : 0,
         DL_NET,
         msg,
         NULL,
@@ -376,8 +400,7 @@ void ec_event_send_net_proxy(
 
     if (actual_server)
     {
-        event->netConnect.actual_server = ec_mem_strdup(actual_server, context);
-        event->netConnect.server_size = ec_mem_size(event->netConnect.actual_server);
+        event->netConnect.actual_server = ec_event_strdup(event, actual_server, &event->netConnect.server_size, context);
     }
 
     ec_send_event(event, context);
@@ -406,6 +429,27 @@ void ec_event_send_net(
         context);
 }
 
+void ec_event_send_net_flow(
+    ProcessHandle         *process_handle,
+    CB_EVENT_NETWORK_FLOW *flow,
+    ProcessContext        *context)
+{
+    PCB_EVENT event = ec_factory_alloc_event(
+        process_handle,
+        CB_EVENT_TYPE_NET_FLOW_SUMMARY,
+        DL_NET,
+        "FLOW",
+        NULL,
+        context);
+
+    CANCEL_VOID(event);
+
+    // Populate the event
+    memcpy(&event->netFlow, flow, sizeof(CB_EVENT_NETWORK_FLOW));
+
+    ec_send_event(event, context);
+}
+
 void ec_event_send_dns(
     CB_EVENT_TYPE          net_event_type,
     CB_EVENT_DNS_RESPONSE *response,
@@ -451,6 +495,7 @@ const char *ec_EventType_ToString(int event_type)
     case CB_EVENT_TYPE_NET_CONNECT_PRE: return "NET CONECT PRE"; break;
     case CB_EVENT_TYPE_NET_CONNECT_POST: return "NET CONNECT POST"; break;
     case CB_EVENT_TYPE_NET_ACCEPT: return "NET ACCEPT"; break;
+    case CB_EVENT_TYPE_NET_FLOW_SUMMARY: return "NET FLOW SUMMARY"; break;
     case CB_EVENT_TYPE_DNS_RESPONSE: return "DNS RESPONSE"; break;
     case CB_EVENT_TYPE_PROCESS_BLOCKED: return "BLOCK"; break;
     case CB_EVENT_TYPE_WEB_PROXY: return "WEB PROXY"; break;
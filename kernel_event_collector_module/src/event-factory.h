@@ -30,7 +30,7 @@ void ec_event_send_block(ProcessHandle  *process_handle,
                          uint32_t          reason,
                          uint32_t          details,
                          uid_t             uid,
-                         char             *cmdline,
+                         PathData         *path_data,
                          ProcessContext *context);
 
 void ec_event_send_file(ProcessHandle  *process_handle,
@@ -43,7 +43,7 @@ void ec_event_send_modload(ProcessHandle  *process_handle,
                            uint64_t         device,
                            uint64_t         inode,
                            int64_t          base_address,
-                           char *path,
+                           PathData        *path_data,
                            ProcessContext *context);
 #
 void ec_event_send_net(ProcessHandle  *process_handle,
@@ -66,6 +66,10 @@ void ec_event_send_net_proxy(ProcessHandle  *process_handle,
                              void             *sk,
                              ProcessContext   *context);
 
+void ec_event_send_net_flow(ProcessHandle         *process_handle,
+                            CB_EVENT_NETWORK_FLOW *flow,
+                            ProcessContext        *context);
+
 void ec_event_send_dns(CB_EVENT_TYPE          net_event_type,
                        CB_EVENT_DNS_RESPONSE *response,
                        ProcessContext        *context);
@@ -11,6 +11,8 @@
 #include <linux/err.h>
 #include <linux/magic.h>
 #include <linux/namei.h>
+#include <linux/dcache.h>
+#include <linux/seqlock.h>
 #include <linux/string.h>    // memset()
 
 typedef PathData *(*path_find_fn)(
@@ -135,6 +137,296 @@ bool ec_file_get_path(struct file const *file, char *buffer, unsigned int buflen
     return ec_path_get_path(&file->f_path, buffer, buflen, pathname);
 }
 
+// Only a few levels are walked before giving up and resolving the full path
+#define PATH_PREFIX_MAX_DEPTH  8
+
+// Directories deeper than this below their mount root are not cached
+#define PATH_LEARN_MAX_DEPTH   16
+
+static inline bool __ec_path_use_dpath(void)
+{
+    return !(current->nsproxy && CB_CHECK_RESOLVED(current_chrooted) && CB_RESOLVED(current_chrooted)());
+}
+
+// A concurrent rename can swap d_name.name and d_name.len at any time, so the length is never
+//  trusted against the name.  Like the kernel's prepend_name() we only read the name up to its NUL,
+//  and the caller's read_seqretry rejects whatever a rename left behind.
+static bool __ec_dentry_name_is(struct dentry *dentry, const char *name, size_t len)
+{
+    const unsigned char *dname = smp_load_acquire(&dentry->d_name.name);
+    size_t i;
+
+    // name has no NUL in it, so this stops at the end of dname
+    for (i = 0; i < len; ++i)
+    {
+        if (dname[i] != name[i])
+        {
+            return false;
+        }
+    }
+
+    return dname[len] == 0;
+}
+
+// Prepends "/name" to the string that starts at *end.  Returns false if the buffer is too small.
+static bool __ec_prepend_dentry_name(struct dentry *dentry, char *buffer, char **end)
+{
+    const unsigned char *dname = smp_load_acquire(&dentry->d_name.name);
+    uint32_t len = READ_ONCE(dentry->d_name.len);
+    char *pos;
+
+    CANCEL(*end - buffer >= len + 1, false);
+
+    *end -= len + 1;
+    pos = *end;
+    *pos++ = '/';
+    while (len--)
+    {
+        char c = *dname++;
+
+        if (!c)
+        {
+            break;
+        }
+        *pos++ = c;
+    }
+
+    return true;
+}
+
+// Checks a cached directory chain against the dentries it was built from.  Invalidation relies on
+//  seeing the rename, so this makes sure a rename we missed (another syscall path, nfsd, a disabled
+//  hook) can not produce a wrong path.  Called under RCU inside the rename_lock read section.
+//
+// Every chain ends at a mount root, which must be the root of the mount we are resolving.  The same
+//  directory seen through a bind mount with another root does not match.
+static bool __ec_path_dir_matches(PathDir *dir, struct dentry *dentry, struct vfsmount *mnt)
+{
+    for (; dir; dir = dir->parent)
+    {
+        struct inode *inode = READ_ONCE(dentry->d_inode);
+
+        CANCEL(inode && inode->i_ino == dir->key.inode && inode->i_generation == dir->i_generation, false);
+
+        if (!dir->parent)
+        {
+            return dentry == mnt->mnt_root;
+        }
+
+        CANCEL(__ec_dentry_name_is(dentry, dir->name, dir->name_len), false);
+        dentry = READ_ONCE(dentry->d_parent);
+    }
+
+    return false;
+}
+
+// Returns the path of the mount point of mnt in buffer, or NULL.  Safe in atomic context.
+char *ec_mount_point_path(struct vfsmount *mnt, char *buffer, int buflen)
+{
+    struct path root = { .mnt = mnt, .dentry = mnt->mnt_root };
+    char *mount_point;
+
+    CANCEL(current->fs, NULL);
+
+    // d_path would add " (deleted)" after the mount point instead of after the file
+    CANCEL(!d_unlinked(mnt->mnt_root), NULL);
+
+    mount_point = d_path(&root, buffer, buflen);
+
+    return IS_ERR(mount_point) ? NULL : mount_point;
+}
+
+// Prepends the mount point of mnt to the string that starts at *end, which must begin with a '/'.
+//  The cache stops at mount roots, so this is always read from the mount itself and a moved mount
+//  or a reused vfsmount can not leave a stale prefix behind.
+static bool __ec_path_prepend_mount(struct vfsmount *mnt, char *buffer, char **end)
+{
+    char saved = **end;
+    char *prefix;
+
+    // d_path terminates its result where our string starts, so put back the '/' it overwrites
+    prefix = ec_mount_point_path(mnt, buffer, *end - buffer + 1);
+    **end = saved;
+    CANCEL(prefix, false);
+
+    // The root mount has nothing to add
+    if (*end - prefix != 1)
+    {
+        *end = prefix;
+    }
+
+    return true;
+}
+
+// Builds the path right to left from the dentry names until it reaches a cached directory, then
+//  prepends the path of that directory from the cache and then the mount point.  Nothing is locked
+//  or referenced.  The walk is done under RCU and the caller falls back to d_path if a rename
+//  happened while we were in it, or if the cached chain no longer matches the dentries.
+bool __ec_path_from_cached_prefix(struct path const *path, char *buffer, unsigned int buflen, char **pathname, ProcessContext *context)
+{
+    struct dentry *dentry = path->dentry;
+    char *end = buffer + buflen;
+    PathDir *cached_dir = NULL;
+    bool found;
+    unsigned int seq;
+    int depth;
+
+    CANCEL(g_enable_path_cache, false);
+    CANCEL(path->mnt && dentry, false);
+    (*pathname) = NULL;
+
+    rcu_read_lock();
+    seq = read_seqbegin(&rename_lock);
+
+    *--end = 0;
+    for (depth = 0; depth < PATH_PREFIX_MAX_DEPTH && !cached_dir; ++depth)
+    {
+        struct dentry *parent = READ_ONCE(dentry->d_parent);
+        struct inode *dir = parent ? READ_ONCE(parent->d_inode) : NULL;
+
+        // Cached directories do not cross mount points
+        if (dentry == path->mnt->mnt_root || IS_ROOT(dentry) || !dir)
+        {
+            break;
+        }
+
+        if (!__ec_prepend_dentry_name(dentry, buffer, &end))
+        {
+            break;
+        }
+
+        cached_dir = ec_path_cache_find_dir(
+            new_encode_dev(dir->i_sb->s_dev),
+            dir->i_ino,
+            dir->i_generation,
+            context);
+        dentry = parent;
+    }
+
+    // dentry is now the cached directory
+    found = cached_dir &&
+        __ec_path_dir_matches(cached_dir, dentry, path->mnt) &&
+        !read_seqretry(&rename_lock, seq) &&
+        ec_path_cache_build_dir(cached_dir, buffer, &end);
+    rcu_read_unlock();
+
+    ec_path_cache_put_dir(cached_dir, context);
+
+    // Outside the read section, older kernels take rename_lock for write in d_path
+    if (found && __ec_path_prepend_mount(path->mnt, buffer, &end))
+    {
+        *pathname = end;
+    }
+
+    return *pathname != NULL;
+}
+
+// Caches the directories above a resolved path so the next file under them can skip most of the walk.
+//  We stop at the first directory that is already cached, or at the mount root which starts a new
+//  chain.  Nothing is cached for a directory too deep below its mount root.  The component names are
+//  taken from pathname, so nothing is cached if a rename happened since seq was read.  Returns the
+//  entry for the file's own directory with a reference.
+PathDir *__ec_path_learn_dirs(struct path const *path, const char *pathname, unsigned int seq, ProcessContext *context)
+{
+    struct dentry *dentries[PATH_LEARN_MAX_DEPTH];
+    size_t lens[PATH_LEARN_MAX_DEPTH];   // Length of the path of each dentry in pathname
+    struct dentry *dentry = path->dentry;
+    PathDir *dir = NULL;
+    int count = 0;
+    int i;
+
+    CANCEL(g_enable_path_cache, NULL);
+    CANCEL(pathname && pathname[0] == '/', NULL);
+    CANCEL(dentry != path->mnt->mnt_root, NULL);
+    CANCEL(!d_unlinked(dentry), NULL);
+
+    lens[0] = strrchr(pathname, '/') - pathname;
+
+    while (true)
+    {
+        struct dentry *parent;
+        struct inode *inode;
+
+        TRY(count < PATH_LEARN_MAX_DEPTH);
+
+        parent = dget_parent(dentry);
+        inode = parent->d_inode;
+        dentries[count] = parent;
+        if (count > 0)
+        {
+            size_t pos = lens[count - 1];
+
+            // The path above the previous component
+            while (pos > 0 && pathname[pos - 1] != '/')
+            {
+                --pos;
+            }
+            TRY(pos > 0);
+            lens[count] = pos - 1;
+        }
+        ++count;
+
+        TRY(inode);
+        dir = ec_path_cache_find_dir(
+            new_encode_dev(inode->i_sb->s_dev),
+            inode->i_ino,
+            inode->i_generation,
+            context);
+        if (dir || parent == path->mnt->mnt_root)
+        {
+            break;
+        }
+
+        // The dentries left this mount, or pathname does not have a name for the next one
+        TRY(!IS_ROOT(parent) && lens[count - 1] > 0);
+        dentry = parent;
+    }
+
+    TRY_DO(!read_seqretry(&rename_lock, seq), {
+        ec_path_cache_put_dir(dir, context);
+        dir = NULL;
+    });
+
+    if (!dir)
+    {
+        // The mount root starts the chain
+        struct inode *inode = dentries[count - 1]->d_inode;
+
+        dir = ec_path_cache_add_dir(
+            new_encode_dev(inode->i_sb->s_dev),
+            inode->i_ino,
+            inode->i_generation,
+            NULL,
+            "",
+            0,
+            context);
+    }
+
+    for (i = count - 2; i >= 0 && dir; --i)
+    {
+        struct inode *inode = dentries[i]->d_inode;
+        PathDir *parent_dir = dir;
+
+        dir = ec_path_cache_add_dir(
+            new_encode_dev(inode->i_sb->s_dev),
+            inode->i_ino,
+            inode->i_generation,
+            parent_dir,
+            pathname + lens[i + 1] + 1,
+            lens[i] - lens[i + 1] - 1,
+            context);
+        ec_path_cache_put_dir(parent_dir, context);
+    }
+
+CATCH_DEFAULT:
+    for (i = 0; i < count; ++i)
+    {
+        dput(dentries[i]);
+    }
+
+    return dir;
+}
+
 PathData *ec_file_get_path_data(
     struct path_lookup *path_lookup,
     ProcessContext     *context)
@@ -146,6 +438,8 @@ PathData *ec_file_get_path_data(
     PathData *path_data = NULL;
     char *owned_path_buffer = NULL;
     char *path_str = NULL;
+    PathDir *dir = NULL;
+    unsigned int seq;
 
     TRY(likely(path_lookup));
 
@@ -186,13 +480,31 @@ PathData *ec_file_get_path_data(
             // We have a file, so use the path from that
             path_lookup->path = &path_lookup->file->f_path;
         }
-        // ec_file_get_path() uses dpath which builds the path efficiently
-        //  by walking back to the root. It starts with a string terminator
-        //  in the last byte of the target buffer.
-        //
-        // The `path` variable will point to the start of the string, so we will
-        //  use that directly later to copy into the tracking entry and event.
-        path_found = ec_path_get_path(path_lookup->path, path_lookup->path_buffer, PATH_MAX, &path_str);
+        // Read before resolving so a rename that races with us keeps the directories out of the cache
+        seq = read_seqbegin(&rename_lock);
+
+        // Try to build the path from a cached parent directory first.  This only works
+        //  in the d_path case, since the cached directories are learned from d_path results.
+        if (__ec_path_use_dpath())
+        {
+            path_found = __ec_path_from_cached_prefix(path_lookup->path, path_lookup->path_buffer, PATH_MAX, &path_str, context);
+        }
+
+        if (!path_found)
+        {
+            // ec_file_get_path() uses dpath which builds the path efficiently
+            //  by walking back to the root. It starts with a string terminator
+            //  in the last byte of the target buffer.
+            //
+            // The `path` variable will point to the start of the string, so we will
+            //  use that directly later to copy into the tracking entry and event.
+            path_found = ec_path_get_path(path_lookup->path, path_lookup->path_buffer, PATH_MAX, &path_str);
+        }
+
+        if (path_found && __ec_path_use_dpath())
+        {
+            dir = __ec_path_learn_dirs(path_lookup->path, path_str, seq, context);
+        }
         path_lookup->path_buffer[PATH_MAX] = 0;
 
         if (!path_found)
@@ -218,15 +530,25 @@ PathData *ec_file_get_path_data(
     }
 
     path_data = ec_path_cache_add(query.key.ns_id, query.key.device, query.key.inode, path_str, fs_magic, context);
+
+    // Link the entry to its directory so it is dropped if any directory above it is renamed
+    ec_path_cache_set_dir(path_data, dir, context);
     if (path_lookup->ignore_spcial && path_data && path_data->is_special_file)
     {
         ec_path_cache_put(path_data, context);
         path_data = NULL;
+        query.path_ignored = true;
     }
 
 CATCH_DEFAULT:
     ec_mem_put(path_str);
     ec_put_path_buffer(owned_path_buffer);
+    ec_path_cache_put_dir(dir, context);
+
+    if (path_lookup)
+    {
+        path_lookup->path_ignored = query.path_ignored;
+    }
 
     if (!path_data)
     {
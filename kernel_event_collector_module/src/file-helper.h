@@ -13,6 +13,7 @@ bool ec_file_get_path(struct file const *file, char *buffer, unsigned int buflen
 bool ec_path_get_path(struct path const *path, char *buffer, unsigned int buflen, char **pathname);
 char *ec_dentry_to_path(struct dentry const *dentry, char *buf, int buflen);
 char *ec_lsm_dentry_path(struct dentry const *dentry, char *path, int len);
+char *ec_mount_point_path(struct vfsmount *mnt, char *buffer, int buflen);
 struct inode const *ec_get_inode_from_file(struct file const *file);
 void ec_get_devinfo_from_file(struct file const *file, uint64_t *device, uint64_t *inode);
 void ec_get_devinfo_fs_magic_from_file(struct file const *file, uint64_t *device, uint64_t *inode, uint64_t *fs_magic);
@@ -32,6 +33,7 @@ struct path_lookup
     const char __user  *filename;
     char               *path_buffer;
     bool                ignore_spcial;
+    bool                path_ignored;   // Set when ignore_spcial filtered out a special file
 };
 
 PathData *ec_file_get_path_data(
@@ -50,6 +50,7 @@ char *ec_event_type_to_str(CB_EVENT_TYPE event_type)
 PathData *__ec_get_path_data(
     int                dfd,
     const char __user *filename,
+    bool              *is_dir,
     ProcessContext    *context)
 {
     PathData *path_data;
@@ -64,6 +65,11 @@ PathData *__ec_get_path_data(
 
     path_data = ec_file_get_path_data(&path_lookup, context);
 
+    if (is_dir)
+    {
+        *is_dir = path.dentry->d_inode && S_ISDIR(path.dentry->d_inode->i_mode);
+    }
+
     path_put(&path);
     return path_data;
 }
@@ -76,12 +82,12 @@ void __ec_do_generic_file_event(
     pid_t pid = ec_getpid(current);
     ProcessHandle *process_handle = NULL;
 
+    TRY(ec_logger_should_log(eventType));
+
     TRY(path_data);
 
     TRY(!ec_banning_IgnoreProcess(context, pid));
 
-    TRY(ec_logger_should_log(eventType));
-
     if (eventType == CB_EVENT_TYPE_FILE_DELETE)
     {
         TRACE(DL_VERBOSE, "Checking if deleted inode [%llu:%llu] was banned.",
@@ -118,11 +124,11 @@ void __ec_do_file_event(ProcessContext *context, struct file *file, CB_EVENT_TYP
     bool               doClose      = false;
     PathData           *path_data   = NULL;
 
+    CANCEL_VOID(ec_logger_should_log(eventType));
+
     CANCEL_VOID(file);
     CANCEL_VOID(!ec_banning_IgnoreProcess(context, pid));
 
-    CANCEL_VOID(ec_logger_should_log(eventType));
-
     // Skip if not interesting
     CANCEL_VOID(ec_is_interesting_file(file));
 
@@ -161,12 +167,17 @@ void __ec_do_file_event(ProcessContext *context, struct file *file, CB_EVENT_TYP
             || eventType == CB_EVENT_TYPE_FILE_CREATE
             || eventType == CB_EVENT_TYPE_FILE_OPEN);
 
+        // Skip files we have already found to be uninteresting without resolving the path again
+        TRY(!ec_file_ignore_check(file, context));
+
         // If this file is deleted already, then just skip it
         TRY(!d_unlinked(file->f_path.dentry));
 
         path_data = ec_file_get_path_data(&path_lookup, context);
         TRY(path_data);
 
+        TRY_DO(!path_lookup.path_ignored, { ec_file_ignore_add(file, context); });
+
         // Do not track if this is an open/read, otherwise a last-write will be issued when we see the close event
         if (eventType != CB_EVENT_TYPE_FILE_OPEN)
         {
@@ -299,6 +310,12 @@ long __ec_sys_open(
 
     IF_MODULE_DISABLED_GOTO(context, CATCH_DISABLED);
 
+    // Checking if the file exists is a path walk, so skip everything if no file events are wanted
+    if (!ec_logger_is_interested(EVENT_INTEREST_FILE))
+    {
+        goto CATCH_DISABLED;
+    }
+
     if ((args->flags & O_CREAT) && !ec_file_exists(args->dfd, args->filename))
     {
         // If this is opened with create mode AND it does not already exist we will report a create event
@@ -339,6 +356,11 @@ asmlinkage long ec_sys_creat(const char __user *filename, umode_t mode)
 
     MODULE_GET_AND_IF_MODULE_DISABLED_GOTO(&context, CATCH_DISABLED);
 
+    if (!ec_logger_is_interested(EVENT_INTEREST_FILE))
+    {
+        goto CATCH_DISABLED;
+    }
+
     // If this is opened with create mode AND it does not already exist we
     //  will report an event
     if (!ec_file_exists(AT_FDCWD, filename))
@@ -388,7 +410,7 @@ long __ec_sys_unlink(
 
     // Collect data about the file before it is modified.  The event will be sent
     // after a successful operation
-    path_data = __ec_get_path_data(args->dfd, args->filename, context);
+    path_data = __ec_get_path_data(args->dfd, args->filename, NULL, context);
 
 CATCH_DISABLED:
     ret = call_unlink_func(args);
@@ -401,6 +423,10 @@ CATCH_DISABLED:
         __ec_do_generic_file_event(path_data, CB_EVENT_TYPE_FILE_DELETE, context);
     }
 
+    if (path_data)
+    {
+        ec_file_ignore_clear(path_data->key.device, path_data->key.inode, context);
+    }
     ec_path_cache_delete(path_data, context);
 
 CATCH_DEFAULT:
@@ -427,6 +453,7 @@ long __ec_sys_rename(
     PathData *old_path_data = NULL;
     PathData *new_path_data_pre_rename = NULL;
     PathData *new_path_data_post_rename = NULL;
+    bool is_dir = false;
 
     // __ec_get_path_data can block if the device is unavailable (e.g. network timeout)
     // so do not begin hook tracking yet, since that can block module disable
@@ -434,12 +461,12 @@ long __ec_sys_rename(
 
     // Collect data about the file before it is modified.  The event will be sent
     // after a successful operation
-    old_path_data = __ec_get_path_data(args->olddirfd, args->oldname, context);
+    old_path_data = __ec_get_path_data(args->olddirfd, args->oldname, &is_dir, context);
 
     // Only lookup new path when old path was found
     if (old_path_data)
     {
-        new_path_data_pre_rename = __ec_get_path_data(args->newdirfd, args->newname, context);
+        new_path_data_pre_rename = __ec_get_path_data(args->newdirfd, args->newname, NULL, context);
     }
     // Old path must exist but still execute syscall
 
@@ -451,11 +478,21 @@ CATCH_DISABLED:
 
     if (!IS_ERR_VALUE(ret) && old_path_data)
     {
+        // Every path cached under the directory just changed
+        if (is_dir)
+        {
+            ec_path_cache_invalidate_dir(old_path_data->key.device, old_path_data->key.inode, context);
+            ec_file_ignore_clear_all(context);
+        }
+
         __ec_do_generic_file_event(old_path_data, CB_EVENT_TYPE_FILE_DELETE, context);
 
         // Delete the old path from the cache
         ec_path_cache_delete(old_path_data, context);
 
+        // The new path may be interesting even if the old one was not
+        ec_file_ignore_clear(old_path_data->key.device, old_path_data->key.inode, context);
+
         // Send a delete for the destination if the rename will overwrite an existing file
         if (new_path_data_pre_rename)
         {
@@ -463,12 +500,13 @@ CATCH_DISABLED:
 
             // Delete the old path from the cache
             ec_path_cache_delete(new_path_data_pre_rename, context);
+            ec_file_ignore_clear(new_path_data_pre_rename->key.device, new_path_data_pre_rename->key.inode, context);
         }
 
         FINISH_MODULE_DISABLE_CHECK(context);
 
         // This could block so call it outside the disable tracking
-        new_path_data_post_rename = __ec_get_path_data(args->newdirfd, args->newname, context);
+        new_path_data_post_rename = __ec_get_path_data(args->newdirfd, args->newname, NULL, context);
 
         BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(context, CATCH_DEFAULT);
 
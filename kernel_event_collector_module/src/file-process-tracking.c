@@ -7,8 +7,13 @@
 #include "process-tracking.h"
 #include "process-tracking-private.h"
 #include "hash-table.h"
+#include "file-helper.h"
+#include "path-buffers.h"
+#include "cb-test.h"
 #include "priv.h"
 
+#include <linux/jhash.h>
+
 uint32_t g_file_tracking_buckets = 65536;
 
 void __ec_file_tracking_delete_callback(void *posix_identity, ProcessContext *context);
@@ -20,19 +25,170 @@ static HashTbl __read_mostly s_file_hash_table = {
     .key_len     = sizeof(FILE_PROCESS_KEY),
     .key_offset  = offsetof(FILE_PROCESS_VALUE, key),
     .delete_callback = __ec_file_tracking_delete_callback,
+    .rcu_lookup = true,
+};
+
+// Files that turned out not to be interesting (special paths) are remembered here so later events
+//  on them skip the path lookup.  The decision was made for one name, so an entry is only trusted for
+//  the same dentry on the same mount, while that mount is still at the same mount point, and only
+//  for a file with a single link.  Writes through a hard link or a bind mount at a watched path
+//  always do their own lookup.  The generation guards against a recycled inode number, and entries
+//  are dropped when the file is unlinked or renamed.
+typedef struct FILE_IGNORE_KEY {
+    uint64_t            device;
+    uint64_t            inode;
+} FILE_IGNORE_KEY;
+
+typedef struct FILE_IGNORE_VALUE {
+    FILE_IGNORE_KEY     key;
+    uint32_t            generation;
+    uint32_t            mount_hash;     // Hash of the mount point path
+    void               *mnt;            // Only compared, never dereferenced
+    void               *dentry;
+} FILE_IGNORE_VALUE;
+
+#define FILE_IGNORE_ENTRIES 8192
+
+static HashTbl __read_mostly s_file_ignore_table = {
+    .numberOfBuckets = 2048,
+    .name = "file_ignore_table",
+    .datasize = sizeof(FILE_IGNORE_VALUE),
+    .key_len     = sizeof(FILE_IGNORE_KEY),
+    .key_offset  = offsetof(FILE_IGNORE_VALUE, key),
+    .memoryBudget = FILE_IGNORE_ENTRIES * HASHTBL_ENTRY_SIZE(sizeof(FILE_IGNORE_VALUE)),
+    .rcu_lookup = true,
 };
 
 bool ec_file_tracking_init(ProcessContext *context)
 {
-    s_file_hash_table.numberOfBuckets = g_file_tracking_buckets;
-    return ec_hashtbl_init(&s_file_hash_table, context);
+    // Start small and let the table grow to the configured size
+    s_file_hash_table.numberOfBuckets = min_t(uint64_t, g_file_tracking_buckets, HASHTBL_MIN_BUCKETS);
+    s_file_hash_table.maxBuckets = g_file_tracking_buckets;
+    TRY(ec_hashtbl_init(&s_file_hash_table, context));
+
+    TRY_STEP(TABLE, ec_hashtbl_init(&s_file_ignore_table, context));
+
+    return true;
+
+CATCH_TABLE:
+    ec_hashtbl_destroy(&s_file_hash_table, context);
+CATCH_DEFAULT:
+    return false;
 }
 
 void ec_file_tracking_shutdown(ProcessContext *context)
 {
+    ec_hashtbl_destroy(&s_file_ignore_table, context);
     ec_hashtbl_destroy(&s_file_hash_table, context);
 }
 
+// A moved mount, or a new mount that reuses a freed vfsmount, changes the path without touching
+//  the dentry, so the mount point is part of what an entry is checked against.  The table secret is
+//  used as the seed so a mount point can not be picked to collide with an ignored one.
+static bool __ec_file_ignore_mount_hash(struct file *file, uint32_t *hash, ProcessContext *context)
+{
+    char *buffer = ec_get_path_buffer(context);
+    char *mount_point = NULL;
+
+    if (buffer)
+    {
+        mount_point = ec_mount_point_path(file->f_path.mnt, buffer, PATH_MAX);
+    }
+    if (mount_point)
+    {
+        *hash = jhash(mount_point, strlen(mount_point), s_file_ignore_table.secret);
+    }
+    ec_put_path_buffer(buffer);
+
+    return mount_point != NULL;
+}
+
+bool ec_file_ignore_check(
+    struct file    *file,
+    ProcessContext *context)
+{
+    FILE_IGNORE_KEY key = { 0, 0 };
+    FILE_IGNORE_VALUE *value = NULL;
+    struct inode const *inode = ec_get_inode_from_file(file);
+    uint32_t mount_hash = 0;
+    bool ignored = false;
+
+    CANCEL(inode, false);
+
+    // Another name for this file may be interesting
+    CANCEL(inode->i_nlink == 1, false);
+
+    ec_get_devinfo_from_file(file, &key.device, &key.inode);
+    value = ec_hashtbl_find(&s_file_ignore_table, &key, context);
+    CANCEL(value, false);
+
+    if (value->generation != inode->i_generation)
+    {
+        // The inode number was reused by a new file
+        ec_hashtbl_del(&s_file_ignore_table, value, context);
+    } else
+    {
+        ignored = value->mnt == file->f_path.mnt &&
+            value->dentry == file->f_path.dentry &&
+            __ec_file_ignore_mount_hash(file, &mount_hash, context) &&
+            value->mount_hash == mount_hash;
+    }
+    ec_hashtbl_put(&s_file_ignore_table, value, context);
+
+    return ignored;
+}
+
+void ec_file_ignore_add(
+    struct file    *file,
+    ProcessContext *context)
+{
+    FILE_IGNORE_VALUE *value = NULL;
+    struct inode const *inode = ec_get_inode_from_file(file);
+
+    CANCEL_VOID(inode);
+    CANCEL_VOID(inode->i_nlink == 1);
+
+    value = ec_hashtbl_alloc(&s_file_ignore_table, context);
+    CANCEL_VOID(value);
+
+    ec_get_devinfo_from_file(file, &value->key.device, &value->key.inode);
+    value->generation = inode->i_generation;
+    value->mnt = file->f_path.mnt;
+    value->dentry = file->f_path.dentry;
+
+    if (!__ec_file_ignore_mount_hash(file, &value->mount_hash, context) ||
+        ec_hashtbl_add_safe(&s_file_ignore_table, value, context) < 0)
+    {
+        // No mount point to check against, or another thread already added it
+        ec_hashtbl_free(&s_file_ignore_table, value, context);
+        return;
+    }
+
+    // The table holds its own reference
+    ec_hashtbl_put(&s_file_ignore_table, value, context);
+}
+
+void ec_file_ignore_clear(
+    uint64_t        device,
+    uint64_t        inode,
+    ProcessContext *context)
+{
+    FILE_IGNORE_KEY key = { device, inode };
+    FILE_IGNORE_VALUE *value = NULL;
+
+    value = ec_hashtbl_del_by_key(&s_file_ignore_table, &key, context);
+
+    // We still need to release it
+    ec_hashtbl_put(&s_file_ignore_table, value, context);
+}
+
+// Entries do not know their path, so a directory rename drops all of them.
+//  They are learned again on the next open.
+void ec_file_ignore_clear_all(ProcessContext *context)
+{
+    ec_hashtbl_clear(&s_file_ignore_table, context);
+}
+
 void __ec_file_tracking_delete_callback(void *data, ProcessContext *context)
 {
     if (data)
@@ -35,3 +35,15 @@ FILE_PROCESS_VALUE *ec_file_process_status_open(
 void ec_file_process_status_close(
     struct file    *file,
     ProcessContext *context);
+
+bool ec_file_ignore_check(
+    struct file    *file,
+    ProcessContext *context);
+void ec_file_ignore_add(
+    struct file    *file,
+    ProcessContext *context);
+void ec_file_ignore_clear(
+    uint64_t        device,
+    uint64_t        inode,
+    ProcessContext *context);
+void ec_file_ignore_clear_all(ProcessContext *context);
@@ -18,6 +18,7 @@
 #include <linux/workqueue.h>
 #include <linux/jiffies.h>
 #include <linux/ioctl.h>
+#include <linux/log2.h>
 
 #include "priv.h"
 #include "cb-banning.h"
@@ -44,6 +45,8 @@ void ec_user_comm_clear_queue(ProcessContext *context);
 bool __ec_is_action_allowed(ModuleState moduleState, CB_EVENT_ACTION_TYPE action);
 bool __ec_is_ioctl_allowed(ModuleState module_state, unsigned int cmd);
 size_t __ec_get_memory_usage(ProcessContext *context);
+void __ec_record_latency(CB_EVENT_TYPE event_type, int kind, uint64_t start_ns, uint64_t now_ns);
+void __ec_reset_latency(void);
 void __ec_apply_legacy_driver_config(uint32_t eventFilter);
 void __ec_apply_driver_config(CB_DRIVER_CONFIG *config);
 char *__ec_driver_config_option_to_string(CB_CONFIG_OPTION config_option);
@@ -52,6 +55,9 @@ void __ec_transfer_from_input_queue(void);
 int __ec_copy_cbevent_to_user(char __user *ubuf, size_t count, ProcessContext *context);
 int __ec_precompute_payload(struct CB_EVENT *cb_event);
 void __ec_stats_work_task(struct work_struct *work);
+void __ec_fold_event_stats(uint64_t *totals);
+void __ec_event_stats_add(int stat, uint64_t count);
+bool __ec_is_queue_empty(void);
 
 // checkpatch-ignore: CONST_STRUCT
 struct file_operations driver_fops = {
@@ -71,7 +77,7 @@ static LLIST_HEAD(msg_queue_in);
 static const uint64_t MAX_VALID_INTERVALS =   60;
 #define  MAX_INTERVALS           62
 #define  NUM_STATS               16
-#define  EVENT_STATS             11
+#define  EVENT_STATS             12
 #define  MEM_START               EVENT_STATS
 #define  MEM_STATS               (EVENT_STATS + 4)
 
@@ -92,6 +98,9 @@ typedef struct CB_EVENT_STATS {
     //  tx_dns
     //  tx_proxy
     //  tx_block
+    //
+    //  The event counters are counted per-CPU and folded in here by the stats work, so the
+    //  hot paths never write this array.
     uint64_t        stats[MAX_INTERVALS][NUM_STATS];
     struct timespec time[MAX_INTERVALS];
 
@@ -133,18 +142,47 @@ const static struct {
 #define current_stat        (s_fops_data.event_stats.curr)
 #define valid_stats         (s_fops_data.event_stats.validStats)
 #define tx_ready            (s_fops_data.event_stats.tx_ready)
-#define tx_queued_t         (s_fops_data.event_stats.stats[current_stat][0])
-#define tx_dropped          (s_fops_data.event_stats.stats[current_stat][1])
-#define tx_pdropped         (s_fops_data.event_stats.stats[current_stat][2])
-#define tx_total            (s_fops_data.event_stats.stats[current_stat][3])
-#define tx_process          (s_fops_data.event_stats.stats[current_stat][4])
-#define tx_modload          (s_fops_data.event_stats.stats[current_stat][5])
-#define tx_file             (s_fops_data.event_stats.stats[current_stat][6])
-#define tx_net              (s_fops_data.event_stats.stats[current_stat][7])
-#define tx_dns              (s_fops_data.event_stats.stats[current_stat][8])
-#define tx_proxy            (s_fops_data.event_stats.stats[current_stat][9])
-#define tx_block            (s_fops_data.event_stats.stats[current_stat][10])
-#define tx_other            (s_fops_data.event_stats.stats[current_stat][11])
+#define TX_QUEUED_T         0
+#define TX_DROPPED          1
+#define TX_PDROPPED         2
+#define TX_TOTAL            3
+#define TX_PROCESS          4
+#define TX_MODLOAD          5
+#define TX_FILE             6
+#define TX_NET              7
+#define TX_DNS              8
+#define TX_PROXY            9
+#define TX_BLOCK            10
+#define TX_OTHER            11
+
+// Running totals of the event counters on each CPU.  The totals at the last reset are kept in
+//  s_event_counters_base so the per-CPU counts never need to be cleared while in use.
+typedef struct event_counters {
+    uint64_t counts[EVENT_STATS];
+} EVENT_COUNTERS;
+
+static DEFINE_PER_CPU(EVENT_COUNTERS, s_event_counters);
+static uint64_t s_event_counters_base[EVENT_STATS];
+
+#define EVENT_STAT_INC(stat)    this_cpu_inc(s_event_counters.counts[stat])
+
+// Per event type latency histograms, recorded when enable_latency_stats is set.  Queue latency is
+//  the time from ec_send_event until the event is copied to the reader.  Hook latency is the time
+//  from the hook passing the module disable check until it queued the event.  Bucket 0 holds anything under 1us, bucket N holds
+//  [2^(N-1), 2^N) us and the last bucket holds everything slower.
+#define LATENCY_QUEUE       0
+#define LATENCY_HOOK        1
+#define LATENCY_KINDS       2
+#define LATENCY_BUCKETS     26
+
+typedef struct event_latency {
+    uint64_t buckets[CB_EVENT_TYPE_MAX][LATENCY_KINDS][LATENCY_BUCKETS];
+} EVENT_LATENCY;
+
+// This is too large for the static per-CPU area so it is allocated at init
+static EVENT_LATENCY __percpu *s_event_latency;
+
+static const char *LATENCY_STRINGS[LATENCY_KINDS] = { "Queue", "Hook" };
 
 #define mem_user            (s_fops_data.event_stats.stats[current_stat][12])
 #define mem_user_peak       (s_fops_data.event_stats.stats[current_stat][13])
@@ -213,6 +251,8 @@ bool __ec_connect_reader(ProcessContext *context)
 
     ec_write_unlock(&s_fops_config.reader_pid_lock, context);
 
+    ec_logger_update_interest();
+
     return true;
 }
 
@@ -233,6 +273,8 @@ bool ec_disconnect_reader(pid_t pid, ProcessContext *context)
 
     ec_write_unlock(&s_fops_config.reader_pid_lock, context);
 
+    ec_logger_update_interest();
+
     return true;
 }
 
@@ -244,6 +286,7 @@ bool __ec_is_process_connected_reader(pid_t pid)
 bool ec_user_comm_initialize(ProcessContext *context)
 {
     size_t kernel_mem;
+    int    cpu;
 
     ec_spinlock_init(&s_fops_data.lock, context);
 
@@ -252,6 +295,18 @@ bool ec_user_comm_initialize(ProcessContext *context)
     ec_percpu_counter_init(&tx_ready, 0, GFP_MODE(context));
 
     memset(&s_fops_data.event_stats.stats, 0, sizeof(s_fops_data.event_stats.stats));
+    for_each_possible_cpu(cpu)
+    {
+        memset(per_cpu_ptr(&s_event_counters, cpu), 0, sizeof(EVENT_COUNTERS));
+    }
+    memset(s_event_counters_base, 0, sizeof(s_event_counters_base));
+
+    // The histograms are only diagnostics so we can run without them
+    s_event_latency = ec_alloc_percpu(EVENT_LATENCY, GFP_MODE(context));
+    if (!s_event_latency)
+    {
+        TRACE(DL_WARNING, "%s: failed to allocate event latency histograms", __func__);
+    }
 
     getnstimeofday(&s_fops_data.event_stats.time[0]);
     kernel_mem = __ec_get_memory_usage(context);
@@ -313,6 +368,11 @@ void ec_user_comm_shutdown(ProcessContext *context)
     cancel_delayed_work_sync(&s_fops_config.stats_work);
 
     percpu_counter_destroy(&tx_ready);
+    if (s_event_latency)
+    {
+        free_percpu(s_event_latency);
+        s_event_latency = NULL;
+    }
     ec_spinlock_destroy(&s_fops_data.lock, context);
 }
 
@@ -377,6 +437,7 @@ int ec_send_event(struct CB_EVENT *msg, ProcessContext *context)
     int                result     = -1;
     uint64_t           readyCount = 0;
     int                payload;
+    uint64_t           now_ns;
     CB_EVENT_NODE      *eventNode;
 
     TRY(ALLOW_SEND_EVENTS(context));
@@ -406,6 +467,14 @@ int ec_send_event(struct CB_EVENT *msg, ProcessContext *context)
             || msg->eventType == CB_EVENT_TYPE_PROCESS_EXIT
             || msg->eventType == CB_EVENT_TYPE_PROCESS_LAST_EXIT)
         {
+            eventNode->enqueue_ns = 0;
+            if (g_enable_latency_stats)
+            {
+                now_ns = ktime_to_ns(ktime_get());
+                eventNode->enqueue_ns = now_ns;
+                __ec_record_latency(msg->eventType, LATENCY_HOOK, context->enter_time_ns, now_ns);
+            }
+
             llist_add(&(eventNode->llistEntry), &msg_queue_in);
             percpu_counter_inc(&tx_ready);
             msg = NULL;
@@ -424,7 +493,7 @@ CATCH_DEFAULT:
     if (msg)
     {
         // If we still have an event at this point free it now
-        ++tx_dropped;
+        EVENT_STAT_INC(TX_DROPPED);
 
         if (msg->eventType == CB_EVENT_TYPE_PROCESS_START
             || msg->eventType == CB_EVENT_TYPE_DISCOVER
@@ -433,7 +502,7 @@ CATCH_DEFAULT:
             || msg->eventType == CB_EVENT_TYPE_PROCESS_EXIT
             || msg->eventType == CB_EVENT_TYPE_PROCESS_LAST_EXIT)
         {
-            ++tx_pdropped;
+            EVENT_STAT_INC(TX_PDROPPED);
         }
 
         ec_free_event(msg, context);
@@ -442,6 +511,12 @@ CATCH_DEFAULT:
     return result;
 }
 
+// llist_empty is not guaranteed to be correct but that's ok, the reader will try again.
+bool __ec_is_queue_empty(void)
+{
+    return llist_empty(&msg_queue_in) && list_empty(&msg_queue);
+}
+
 void ec_fops_comm_wake_up_reader(ProcessContext *context)
 {
     /* Wake up the reader task if we are allowed to. We want to avoid calling wake_up unnecessarily because it
@@ -466,6 +541,13 @@ ssize_t ec_device_read(struct file *f,  char __user *ubuf, size_t count, loff_t
 
     TRACE(DL_COMMS, "%s: start read", __func__);
 
+    // Queue the next chunk of an in-progress discovery once the reader has caught up.
+    //  This must be done before the disable check below because it does its own.
+    if (ec_process_tracking_discovery_pending() && __ec_is_queue_empty())
+    {
+        ec_process_tracking_discovery_continue(&context);
+    }
+
     BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
 
     // Perform once copy to user outside loop first to more easily
@@ -700,7 +782,13 @@ int __ec_copy_cbevent_to_user(char __user *ubuf, size_t count, ProcessContext *c
 
     xcode = payload;
 
-    ++tx_total;
+    EVENT_STAT_INC(TX_TOTAL);
+    if (container_of(msg, CB_EVENT_NODE, data)->enqueue_ns)
+    {
+        __ec_record_latency(msg->eventType, LATENCY_QUEUE,
+                            container_of(msg, CB_EVENT_NODE, data)->enqueue_ns,
+                            ktime_to_ns(ktime_get()));
+    }
 
     switch (msg->eventType)
     {
@@ -710,11 +798,11 @@ int __ec_copy_cbevent_to_user(char __user *ubuf, size_t count, ProcessContext *c
     case CB_EVENT_TYPE_DISCOVER_FLUSH:
     case CB_EVENT_TYPE_PROCESS_EXIT:
     case CB_EVENT_TYPE_PROCESS_LAST_EXIT:
-        ++tx_process;
+        EVENT_STAT_INC(TX_PROCESS);
         break;
 
     case CB_EVENT_TYPE_MODULE_LOAD:
-        ++tx_modload;
+        EVENT_STAT_INC(TX_MODLOAD);
         break;
 
     case CB_EVENT_TYPE_FILE_CREATE:
@@ -722,26 +810,27 @@ int __ec_copy_cbevent_to_user(char __user *ubuf, size_t count, ProcessContext *c
     case CB_EVENT_TYPE_FILE_WRITE:
     case CB_EVENT_TYPE_FILE_CLOSE:
     case CB_EVENT_TYPE_FILE_OPEN:
-        ++tx_file;
+        EVENT_STAT_INC(TX_FILE);
         break;
 
     case CB_EVENT_TYPE_NET_CONNECT_PRE:
     case CB_EVENT_TYPE_NET_CONNECT_POST:
     case CB_EVENT_TYPE_NET_ACCEPT:
-        ++tx_net;
+    case CB_EVENT_TYPE_NET_FLOW_SUMMARY:
+        EVENT_STAT_INC(TX_NET);
         break;
 
     case CB_EVENT_TYPE_DNS_RESPONSE:
-        ++tx_dns;
+        EVENT_STAT_INC(TX_DNS);
         break;
 
     case CB_EVENT_TYPE_WEB_PROXY:
-        ++tx_proxy;
+        EVENT_STAT_INC(TX_PROXY);
         break;
 
     case CB_EVENT_TYPE_PROCESS_BLOCKED:
     case CB_EVENT_TYPE_PROCESS_NOT_BLOCKED:
-        ++tx_block;
+        EVENT_STAT_INC(TX_BLOCK);
         break;
 
     case CB_EVENT_TYPE_PROC_ANALYZE:
@@ -749,7 +838,7 @@ int __ec_copy_cbevent_to_user(char __user *ubuf, size_t count, ProcessContext *c
     case CB_EVENT_TYPE_MAX:
     case CB_EVENT_TYPE_UNKNOWN:
     default:
-        ++tx_other;
+        EVENT_STAT_INC(TX_OTHER);
         break;
     }
 
@@ -841,6 +930,9 @@ int ec_device_release(struct inode *inode, struct file *filp)
         return -ECONNREFUSED;
     }
 
+    // Nobody is left to read the rest of the discovery
+    ec_process_tracking_discovery_cancel(&context);
+
     return 0;
 }
 
@@ -853,9 +945,8 @@ unsigned int ec_device_poll(struct file *filp, struct poll_table_struct *pts)
 
     BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
 
-    // Check if messages are available. llist_empty is not guaranteed to be correct but that's ok,
-    // the reader will try again.
-    msg_queued = !llist_empty(&msg_queue_in) || !list_empty(&msg_queue);
+    // Check if messages are available, or if a discovery has more chunks to queue.
+    msg_queued = !__ec_is_queue_empty() || ec_process_tracking_discovery_pending();
 
     TRY_MSG(!msg_queued, DL_COMMS, "%s: msg queued so not waiting", __func__);
 
@@ -891,8 +982,10 @@ long ec_device_unlocked_ioctl(struct file *filep, unsigned int cmd_in, unsigned
     void *page = 0;
     union {
         uint32_t         value;
+        uint64_t         value64;
         CB_EVENT_DYNAMIC dynControl;
         CB_DRIVER_CONFIG config;
+        CB_DISCOVERY_DELTA discoveryDelta;
         unsigned char    raw[0];
     } data;
 
@@ -939,6 +1032,8 @@ long ec_device_unlocked_ioctl(struct file *filep, unsigned int cmd_in, unsigned
         }
     } else
     {
+        // A short request must not leave stack data in the fields it did not fill
+        memset(&data, 0, sizeof(data));
         if (copy_from_user((void *)data.raw, (void *)arg, min(sizeof(data), size)))
         {
             TRACE(DL_ERROR, "%s: failed to copy arg", __func__);
@@ -978,6 +1073,7 @@ long ec_device_unlocked_ioctl(struct file *filep, unsigned int cmd_in, unsigned
             {
                 TRACE(DL_WARNING, "+Setting CB server UID=%u", uid);
                 g_edr_server_uid  = uid;
+                ec_logger_update_interest();
             }
         }
         break;
@@ -991,12 +1087,40 @@ long ec_device_unlocked_ioctl(struct file *filep, unsigned int cmd_in, unsigned
         }
         break;
 
+    case CB_DRIVER_REQUEST_IGNORE_PROCESS_TREE:
+        {
+            pid_t pid = (pid_t)data.value;
+
+            TRACE(DL_INFO, "Recevied trusted process tree pid=%u", pid);
+            ec_banning_SetIgnoredProcessTree(&context, pid);
+        }
+        break;
+
+    case CB_DRIVER_REQUEST_IGNORE_CGROUP:
+        {
+            if (size < sizeof(data.value64))
+            {
+                TRACE(DL_ERROR, "%s: cgroup request too small size=%zu", __func__, size);
+                return -EINVAL;
+            }
+
+            TRACE(DL_INFO, "Recevied trusted cgroup=%llu", data.value64);
+            ec_banning_SetIgnoredCgroup(&context, data.value64);
+        }
+        break;
+
     case CB_DRIVER_REQUEST_ISOLATION_MODE_CONTROL:
         {
             ec_ProcessIsolationIoctl(&context, IOCTL_SET_ISOLATION_MODE, (void *)data.dynControl.data, data.dynControl.size);
         }
         break;
 
+    case CB_DRIVER_REQUEST_ISOLATION_RULES_CONTROL:
+        {
+            ec_ProcessIsolationIoctl(&context, IOCTL_SET_ISOLATION_RULES, (void *)data.dynControl.data, data.dynControl.size);
+        }
+        break;
+
     case CB_DRIVER_REQUEST_HEARTBEAT:
         {
             PCB_EVENT event = NULL;
@@ -1126,6 +1250,54 @@ long ec_device_unlocked_ioctl(struct file *filep, unsigned int cmd_in, unsigned
         }
         break;
 
+    case CB_DRIVER_REQUEST_PROCESS_DISCOVERY_DELTA:
+        {
+            data.discoveryDelta.generation = ec_process_tracking_send_process_discovery_delta(
+                data.discoveryDelta.since_generation,
+                &context);
+
+            if (copy_to_user((void *)arg, &data.discoveryDelta, sizeof(data.discoveryDelta)))
+            {
+                TRACE(DL_ERROR, "%s: failed to copy arg", __func__);
+                return -EFAULT;
+            }
+        }
+        break;
+
+    case CB_DRIVER_REQUEST_EVENT_STATS:
+        {
+            CB_EVENT_STATS_SNAPSHOT snapshot;
+            uint64_t totals[EVENT_STATS];
+
+            __ec_fold_event_stats(totals);
+
+            snapshot.timestamp          = ec_get_current_time();
+            snapshot.queued_now         = percpu_counter_sum_positive(&tx_ready);
+            snapshot.queued_total       = totals[TX_QUEUED_T];
+            snapshot.dropped            = totals[TX_DROPPED];
+            snapshot.process_dropped    = totals[TX_PDROPPED];
+            snapshot.total              = totals[TX_TOTAL];
+            snapshot.process            = totals[TX_PROCESS];
+            snapshot.modload            = totals[TX_MODLOAD];
+            snapshot.file               = totals[TX_FILE];
+            snapshot.net                = totals[TX_NET];
+            snapshot.dns                = totals[TX_DNS];
+            snapshot.proxy              = totals[TX_PROXY];
+            snapshot.blocked            = totals[TX_BLOCK];
+            snapshot.other              = totals[TX_OTHER];
+            snapshot.user_memory        = mem_user;
+            snapshot.user_memory_peak   = mem_user_peak;
+            snapshot.kernel_memory      = mem_kernel;
+            snapshot.kernel_memory_peak = mem_kernel_peak;
+
+            if (copy_to_user((void *)arg, &snapshot, sizeof(snapshot)))
+            {
+                TRACE(DL_ERROR, "%s: failed to copy arg", __func__);
+                return -EFAULT;
+            }
+        }
+        break;
+
     case CB_DRIVER_REQUEST_ACTION:
         {
             int result = 0;
@@ -1204,6 +1376,7 @@ void __ec_apply_legacy_driver_config(uint32_t eventFilter)
     g_driver_config.file_mods = (eventFilter & CB_EVENT_FILTER_FILEMODS ? ENABLE : DISABLE);
     g_driver_config.net_conns = (eventFilter & CB_EVENT_FILTER_NETCONNS ? ENABLE : DISABLE);
     g_driver_config.report_process_user = (eventFilter & CB_EVENT_FILTER_PROCESSUSER ? ENABLE : DISABLE);
+    ec_logger_update_interest();
 
     __ec_print_driver_config("New Module Config", &g_driver_config);
 }
@@ -1217,6 +1390,7 @@ void __ec_apply_driver_config(CB_DRIVER_CONFIG *config)
         g_driver_config.file_mods = (config->file_mods != NO_CHANGE ? config->file_mods : g_driver_config.file_mods);
         g_driver_config.net_conns = (config->net_conns != NO_CHANGE ? config->net_conns : g_driver_config.net_conns);
         g_driver_config.report_process_user = (config->report_process_user != NO_CHANGE ? config->report_process_user : g_driver_config.report_process_user);
+        ec_logger_update_interest();
 
         __ec_print_driver_config("New Module Config", &g_driver_config);
     }
@@ -1262,14 +1436,12 @@ void __ec_stats_work_task(struct work_struct *work)
 
     DECLARE_NON_ATOMIC_CONTEXT(context, ec_getpid(current));
 
-    // I am not strictly speaking doing this operation atomicly.  This means there is a
-    //  chance that a counter will be missed.  I am willing to allow that for the sake of
-    //  performance.
-
     // tx_ready_X are live counters that rise and fall as events are generated. Add whatever
     //  is new in this variable to the current stat.
+    __ec_event_stats_add(TX_QUEUED_T, ready0);
 
-    tx_queued_t += ready0;
+    // Close out the current interval with the totals from every CPU
+    __ec_fold_event_stats(s_fops_data.event_stats.stats[curr]);
 
     // Copy over the current total to the next interval
     for (i = 0; i < NUM_STATS; ++i)
@@ -1287,6 +1459,39 @@ void __ec_stats_work_task(struct work_struct *work)
     schedule_delayed_work(&s_fops_config.stats_work, s_fops_config.stats_work_delay);
 }
 
+void __ec_event_stats_add(int stat, uint64_t count)
+{
+    this_cpu_add(s_event_counters.counts[stat], count);
+}
+
+// Sum the per-CPU counters since the last reset.  A CPU may be counting while we read, so this
+//  can miss an event that is counted in the next interval.
+void __ec_fold_event_stats(uint64_t *totals)
+{
+    int cpu;
+    int i;
+
+    for (i = 0; i < EVENT_STATS; ++i)
+    {
+        totals[i] = 0;
+    }
+
+    for_each_possible_cpu(cpu)
+    {
+        EVENT_COUNTERS *counters = per_cpu_ptr(&s_event_counters, cpu);
+
+        for (i = 0; i < EVENT_STATS; ++i)
+        {
+            totals[i] += READ_ONCE(counters->counts[i]);
+        }
+    }
+
+    for (i = 0; i < EVENT_STATS; ++i)
+    {
+        totals[i] -= s_event_counters_base[i];
+    }
+}
+
 // Print event stats
 int ec_proc_show_events_avg(struct seq_file *m, void *v)
 {
@@ -1300,14 +1505,13 @@ int ec_proc_show_events_avg(struct seq_file *m, void *v)
     int32_t     avg1    = (curr - avg1_c) % MAX_INTERVALS;
     int32_t     avg2    = (curr - avg2_c) % MAX_INTERVALS;
     int32_t     avg3    = (curr - avg3_c) % MAX_INTERVALS;
+    uint64_t    totals[EVENT_STATS];
 
     int         i;
 
-    if (valid == 0)
-    {
-        seq_puts(m, "No Data\n");
-        return 0;
-    }
+    // The intervals only hold what was folded in when they closed, so the total comes from the CPUs.
+    //  The averages need at least one closed interval.
+    __ec_fold_event_stats(totals);
 
     // I only want to include valid intervals, so back the current pointer to the last valid
     curr = (curr - 1) % MAX_INTERVALS;
@@ -1323,10 +1527,135 @@ int ec_proc_show_events_avg(struct seq_file *m, void *v)
         //  number of elements between them to yield the average.
         uint64_t currentStat = s_fops_data.event_stats.stats[curr][i];
 
-        seq_printf(m, " %15s | %9lld | %9lld | %9lld | %10lld |\n", STAT_STRINGS[i].name, currentStat,
-                   (currentStat - s_fops_data.event_stats.stats[avg1][i]) / avg1_c / STAT_INTERVAL,
-                   (currentStat - s_fops_data.event_stats.stats[avg2][i]) / avg2_c / STAT_INTERVAL,
-                   (currentStat - s_fops_data.event_stats.stats[avg3][i]) / avg3_c / STAT_INTERVAL);
+        seq_printf(m, " %15s | %9lld | %9lld | %9lld | %10lld |\n", STAT_STRINGS[i].name, totals[i],
+                   valid ? (currentStat - s_fops_data.event_stats.stats[avg1][i]) / avg1_c / STAT_INTERVAL : 0,
+                   valid ? (currentStat - s_fops_data.event_stats.stats[avg2][i]) / avg2_c / STAT_INTERVAL : 0,
+                   valid ? (currentStat - s_fops_data.event_stats.stats[avg3][i]) / avg3_c / STAT_INTERVAL : 0);
+    }
+
+    seq_puts(m, "\n");
+
+    return 0;
+}
+
+void __ec_record_latency(CB_EVENT_TYPE event_type, int kind, uint64_t start_ns, uint64_t now_ns)
+{
+    uint64_t usecs;
+    int      bucket = 0;
+
+    // Events sent from outside a hook have no start time
+    CANCEL_VOID(s_event_latency && start_ns && now_ns >= start_ns);
+    CANCEL_VOID((unsigned int)event_type < CB_EVENT_TYPE_MAX);
+
+    usecs = div_u64(now_ns - start_ns, NSEC_PER_USEC);
+    if (usecs)
+    {
+        bucket = min_t(int, ilog2(usecs) + 1, LATENCY_BUCKETS - 1);
+    }
+
+    this_cpu_inc(s_event_latency->buckets[event_type][kind][bucket]);
+}
+
+// The histograms may be updated while they are cleared, so a reset can leave a few stray
+//  counts behind.  That is fine for diagnostics.
+void __ec_reset_latency(void)
+{
+    int cpu;
+
+    CANCEL_VOID(s_event_latency);
+
+    for_each_possible_cpu(cpu)
+    {
+        memset(per_cpu_ptr(s_event_latency, cpu), 0, sizeof(EVENT_LATENCY));
+    }
+}
+
+// Upper bound of the bucket holding the given percentile, in us
+static uint64_t __ec_latency_percentile(uint64_t *buckets, uint64_t count, int percent)
+{
+    uint64_t target = div_u64(count * percent + 99, 100);
+    uint64_t seen   = 0;
+    int      i;
+
+    for (i = 0; i < LATENCY_BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= target)
+        {
+            break;
+        }
+    }
+
+    return 1ULL << min(i, LATENCY_BUCKETS - 1);
+}
+
+// Print the latency histograms
+int ec_proc_show_events_lat(struct seq_file *m, void *v)
+{
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    int      type;
+    int      kind;
+    int      cpu;
+    int      i;
+
+    if (!s_event_latency)
+    {
+        seq_puts(m, "No Data\n");
+        return 0;
+    }
+
+    if (!g_enable_latency_stats)
+    {
+        seq_puts(m, "Not recording, set enable_latency_stats to start\n");
+    }
+
+    seq_printf(m, " %22s | %5s | %10s | %8s | %8s | %8s | %8s |\n",
+               "Event", "Kind", "Count", "p50 us", "p90 us", "p99 us", "max us");
+
+    for (type = 0; type < CB_EVENT_TYPE_MAX; ++type)
+    {
+        for (kind = 0; kind < LATENCY_KINDS; ++kind)
+        {
+            int max_bucket = 0;
+
+            memset(buckets, 0, sizeof(buckets));
+            for_each_possible_cpu(cpu)
+            {
+                EVENT_LATENCY *latency = per_cpu_ptr(s_event_latency, cpu);
+
+                for (i = 0; i < LATENCY_BUCKETS; ++i)
+                {
+                    buckets[i] += READ_ONCE(latency->buckets[type][kind][i]);
+                }
+            }
+
+            count = 0;
+            for (i = 0; i < LATENCY_BUCKETS; ++i)
+            {
+                count += buckets[i];
+                if (buckets[i])
+                {
+                    max_bucket = i;
+                }
+            }
+
+            if (!count)
+            {
+                continue;
+            }
+
+            // The last bucket is open ended, so its bound is only a lower limit
+            seq_printf(m, " %22s | %5s | %10llu | %8llu | %8llu | %8llu | %7llu%s |\n",
+                       ec_event_type_to_str(type),
+                       LATENCY_STRINGS[kind],
+                       count,
+                       __ec_latency_percentile(buckets, count, 50),
+                       __ec_latency_percentile(buckets, count, 90),
+                       __ec_latency_percentile(buckets, count, 99),
+                       1ULL << max_bucket,
+                       max_bucket == LATENCY_BUCKETS - 1 ? "+" : " ");
+        }
     }
 
     seq_puts(m, "\n");
@@ -1341,14 +1670,12 @@ int ec_proc_show_events_det(struct seq_file *m, void *v)
     uint32_t    curr    = s_fops_data.event_stats.curr;
     uint32_t    valid   = min(s_fops_data.event_stats.validStats, MAX_VALID_INTERVALS);
     uint32_t    start   = (MAX_INTERVALS + curr - valid) % MAX_INTERVALS + MAX_INTERVALS;
+    uint32_t    last    = (MAX_INTERVALS + curr - 1) % MAX_INTERVALS;
+    uint64_t    totals[EVENT_STATS];
+    struct timespec now;
     int         i;
     int         j;
 
-    if (valid == 0)
-    {
-        seq_puts(m, "No Data\n");
-        return 0;
-    }
     //seq_printf(m, "Curr = %d, valid = %d, start = %d\n", curr, valid, start - MAX_INTERVALS );
 
     seq_printf(m, " %19s |", "Timestamp");
@@ -1371,15 +1698,34 @@ int ec_proc_show_events_det(struct seq_file *m, void *v)
         seq_puts(m, "\n");
     }
 
+    // The interval in progress has not been folded in yet, so sum it from the CPUs
+    __ec_fold_event_stats(totals);
+    getnstimeofday(&now);
+    seq_printf(m, " %19lld |", ec_to_windows_timestamp(&now));
+    for (j = 0; j < EVENT_STATS; ++j)
+    {
+        seq_printf(m, STAT_STRINGS[j].num_format, totals[j] - s_fops_data.event_stats.stats[last][j]);
+    }
+    seq_puts(m, "\n");
+
     return 0;
 }
 
 ssize_t ec_proc_show_events_rst(struct file *file, const char *buf, size_t size, loff_t *ppos)
 {
-    int i;
+    int      i;
+    uint64_t totals[EVENT_STATS];
 
     // Cancel the currently scheduled job
-    cancel_delayed_work(&s_fops_config.stats_work);
+    cancel_delayed_work_sync(&s_fops_config.stats_work);
+
+    // Count from the current per-CPU totals
+    __ec_fold_event_stats(totals);
+    for (i = 0; i < EVENT_STATS; ++i)
+    {
+        s_event_counters_base[i] += totals[i];
+    }
+    __ec_reset_latency();
 
     // I do not need to zero out everything, just the new active interval
     current_stat = 0;
@@ -1430,10 +1776,12 @@ int ec_proc_current_memory_det(struct seq_file *m, void *v)
     int         i;
     int         j;
 
+    DECLARE_NON_ATOMIC_CONTEXT(context, ec_getpid(current));
+
     if (valid == 0)
     {
         seq_puts(m, "No Data\n");
-        return 0;
+        goto show_process_memory;
     }
     //seq_printf(m, "Curr = %d, valid = %d, start = %d\n", curr, valid, start - MAX_INTERVALS );
 
@@ -1457,6 +1805,10 @@ int ec_proc_current_memory_det(struct seq_file *m, void *v)
         seq_puts(m, "\n");
     }
 
+show_process_memory:
+    ec_proc_track_show_memory(m, &context);
+    ec_path_cache_show_memory(m, &context);
+
     return 0;
 }
 
@@ -7,12 +7,7 @@
 #include "cb-spinlock.h"
 #include "mem-alloc.h"
 
-typedef struct hash_table_node {
-    struct list_head link;
-    u32 hash;
-    u32 activity;
-    HashTbl *hashTblp;
-} HashTableNode;
+#include <linux/rculist.h>
 
 static const size_t HASH_NODE_SZ = sizeof(HashTableNode);
 
@@ -55,6 +50,49 @@ inline void *__ec_get_key_ptr(HashTbl *hashTblp, void *datap)
     return (void *) datap + hashTblp->key_offset;
 }
 
+// Tables with rcu_lookup set must use the _rcu list primitives so that a lockless reader
+//  never sees a node pointing at itself.  list_del_rcu leaves next intact and poisons prev.
+static inline bool __ec_hashtbl_node_linked(HashTableNode *nodep)
+{
+    return !list_empty(&nodep->link) && nodep->link.prev != LIST_POISON2;
+}
+
+static inline void __ec_hashtbl_link(HashTbl *hashTblp, HashTableNode *nodep, struct list_head *head)
+{
+    if (hashTblp->rcu_lookup)
+    {
+        list_add_rcu(&nodep->link, head);
+    } else
+    {
+        list_add(&nodep->link, head);
+    }
+}
+
+static inline void __ec_hashtbl_unlink(HashTbl *hashTblp, HashTableNode *nodep)
+{
+    if (hashTblp->rcu_lookup)
+    {
+        list_del_rcu(&nodep->link);
+    } else
+    {
+        list_del_init(&nodep->link);
+    }
+}
+
+static inline void __ec_hashtbl_move_before(HashTbl *hashTblp, HashTableNode *nodep, HashTableNode *before)
+{
+    if (hashTblp->rcu_lookup)
+    {
+        // A reader standing on nodep will revisit 'before' rather than lose its place
+        list_del_rcu(&nodep->link);
+        list_add_tail_rcu(&nodep->link, &before->link);
+    } else
+    {
+        list_del_init(&nodep->link);
+        list_add_tail(&nodep->link, &before->link);
+    }
+}
+
 bool ec_hashtbl_startup(ProcessContext *context)
 {
     ec_spinlock_init(&s_hashtbl.lock, context);
@@ -78,22 +116,303 @@ static inline int ec_hashtbl_bkt_index(HashTbl *hashTblp, u32 hash)
     return hash & (hashTblp->numberOfBuckets - 1);
 }
 
-static void ec_hashtbl_bkt_read_lock(HashTableBkt *bkt, ProcessContext *context)
+static inline linuxSpinlock_t *__ec_hashtbl_stripe(HashTbl *hashTblp, u32 hash)
+{
+    return &hashTblp->locks[hash & (hashTblp->numberOfLocks - 1)].lock;
+}
+
+static void ec_hashtbl_bkt_read_lock(HashTbl *hashTblp, u32 hash, ProcessContext *context)
+{
+    ec_embedded_read_lock(__ec_hashtbl_stripe(hashTblp, hash), context);
+}
+static void ec_hashtbl_bkt_read_unlock(HashTbl *hashTblp, u32 hash, ProcessContext *context)
+{
+    ec_embedded_read_unlock(__ec_hashtbl_stripe(hashTblp, hash), context);
+}
+
+static void ec_hashtbl_bkt_write_lock(HashTbl *hashTblp, u32 hash, ProcessContext *context)
+{
+    ec_embedded_write_lock(__ec_hashtbl_stripe(hashTblp, hash), context);
+}
+static void ec_hashtbl_bkt_write_unlock(HashTbl *hashTblp, u32 hash, ProcessContext *context)
+{
+    ec_embedded_write_unlock(__ec_hashtbl_stripe(hashTblp, hash), context);
+}
+
+// Grow when the average bucket depth passes HASHTBL_GROW_LOAD, and shrink when it falls below
+//  1/HASHTBL_SHRINK_LOAD.  The gap between the two keeps the table from bouncing between sizes.
+#define HASHTBL_GROW_LOAD    2
+#define HASHTBL_SHRINK_LOAD  4
+
+static inline HashTblResize *__ec_hashtbl_get_resize(HashTbl *hashTblp)
+{
+    HashTblResize *resize = rcu_dereference_raw(hashTblp->resize);
+
+    // Pairs with the smp_wmb in __ec_hashtbl_resize so tablePtr is current once resize is seen as NULL
+    smp_rmb();
+    return resize;
+}
+
+// Find the bucket a hash currently lives in.  The caller must hold the stripe lock for this hash, which
+//  keeps the bucket from being migrated underneath it.
+static HashTableBkt *__ec_hashtbl_bucket_locked(HashTbl *hashTblp, u32 hash)
+{
+    HashTblResize *resize = __ec_hashtbl_get_resize(hashTblp);
+
+    if (resize)
+    {
+        HashTableBkt *oldBucketp = &resize->oldTablePtr[hash & (resize->oldNumberOfBuckets - 1)];
+
+        if (!oldBucketp->migrated)
+        {
+            return oldBucketp;
+        }
+        return &resize->newTablePtr[hash & (resize->newNumberOfBuckets - 1)];
+    }
+
+    return &hashTblp->tablePtr[ec_hashtbl_bkt_index(hashTblp, hash)];
+}
+
+static uint64_t __ec_hashtbl_resize_target(HashTbl *hashTblp, int64_t count)
+{
+    uint64_t numberOfBuckets = hashTblp->numberOfBuckets;
+
+    if (count > numberOfBuckets * HASHTBL_GROW_LOAD)
+    {
+        while (numberOfBuckets < hashTblp->maxBuckets && count > numberOfBuckets)
+        {
+            numberOfBuckets <<= 1;
+        }
+    } else if (count * HASHTBL_SHRINK_LOAD < numberOfBuckets)
+    {
+        while (numberOfBuckets > hashTblp->minBuckets && count * 2 < numberOfBuckets)
+        {
+            numberOfBuckets >>= 1;
+        }
+    }
+
+    return numberOfBuckets;
+}
+
+#define HASHTBL_CLOCK_MAX_SCAN  32
+
+static inline size_t __ec_hashtbl_entry_size(HashTbl *hashTblp)
+{
+    return HASHTBL_ENTRY_SIZE(hashTblp->datasize);
+}
+
+// Bytes are batched per CPU, so the total may be behind by up to HASHTBL_MEMORY_BATCH per CPU
+#define HASHTBL_MEMORY_BATCH  1024
+
+static inline bool __ec_hashtbl_over_budget(HashTbl *hashTblp)
+{
+    return percpu_counter_read_positive(&hashTblp->memoryUsed) > hashTblp->memoryBudget;
+}
+
+// A generalized CLOCK over the whole table.  The hand sweeps the buckets in order and halves the activity
+//  of every entry it passes, so an entry is only evicted if it has not been looked up since the hand
+//  last came around.  Each call scans a bounded number of buckets so adds stay cheap.
+static void __ec_hashtbl_evict(HashTbl *hashTblp, ProcessContext *context)
+{
+    int scanned;
+
+    for (scanned = 0;
+         scanned < HASHTBL_CLOCK_MAX_SCAN &&
+         __ec_hashtbl_over_budget(hashTblp);
+         ++scanned)
+    {
+        // The stripe for a bucket index is the same for any table size, so the hand survives a resize
+        uint64_t         hand  = atomic64_inc_return(&hashTblp->clockHand) - 1;
+        linuxSpinlock_t *lockp = &hashTblp->locks[hand & (hashTblp->numberOfLocks - 1)].lock;
+        HashTableBkt    *bucketp;
+        HashTableNode   *nodep = NULL;
+        HashTableNode   *prev = NULL;
+
+        ec_embedded_write_lock(lockp, context);
+
+        // Skip the sweep while a resize is moving the buckets around
+        if (!__ec_hashtbl_get_resize(hashTblp))
+        {
+            bucketp = &hashTblp->tablePtr[hand & (hashTblp->numberOfBuckets - 1)];
+
+            // The tail holds the oldest and least promoted entries
+            list_for_each_entry_safe_reverse(nodep, prev, &bucketp->head, link)
+            {
+                if (nodep->activity > 0)
+                {
+                    nodep->activity >>= 1;
+                    continue;
+                }
+
+                ec_hashtbl_del_lockheld(hashTblp, bucketp, __ec_get_datap(hashTblp, nodep), context);
+                percpu_counter_inc(&hashTblp->evictions);
+
+                if (!__ec_hashtbl_over_budget(hashTblp))
+                {
+                    break;
+                }
+            }
+        }
+
+        ec_embedded_write_unlock(lockp, context);
+    }
+}
+
+// Cheap enough to call on every add and delete
+static inline void __ec_hashtbl_resize_check(HashTbl *hashTblp)
 {
-    ec_read_lock(&bkt->lock, context);
+    if (hashTblp->maxBuckets > hashTblp->minBuckets &&
+        hashTblp->initialized &&
+        !rcu_access_pointer(hashTblp->resize) &&
+        __ec_hashtbl_resize_target(hashTblp, percpu_counter_read_positive(&hashTblp->tableInstance)) != hashTblp->numberOfBuckets)
+    {
+        schedule_work(&hashTblp->resize_work);
+    }
 }
-static void ec_hashtbl_bkt_read_unlock(HashTableBkt *bkt, ProcessContext *context)
+
+// Move every entry in an old bucket to its bucket in the new table.  Called with the stripe lock held.
+static void __ec_hashtbl_migrate_bkt(HashTblResize *resize, HashTableBkt *oldBucketp)
 {
-    ec_read_unlock(&bkt->lock, context);
+    HashTableNode *nodep = NULL;
+    HashTableNode *next = NULL;
+
+    // Walking from the head keeps the LRU order in the new bucket
+    list_for_each_entry_safe(nodep, next, &oldBucketp->head, link)
+    {
+        HashTableBkt *newBucketp = &resize->newTablePtr[nodep->hash & (resize->newNumberOfBuckets - 1)];
+
+        list_move_tail(&nodep->link, &newBucketp->head);
+        ++newBucketp->itemCount;
+    }
+    oldBucketp->itemCount = 0;
+    oldBucketp->migrated = true;
 }
 
-static void ec_hashtbl_bkt_write_lock(HashTableBkt *bkt, ProcessContext *context)
+// Claim the next old bucket and migrate it.  Returns false when there is nothing left to claim.
+static bool __ec_hashtbl_migrate_next(HashTbl *hashTblp, HashTblResize *resize, ProcessContext *context)
 {
-    ec_write_lock(&bkt->lock, context);
+    uint64_t  bucket_indx = atomic64_inc_return(&resize->nextBucket) - 1;
+    linuxSpinlock_t *lockp;
+
+    CANCEL(bucket_indx < resize->oldNumberOfBuckets, false);
+
+    // Every bucket that this old bucket can split into (or merge with) is covered by the same stripe
+    lockp = &hashTblp->locks[bucket_indx & (hashTblp->numberOfLocks - 1)].lock;
+    ec_embedded_write_lock(lockp, context);
+    __ec_hashtbl_migrate_bkt(resize, &resize->oldTablePtr[bucket_indx]);
+    ec_embedded_write_unlock(lockp, context);
+
+    atomic64_inc(&resize->migratedBuckets);
+    return true;
+}
+
+// Take and drop every stripe lock.  Anyone who looked at the resize state before we changed it is done
+//  with it when this returns.
+static void __ec_hashtbl_lock_barrier(HashTbl *hashTblp, ProcessContext *context)
+{
+    uint64_t i;
+
+    for (i = 0; i < hashTblp->numberOfLocks; ++i)
+    {
+        ec_embedded_write_lock(&hashTblp->locks[i].lock, context);
+        ec_embedded_write_unlock(&hashTblp->locks[i].lock, context);
+    }
+}
+
+static void __ec_hashtbl_resize(HashTbl *hashTblp, uint64_t newNumberOfBuckets, ProcessContext *context)
+{
+    uint64_t       i;
+    size_t         tableSize     = newNumberOfBuckets * sizeof(HashTableBkt);
+    HashTableBkt  *oldTablePtr   = hashTblp->tablePtr;
+    HashTableBkt  *newTablePtr   = NULL;
+    HashTblResize *resize        = NULL;
+
+    resize = ec_mem_alloc(sizeof(HashTblResize), context);
+    TRY(resize);
+
+    newTablePtr = ec_mem_valloc(tableSize, context);
+    TRY_MSG(newTablePtr, DL_WARNING, "%s: Failed to allocate %luB to resize %s",
+        __func__, tableSize, hashTblp->name);
+
+    memset(newTablePtr, 0, tableSize);
+    for (i = 0; i < newNumberOfBuckets; i++)
+    {
+        INIT_LIST_HEAD(&newTablePtr[i].head);
+    }
+
+    resize->oldTablePtr        = oldTablePtr;
+    resize->oldNumberOfBuckets = hashTblp->numberOfBuckets;
+    resize->newTablePtr        = newTablePtr;
+    resize->newNumberOfBuckets = newNumberOfBuckets;
+    resize->ready              = false;
+    atomic64_set(&resize->nextBucket, 0);
+    atomic64_set(&resize->migratedBuckets, 0);
+
+    HASHTBL_PRINT("%s: resize %s from %llu to %llu buckets\n", __func__, hashTblp->name,
+        resize->oldNumberOfBuckets, newNumberOfBuckets);
+
+    // Publish the resize and wait for everyone using the old table without it to finish.
+    //  Lockless readers fall back to the locked lookup from here on, so buckets can move safely.
+    rcu_assign_pointer(hashTblp->resize, resize);
+    __ec_hashtbl_lock_barrier(hashTblp, context);
+    synchronize_rcu();
+    WRITE_ONCE(resize->ready, true);
+
+    // Writers help with the migration, so we only sweep up what they leave behind
+    while (__ec_hashtbl_migrate_next(hashTblp, resize, context))
+    {
+        cond_resched();
+    }
+    while (atomic64_read(&resize->migratedBuckets) < resize->oldNumberOfBuckets)
+    {
+        cond_resched();
+    }
+
+    hashTblp->tablePtr = newTablePtr;
+    hashTblp->numberOfBuckets = newNumberOfBuckets;
+    smp_wmb();
+    rcu_assign_pointer(hashTblp->resize, NULL);
+    __ec_hashtbl_lock_barrier(hashTblp, context);
+    synchronize_rcu();
+
+    hashTblp->base_size = tableSize + hashTblp->numberOfLocks * sizeof(HashTblLock) + sizeof(HashTbl);
+    ++hashTblp->resizeCount;
+
+    ec_mem_free(oldTablePtr);
+    ec_mem_free(resize);
+    return;
+
+CATCH_DEFAULT:
+    ec_mem_free(newTablePtr);
+    ec_mem_free(resize);
+}
+
+static void __ec_hashtbl_resize_work(struct work_struct *work)
+{
+    HashTbl *hashTblp = container_of(work, HashTbl, resize_work);
+    uint64_t newNumberOfBuckets;
+
+    DECLARE_NON_ATOMIC_CONTEXT(context, ec_getpid(current));
+
+    mutex_lock(&hashTblp->resize_mutex);
+    // The check that scheduled us used the cheap approximate count, so get an exact one
+    newNumberOfBuckets = __ec_hashtbl_resize_target(hashTblp, percpu_counter_sum_positive(&hashTblp->tableInstance));
+    if (hashTblp->initialized && newNumberOfBuckets != hashTblp->numberOfBuckets)
+    {
+        __ec_hashtbl_resize(hashTblp, newNumberOfBuckets, &context);
+    }
+    mutex_unlock(&hashTblp->resize_mutex);
+
+    // Items may have been added faster than we could grow
+    __ec_hashtbl_resize_check(hashTblp);
 }
-static void ec_hashtbl_bkt_write_unlock(HashTableBkt *bkt, ProcessContext *context)
+
+void ec_hashtbl_resize_sync(HashTbl *hashTblp, ProcessContext *context)
 {
-    ec_write_unlock(&bkt->lock, context);
+    CANCEL_VOID(hashTblp && hashTblp->initialized && hashTblp->maxBuckets > hashTblp->minBuckets);
+
+    schedule_work(&hashTblp->resize_work);
+    flush_work(&hashTblp->resize_work);
 }
 
 bool ec_hashtbl_init(
@@ -118,6 +437,27 @@ bool ec_hashtbl_init(
         TRACE(DL_ERROR, "%s: Increase bucket size to %llu", __func__, hashTblp->numberOfBuckets);
     }
 
+    if (hashTblp->maxBuckets)
+    {
+        hashTblp->maxBuckets = max_t(uint64_t, roundup_pow_of_two(hashTblp->maxBuckets), hashTblp->numberOfBuckets);
+    }
+
+    // The stripe count does not depend on the starting size, but there must be at least one bucket per
+    //  stripe so a small table starts (and stays) at the stripe count
+    if (!hashTblp->numberOfLocks)
+    {
+        hashTblp->numberOfLocks = min_t(uint64_t, roundup_pow_of_two(num_possible_cpus() * HASHTBL_LOCKS_PER_CPU), HASHTBL_MAX_LOCKS);
+        hashTblp->numberOfLocks = min_t(uint64_t, hashTblp->numberOfLocks, max_t(uint64_t, hashTblp->maxBuckets, hashTblp->numberOfBuckets));
+    }
+    hashTblp->numberOfLocks = roundup_pow_of_two(hashTblp->numberOfLocks);
+    hashTblp->numberOfBuckets = max_t(uint64_t, hashTblp->numberOfBuckets, hashTblp->numberOfLocks);
+    hashTblp->maxBuckets = hashTblp->maxBuckets ? max_t(uint64_t, hashTblp->maxBuckets, hashTblp->numberOfBuckets) : 0;
+    hashTblp->minBuckets = hashTblp->numberOfBuckets;
+
+    hashTblp->lockStorage = ec_mem_valloc(hashTblp->numberOfLocks * sizeof(HashTblLock) + SMP_CACHE_BYTES, context);
+    CANCEL_MSG(hashTblp->lockStorage, false, DL_ERROR, "[%s:%d] Failed to allocate locks.", __func__, __LINE__);
+    hashTblp->locks = PTR_ALIGN((HashTblLock *)hashTblp->lockStorage, SMP_CACHE_BYTES);
+
     tableSize = hashTblp->numberOfBuckets * sizeof(HashTableBkt);
 
     //Since we're not in an atomic context this is an acceptable alternative to
@@ -126,7 +466,7 @@ bool ec_hashtbl_init(
     //fragmented, our driver will fail to load with a normal kmalloc
     tbl_storage_p  = ec_mem_valloc(tableSize, context);
 
-    CANCEL_MSG(tbl_storage_p, NULL, DL_ERROR, "[%s:%d] Failed to allocate %luB at .",
+    TRY_MSG(tbl_storage_p, DL_ERROR, "[%s:%d] Failed to allocate %luB at .",
         __func__, __LINE__, tableSize);
 
     //With kzalloc we get zeroing for free, with vmalloc we need to do it ourself
@@ -135,10 +475,22 @@ bool ec_hashtbl_init(
     HASHTBL_PRINT("Cache=%s elemsize=%llu\n", hashTblp->name, hashTblp->datasize);
 
     hashTblp->tablePtr = (HashTableBkt *)tbl_storage_p;
-    hashTblp->base_size   = tableSize + sizeof(HashTbl);
+    hashTblp->base_size   = tableSize + hashTblp->numberOfLocks * sizeof(HashTblLock) + sizeof(HashTbl);
+    hashTblp->resize      = NULL;
+    hashTblp->resizeCount = 0;
+    mutex_init(&hashTblp->resize_mutex);
+    INIT_WORK(&hashTblp->resize_work, __ec_hashtbl_resize_work);
     ec_percpu_counter_init(&hashTblp->tableInstance, 0, GFP_MODE(context));
+    ec_percpu_counter_init(&hashTblp->hits, 0, GFP_MODE(context));
+    ec_percpu_counter_init(&hashTblp->misses, 0, GFP_MODE(context));
+    ec_percpu_counter_init(&hashTblp->evictions, 0, GFP_MODE(context));
+    ec_percpu_counter_init(&hashTblp->memoryUsed, 0, GFP_MODE(context));
+
+    atomic64_set(&hashTblp->clockHand, 0);
 
     hashTblp->hash_cache.delete_callback = __ec_hashtbl_cache_delete_cb;
+    hashTblp->hash_cache.rcu_free = hashTblp->rcu_lookup;
+    hashTblp->hash_cache.magazine_size = 32;
     if (hashTblp->printval_callback)
     {
         hashTblp->hash_cache.printval_callback = __ec_hashtbl_print_callback;
@@ -150,9 +502,13 @@ bool ec_hashtbl_init(
     // Make hash more random
     get_random_bytes(&hashTblp->secret, sizeof(hashTblp->secret));
 
+    for (i = 0; i < hashTblp->numberOfLocks; i++)
+    {
+        ec_embedded_lock_init(&hashTblp->locks[i].lock, context);
+    }
+
     for (i = 0; i < hashTblp->numberOfBuckets; i++)
     {
-        ec_spinlock_init(&hashTblp->tablePtr[i].lock, context);
         INIT_LIST_HEAD(&hashTblp->tablePtr[i].head);
     }
 
@@ -171,8 +527,15 @@ bool ec_hashtbl_init(
 
 CATCH_DEFAULT:
     ec_mem_free(tbl_storage_p);
+    ec_mem_free(hashTblp->lockStorage);
     percpu_counter_destroy(&hashTblp->tableInstance);
+    percpu_counter_destroy(&hashTblp->hits);
+    percpu_counter_destroy(&hashTblp->misses);
+    percpu_counter_destroy(&hashTblp->evictions);
+    percpu_counter_destroy(&hashTblp->memoryUsed);
     hashTblp->tablePtr = NULL;
+    hashTblp->locks = NULL;
+    hashTblp->lockStorage = NULL;
     return false;
 }
 
@@ -197,21 +560,30 @@ void ec_hashtbl_destroy(HashTbl *hashTblp, ProcessContext *context)
 
     __ec_hashtbl_proc_shutdown(hashTblp, context);
 
+    // Any resize in progress will finish before this returns, and no new one will start
+    cancel_work_sync(&hashTblp->resize_work);
+
     __ec_hashtbl_for_each(hashTblp, __ec_hashtbl_delete_callback, NULL, true, context);
 
     HASHTBL_PRINT("hash shutdown inst=%" PRFs64 " alloc=%" PRFs64 "\n",
         percpu_counter_sum_positive(&hashTblp->tableInstance),
         ec_mem_cache_get_allocated_count(&hashTblp->hash_cache, context));
 
-    for (i = 0; i < hashTblp->numberOfBuckets; i++)
+    for (i = 0; i < hashTblp->numberOfLocks; i++)
     {
-        ec_spinlock_destroy(&hashTblp->tablePtr[i].lock, context);
+        ec_embedded_lock_destroy(&hashTblp->locks[i].lock, context);
     }
 
 
     percpu_counter_destroy(&hashTblp->tableInstance);
+    percpu_counter_destroy(&hashTblp->hits);
+    percpu_counter_destroy(&hashTblp->misses);
+    percpu_counter_destroy(&hashTblp->evictions);
+    percpu_counter_destroy(&hashTblp->memoryUsed);
     ec_mem_cache_destroy(&hashTblp->hash_cache, context);
     ec_mem_free(hashTblp->tablePtr);
+    ec_mem_free(hashTblp->lockStorage);
+    mutex_destroy(&hashTblp->resize_mutex);
 }
 
 void ec_hashtbl_clear(HashTbl *hashTblp, ProcessContext *context)
@@ -235,76 +607,99 @@ void ec_hashtbl_read_for_each(HashTbl *hashTblp, hashtbl_for_each_cb callback, v
     __ec_hashtbl_for_each(hashTblp, callback, priv, false, context);
 }
 
+static int __ec_hashtbl_for_each_bkt(HashTbl *hashTblp, HashTableBkt *bucketp, uint64_t bucket_indx, hashtbl_for_each_cb callback, void *priv, bool haveWriteLock, ProcessContext *context)
+{
+    HashTableNode *nodep = 0, *next = 0;
+
+    if (!list_empty(&bucketp->head))
+    {
+        list_for_each_entry_safe(nodep, next, &bucketp->head, link)
+        {
+
+            switch ((*callback)(hashTblp, __ec_get_datap(hashTblp, nodep), priv, context))
+            {
+            case ACTION_DELETE:
+                // This should never be called with only a read lock
+                BUG_ON(!haveWriteLock);
+                __ec_hashtbl_unlink(hashTblp, nodep);
+                --bucketp->itemCount;
+                percpu_counter_dec(&hashTblp->tableInstance);
+                ec_mem_cache_disown(nodep, context);
+                break;
+            case ACTION_STOP:
+                return ACTION_STOP;
+            case ACTION_PRINT:
+                TRACE(DL_INFO, "bucket: %llu, active: %u", bucket_indx, nodep->activity);
+                break;
+            case ACTION_CONTINUE:
+            default:
+                break;
+            }
+        }
+    }
+
+    return ACTION_CONTINUE;
+}
+
 void __ec_hashtbl_for_each(HashTbl *hashTblp, hashtbl_for_each_cb callback, void *priv, bool haveWriteLock, ProcessContext *context)
 {
-    unsigned int i;
-    uint64_t numberOfBuckets;
-    HashTableBkt *ec_hashtbl_tbl  = NULL;
+    uint64_t lock_indx;
+    uint64_t i;
+    int action = ACTION_CONTINUE;
 
     if (!hashTblp) return;
 
-    ec_hashtbl_tbl = hashTblp->tablePtr;
-    numberOfBuckets  = hashTblp->numberOfBuckets;
-
-    // May need to walk the lists too
-    for (i = 0; i < numberOfBuckets; ++i)
+    // Walk the table one lock stripe at a time.  The stripe lock keeps every bucket in it from moving,
+    //  so during a resize we visit the old buckets that have not migrated yet and all the new ones.
+    for (lock_indx = 0; lock_indx < hashTblp->numberOfLocks && action != ACTION_STOP; ++lock_indx)
     {
-        HashTableBkt *bucketp = &ec_hashtbl_tbl[i];
-        HashTableNode *nodep = 0, *next = 0;
+        linuxSpinlock_t *lockp = &hashTblp->locks[lock_indx].lock;
+        HashTblResize *resize;
 
         if (haveWriteLock)
         {
-            ec_hashtbl_bkt_write_lock(bucketp, context);
+            ec_embedded_write_lock(lockp, context);
         } else
         {
-            ec_hashtbl_bkt_read_lock(bucketp, context);
+            ec_embedded_read_lock(lockp, context);
         }
 
-        if (!list_empty(&bucketp->head))
+        resize = __ec_hashtbl_get_resize(hashTblp);
+        if (resize)
         {
-            list_for_each_entry_safe(nodep, next, &bucketp->head, link)
+            for (i = lock_indx; i < resize->oldNumberOfBuckets && action != ACTION_STOP; i += hashTblp->numberOfLocks)
             {
-
-                switch ((*callback)(hashTblp, __ec_get_datap(hashTblp, nodep), priv, context))
+                if (!resize->oldTablePtr[i].migrated)
                 {
-                case ACTION_DELETE:
-                    // This should never be called with only a read lock
-                    BUG_ON(!haveWriteLock);
-                    list_del_init(&nodep->link);
-                    --bucketp->itemCount;
-                    percpu_counter_dec(&hashTblp->tableInstance);
-                    ec_mem_cache_disown(nodep, context);
-                    break;
-                case ACTION_STOP:
-                    if (haveWriteLock)
-                    {
-                        ec_hashtbl_bkt_write_unlock(bucketp, context);
-                    } else
-                    {
-                        ec_hashtbl_bkt_read_unlock(bucketp, context);
-                    }
-                    goto Exit;
-                    break;
-                case ACTION_PRINT:
-                    TRACE(DL_INFO, "bucket: %u, active: %u", i, nodep->activity);
-                    break;
-                case ACTION_CONTINUE:
-                default:
-                    break;
+                    action = __ec_hashtbl_for_each_bkt(hashTblp, &resize->oldTablePtr[i], i, callback, priv, haveWriteLock, context);
                 }
             }
+            for (i = lock_indx; i < resize->newNumberOfBuckets && action != ACTION_STOP; i += hashTblp->numberOfLocks)
+            {
+                action = __ec_hashtbl_for_each_bkt(hashTblp, &resize->newTablePtr[i], i, callback, priv, haveWriteLock, context);
+            }
+        } else
+        {
+            for (i = lock_indx; i < hashTblp->numberOfBuckets && action != ACTION_STOP; i += hashTblp->numberOfLocks)
+            {
+                action = __ec_hashtbl_for_each_bkt(hashTblp, &hashTblp->tablePtr[i], i, callback, priv, haveWriteLock, context);
+            }
         }
 
         if (haveWriteLock)
         {
-            ec_hashtbl_bkt_write_unlock(bucketp, context);
+            ec_embedded_write_unlock(lockp, context);
         } else
         {
-            ec_hashtbl_bkt_read_unlock(bucketp, context);
+            ec_embedded_read_unlock(lockp, context);
         }
     }
 
-Exit:
+    if (haveWriteLock)
+    {
+        __ec_hashtbl_resize_check(hashTblp);
+    }
+
     // Signal the callback we are done.  It may need to clean up something in the context
     (*callback)(hashTblp, NULL, priv, context);
     return;
@@ -337,8 +732,7 @@ HashTableNode *__ec_hashtbl_lookup(HashTbl *hashTblp, struct list_head *head, u3
                 if (tableNode->activity > prevNode->activity &&
                     tableNode->activity - prevNode->activity > LRU_REORDERLIMIT)
                 {
-                    list_del_init(&tableNode->link);
-                    list_add_tail(&tableNode->link, &prevNode->link);
+                    __ec_hashtbl_move_before(hashTblp, tableNode, prevNode);
                 }
             }
             return tableNode;
@@ -357,6 +751,7 @@ int __ec_hashtbl_add(HashTbl *hashTblp, void *datap, bool forceUnique, ProcessCo
     char *key_str;
     void *key;
     int ret = 0;
+    HashTblResize *resize;
 
     CANCEL(hashTblp && datap, -EINVAL);
     CANCEL(hashTblp->initialized, -EINVAL);
@@ -365,7 +760,15 @@ int __ec_hashtbl_add(HashTbl *hashTblp, void *datap, bool forceUnique, ProcessCo
     key = __ec_get_key_ptr(hashTblp, datap);
     nodep->hash = ec_hashtbl_hash_key(hashTblp, key);
     bucket_indx = ec_hashtbl_bkt_index(hashTblp, nodep->hash);
-    bucketp = &(hashTblp->tablePtr[bucket_indx]);
+
+    // Spread the cost of a resize by moving one old bucket for every add
+    rcu_read_lock();
+    resize = rcu_dereference(hashTblp->resize);
+    if (resize && READ_ONCE(resize->ready))
+    {
+        __ec_hashtbl_migrate_next(hashTblp, resize, context);
+    }
+    rcu_read_unlock();
 
     if (hashTblp->debug_logging)
     {
@@ -374,7 +777,8 @@ int __ec_hashtbl_add(HashTbl *hashTblp, void *datap, bool forceUnique, ProcessCo
         ec_mem_free(key_str);
     }
 
-    ec_hashtbl_bkt_write_lock(bucketp, context);
+    ec_hashtbl_bkt_write_lock(hashTblp, nodep->hash, context);
+    bucketp = __ec_hashtbl_bucket_locked(hashTblp, nodep->hash);
 
     if (hashTblp->lruSize > 0 && bucketp->itemCount >= hashTblp->lruSize)
     {
@@ -386,6 +790,7 @@ int __ec_hashtbl_add(HashTbl *hashTblp, void *datap, bool forceUnique, ProcessCo
         void          *datap     = __ec_get_datap(hashTblp, tableNode);
 
         ec_hashtbl_del_lockheld(hashTblp, bucketp, datap, context);
+        percpu_counter_inc(&hashTblp->evictions);
     }
 
     if (forceUnique)
@@ -395,13 +800,34 @@ int __ec_hashtbl_add(HashTbl *hashTblp, void *datap, bool forceUnique, ProcessCo
         TRY_DO(!old_node, { ret = -EEXIST; });
     }
 
-    list_add(&nodep->link, &bucketp->head);
+    if (hashTblp->memoryBudget)
+    {
+        // New entries start out referenced so the CLOCK hand passes over them once
+        nodep->activity = 1;
+    }
+
+    // Charged once here and refunded when the entry is removed, so later changes to what the entry
+    //  points at cannot unbalance the count
+    nodep->charge = __ec_hashtbl_entry_size(hashTblp);
+    if (hashTblp->size_callback)
+    {
+        nodep->charge += hashTblp->size_callback(datap, context);
+    }
+    ec_percpu_counter_add_batch(&hashTblp->memoryUsed, nodep->charge, HASHTBL_MEMORY_BATCH);
+
+    __ec_hashtbl_link(hashTblp, nodep, &bucketp->head);
     ++bucketp->itemCount;
     percpu_counter_inc(&hashTblp->tableInstance);
     ec_mem_cache_get(nodep, context);
 
 CATCH_DEFAULT:
-    ec_hashtbl_bkt_write_unlock(bucketp, context);
+    ec_hashtbl_bkt_write_unlock(hashTblp, nodep->hash, context);
+
+    if (hashTblp->memoryBudget)
+    {
+        __ec_hashtbl_evict(hashTblp, context);
+    }
+    __ec_hashtbl_resize_check(hashTblp);
 
     return ret;
 }
@@ -416,6 +842,75 @@ int ec_hashtbl_add_safe(HashTbl *hashTblp, void *datap, ProcessContext *context)
     return __ec_hashtbl_add(hashTblp, datap, true, context);
 }
 
+// Convert a reference held by the caller into the value returned to the table user
+static void *__ec_hashtbl_get_handle(HashTbl *hashTblp, void *datap, ProcessContext *context)
+{
+    if (hashTblp->handle_callback)
+    {
+        void *handle = hashTblp->handle_callback(datap, context);
+
+        if (!handle)
+        {
+            // If we failed to get a handle, we want to release the reference and return NULL
+            ec_hashtbl_put(hashTblp, datap, context);
+        }
+
+        // We want to return the handle
+        datap = handle;
+    }
+
+    return datap;
+}
+
+// Lockless lookup for tables created with rcu_lookup.  The bucket is walked under rcu_read_lock, and a
+//  node is only returned if a reference can be taken before the last owner releases it.  The activity
+//  counter is bumped racily and the LRU reorder is left to the writers that hold the bucket lock.
+//  Returns false without looking if a resize is moving buckets, and the caller must take the lock.
+static bool __ec_hashtbl_find_rcu(HashTbl *hashTblp, u32 hash, void *key, void **datap, ProcessContext *context)
+{
+    HashTableBkt  *bucketp;
+    HashTableNode *nodep = NULL;
+    HashTableNode *found = NULL;
+
+    *datap = NULL;
+
+    rcu_read_lock();
+    if (__ec_hashtbl_get_resize(hashTblp))
+    {
+        rcu_read_unlock();
+        return false;
+    }
+
+    bucketp = &hashTblp->tablePtr[ec_hashtbl_bkt_index(hashTblp, hash)];
+    list_for_each_entry_rcu(nodep, &bucketp->head, link)
+    {
+        if (hash == nodep->hash &&
+            memcmp(key, __ec_get_key_ptr(hashTblp, __ec_get_datap(hashTblp, nodep)), hashTblp->key_len) == 0)
+        {
+            if (ec_mem_cache_get_unless_zero(nodep, context))
+            {
+                nodep->activity += 1;
+                found = nodep;
+            }
+            break;
+        }
+    }
+    rcu_read_unlock();
+
+    CANCEL(found, true);
+
+    if (hashTblp->find_verify_callback &&
+        !hashTblp->find_verify_callback(__ec_get_datap(hashTblp, found), key, context))
+    {
+        // If we failed the verify then reject this node
+        ec_mem_cache_put(found, context);
+        return true;
+    }
+
+    *datap = __ec_hashtbl_get_handle(hashTblp, __ec_get_datap(hashTblp, found), context);
+    return true;
+}
+
 void *ec_hashtbl_find(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
     u32 hash;
@@ -434,7 +929,6 @@ void *ec_hashtbl_find(HashTbl *hashTblp, void *key, ProcessContext *context)
 
     hash = ec_hashtbl_hash_key(hashTblp, key);
     bucket_indx = ec_hashtbl_bkt_index(hashTblp, hash);
-    bucketp = &(hashTblp->tablePtr[bucket_indx]);
 
     if (hashTblp->debug_logging)
     {
@@ -443,7 +937,14 @@ void *ec_hashtbl_find(HashTbl *hashTblp, void *key, ProcessContext *context)
         ec_mem_free(key_str);
     }
 
-    ec_hashtbl_bkt_read_lock(bucketp, context);
+    if (hashTblp->rcu_lookup && __ec_hashtbl_find_rcu(hashTblp, hash, key, &datap, context))
+    {
+        percpu_counter_inc(datap ? &hashTblp->hits : &hashTblp->misses);
+        return datap;
+    }
+
+    ec_hashtbl_bkt_read_lock(hashTblp, hash, context);
+    bucketp = __ec_hashtbl_bucket_locked(hashTblp, hash);
     nodep = __ec_hashtbl_lookup(hashTblp, &bucketp->head, hash, key);
     if (nodep && hashTblp->find_verify_callback)
     {
@@ -463,8 +964,9 @@ void *ec_hashtbl_find(HashTbl *hashTblp, void *key, ProcessContext *context)
             __ec_get_datap(hashTblp, nodep),
             context);
     }
-    ec_hashtbl_bkt_read_unlock(bucketp, context);
+    ec_hashtbl_bkt_read_unlock(hashTblp, hash, context);
 
+    percpu_counter_inc(datap ? &hashTblp->hits : &hashTblp->misses);
     return datap;
 }
 
@@ -473,21 +975,8 @@ void *ec_hashtbl_get(HashTbl *hashTblp, void *datap, ProcessContext *context)
     CANCEL(hashTblp && datap, NULL);
 
     ec_mem_cache_get(__ec_get_nodep(hashTblp, datap), context);
-    if (hashTblp->handle_callback)
-    {
-        void *handle = hashTblp->handle_callback(datap, context);
 
-        if (!handle)
-        {
-            // If we failed to get a handle, we want to release the reference and return NULL
-            ec_hashtbl_put(hashTblp, datap, context);
-        }
-
-        // We want to return the handle
-        datap = handle;
-    }
-
-    return datap;
+    return __ec_hashtbl_get_handle(hashTblp, datap, context);
 }
 
 int64_t ec_hashtbl_ref_count(HashTbl *hashTblp, void *datap, ProcessContext *context)
@@ -512,11 +1001,12 @@ int ec_hashtbl_del_lockheld(HashTbl *hashTblp, HashTableBkt *bucketp, void *data
     HashTableNode *nodep = __ec_get_nodep(hashTblp, datap);
 
     // This protects against ec_hashtbl_del being called twice for the same datap
-    if (!list_empty(&nodep->link))
+    if (__ec_hashtbl_node_linked(nodep))
     {
-        list_del_init(&nodep->link);
+        __ec_hashtbl_unlink(hashTblp, nodep);
         --bucketp->itemCount;
         percpu_counter_dec(&hashTblp->tableInstance);
+        ec_percpu_counter_add_batch(&hashTblp->memoryUsed, -(s64)nodep->charge, HASHTBL_MEMORY_BATCH);
 
         ec_mem_cache_disown(nodep, context);
 
@@ -534,7 +1024,6 @@ int ec_hashtbl_del_lockheld(HashTbl *hashTblp, HashTableBkt *bucketp, void *data
 void *ec_hashtbl_del_by_key(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
     u32 hash;
-    uint64_t bucket_indx;
     HashTableBkt *bucketp;
     HashTableNode *nodep = NULL;
     void *datap = NULL;
@@ -547,10 +1036,9 @@ void *ec_hashtbl_del_by_key(HashTbl *hashTblp, void *key, ProcessContext *contex
     CANCEL(hashTblp->initialized, NULL);
 
     hash = ec_hashtbl_hash_key(hashTblp, key);
-    bucket_indx = ec_hashtbl_bkt_index(hashTblp, hash);
-    bucketp = &(hashTblp->tablePtr[bucket_indx]);
 
-    ec_hashtbl_bkt_write_lock(bucketp, context);
+    ec_hashtbl_bkt_write_lock(hashTblp, hash, context);
+    bucketp = __ec_hashtbl_bucket_locked(hashTblp, hash);
     nodep = __ec_hashtbl_lookup(hashTblp, &bucketp->head, hash, key);
     if (nodep)
     {
@@ -561,7 +1049,9 @@ void *ec_hashtbl_del_by_key(HashTbl *hashTblp, void *key, ProcessContext *contex
 
         ec_hashtbl_del_lockheld(hashTblp, bucketp, datap, context);
     }
-    ec_hashtbl_bkt_write_unlock(bucketp, context);
+    ec_hashtbl_bkt_write_unlock(hashTblp, hash, context);
+
+    __ec_hashtbl_resize_check(hashTblp);
 
     // caller must put or free (if no reference count)
     return datap;
@@ -569,7 +1059,6 @@ void *ec_hashtbl_del_by_key(HashTbl *hashTblp, void *key, ProcessContext *contex
 
 void ec_hashtbl_del(HashTbl *hashTblp, void *datap, ProcessContext *context)
 {
-    uint64_t bucket_indx;
     HashTableBkt *bucketp;
     HashTableNode *nodep;
 
@@ -578,12 +1067,13 @@ void ec_hashtbl_del(HashTbl *hashTblp, void *datap, ProcessContext *context)
     CANCEL_VOID(hashTblp && hashTblp->initialized);
 
     nodep = __ec_get_nodep(hashTblp, datap);
-    bucket_indx = ec_hashtbl_bkt_index(hashTblp, nodep->hash);
-    bucketp = &(hashTblp->tablePtr[bucket_indx]);
 
-    ec_hashtbl_bkt_write_lock(bucketp, context);
+    ec_hashtbl_bkt_write_lock(hashTblp, nodep->hash, context);
+    bucketp = __ec_hashtbl_bucket_locked(hashTblp, nodep->hash);
     ec_hashtbl_del_lockheld(hashTblp, bucketp, datap, context);
-    ec_hashtbl_bkt_write_unlock(bucketp, context);
+    ec_hashtbl_bkt_write_unlock(hashTblp, nodep->hash, context);
+
+    __ec_hashtbl_resize_check(hashTblp);
 }
 
 int64_t ec_hashtbl_get_count(HashTbl *hashTblp, ProcessContext *context)
@@ -604,6 +1094,7 @@ void *ec_hashtbl_alloc(HashTbl *hashTblp, ProcessContext *context)
     CANCEL(nodep, NULL);
 
     nodep->activity = 0;
+    nodep->charge = 0;
     nodep->hash = 0;
     nodep->hashTblp = hashTblp;
     INIT_LIST_HEAD(&nodep->link);
@@ -664,7 +1155,6 @@ size_t ec_hashtbl_get_memory(ProcessContext *context)
 bool __ec_hashtbl_bkt_lock(bool haveWriteLock, HashTbl *hashTblp, void *key, void **datap, HashTableBkt **bkt, ProcessContext *context)
 {
     u32 hash;
-    uint64_t bucket_indx;
     HashTableBkt *bucketp;
     HashTableNode *nodep;
 
@@ -676,26 +1166,25 @@ bool __ec_hashtbl_bkt_lock(bool haveWriteLock, HashTbl *hashTblp, void *key, voi
     CANCEL(hashTblp->initialized, NULL);
 
     hash = ec_hashtbl_hash_key(hashTblp, key);
-    bucket_indx = ec_hashtbl_bkt_index(hashTblp, hash);
-    bucketp = &(hashTblp->tablePtr[bucket_indx]);
 
     if (haveWriteLock)
     {
-        ec_hashtbl_bkt_write_lock(bucketp, context);
+        ec_hashtbl_bkt_write_lock(hashTblp, hash, context);
     } else
     {
-        ec_hashtbl_bkt_read_lock(bucketp, context);
+        ec_hashtbl_bkt_read_lock(hashTblp, hash, context);
     }
 
+    bucketp = __ec_hashtbl_bucket_locked(hashTblp, hash);
     nodep = __ec_hashtbl_lookup(hashTblp, &bucketp->head, hash, key);
     if (!nodep)
     {
         if (haveWriteLock)
         {
-            ec_hashtbl_bkt_write_unlock(bucketp, context);
+            ec_hashtbl_bkt_write_unlock(hashTblp, hash, context);
         } else
         {
-            ec_hashtbl_bkt_read_unlock(bucketp, context);
+            ec_hashtbl_bkt_read_unlock(hashTblp, hash, context);
         }
         return false;
     }
@@ -710,12 +1199,9 @@ bool ec_hashtbl_read_bkt_lock(HashTbl *hashTblp, void *key, void **datap, HashTa
     return __ec_hashtbl_bkt_lock(false, hashTblp, key, datap, bkt, context);
 }
 
-void ec_hashtbl_read_bkt_unlock(HashTableBkt *bkt, ProcessContext *context)
+void ec_hashtbl_read_bkt_unlock(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
-    if (bkt)
-    {
-        ec_hashtbl_bkt_read_unlock(bkt, context);
-    }
+    ec_hashtbl_read_unlock(hashTblp, key, context);
 }
 
 bool ec_hashtbl_write_bkt_lock(HashTbl *hashTblp, void *key, void **datap, HashTableBkt **bkt, ProcessContext *context)
@@ -723,19 +1209,14 @@ bool ec_hashtbl_write_bkt_lock(HashTbl *hashTblp, void *key, void **datap, HashT
     return __ec_hashtbl_bkt_lock(true, hashTblp, key, datap, bkt, context);
 }
 
-void ec_hashtbl_write_bkt_unlock(HashTableBkt *bkt, ProcessContext *context)
+void ec_hashtbl_write_bkt_unlock(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
-    if (bkt)
-    {
-        ec_hashtbl_bkt_write_unlock(bkt, context);
-    }
+    ec_hashtbl_write_unlock(hashTblp, key, context);
 }
 
-HashTableBkt *__ec_hashtbl_find_bucket(HashTbl *hashTblp, void *key)
+// The key lock is the stripe lock for the key, which stays the same while the table is resized
+linuxSpinlock_t *__ec_hashtbl_find_lock(HashTbl *hashTblp, void *key)
 {
-    u32 hash;
-    uint64_t bucket_indx;
-
     if (!hashTblp || !key)
     {
         return NULL;
@@ -743,49 +1224,46 @@ HashTableBkt *__ec_hashtbl_find_bucket(HashTbl *hashTblp, void *key)
 
     CANCEL(hashTblp->initialized, NULL);
 
-    hash = ec_hashtbl_hash_key(hashTblp, key);
-    bucket_indx = ec_hashtbl_bkt_index(hashTblp, hash);
-
-    return &(hashTblp->tablePtr[bucket_indx]);
+    return __ec_hashtbl_stripe(hashTblp, ec_hashtbl_hash_key(hashTblp, key));
 }
 
 void ec_hashtbl_read_lock(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
-    HashTableBkt *bucketp = __ec_hashtbl_find_bucket(hashTblp, key);
+    linuxSpinlock_t *lockp = __ec_hashtbl_find_lock(hashTblp, key);
 
-    if (bucketp)
+    if (lockp)
     {
-        ec_hashtbl_bkt_read_lock(bucketp, context);
+        ec_embedded_read_lock(lockp, context);
     }
 }
 
 void ec_hashtbl_read_unlock(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
-    HashTableBkt *bucketp = __ec_hashtbl_find_bucket(hashTblp, key);
+    linuxSpinlock_t *lockp = __ec_hashtbl_find_lock(hashTblp, key);
 
-    if (bucketp)
+    if (lockp)
     {
-        ec_hashtbl_bkt_read_unlock(bucketp, context);
+        ec_embedded_read_unlock(lockp, context);
     }
 }
 
 void ec_hashtbl_write_lock(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
-    HashTableBkt *bucketp = __ec_hashtbl_find_bucket(hashTblp, key);
+    linuxSpinlock_t *lockp = __ec_hashtbl_find_lock(hashTblp, key);
 
-    if (bucketp)
+    if (lockp)
     {
-        ec_hashtbl_bkt_write_lock(bucketp, context);
+        ec_embedded_write_lock(lockp, context);
     }
 }
 
 void ec_hashtbl_write_unlock(HashTbl *hashTblp, void *key, ProcessContext *context)
 {
-    HashTableBkt *bucketp = __ec_hashtbl_find_bucket(hashTblp, key);
+    linuxSpinlock_t *lockp = __ec_hashtbl_find_lock(hashTblp, key);
 
-    if (bucketp)
+    if (lockp)
     {
-        ec_hashtbl_bkt_write_unlock(bucketp, context);
+        ec_embedded_write_unlock(lockp, context);
     }
 }
 
@@ -800,16 +1278,26 @@ void ec_hastable_bkt_show(HashTbl *hashTblp, hastable_print_func _print, void *m
 {
     int bucket_index = 0;
     int output_size = 0;
-    struct counter *items = ec_mem_valloc(sizeof(struct counter) * hashTblp->numberOfBuckets, context);
+    struct counter *items;
 
+    // Hold off any resize so the table stays put while we walk it
+    mutex_lock(&hashTblp->resize_mutex);
+
+    items = ec_mem_valloc(sizeof(struct counter) * hashTblp->numberOfBuckets, context);
+    if (!items)
+    {
+        mutex_unlock(&hashTblp->resize_mutex);
+        return;
+    }
     memset(items, 0, ec_mem_size(items));
 
     for (; bucket_index < hashTblp->numberOfBuckets; ++bucket_index)
     {
         int write_index = 0;
+        linuxSpinlock_t *lockp = &hashTblp->locks[bucket_index & (hashTblp->numberOfLocks - 1)].lock;
         uint64_t itemCount = hashTblp->tablePtr[bucket_index].itemCount;
 
-        ec_read_lock(&hashTblp->tablePtr[bucket_index].lock, context);
+        ec_embedded_read_lock(lockp, context);
         for (; write_index < output_size; ++write_index)
         {
             if (itemCount == items[write_index].itemCount)
@@ -829,7 +1317,7 @@ void ec_hastable_bkt_show(HashTbl *hashTblp, hastable_print_func _print, void *m
                 break;
             }
         }
-        ec_read_unlock(&hashTblp->tablePtr[bucket_index].lock, context);
+        ec_embedded_read_unlock(lockp, context);
         if (items[write_index].bucketCount++ == 0)
         {
             items[write_index].itemCount = itemCount;
@@ -842,6 +1330,7 @@ void ec_hastable_bkt_show(HashTbl *hashTblp, hastable_print_func _print, void *m
     {
         _print(m, "%20llu : %20llu\n", items[bucket_index].itemCount, items[bucket_index].bucketCount);
     }
+    mutex_unlock(&hashTblp->resize_mutex);
 
     ec_mem_free(items);
 }
@@ -851,11 +1340,32 @@ int __ec_hashtbl_show(struct seq_file *m, void *v)
     DECLARE_NON_ATOMIC_CONTEXT(context, ec_getpid(current));
 
     HashTbl *hashTblp = (HashTbl *)m->private;
+    HashTblResize *resize;
 
     seq_printf(m, "%20s : %20s\n", "Name", hashTblp->name);
     seq_printf(m, "%20s : %20llu\n", "Bucket Count", hashTblp->numberOfBuckets);
+    seq_printf(m, "%20s : %20llu\n", "Max Buckets", hashTblp->maxBuckets);
+    seq_printf(m, "%20s : %20llu\n", "Lock Count", hashTblp->numberOfLocks);
+    seq_printf(m, "%20s : %20llu\n", "Resize Count", hashTblp->resizeCount);
+
+    rcu_read_lock();
+    resize = rcu_dereference(hashTblp->resize);
+    if (resize)
+    {
+        seq_printf(m, "%20s : %9llu -> %-9llu\n", "Resizing",
+            resize->oldNumberOfBuckets, resize->newNumberOfBuckets);
+        seq_printf(m, "%20s : %9lld / %-9llu\n", "Migrated",
+            (long long)atomic64_read(&resize->migratedBuckets), resize->oldNumberOfBuckets);
+    }
+    rcu_read_unlock();
     seq_printf(m, "%20s : %20zu\n", "Table Size", hashTblp->base_size);
     seq_printf(m, "%20s : %20llu\n", "LRU Size", hashTblp->lruSize);
+    seq_printf(m, "%20s : %20zu\n", "Memory Budget", hashTblp->memoryBudget);
+    seq_printf(m, "%20s : %20lld\n", "Memory Used", percpu_counter_sum_positive(&hashTblp->memoryUsed));
+    seq_printf(m, "%20s : %20lld\n", "Hits", percpu_counter_sum_positive(&hashTblp->hits));
+    seq_printf(m, "%20s : %20lld\n", "Misses", percpu_counter_sum_positive(&hashTblp->misses));
+    seq_printf(m, "%20s : %20lld\n", "Evictions", percpu_counter_sum_positive(&hashTblp->evictions));
+    seq_printf(m, "%20s : %20s\n", "RCU Lookup", hashTblp->rcu_lookup ? "yes" : "no");
     seq_printf(m, "%20s : %20lld\n", "Item Count", percpu_counter_sum_positive(&hashTblp->tableInstance));
     seq_puts(m, "\n");
 
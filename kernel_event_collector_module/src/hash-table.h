@@ -6,16 +6,26 @@
 
 #include <linux/hash.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "version.h"
 #include "percpu-util.h"
 #include "mem-cache.h"
+#include "cb-spinlock.h"
 
 #define  ACTION_CONTINUE   0
 #define  ACTION_STOP       1
 #define  ACTION_PRINT      2
 #define  ACTION_DELETE     4
 
+// Suggested initial size for tables that are allowed to grow
+#define  HASHTBL_MIN_BUCKETS   4096
+
+// Default lock stripes are sized from the number of CPUs, up to HASHTBL_MAX_LOCKS
+#define  HASHTBL_LOCKS_PER_CPU 16
+#define  HASHTBL_MAX_LOCKS     1024
+
 // hash-table-generic provides interfaces for hash tables. It supports arbitary
 // key length. In order to use this hash table, you need to create a struct that
 // contains a struct list_node called 'link'. Then you can add one, or more
@@ -33,21 +43,83 @@ typedef void *(*hashtbl_handle_cb)(void *datap, ProcessContext *context);
 typedef void (*hashtbl_printval_cb)(void *datap, ProcessContext *context);
 typedef bool (*hashtbl_find_verify_cb)(void *datap, void *key, ProcessContext *context);
 
+// Returns the bytes an object has allocated outside of its table entry
+typedef size_t (*hashtbl_size_cb)(void *datap, ProcessContext *context);
+
+// Sits in front of the data of every entry
+typedef struct hash_table_node {
+    struct list_head link;
+    u32 hash;
+    u32 activity;
+    u32 charge;     // Bytes charged to the memory budget when the entry was added
+    struct hashtbl *hashTblp;
+} HashTableNode;
+
+// Bytes charged to memoryBudget for an entry, before anything the size_callback adds
+#define HASHTBL_ENTRY_SIZE(datasize)  ((datasize) + sizeof(HashTableNode))
+
 // We need a pointer to the end of the bucket list for the LRU, so use list here instead of hlist
 // since hlist does not provide a pointer to the end (see list.h)
+//  Buckets hold no lock, which keeps them at 32 bytes on 64 bit so two share a cache line.
 typedef struct hashbtl_bkt {
-    uint64_t lock;
     struct list_head head;
     uint64_t itemCount;
+    bool     migrated; // Only used in the old table while a resize is in progress
 } HashTableBkt;
 
+// One lock per stripe, stored inline and padded out to a cache line so neighboring stripes never
+//  bounce the same line between CPUs.
+typedef struct hashtbl_lock {
+    linuxSpinlock_t lock;
+} ____cacheline_aligned_in_smp HashTblLock;
+
+// Tracks an in progress resize.  Buckets are moved from the old table to the new one a few at a time
+//  by ec_hashtbl_add, and the resize worker sweeps up whatever is left.
+typedef struct hashtbl_resize {
+    HashTableBkt *oldTablePtr;
+    uint64_t      oldNumberOfBuckets;
+    HashTableBkt *newTablePtr;
+    uint64_t      newNumberOfBuckets;
+    bool          ready;           // Set once lockless readers have left the old table
+    atomic64_t    nextBucket;      // Next old bucket to be claimed for migration
+    atomic64_t    migratedBuckets;
+} HashTblResize;
+
 typedef struct hashtbl {
     HashTableBkt *tablePtr;
     struct list_head   genTables;
     const char *name;
     uint64_t   numberOfBuckets;
+
+    // The table will grow up to maxBuckets when the load factor is high, and shrink back to minBuckets
+    //  when it is low.  Set to 0 to keep the table at a fixed size.
+    uint64_t   maxBuckets;
+    uint64_t   minBuckets;
+
+    // Locks are striped by hash.  Leave numberOfLocks at 0 to size the stripes from the number of CPUs,
+    //  capped at HASHTBL_MAX_LOCKS and maxBuckets.  The table never shrinks below the stripe count, so
+    //  every bucket an entry can move to during a resize is covered by the same lock.
+    HashTblLock *locks;
+    void      *lockStorage;
+    uint64_t   numberOfLocks;
+    HashTblResize     *resize;
+    struct work_struct resize_work;
+    struct mutex       resize_mutex;
+    uint64_t   resizeCount;
+
     uint64_t   datasize;
-    uint64_t   lruSize;
+    uint64_t   lruSize;       // Per bucket limit, prefer memoryBudget for new tables
+
+    // Once the entries use more than memoryBudget bytes, a table wide CLOCK sweep evicts the ones that
+    //  have not been looked up recently.  Each entry is charged HASHTBL_ENTRY_SIZE(datasize) plus what
+    //  size_callback returns for it.  0 is no limit.
+    size_t     memoryBudget;
+    struct percpu_counter memoryUsed;
+    atomic64_t clockHand;
+    struct percpu_counter hits;
+    struct percpu_counter misses;
+    struct percpu_counter evictions;
+
     uint32_t   secret;
     struct percpu_counter tableInstance;
     bool initialized;
@@ -57,10 +129,19 @@ typedef struct hashtbl {
     int key_offset;
     size_t base_size;
     bool debug_logging;
+
+    // Lookups with ec_hashtbl_find walk the bucket under rcu_read_lock instead of the bucket lock.
+    //  Writers still take the bucket lock, and nodes are freed after an RCU grace period.
+    //  The find_verify_callback and handle_callback are called holding a reference but no lock.
+    bool rcu_lookup;
     hashtbl_delete_cb delete_callback; // Delete private data in object
     hashtbl_handle_cb handle_callback; // Generate a private handle to the object (get ref counts, etc..)
     hashtbl_printval_cb printval_callback; // Debug print of object
-    hashtbl_find_verify_cb find_verify_callback; // Verify found object matches extra criteria (called locked without increasing ref)
+    hashtbl_size_cb size_callback; // Memory attached to the object, called once when it is added
+    // Verify found object matches extra criteria.  Without rcu_lookup it is called under the bucket read lock
+    //  without taking a reference.  With rcu_lookup it is called holding a reference but no lock, and may run
+    //  concurrently with writers on the same bucket, so it must not rely on the bucket lock for exclusion.
+    hashtbl_find_verify_cb find_verify_callback;
 } HashTbl;
 
 bool ec_hashtbl_startup(ProcessContext *context);
@@ -107,13 +188,16 @@ size_t ec_hashtbl_get_memory(ProcessContext *context);
 void ec_hashtbl_debug_on(void);
 void ec_hashtbl_debug_off(void);
 
+// Resize the table now if the load calls for it, and wait for any resize to complete
+void ec_hashtbl_resize_sync(HashTbl *hashTblp, ProcessContext *context);
+
 bool ec_hashtbl_read_bkt_lock(HashTbl *hashTblp, void *key, void **datap, HashTableBkt **bkt,
                               ProcessContext *context);
-void ec_hashtbl_read_bkt_unlock(HashTableBkt *bkt, ProcessContext *context);
+void ec_hashtbl_read_bkt_unlock(HashTbl *hashTblp, void *key, ProcessContext *context);
 
 bool ec_hashtbl_write_bkt_lock(HashTbl *hashTblp, void *key, void **datap, HashTableBkt **bkt,
                                ProcessContext *context);
-void ec_hashtbl_write_bkt_unlock(HashTableBkt *bkt, ProcessContext *context);
+void ec_hashtbl_write_bkt_unlock(HashTbl *hashTblp, void *key, ProcessContext *context);
 
 void ec_hashtbl_read_lock(HashTbl *hashTblp, void *key, ProcessContext *context);
 void ec_hashtbl_read_unlock(HashTbl *hashTblp, void *key, ProcessContext *context);
@@ -7,11 +7,36 @@
 #include "process-context.h"
 #include "priv.h"
 
+#include <linux/hash.h>
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 0, 0)  //{
 #define CURRENT_TIME_SEC ((struct timespec) { get_seconds(), 0 })
 #endif  //}
 
 extern bool g_enable_hook_tracking;
+extern bool g_enable_hook_profiling;
+
+// Hook profiling counts the calls and time spent in each hook per-CPU.  Each hook is given a
+//  slot the first time it is seen, keyed by its __func__ pointer, so finding the slot is a
+//  hash and usually a single compare.  Slots are released when the profile is reset.
+#define HOOK_PROFILE_BITS   6
+#define HOOK_PROFILE_SLOTS  (1 << HOOK_PROFILE_BITS)
+
+typedef struct hook_profile {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} HOOK_PROFILE;
+
+typedef struct hook_profile_table {
+    HOOK_PROFILE slots[HOOK_PROFILE_SLOTS];
+} HOOK_PROFILE_TABLE;
+
+static const char *s_hook_profile_names[HOOK_PROFILE_SLOTS];
+static DEFINE_PER_CPU(HOOK_PROFILE_TABLE, s_hook_profile);
+
+static int __ec_hook_profile_slot(const char *hook_name);
+static void __ec_hook_profile_fold(int slot, HOOK_PROFILE *totals);
 
 static struct ec_hook_tracking_node
 {
@@ -33,9 +58,12 @@ void ec_hook_tracking_shutdown(ProcessContext *context)
 
 void ec_hook_tracking_add_entry(ProcessContext *context, const char *hook_name)
 {
-    CANCEL_VOID(g_enable_hook_tracking);
     CANCEL_VOID(context);
 
+    ec_hook_profile_enter(context, hook_name);
+
+    CANCEL_VOID(g_enable_hook_tracking);
+
     if (!context->hook_tracking.hook_name)
     {
         ec_write_lock(&s_hook_tracking.lock, context);
@@ -56,9 +84,12 @@ void ec_hook_tracking_add_entry(ProcessContext *context, const char *hook_name)
 
 void ec_hook_tracking_del_entry(ProcessContext *context)
 {
-    CANCEL_VOID(g_enable_hook_tracking);
     CANCEL_VOID(context);
 
+    ec_hook_profile_exit(context);
+
+    CANCEL_VOID(g_enable_hook_tracking);
+
     ATOMIC64_DEC__CHECK_NEG(&context->hook_tracking.count);
     context->hook_tracking.last_enter_time = 0;
     context->hook_tracking.last_pid = 0;
@@ -116,3 +147,168 @@ int ec_show_active_hooks(struct seq_file *seq_file, void *v)
 
     return 0;
 }
+
+void ec_hook_profile_enter(ProcessContext *context, const char *hook_name)
+{
+    int slot;
+
+    CANCEL_VOID(g_enable_hook_profiling);
+
+    slot = __ec_hook_profile_slot(hook_name);
+    CANCEL_VOID(slot >= 0);
+
+    // The module disable check has already stamped the entry time for most hooks
+    if (!context->enter_time_ns)
+    {
+        context->enter_time_ns = ktime_to_ns(ktime_get());
+    }
+    context->hook_profile_slot = slot + 1;
+}
+
+void ec_hook_profile_exit(ProcessContext *context)
+{
+    HOOK_PROFILE *profile;
+    uint64_t      elapsed_ns;
+    int           slot = context->hook_profile_slot - 1;
+
+    CANCEL_VOID(slot >= 0);
+    context->hook_profile_slot = 0;
+
+    elapsed_ns = ktime_to_ns(ktime_get()) - context->enter_time_ns;
+
+    // The count and total may be updated from an interrupt on the same CPU so use the irq
+    //  safe operations.  A lost max update is harmless.
+    this_cpu_inc(s_hook_profile.slots[slot].count);
+    this_cpu_add(s_hook_profile.slots[slot].total_ns, elapsed_ns);
+
+    profile = get_cpu_ptr(&s_hook_profile.slots[slot]);
+    if (elapsed_ns > profile->max_ns)
+    {
+        profile->max_ns = elapsed_ns;
+    }
+    put_cpu_ptr(&s_hook_profile.slots[slot]);
+}
+
+static int __ec_hook_profile_slot(const char *hook_name)
+{
+    int start = hash_ptr((void *)hook_name, HOOK_PROFILE_BITS);
+    int i;
+
+    for (i = 0; i < HOOK_PROFILE_SLOTS; ++i)
+    {
+        int         slot = (start + i) & (HOOK_PROFILE_SLOTS - 1);
+        const char *name = READ_ONCE(s_hook_profile_names[slot]);
+
+        if (!name)
+        {
+            // Claim the empty slot, or use it if another CPU claimed it for the same hook
+            name = cmpxchg(&s_hook_profile_names[slot], NULL, hook_name);
+            if (!name)
+            {
+                return slot;
+            }
+        }
+
+        if (name == hook_name)
+        {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+static void __ec_hook_profile_fold(int slot, HOOK_PROFILE *totals)
+{
+    int cpu;
+
+    memset(totals, 0, sizeof(*totals));
+    for_each_possible_cpu(cpu)
+    {
+        HOOK_PROFILE *profile = &per_cpu(s_hook_profile, cpu).slots[slot];
+
+        totals->count    += READ_ONCE(profile->count);
+        totals->total_ns += READ_ONCE(profile->total_ns);
+        totals->max_ns    = max_t(uint64_t, totals->max_ns, READ_ONCE(profile->max_ns));
+    }
+}
+
+bool ec_hook_profile_get(const char *hook_name, uint64_t *count, uint64_t *total_ns, uint64_t *max_ns)
+{
+    HOOK_PROFILE totals;
+    int          slot;
+
+    for (slot = 0; slot < HOOK_PROFILE_SLOTS; ++slot)
+    {
+        if (READ_ONCE(s_hook_profile_names[slot]) == hook_name)
+        {
+            __ec_hook_profile_fold(slot, &totals);
+            *count    = totals.count;
+            *total_ns = totals.total_ns;
+            *max_ns   = totals.max_ns;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// This is called when reading the proc file
+int ec_show_hook_profile(struct seq_file *seq_file, void *v)
+{
+    HOOK_PROFILE totals;
+    uint64_t     total_ns = 0;
+    int          slot;
+
+    if (!g_enable_hook_profiling)
+    {
+        seq_puts(seq_file, "Hook profiling is disabled (enable_hook_profiling=1)\n");
+    }
+
+    seq_printf(seq_file, "%35s | %12s | %12s | %9s | %10s |\n",
+                "HOOK", "CALLS", "TOTAL us", "AVG ns", "MAX us");
+
+    for (slot = 0; slot < HOOK_PROFILE_SLOTS; ++slot)
+    {
+        const char *name = READ_ONCE(s_hook_profile_names[slot]);
+
+        if (!name)
+        {
+            continue;
+        }
+
+        __ec_hook_profile_fold(slot, &totals);
+        total_ns += totals.total_ns;
+
+        seq_printf(seq_file, "%35s | %12llu | %12llu | %9llu | %10llu |\n",
+                      name,
+                      totals.count,
+                      div_u64(totals.total_ns, NSEC_PER_USEC),
+                      totals.count ? div64_u64(totals.total_ns, totals.count) : 0,
+                      div_u64(totals.max_ns, NSEC_PER_USEC));
+    }
+    seq_printf(seq_file, "Total %llu us\n", div_u64(total_ns, NSEC_PER_USEC));
+
+    return 0;
+}
+
+// Clears the counters and releases every slot.  A hook running during the reset may leave a
+//  few counts behind, in a slot that is claimed again on its next call.
+void ec_hook_profile_reset(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        memset(per_cpu_ptr(&s_hook_profile, cpu), 0, sizeof(HOOK_PROFILE_TABLE));
+    }
+    memset(s_hook_profile_names, 0, sizeof(s_hook_profile_names));
+}
+
+// Writing anything to the proc file resets the profile
+ssize_t ec_reset_hook_profile(struct file *file, const char *buf, size_t size, loff_t *ppos)
+{
+    ec_hook_profile_reset();
+
+    return size;
+}
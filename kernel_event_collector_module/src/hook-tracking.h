@@ -19,3 +19,11 @@ void ec_hook_tracking_shutdown(ProcessContext *context);
 void ec_hook_tracking_add_entry(ProcessContext *context, const char *hook_name);
 void ec_hook_tracking_del_entry(ProcessContext *context);
 int ec_hook_tracking_print_active(ProcessContext *context);
+
+// The profiler is enabled with the enable_hook_profiling module parameter.  It records the
+//  count, total and max time of each hook per-CPU.  Hooks using the module disable check macros
+//  are profiled automatically, other hooks can call these directly.
+void ec_hook_profile_enter(ProcessContext *context, const char *hook_name);
+void ec_hook_profile_exit(ProcessContext *context);
+bool ec_hook_profile_get(const char *hook_name, uint64_t *count, uint64_t *total_ns, uint64_t *max_ns);
+void ec_hook_profile_reset(void);
@@ -26,6 +26,20 @@ logger_work, *plogger_work;
 
 static CB_MEM_CACHE s_event_cache = {
     .printval_callback = __ec_logger_event_print_callback,
+    .magazine_size = 32,
+};
+
+// Events that carry strings are allocated with room for them after the node, so the strings
+//  are copied in place and released with the event.  Strings that do not fit still fall back
+//  to ec_mem_strdup.
+//
+// The only user is the web proxy event, whose server string is bounded by PROXY_SERVER_MAX_LEN.
+//  Paths are shared with the path cache by reference instead (see ec_event_send_block).
+#define EVENT_INLINE_SIZE  PROXY_SERVER_MAX_LEN
+
+static CB_MEM_CACHE s_event_inline_cache = {
+    .printval_callback = __ec_logger_event_print_callback,
+    .magazine_size = 16,
 };
 
 static const struct timespec null_time = {0, 0};
@@ -56,6 +70,15 @@ time_t ec_get_null_time(void)
     return TO_WIN_TIME(0, 0);
 }
 
+// Strings copied into the event by ec_event_strdup go away with it
+static inline void __ec_event_free_string(CB_EVENT_NODE *node, char *str)
+{
+    if (str && (str < node->inline_buf || str >= node->inline_buf + node->inline_size))
+    {
+        ec_mem_free(str);
+    }
+}
+
 // Coverity thinks that we leak the event because we use containerof to get the list node.  Tell it that this
 //  will free the event
 // coverity[+free : arg-0]
@@ -89,7 +112,7 @@ void ec_free_event(PCB_EVENT event, ProcessContext *context)
         case CB_EVENT_TYPE_MODULE_LOAD:
             if (event->moduleLoad.path)
             {
-                ec_mem_free(event->moduleLoad.path);
+                __ec_event_free_string(node, event->moduleLoad.path);
                 event->moduleLoad.path = NULL;
             }
             break;
@@ -120,7 +143,7 @@ void ec_free_event(PCB_EVENT event, ProcessContext *context)
         case CB_EVENT_TYPE_WEB_PROXY:
             if (event->netConnect.actual_server)
             {
-                ec_mem_free(event->netConnect.actual_server);
+                __ec_event_free_string(node, event->netConnect.actual_server);
                 event->netConnect.actual_server = NULL;
             }
             break;
@@ -128,7 +151,7 @@ void ec_free_event(PCB_EVENT event, ProcessContext *context)
         case CB_EVENT_TYPE_PROCESS_BLOCKED:
             if (event->blockResponse.path)
             {
-                ec_mem_free(event->blockResponse.path);
+                __ec_event_free_string(node, event->blockResponse.path);
                 event->blockResponse.path = NULL;
             }
             break;
@@ -141,48 +164,58 @@ void ec_free_event(PCB_EVENT event, ProcessContext *context)
     }
 }
 
+uint64_t g_event_interest __read_mostly;
+
+static DEFINE_SPINLOCK(s_event_interest_lock);
+
 bool ec_logger_should_log(CB_EVENT_TYPE eventType)
 {
-    switch (eventType)
+    return (unsigned int)eventType < CB_EVENT_TYPE_MAX
+        && ec_logger_is_interested(EVENT_INTEREST(eventType));
+}
+
+// This must be called after anything that feeds the mask changes.  The lock keeps two
+//  updates from publishing their results out of order.
+void ec_logger_update_interest(void)
+{
+    uint64_t interest = 0;
+
+    spin_lock(&s_event_interest_lock);
+
+    // Events are dropped at the queue when nobody is reading them
+    if (ec_is_reader_connected())
     {
-    case CB_EVENT_TYPE_PROCESS_START_FORK:
-    case CB_EVENT_TYPE_PROCESS_START_EXEC:
-    case CB_EVENT_TYPE_DISCOVER:
-    case CB_EVENT_TYPE_DISCOVER_COMPLETE:
-    case CB_EVENT_TYPE_DISCOVER_FLUSH:
-    case CB_EVENT_TYPE_PROCESS_EXIT:
-    case CB_EVENT_TYPE_PROCESS_LAST_EXIT:
-        return g_driver_config.processes != DISABLE;
-        break;
+        interest |= EVENT_INTEREST_ALWAYS;
 
-    case CB_EVENT_TYPE_MODULE_LOAD:
-        return g_driver_config.module_loads == ENABLE;
-
-    case CB_EVENT_TYPE_FILE_CREATE:
-    case CB_EVENT_TYPE_FILE_DELETE:
-    case CB_EVENT_TYPE_FILE_WRITE:
-    case CB_EVENT_TYPE_FILE_CLOSE:
-    case CB_EVENT_TYPE_FILE_OPEN:
-        return g_driver_config.file_mods == ENABLE;
-
-    case CB_EVENT_TYPE_NET_CONNECT_PRE:
-    case CB_EVENT_TYPE_NET_CONNECT_POST:
-    case CB_EVENT_TYPE_NET_ACCEPT:
-    case CB_EVENT_TYPE_DNS_RESPONSE:
-        return g_driver_config.net_conns == ENABLE;
-
-    case CB_EVENT_TYPE_PROCESS_BLOCKED:
-    case CB_EVENT_TYPE_PROCESS_NOT_BLOCKED:
-    case CB_EVENT_TYPE_HEARTBEAT:
-    case CB_EVENT_TYPE_WEB_PROXY:
-        return true;
+        if (g_driver_config.processes != DISABLE)
+        {
+            interest |= EVENT_INTEREST_PROCESS;
+        }
+        if (g_driver_config.module_loads == ENABLE)
+        {
+            interest |= EVENT_INTEREST(CB_EVENT_TYPE_MODULE_LOAD);
+        }
+        if (g_driver_config.file_mods == ENABLE)
+        {
+            interest |= EVENT_INTEREST_FILE;
+        }
+        if (g_driver_config.net_conns == ENABLE)
+        {
+            interest |= EVENT_INTEREST_NET;
+        }
+    }
 
-    default:
-        TRACE(DL_WARNING, "Unknown shouldlog event type %d", eventType);
-        return true;
+    if (g_edr_server_uid != (uid_t)-1 || ec_banning_HasIgnoredUids())
+    {
+        interest |= EVENT_INTEREST_UID_FILTER;
     }
-}
 
+    WRITE_ONCE(g_event_interest, interest);
+
+    spin_unlock(&s_event_interest_lock);
+
+    TRACE(DL_INFO, "Event interest mask 0x%llx", interest);
+}
 
 bool ec_shouldExcludeByUID(ProcessContext *context, uid_t uid)
 {
@@ -196,10 +229,46 @@ bool ec_shouldExcludeByUID(ProcessContext *context, uid_t uid)
 
 // coverity[+alloc]
 PCB_EVENT ec_alloc_event(CB_EVENT_TYPE eventType, ProcessContext *context)
+{
+    return ec_alloc_event_inline(eventType, 0, context);
+}
+
+// Copy a string into the space reserved by ec_alloc_event_inline, or allocate it if there is not
+//  enough left.  Either way it is released by ec_free_event.
+char *ec_event_strdup(PCB_EVENT event, const char *src, uint16_t *size, ProcessContext *context)
+{
+    CB_EVENT_NODE *node = container_of(event, CB_EVENT_NODE, data);
+    char          *dest;
+    size_t         len;
+
+    CANCEL(src, NULL);
+
+    len = strlen(src) + 1;
+    if (len <= node->inline_size - node->inline_used)
+    {
+        dest = node->inline_buf + node->inline_used;
+        node->inline_used += len;
+        memcpy(dest, src, len);
+    } else
+    {
+        dest = ec_mem_strdup(src, context);
+        len  = ec_mem_size(dest);
+    }
+
+    if (size)
+    {
+        *size = dest ? (uint16_t)len : 0;
+    }
+    return dest;
+}
+
+// coverity[+alloc]
+PCB_EVENT ec_alloc_event_inline(CB_EVENT_TYPE eventType, size_t inline_size, ProcessContext *context)
 {
     CB_EVENT_NODE *node = NULL;
+    CB_MEM_CACHE *cache = &s_event_cache;
+    uint16_t cache_inline_size = 0;
     PCB_EVENT event = NULL;
-    uid_t uid = GET_UID();
     CB_EVENT_TYPE resolvedEventType = eventType;
 
     // We use some semi-private event types to provide some extra granularity.
@@ -217,9 +286,16 @@ PCB_EVENT ec_alloc_event(CB_EVENT_TYPE eventType, ProcessContext *context)
         break;
     }
 
-    TRY(!ec_shouldExcludeByUID(context, uid));
+    // Only read the creds when there is a uid to compare against
+    TRY(!ec_logger_is_interested(EVENT_INTEREST_UID_FILTER) || !ec_shouldExcludeByUID(context, GET_UID()));
 
-    node = (CB_EVENT_NODE *)ec_mem_cache_alloc(&s_event_cache, context);
+    if (inline_size)
+    {
+        cache = &s_event_inline_cache;
+        cache_inline_size = EVENT_INLINE_SIZE;
+    }
+
+    node = (CB_EVENT_NODE *)ec_mem_cache_alloc(cache, context);
 
     TRY_DO(node, {
         TRACE(DL_WARNING, "Error allocating event with mode %s, pid: %d", IS_ATOMIC(context) ? "ATOMIC" : "KERNEL", context->pid);
@@ -227,6 +303,7 @@ PCB_EVENT ec_alloc_event(CB_EVENT_TYPE eventType, ProcessContext *context)
 
     memset(node, 0, sizeof(*node));
     INIT_LIST_HEAD(&node->listEntry);
+    node->inline_size = cache_inline_size;
 
     event              = &node->data;
 
@@ -257,11 +334,21 @@ bool ec_logger_initialize(ProcessContext *context)
         return false;
     }
 
+    if (!ec_mem_cache_create(&s_event_inline_cache, "event_cache_inline",
+                             sizeof(CB_EVENT_NODE) + EVENT_INLINE_SIZE, context))
+    {
+        ec_mem_cache_destroy(&s_event_cache, context);
+        return false;
+    }
+
+    ec_logger_update_interest();
+
     return true;
 }
 
 void ec_logger_shutdown(ProcessContext *context)
 {
+    ec_mem_cache_destroy(&s_event_inline_cache, context);
     ec_mem_cache_destroy(&s_event_cache, context);
 }
 
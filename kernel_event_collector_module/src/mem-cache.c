@@ -19,12 +19,18 @@ static struct
 
 typedef struct cache_buffer {
     uint32_t  magic;
-    struct list_head  list;
+    union {
+        // The tracking list entry is always removed before an RCU free is queued
+        struct list_head  list;
+        struct rcu_head   rcu;
+    };
     CB_MEM_CACHE *cache;
 
     // This tracks the owners of this object
     atomic64_t refcnt;
     bool is_owned;
+    bool is_tracked;    // On the allocation_list of track_cpu
+    uint16_t track_cpu;
 } cache_buffer_t;
 
 #define CACHE_BUFFER_MAGIC   0xDEADBEEF
@@ -68,12 +74,30 @@ bool ec_mem_cache_create(CB_MEM_CACHE *cache, const char *name, size_t size, Pro
 {
     if (cache)
     {
+        int cpu;
+
         cache->object_size = size;
+        cache->magazine_size = min_t(uint32_t, cache->magazine_size, CB_MEM_CACHE_MAGAZINE_MAX);
         // prefix the cache name with a unique prefix to avoid conflicts with cbr
         cache->name[0] = 0;
         strncat(cache->name, MEM_CACHE_PREFIX, CB_MEM_CACHE_NAME_LEN);
         strncat(cache->name, name, CB_MEM_CACHE_NAME_LEN - MEM_CACHE_PREFIX_LEN);
-        INIT_LIST_HEAD(&cache->allocation_list);
+
+        cache->percpu = ec_alloc_percpu(CB_MEM_CACHE_PERCPU, GFP_MODE(context));
+        if (unlikely(!cache->percpu))
+        {
+            cache->kmem_cache = NULL;
+            return false;
+        }
+
+        for_each_possible_cpu(cpu)
+        {
+            CB_MEM_CACHE_PERCPU *percpu = per_cpu_ptr(cache->percpu, cpu);
+
+            ec_embedded_lock_init(&percpu->lock, context);
+            INIT_LIST_HEAD(&percpu->allocation_list);
+            percpu->count = 0;
+        }
 
         cache->kmem_cache = kmem_cache_create(
             cache->name,
@@ -86,17 +110,83 @@ bool ec_mem_cache_create(CB_MEM_CACHE *cache, const char *name, size_t size, Pro
 
         if (likely(cache->kmem_cache))
         {
-            ec_spinlock_init(&cache->lock, context);
             ec_write_lock(&s_mem_cache.lock, context);
             list_add(&cache->node, &s_mem_cache.list);
             ec_write_unlock(&s_mem_cache.lock, context);
 
             return true;
         }
+
+        free_percpu(cache->percpu);
+        cache->percpu = NULL;
     }
     return false;
 }
 
+// Hand every object sitting in a magazine back to kmem_cache
+static void __ec_mem_cache_drain_magazines(CB_MEM_CACHE *cache)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        CB_MEM_CACHE_PERCPU *percpu = per_cpu_ptr(cache->percpu, cpu);
+
+        while (percpu->count > 0)
+        {
+            kmem_cache_free(cache->kmem_cache, percpu->objects[--percpu->count]);
+        }
+    }
+}
+
+// The magazine is only touched by its own CPU.  Interrupts are disabled because objects are also
+//  allocated and freed from softirq context (netfilter hooks and RCU callbacks).
+static void *__ec_mem_cache_magazine_pop(CB_MEM_CACHE *cache)
+{
+    void *object = NULL;
+    unsigned long flags;
+    CB_MEM_CACHE_PERCPU *percpu;
+
+    local_irq_save(flags);
+    percpu = this_cpu_ptr(cache->percpu);
+    if (percpu->count > 0)
+    {
+        object = percpu->objects[--percpu->count];
+    }
+    local_irq_restore(flags);
+
+    return object;
+}
+
+static bool __ec_mem_cache_magazine_push(CB_MEM_CACHE *cache, void *object)
+{
+    bool pushed = false;
+    unsigned long flags;
+    CB_MEM_CACHE_PERCPU *percpu;
+
+    local_irq_save(flags);
+    percpu = this_cpu_ptr(cache->percpu);
+    if (percpu->count < cache->magazine_size)
+    {
+        percpu->objects[percpu->count++] = object;
+        pushed = true;
+    }
+    local_irq_restore(flags);
+
+    return pushed;
+}
+
+static void __ec_mem_cache_free_object(CB_MEM_CACHE *cache, cache_buffer_t *cache_buffer)
+{
+    // Catch anyone still holding a pointer to this object
+    cache_buffer->magic = 0;
+
+    if (!cache->magazine_size || !__ec_mem_cache_magazine_push(cache, cache_buffer))
+    {
+        kmem_cache_free(cache->kmem_cache, (void *)cache_buffer);
+    }
+}
+
 uint64_t ec_mem_cache_destroy(CB_MEM_CACHE *cache, ProcessContext *context)
 {
     uint64_t allocated_count = 0;
@@ -119,30 +209,44 @@ uint64_t ec_mem_cache_destroy(CB_MEM_CACHE *cache, ProcessContext *context)
             {
                 struct cache_buffer *cache_buffer = NULL;
                 void *value = NULL;
+                int cpu;
 
-                ec_write_lock(&cache->lock, context);
-                list_for_each_entry(cache_buffer, &cache->allocation_list, list)
+                for_each_possible_cpu(cpu)
                 {
-                    if (likely(cache_buffer))
+                    CB_MEM_CACHE_PERCPU *percpu = per_cpu_ptr(cache->percpu, cpu);
+
+                    ec_embedded_write_lock(&percpu->lock, context);
+                    list_for_each_entry(cache_buffer, &percpu->allocation_list, list)
                     {
-                        TRACE(DL_ERROR, "    CACHE %s (ref: %ld) (%p)",
-                            cache->name,
-                            atomic64_read(&cache_buffer->refcnt),
-                            cache_buffer);
-                        if (cache->printval_callback)
+                        if (likely(cache_buffer))
                         {
-                            value = __ec_get_valuep(cache_buffer);
-                            cache->printval_callback(value, context);
+                            TRACE(DL_ERROR, "    CACHE %s (ref: %ld) (%p)",
+                                cache->name,
+                                atomic64_read(&cache_buffer->refcnt),
+                                cache_buffer);
+                            if (cache->printval_callback)
+                            {
+                                value = __ec_get_valuep(cache_buffer);
+                                cache->printval_callback(value, context);
+                            }
                         }
                     }
+                    ec_embedded_write_unlock(&percpu->lock, context);
                 }
-                ec_write_unlock(&cache->lock, context);
-
             }
         }
 
         percpu_counter_destroy(&cache->allocated_count);
-        ec_spinlock_destroy(&cache->lock, context);
+
+        if (cache->rcu_free)
+        {
+            // Wait for any pending RCU frees to return their objects to the cache
+            rcu_barrier();
+        }
+
+        __ec_mem_cache_drain_magazines(cache);
+        free_percpu(cache->percpu);
+        cache->percpu = NULL;
 
         kmem_cache_destroy(cache->kmem_cache);
         cache->kmem_cache = NULL;
@@ -171,13 +275,21 @@ void *ec_mem_cache_alloc(CB_MEM_CACHE *cache, ProcessContext *context)
 
     if (likely(cache && cache->kmem_cache))
     {
-        value = kmem_cache_alloc(cache->kmem_cache, CHECK_GFP(context));
+        if (cache->magazine_size)
+        {
+            value = __ec_mem_cache_magazine_pop(cache);
+        }
+        if (!value)
+        {
+            value = kmem_cache_alloc(cache->kmem_cache, CHECK_GFP(context));
+        }
         if (value)
         {
             cache_buffer_t *cache_buffer = (cache_buffer_t *)value;
 
             cache_buffer->magic = CACHE_BUFFER_MAGIC;
             cache_buffer->is_owned = true;
+            cache_buffer->is_tracked = false;
 
             // Init the refcount and take an initial reference
             atomic64_set(&cache_buffer->refcnt, 1);
@@ -186,9 +298,16 @@ void *ec_mem_cache_alloc(CB_MEM_CACHE *cache, ProcessContext *context)
             percpu_counter_inc(&cache->allocated_count);
             if (g_enable_mem_cache_tracking)
             {
-                ec_write_lock(&cache->lock, context);
-                list_add(&cache_buffer->list, &cache->allocation_list);
-                ec_write_unlock(&cache->lock, context);
+                // Track on the local list so allocations on different CPUs do not contend
+                CB_MEM_CACHE_PERCPU *percpu;
+
+                cache_buffer->track_cpu = raw_smp_processor_id();
+                cache_buffer->is_tracked = true;
+                percpu = per_cpu_ptr(cache->percpu, cache_buffer->track_cpu);
+
+                ec_embedded_write_lock(&percpu->lock, context);
+                list_add(&cache_buffer->list, &percpu->allocation_list);
+                ec_embedded_write_unlock(&percpu->lock, context);
             }
 
             value = __ec_get_valuep(cache_buffer);
@@ -229,6 +348,15 @@ bool ec_mem_cache_is_owned(void *value, ProcessContext *context)
     return false;
 }
 
+static void __ec_mem_cache_free_object(CB_MEM_CACHE *cache, cache_buffer_t *cache_buffer);
+
+static void __ec_mem_cache_free_rcu(struct rcu_head *rcu)
+{
+    cache_buffer_t *cache_buffer = container_of(rcu, cache_buffer_t, rcu);
+
+    __ec_mem_cache_free_object(cache_buffer->cache, cache_buffer);
+}
+
 void __ec_mem_cache_release(cache_buffer_t *cache_buffer, ProcessContext *context)
 {
     if (likely(cache_buffer && cache_buffer->cache))
@@ -244,16 +372,28 @@ void __ec_mem_cache_release(cache_buffer_t *cache_buffer, ProcessContext *contex
                 cache->delete_callback(value, context);
             }
 
-            if (g_enable_mem_cache_tracking)
+            // Tracking may have been switched on after this object was allocated
+            if (cache_buffer->is_tracked)
             {
-                ec_write_lock(&cache->lock, context);
+                CB_MEM_CACHE_PERCPU *percpu = per_cpu_ptr(cache->percpu, cache_buffer->track_cpu);
+
+                ec_embedded_write_lock(&percpu->lock, context);
                 list_del_init(&cache_buffer->list);
-                ec_write_unlock(&cache->lock, context);
+                ec_embedded_write_unlock(&percpu->lock, context);
+                cache_buffer->is_tracked = false;
             }
 
             if (likely(cache_buffer->cache->kmem_cache))
             {
-                kmem_cache_free(cache->kmem_cache, (void *)cache_buffer);
+                if (cache->rcu_free)
+                {
+                    // RCU readers may still be looking at this object, so wait for a grace period
+                    //  before giving it back.  ec_mem_cache_destroy waits for these with rcu_barrier.
+                    call_rcu(&cache_buffer->rcu, __ec_mem_cache_free_rcu);
+                } else
+                {
+                    __ec_mem_cache_free_object(cache, cache_buffer);
+                }
             } else
             {
                     TRACE(DL_ERROR, "Cache %s already destroyed.  Failed to free memory: %p",
@@ -287,6 +427,25 @@ void ec_mem_cache_get(void *value, ProcessContext *context)
     }
 }
 
+bool ec_mem_cache_get_unless_zero(void *value, ProcessContext *context)
+{
+    if (value)
+    {
+        cache_buffer_t *cache_buffer = __ec_get_bufferp(value);
+
+        if (likely(cache_buffer->magic == CACHE_BUFFER_MAGIC))
+        {
+            return atomic64_inc_not_zero(&cache_buffer->refcnt);
+        } else
+        {
+            TRACE(DL_ERROR, "%s: Cache entry magic does not match.  Failed to get memory: %p %x", __func__, value, cache_buffer->magic);
+            CB_BUG();
+        }
+    }
+
+    return false;
+}
+
 void ec_mem_cache_put(void *value, ProcessContext *context)
 {
     if (value)
@@ -365,18 +524,27 @@ int ec_mem_cache_show(struct seq_file *m, void *v)
 
     DECLARE_NON_ATOMIC_CONTEXT(context, ec_getpid(current));
 
-    seq_printf(m, "%40s | %6s | %40s | %9s |\n",
-                  "Name", "Alloc", "Cache Name", "Obj. Size");
+    seq_printf(m, "%40s | %6s | %6s | %40s | %9s |\n",
+                  "Name", "Alloc", "Cached", "Cache Name", "Obj. Size");
 
     ec_write_lock(&s_mem_cache.lock, &context);
     list_for_each_entry(cache, &s_mem_cache.list, node) {
             const char *cache_name = cache->kmem_cache ? cache->kmem_cache->name : "";
             int         cache_size = cache->object_size;
             long        count      = percpu_counter_sum_positive(&cache->allocated_count);
+            long        cached     = 0;
+            int         cpu;
+
+            // Objects held in magazines are free but not yet returned to kmem_cache
+            for_each_possible_cpu(cpu)
+            {
+                cached += per_cpu_ptr(cache->percpu, cpu)->count;
+            }
 
-            seq_printf(m, "%40s | %6ld | %40s | %9d |\n",
+            seq_printf(m, "%40s | %6ld | %6ld | %40s | %9d |\n",
                        cache->name,
                        count,
+                       cached,
                        cache_name,
                        cache_size);
             size += count * cache_size;
@@ -9,22 +9,41 @@
 
 #include "process-context.h"
 #include "percpu-util.h"
+#include "cb-spinlock.h"
 
 #define CB_MEM_CACHE_NAME_LEN    43
+#define CB_MEM_CACHE_MAGAZINE_MAX 64
 
 typedef void (*cache_delete_cb)(void *value, ProcessContext *context);
 typedef void (*cache_printval_cb)(void *value, ProcessContext *context);
 
+// Per CPU state for a cache.  The magazine holds freed objects that are handed back out on this CPU
+//  without going to kmem_cache.  When g_enable_mem_cache_tracking is set, objects allocated on this CPU
+//  are kept on allocation_list.  They may be freed from any CPU, so the list has its own lock.
+typedef struct CB_MEM_CACHE_PERCPU {
+    linuxSpinlock_t    lock;
+    struct list_head   allocation_list;
+    uint32_t           count;
+    void              *objects[CB_MEM_CACHE_MAGAZINE_MAX];
+} CB_MEM_CACHE_PERCPU;
+
 typedef struct CB_MEM_CACHE {
     struct list_head   node;
-    struct list_head   allocation_list;
-    uint64_t           lock;
+    CB_MEM_CACHE_PERCPU __percpu *percpu;
     struct percpu_counter allocated_count;
     struct kmem_cache *kmem_cache;
     uint32_t           object_size;
     uint8_t            name[CB_MEM_CACHE_NAME_LEN + 1];
     cache_delete_cb    delete_callback;
     cache_printval_cb  printval_callback;
+
+    // Set before ec_mem_cache_create when objects may be read under rcu_read_lock.
+    //  The final put will wait for a grace period before handing the memory back to kmem_cache.
+    bool               rcu_free;
+
+    // Set before ec_mem_cache_create to keep up to this many freed objects per CPU for reuse.
+    //  Meant for hot caches.  0 sends every free straight back to kmem_cache.
+    uint32_t           magazine_size;
 } CB_MEM_CACHE;
 
 // checkpatch-ignore: COMPLEX_MACRO
@@ -47,6 +66,9 @@ void *ec_mem_cache_alloc(CB_MEM_CACHE *cache, ProcessContext *context);
 void ec_mem_cache_disown(void *value, ProcessContext *context);
 bool ec_mem_cache_is_owned(void *value, ProcessContext *context);
 void ec_mem_cache_get(void *value, ProcessContext *context);
+
+// Takes a reference only if the object is not already being released.  Used by RCU readers.
+bool ec_mem_cache_get_unless_zero(void *value, ProcessContext *context);
 void ec_mem_cache_put(void *value, ProcessContext *context);
 int64_t ec_mem_cache_ref_count(void *value, ProcessContext *context);
 int64_t ec_mem_cache_get_allocated_count(CB_MEM_CACHE *cache, ProcessContext *context);
@@ -28,6 +28,7 @@ typedef struct _ModuleStateInfo {
 // - Keep track of a counter use_count, to allow for safe rmmod.
 
 extern ModuleStateInfo g_module_state_info;
+extern bool g_enable_latency_stats;
 
 //-------------------------------------------------
 // Module usage protection
@@ -56,6 +57,10 @@ do {
     else                                                                            \
     {                                                                               \
         (CONTEXT)->decr_active_call_count_on_exit = true;                           \
+        if (g_enable_latency_stats)                                                 \
+        {                                                                           \
+            (CONTEXT)->enter_time_ns = ktime_to_ns(ktime_get());                    \
+        }                                                                           \
         this_cpu_inc(module_active_inuse);                                          \
     }                                                                               \
                                                                                     \
@@ -91,6 +96,7 @@ do {                                                                           \
    {                                                                           \
        (CONTEXT)->decr_active_call_count_on_exit = false;                      \
        ec_hook_tracking_del_entry((CONTEXT));                                  \
+       (CONTEXT)->enter_time_ns = 0;                                           \
        this_cpu_dec(module_active_inuse);                                      \
    }                                                                           \
 }                                                                              \
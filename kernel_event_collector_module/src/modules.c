@@ -31,6 +31,8 @@ int ec_lsm_file_mmap(struct file *file,
 
     MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
 
+    TRY(ec_logger_is_interested(EVENT_INTEREST(CB_EVENT_TYPE_MODULE_LOAD)));
+
     TRY((prot & PROT_EXEC) && !(prot & PROT_WRITE));
 
     TRY(file);
@@ -68,7 +70,7 @@ int ec_lsm_file_mmap(struct file *file,
         path_data->key.inode,
         //path_data->fs_magic, // We should include the fs_magic
         MMAP_ADDRESS(),
-        path_data->path,
+        path_data,
         &context);
 
 CATCH_DEFAULT:
@@ -81,6 +81,8 @@ int ec_sendmsg_ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 
     MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
 
+    TRY(ec_logger_is_interested(EVENT_INTEREST_NET));
+
     TRY(retval >= 0);
     TRY(data);
     TRY(CHECK_SK_FAMILY(data->sk) && CHECK_SK_PROTO_UDP(data->sk));
@@ -113,6 +115,8 @@ int ec_recvmsg_ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 
     MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
 
+    TRY(ec_logger_is_interested(EVENT_INTEREST_NET));
+
     TRY(skb);
     TRY(data);
     TRY(CHECK_SK_FAMILY(data->sk) && CHECK_SK_PROTO_UDP(data->sk));
@@ -141,6 +145,8 @@ int ec_accept_ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 
     MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
 
+    TRY(ec_logger_is_interested(EVENT_INTEREST_NET));
+
     TRY(data->sk && newsk);
 
     ec_getsockname(newsk, &localAddr);
@@ -166,6 +172,8 @@ int ec_connect_ret_handler(struct kretprobe_instance *ri, struct pt_regs *regs)
 
     MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
 
+    TRY(ec_logger_is_interested(EVENT_INTEREST_NET));
+
     TRY(ret >= 0);
     TRY(data->sk);
 
@@ -340,9 +348,10 @@ void __ec_process_dns_packet(
 {
     CB_EVENT_DNS_RESPONSE response  = { 0 };
     char                  *dns_data = NULL;
+    char                  *buffer   = NULL;
     uint8_t               protocol;
     int                   port      = 0;
-    size_t                length    = 0;
+    int                   length    = 0;
     int                   payload_offset;
     struct iphdr          *ip_header;
     struct udphdr         *udphdr;
@@ -374,29 +383,47 @@ void __ec_process_dns_packet(
     }
 
     port = ntohs(udphdr->source);
-    length         = min((size_t)PATH_MAX, (size_t)(ntohs(udphdr->len) - sizeof(struct udphdr)));
-    payload_offset = payload_offset + sizeof(udphdr);
+    payload_offset = payload_offset + sizeof(struct udphdr);
+
+    // EDNS0 responses can be larger than a path buffer, but never larger than the skb
+    length = min((int)ntohs(udphdr->len) - (int)sizeof(struct udphdr), (int)skb->len - payload_offset);
 
     if (port == 53)
     {
-        TRY_MSG(length > 0, DL_WARNING, "invalid length:%ld for UDP response", length);
-        dns_data = ec_get_path_buffer(context);
-        if (dns_data)
+        TRY_MSG(length > 0, DL_WARNING, "invalid length:%d for UDP response", length);
+
+        // Parse the response in place when it is all in the linear data, and copy it otherwise
+        if (payload_offset + length <= skb_headlen(skb))
+        {
+            dns_data = (char *)skb->data + payload_offset;
+        } else
         {
-            TRY_MSG(!skb_copy_bits(skb, payload_offset, dns_data, length),
+            buffer = length <= PATH_MAX ? ec_get_path_buffer(context) : ec_mem_alloc(length, context);
+            TRY(buffer);
+            TRY_MSG(!skb_copy_bits(skb, payload_offset, buffer, length),
                     DL_ERROR, "Error copying UDP DNS response data");
+            dns_data = buffer;
+        }
 
-            TRY_MSG(!ec_dns_parse_data(dns_data, length, &response, context),
-                    DL_INFO, "No DNS record found");
+        TRY_MSG(!ec_dns_parse_data(dns_data, length, &response, context),
+                DL_INFO, "No DNS record found");
 
-            ec_event_send_dns(
-                CB_EVENT_TYPE_DNS_RESPONSE,
-                &response,
-                context);
-        }
+        TRY_MSG(ec_dns_should_report(&response, context),
+                DL_INFO, "DNS response for %s already reported", response.qname);
+
+        ec_event_send_dns(
+            CB_EVENT_TYPE_DNS_RESPONSE,
+            &response,
+            context);
     }
 
 CATCH_DEFAULT:
-    ec_put_path_buffer(dns_data);
+    if (length <= PATH_MAX)
+    {
+        ec_put_path_buffer(buffer);
+    } else
+    {
+        ec_mem_free(buffer);
+    }
     ec_mem_free(response.records);
 }
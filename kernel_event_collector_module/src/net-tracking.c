@@ -5,8 +5,12 @@
 #include "net-helper.h"
 #include "hash-table.h"
 #include "cb-spinlock.h"
+#include "event-factory.h"
+#include "process-tracking.h"
+#include "mem-alloc.h"
 
 #include <linux/inet.h>
+#include <linux/workqueue.h>
 
 typedef struct table_key {
     uint32_t        pid;
@@ -16,8 +20,10 @@ typedef struct table_key {
 } NET_TBL_KEY;
 
 typedef struct table_value {
+    struct timespec  first_seen;
     struct timespec  last_seen;
-    uint64_t         count;
+    atomic64_t       count;          // Updated from every CPU without the bucket lock
+    uint64_t         reported_count; // count as of the last flow summary, only changed under the bucket lock
     uint16_t         conn_dir;
 } NET_TBL_VALUE;
 
@@ -26,6 +32,17 @@ typedef struct table_node {
     NET_TBL_VALUE     value;
 } NET_TBL_NODE;
 
+typedef struct net_flow_report {
+    pid_t                  pid;
+    CB_EVENT_NETWORK_FLOW  flow;
+} NET_FLOW_REPORT;
+
+typedef struct net_flow_batch {
+    NET_FLOW_REPORT *reports;
+    int              count;
+    struct timespec  now;
+} NET_FLOW_BATCH;
+
 void __ec_net_tracking_print_message(const char *message, NET_TBL_NODE *node);
 void __ec_net_tracking_set_key(NET_TBL_KEY    *key,
                       pid_t           pid,
@@ -34,7 +51,17 @@ void __ec_net_tracking_set_key(NET_TBL_KEY    *key,
                       uint16_t        proto,
                       CONN_DIRECTION  conn_dir);
 int __ec_print_net_tracking(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context);
+int __ec_net_tracking_collect_flow(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context);
+static void __ec_net_tracking_report_work(struct work_struct *work);
 bool __ec_net_tracking_check_cache(
+    ProcessContext *context,
+    pid_t           pid,
+    CB_SOCK_ADDR   *localAddr,
+    CB_SOCK_ADDR   *remoteAddr,
+    uint16_t        proto,
+    CONN_DIRECTION  conn_dir,
+    bool            reported);
+bool __ec_net_tracking_is_tracked(
     ProcessContext *context,
     pid_t           pid,
     CB_SOCK_ADDR   *localAddr,
@@ -42,28 +69,154 @@ bool __ec_net_tracking_check_cache(
     uint16_t        proto,
     CONN_DIRECTION  conn_dir);
 
-//TODO pick appropriate size
 #define NET_TBL_SIZE     2048
-#define NET_LRU_SIZE     4
+#define NET_TBL_MIN_SIZE 256
+#define NET_TBL_ENTRIES  (NET_TBL_SIZE * 4)
+
+// A flow that has been idle this many report intervals is dropped, so the next connection is
+//  reported as new.
+#define NET_FLOW_IDLE_INTERVALS  10
+
+// At most this many flow summaries are sent per interval.  Flows that miss the cut keep their
+//  counts and are reported in a later interval.
+#define NET_FLOW_REPORT_MAX      1024
+
+uint32_t g_net_track_budget_kb = (NET_TBL_ENTRIES * HASHTBL_ENTRY_SIZE(sizeof(NET_TBL_NODE))) / 1024;
+uint32_t g_net_flow_report_secs = 60;
 
 static HashTbl __read_mostly s_net_hash_table = {
-    .numberOfBuckets = NET_TBL_SIZE,
+    .numberOfBuckets = NET_TBL_MIN_SIZE,
+    .maxBuckets = NET_TBL_SIZE,
     .name = "network_tracking_table",
     .datasize = sizeof(NET_TBL_NODE),
     .key_len     = sizeof(NET_TBL_KEY),
     .key_offset  = offsetof(NET_TBL_NODE, key),
-    .lruSize = NET_LRU_SIZE,
+    .memoryBudget = NET_TBL_ENTRIES * HASHTBL_ENTRY_SIZE(sizeof(NET_TBL_NODE)),
+    .rcu_lookup = true,
 };
 
+static NET_FLOW_REPORT *s_flow_reports;
+static DECLARE_DELAYED_WORK(s_net_flow_work, __ec_net_tracking_report_work);
 
 bool ec_net_tracking_initialize(ProcessContext *context)
 {
-    return ec_hashtbl_init(&s_net_hash_table, context);
+    // Let the table grow far enough to hold everything the budget allows
+    s_net_hash_table.memoryBudget = max_t(size_t, (size_t)g_net_track_budget_kb * 1024, HASHTBL_ENTRY_SIZE(sizeof(NET_TBL_NODE)));
+    s_net_hash_table.maxBuckets   = max_t(uint64_t, NET_TBL_SIZE, s_net_hash_table.memoryBudget / HASHTBL_ENTRY_SIZE(sizeof(NET_TBL_NODE)) / 2);
+
+    TRY(ec_hashtbl_init(&s_net_hash_table, context));
+
+    if (g_net_flow_report_secs)
+    {
+        s_flow_reports = ec_mem_valloc(NET_FLOW_REPORT_MAX * sizeof(NET_FLOW_REPORT), context);
+        TRY_DO_MSG(s_flow_reports,
+                   { ec_hashtbl_destroy(&s_net_hash_table, context); },
+                   DL_ERROR, "Failed to allocate network flow reports");
+
+        schedule_delayed_work(&s_net_flow_work, g_net_flow_report_secs * HZ);
+    }
+
+    return true;
+
+CATCH_DEFAULT:
+    return false;
 }
 
 void ec_net_tracking_shutdown(ProcessContext *context)
 {
+    cancel_delayed_work_sync(&s_net_flow_work);
     ec_hashtbl_destroy(&s_net_hash_table, context);
+    ec_mem_free(s_flow_reports);
+    s_flow_reports = NULL;
+}
+
+// Periodically summarize the connections we suppressed since the last report, one event per flow.
+//  A chatty service produces at most one event per flow per interval no matter how often it
+//  connects.
+static void __ec_net_tracking_report_work(struct work_struct *work)
+{
+    DECLARE_NON_ATOMIC_CONTEXT(context, ec_getpid(current));
+    NET_FLOW_BATCH batch = { .reports = s_flow_reports, .count = 0 };
+    int i;
+
+    MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(&context, CATCH_DEFAULT);
+
+    // The reports are copied out under the bucket locks and sent after the walk
+    getnstimeofday(&batch.now);
+    ec_hashtbl_write_for_each(&s_net_hash_table, __ec_net_tracking_collect_flow, &batch, &context);
+
+    // Wake the reader once for the whole batch
+    DISABLE_WAKE_UP(&context);
+    for (i = 0; i < batch.count; ++i)
+    {
+        ProcessHandle *handle = ec_process_tracking_get_handle(batch.reports[i].pid, &context);
+
+        // The process has exited since, and its flows will age out
+        if (handle)
+        {
+            ec_event_send_net_flow(handle, &batch.reports[i].flow, &context);
+            ec_process_tracking_put_handle(handle, &context);
+        }
+    }
+    ENABLE_WAKE_UP(&context);
+
+    if (batch.count)
+    {
+        ec_fops_comm_wake_up_reader(&context);
+    }
+
+CATCH_DEFAULT:
+    MODULE_PUT_AND_FINISH_MODULE_DISABLE_CHECK(&context);
+
+    if (g_net_flow_report_secs)
+    {
+        schedule_delayed_work(&s_net_flow_work, g_net_flow_report_secs * HZ);
+    }
+}
+
+int __ec_net_tracking_collect_flow(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context)
+{
+    NET_TBL_NODE    *node  = (NET_TBL_NODE *)datap;
+    NET_FLOW_BATCH  *batch = priv;
+    NET_FLOW_REPORT *report;
+    uint64_t         count;
+
+    IF_MODULE_DISABLED_GOTO(context, CATCH_DISABLED);
+
+    count = atomic64_read(&node->value.count);
+
+    // Only the first connection was reported, and nothing has happened since
+    if (count == node->value.reported_count)
+    {
+        if (batch->now.tv_sec - node->value.last_seen.tv_sec > (long)g_net_flow_report_secs * NET_FLOW_IDLE_INTERVALS)
+        {
+            return ACTION_DELETE;
+        }
+        return ACTION_CONTINUE;
+    }
+
+    if (batch->count >= NET_FLOW_REPORT_MAX)
+    {
+        return ACTION_CONTINUE;
+    }
+
+    report = &batch->reports[batch->count++];
+    report->pid = node->key.pid;
+    report->flow.protocol  = node->key.proto;
+    report->flow.direction = node->value.conn_dir;
+    ec_copy_sockaddr(&report->flow.localAddr,  &node->key.laddr);
+    ec_copy_sockaddr(&report->flow.remoteAddr, &node->key.raddr);
+    report->flow.count       = count - node->value.reported_count;
+    report->flow.total_count = count;
+    report->flow.first_seen  = ec_to_windows_timestamp(&node->value.first_seen);
+    report->flow.last_seen   = ec_to_windows_timestamp(&node->value.last_seen);
+
+    node->value.reported_count = count;
+
+    return ACTION_CONTINUE;
+
+CATCH_DISABLED:
+    return ACTION_STOP;
 }
 
 // Track this connection in the local table
@@ -77,16 +230,14 @@ bool ec_net_tracking_check_cache(
     uint16_t        proto,
     CONN_DIRECTION  conn_dir)
 {
-    bool added_entry = __ec_net_tracking_check_cache(context, pid, localAddr, remoteAddr, proto, conn_dir);
+    bool reverse_tracked = false;
 
     // If this is UDP we need to do a little extra work
-    if (added_entry && proto == IPPROTO_UDP)
+    if (proto == IPPROTO_UDP)
     {
-        // If we added an entry it means that this connection was not already tracked,
-        //  which would normally cause an event to be generated.
-        //  For UDP we hook the data path, and it is impossible to know the real direction of the connection.
-        //  We want to check to make sure we are not tracking the opposite direction for this connection.
-        added_entry = __ec_net_tracking_check_cache(
+        // For UDP we hook the data path, and it is impossible to know the real direction of the connection.
+        //  A connection already tracked in the opposite direction is not reported again.
+        reverse_tracked = __ec_net_tracking_is_tracked(
             context,
             pid,
             localAddr,
@@ -95,16 +246,38 @@ bool ec_net_tracking_check_cache(
             conn_dir == CONN_IN ? CONN_OUT : CONN_IN);
     }
 
-    return added_entry;
+    // A new entry only counts its first connection as reported when an event is really sent for it
+    return __ec_net_tracking_check_cache(context, pid, localAddr, remoteAddr, proto, conn_dir, !reverse_tracked) &&
+        !reverse_tracked;
 }
 
-bool __ec_net_tracking_check_cache(
+bool __ec_net_tracking_is_tracked(
     ProcessContext *context,
     pid_t           pid,
     CB_SOCK_ADDR   *localAddr,
     CB_SOCK_ADDR   *remoteAddr,
     uint16_t        proto,
     CONN_DIRECTION  conn_dir)
+{
+    NET_TBL_KEY key;
+    NET_TBL_NODE *node;
+
+    __ec_net_tracking_set_key(&key, pid, localAddr, remoteAddr, proto, conn_dir);
+
+    node = ec_hashtbl_find(&s_net_hash_table, &key, context);
+    ec_hashtbl_put(&s_net_hash_table, node, context);
+
+    return node != NULL;
+}
+
+bool __ec_net_tracking_check_cache(
+    ProcessContext *context,
+    pid_t           pid,
+    CB_SOCK_ADDR   *localAddr,
+    CB_SOCK_ADDR   *remoteAddr,
+    uint16_t        proto,
+    CONN_DIRECTION  conn_dir,
+    bool            reported)
 {
     bool xcode = false;
     NET_TBL_KEY key;
@@ -123,8 +296,10 @@ bool __ec_net_tracking_check_cache(
         TRY_MSG(node, DL_ERROR, "Failed to allocate a network tracking node, event will be sent!");
 
         memcpy(&node->key, &key, sizeof(NET_TBL_KEY));
-        node->value.count = 0;
+        atomic64_set(&node->value.count, 0);
+        node->value.reported_count = reported ? 1 : 0; // This connection is reported by the caller
         node->value.conn_dir = conn_dir;
+        getnstimeofday(&node->value.first_seen);
 
         __ec_net_tracking_print_message("ADD", node);
 
@@ -135,7 +310,7 @@ bool __ec_net_tracking_check_cache(
 
     // Update the last seen time and count
     getnstimeofday(&node->value.last_seen);
-    ++node->value.count;
+    atomic64_inc(&node->value.count);
 
 CATCH_DEFAULT:
 
@@ -200,12 +375,14 @@ int __ec_print_net_tracking(HashTbl *hashTblp, void *datap, void *priv, ProcessC
 
         ec_ntop(&net_data->key.raddr.sa_addr, raddr_str, sizeof(raddr_str), &rport);
         ec_ntop(&net_data->key.laddr.sa_addr, laddr_str, sizeof(laddr_str), &lport);
-        seq_printf(m, "NET-TRACK %d %s-%s %s:%u -> %s:%u (%d)\n",
+        seq_printf(m, "NET-TRACK %d %s-%s %s:%u -> %s:%u (%d) count=%llu first=%d\n",
                    net_data->key.pid,
                    PROTOCOL_STR(net_data->key.proto),
                    (net_data->value.conn_dir == CONN_IN ? "in" : (net_data->value.conn_dir == CONN_OUT ? "out" : "??")),
                    laddr_str, ntohs(lport), raddr_str, ntohs(rport),
-                   (int)net_data->value.last_seen.tv_sec);
+                   (int)net_data->value.last_seen.tv_sec,
+                   (uint64_t)atomic64_read(&net_data->value.count),
+                   (int)net_data->value.first_seen.tv_sec);
     }
 
     return ACTION_CONTINUE;
@@ -12,6 +12,9 @@ typedef enum _conn_direction {
     CONN_OUT = 2
 } CONN_DIRECTION;
 
+extern uint32_t g_net_track_budget_kb;
+extern uint32_t g_net_flow_report_secs;
+
 bool ec_net_tracking_initialize(ProcessContext *context);
 void ec_net_tracking_shutdown(ProcessContext *context);
 bool ec_net_tracking_check_cache(
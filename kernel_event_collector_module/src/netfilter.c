@@ -9,6 +9,7 @@
 #include "cb-isolation.h"
 #include "cb-spinlock.h"
 #include "event-factory.h"
+#include "hook-tracking.h"
 
 #include "netfilter.h"
 
@@ -23,16 +24,17 @@
 #include <linux/ip.h>
 #include <linux/tcp.h>
 #include <linux/string.h>
+#include <linux/hash.h>
 #include <net/ip.h>
 
 bool g_webproxy_enabled;
+bool g_webproxy_first_segment_only __read_mostly;
 
 #define NUM_HOOKS     4
 static struct nf_hook_ops nfho_local_out[NUM_HOOKS];
 static bool               s_netfilter_registered;
 static uint64_t           s_netfilter_lock;
 
-int __ec_find_char_offset(const struct sk_buff *skb, int offset, char target);
 int __ec_web_proxy_request_check(ProcessContext *context, struct sk_buff *skb);
 
 static unsigned int ec_hook_func_local_out(
@@ -57,8 +59,12 @@ static unsigned int ec_hook_func_local_out(
 #endif  //}
     )
 {
+    unsigned int verdict = NF_ACCEPT;
+
     DECLARE_ATOMIC_CONTEXT(context, ec_getpid(current));
 
+    ec_hook_profile_enter(&context, __func__);
+
     TRY(skb);
     TRY(CHECK_SK_FAMILY(skb->sk) && CHECK_SK_PROTO(skb->sk));
 
@@ -73,17 +79,20 @@ static unsigned int ec_hook_func_local_out(
         ec_IsolationInterceptByAddrProtoPort(&context, skb->sk->sk_protocol, &remoteAddr, &isolation_result);
         if (isolation_result.isolationAction == IsolationActionBlock)
         {
-            return NF_DROP;
+            verdict = NF_DROP;
+            goto CATCH_DEFAULT;
         }
     }
 
-    if (g_webproxy_enabled && skb->sk->sk_protocol == IPPROTO_TCP)
+    if (g_webproxy_enabled && skb->sk->sk_protocol == IPPROTO_TCP
+        && ec_logger_is_interested(EVENT_INTEREST(CB_EVENT_TYPE_WEB_PROXY)))
     {
         __ec_web_proxy_request_check(&context, skb);
     }
 
 CATCH_DEFAULT:
-    return NF_ACCEPT;
+    ec_hook_profile_exit(&context);
+    return verdict;
 }
 
 
@@ -112,8 +121,12 @@ unsigned int ec_hook_func_local_in_v4(
 #endif  //}
     )
 {
+    unsigned int verdict = NF_ACCEPT;
+
     DECLARE_ATOMIC_CONTEXT(context, ec_getpid(current));
 
+    ec_hook_profile_enter(&context, __func__);
+
     TRY(skb);
     TRY(CHECK_SK_FAMILY(skb->sk) && CHECK_SK_PROTO(skb->sk));
 
@@ -128,12 +141,14 @@ unsigned int ec_hook_func_local_in_v4(
         ec_IsolationInterceptByAddrProtoPort(&context, skb->sk->sk_protocol, &remoteAddr, &isolation_result);
         if (isolation_result.isolationAction == IsolationActionBlock)
         {
-            return NF_DROP;
+            verdict = NF_DROP;
+            goto CATCH_DEFAULT;
         }
     }
 
 CATCH_DEFAULT:
-    return NF_ACCEPT;
+    ec_hook_profile_exit(&context);
+    return verdict;
 }
 
 unsigned int ec_hook_func_local_in_v6(
@@ -158,8 +173,12 @@ unsigned int ec_hook_func_local_in_v6(
 #endif  //}
     )
 {
+    unsigned int verdict = NF_ACCEPT;
+
     DECLARE_ATOMIC_CONTEXT(context, ec_getpid(current));
 
+    ec_hook_profile_enter(&context, __func__);
+
     TRY(skb);
     TRY(CHECK_SK_FAMILY(skb->sk) && CHECK_SK_PROTO(skb->sk));
 
@@ -174,170 +193,263 @@ unsigned int ec_hook_func_local_in_v6(
         ec_IsolationInterceptByAddrProtoPort(&context, skb->sk->sk_protocol, &remoteAddr, &isolation_result);
         if (isolation_result.isolationAction == IsolationActionBlock)
         {
-            return NF_DROP;
+            verdict = NF_DROP;
+            goto CATCH_DEFAULT;
         }
     }
 
 CATCH_DEFAULT:
-    return NF_ACCEPT;
+    ec_hook_profile_exit(&context);
+    return verdict;
 }
 
-int __ec_web_proxy_request_check(ProcessContext *context, struct sk_buff *skb)
+// A request sent through a proxy starts with "<METHOD> <absolute-URL> HTTP/1.x", while a
+//  request sent directly to the server has a URL that starts with '/'.
+#define HTTP_VERSION_LEN      8
+#define HTTP_REQUEST_MIN_LEN  (3 + 1 + 1 + 1 + HTTP_VERSION_LEN)
+
+// Enough payload for the longest method, the longest URL we report and the version
+#define HTTP_PARSE_WINDOW     (7 + 1 + PROXY_SERVER_MAX_LEN + 1 + HTTP_VERSION_LEN)
+
+// A longer URL is reported truncated.  We look this far into the payload for the space that ends it.
+#define HTTP_URL_SCAN_MAX     8192
+#define HTTP_URL_SCAN_CHUNK   64
+
+// The local-out hook sees every segment of every connection.  When this is set we remember the
+//  initial sequence number of each connection from its SYN, and only parse the first payload
+//  segment.  The table is direct-mapped by socket and lossy on purpose: a collision only means
+//  we parse a segment we could have skipped.
+//
+// Only the first request on a connection is seen, so later requests on a keep-alive (or pipelined)
+//  connection to the proxy are not reported.  Leave this off when every request matters.
+#define WEB_PROXY_FLOW_BITS   10
+static atomic64_t s_web_proxy_flows[1 << WEB_PROXY_FLOW_BITS];
+
+// Returns the length of the method if data starts with one we report followed by a space
+static inline int __ec_http_method_len(const char *data)
 {
-    char tmp[10];
-    char url[PROXY_SERVER_MAX_LEN + 1];
+    switch (data[0])
+    {
+    case 'G': return memcmp(data, "GET ", 4) ? 0 : 3;
+    case 'P': return !memcmp(data, "PUT ", 4) ? 3 : (!memcmp(data, "POST ", 5) ? 4 : 0);
+    case 'D': return memcmp(data, "DELETE ", 7) ? 0 : 6;
+    case 'C': return memcmp(data, "CONNECT ", 8) ? 0 : 7;
+    default:  return 0;
+    }
+}
 
-    static const char * const HTTP_METHODS[] = {"GET", "PUT", "POST", "DELETE", "CONNECT"};
-    static const int HTTP_METHODS_LEN[] = {3, 3, 4, 6, 7};
-    static const int HTTP_METHOD_MAX_LEN = 7;
-    static const char * const HTTP_VERSION[] = {"HTTP/1.1", "HTTP/1.0"};
-    static const int HTTP_VERSION_LEN = 8;
-    int family;
+// Returns the offset of the URL if data starts with "<METHOD> " and an absolute URL, otherwise 0
+static int __ec_http_url_offset(const char *data, int len)
+{
+    int method_len;
 
-    int i;
-    int space_offset;
-    int url_len;
-    int payload_offset;
-    struct tcphdr *tcp_header;
-    CB_SOCK_ADDR      localAddr;
-    CB_SOCK_ADDR      remoteAddr;
+    CANCEL(len >= HTTP_REQUEST_MIN_LEN, 0);
 
-    TRY(skb);
-    TRY(skb->sk);
+    method_len = __ec_http_method_len(data);
+    CANCEL(method_len, 0);
+    CANCEL(data[method_len + 1] != '/', 0);
 
-    family = skb->sk->sk_family;
+    return method_len + 1;
+}
 
-    // The skb_transport_offset will give me offset of the transport header, skipping any IPv6 extended headers.
-    payload_offset = skb_transport_offset(skb) + tcp_hdrlen(skb);
+static inline bool __ec_http_is_version(const char *version)
+{
+    return !memcmp(version, "HTTP/1.", HTTP_VERSION_LEN - 1) &&
+           (version[HTTP_VERSION_LEN - 1] == '0' || version[HTTP_VERSION_LEN - 1] == '1');
+}
 
-    if (skb_copy_bits(skb, payload_offset, tmp, HTTP_METHOD_MAX_LEN + 2) != 0)
-    {
-        goto CATCH_DEFAULT;
-    }
+// Parse a proxy request line at the start of data in a single pass.  Returns the length of the
+//  URL and sets url_offset, or returns 0 if this is not a proxy request.
+int ec_web_proxy_parse_request(const char *data, int len, int *url_offset)
+{
+    const char *url;
+    const char *space;
+    int         offset;
 
-    for (i = 0; i < 5; i++)
-    {
-        if (strncmp(HTTP_METHODS[i], tmp, HTTP_METHODS_LEN[i]) != 0)
-        {
-            continue;
-        }
+    offset = __ec_http_url_offset(data, len);
+    CANCEL(offset, 0);
 
-        if (tmp[HTTP_METHODS_LEN[i] + 1] == '/')
-        {
-            goto CATCH_DEFAULT;
-        }
+    url = data + offset;
+    space = memchr(url + 1, ' ', len - (offset + 1));
+    CANCEL(space && data + len - (space + 1) >= HTTP_VERSION_LEN, 0);
+    CANCEL(__ec_http_is_version(space + 1), 0);
 
-        space_offset = __ec_find_char_offset(skb, payload_offset + HTTP_METHODS_LEN[i] + 2, ' ');
-        if (space_offset == -1)
-        {
-            goto CATCH_DEFAULT;
-        }
+    *url_offset = offset;
+    return space - url;
+}
 
-        if (skb_copy_bits(skb, space_offset + 1,    tmp, HTTP_VERSION_LEN) != 0)
-        {
-            goto CATCH_DEFAULT;
-        }
+// Looks for the space that ends a URL which starts at url_offset, from offset on.  Returns the
+//  length of the URL, or 0 if the space is not within HTTP_URL_SCAN_MAX bytes of the URL.
+static int __ec_web_proxy_url_len(struct sk_buff *skb, int url_offset, int offset)
+{
+    char chunk[HTTP_URL_SCAN_CHUNK];
+    int  end = min_t(int, (int)skb->len, url_offset + HTTP_URL_SCAN_MAX);
 
-        if (strncmp(HTTP_VERSION[0], tmp, HTTP_VERSION_LEN) != 0 &&
-            strncmp(HTTP_VERSION[1], tmp, HTTP_VERSION_LEN) != 0)
-        {
-            goto CATCH_DEFAULT;
-        }
+    while (offset < end)
+    {
+        int         len   = min_t(int, end - offset, HTTP_URL_SCAN_CHUNK);
+        const char *data  = skb_header_pointer(skb, offset, len, chunk);
+        const char *space;
 
-        url_len = space_offset - (payload_offset + HTTP_METHODS_LEN[i] + 1);
-        if (url_len >= PROXY_SERVER_MAX_LEN)
-        {
-            url_len = PROXY_SERVER_MAX_LEN - 1;
-        }
+        CANCEL(data, 0);
 
-        if (skb_copy_bits(skb, payload_offset + HTTP_METHODS_LEN[i] + 1, url, url_len) != 0)
+        space = memchr(data, ' ', len);
+        if (space)
         {
-            goto CATCH_DEFAULT;
+            return offset + (space - data) - url_offset;
         }
+        offset += len;
+    }
 
-        url[url_len] = 0;
+    return 0;
+}
 
-        TRACE(DL_INFO, "%s: will send proxy event for pid %lld to %s\n", __func__, (uint64_t)ec_getpid(current), url);
+// Find a proxy request at payload_offset and copy its URL, truncated to PROXY_SERVER_MAX_LEN - 1.
+//  Returns the length copied, or 0 if this is not a proxy request.
+int ec_web_proxy_parse_skb(struct sk_buff *skb, int payload_offset, char *url)
+{
+    char        window[HTTP_PARSE_WINDOW];
+    char        version_buf[HTTP_VERSION_LEN];
+    char        first;
+    const char *data;
+    const char *version;
+    const char *space;
+    int         len;
+    int         url_offset;
+    int         url_len;
+
+    len = min_t(int, (int)skb->len - payload_offset, HTTP_PARSE_WINDOW);
+    CANCEL(len >= HTTP_REQUEST_MIN_LEN, 0);
+
+    // Most segments are not the start of a request, so reject them on the first byte
+    data = skb_header_pointer(skb, payload_offset, 1, &first);
+    CANCEL(data && (*data == 'G' || *data == 'P' || *data == 'D' || *data == 'C'), 0);
+
+    // Parse the linear data in place when it holds all we would look at, otherwise copy it once
+    if ((int)skb_headlen(skb) - payload_offset >= len)
+    {
+        data = skb->data + payload_offset;
+        len  = skb_headlen(skb) - payload_offset;
+    } else
+    {
+        data = skb_header_pointer(skb, payload_offset, len, window);
+        CANCEL(data, 0);
+    }
 
-        localAddr. sa_addr.sa_family = family;
-        remoteAddr.sa_addr.sa_family = family;
-        tcp_header                   = (struct tcphdr *) skb_transport_header(skb);
+    url_offset = __ec_http_url_offset(data, len);
+    CANCEL(url_offset, 0);
 
-        if (family == AF_INET)
-        {
-            struct iphdr *ip_header = (struct iphdr *)skb_network_header(skb);
+    space = memchr(data + url_offset + 1, ' ', len - (url_offset + 1));
+    if (space)
+    {
+        url_len = space - (data + url_offset);
+    } else
+    {
+        // The URL runs past what we have, which then holds at least the part we report
+        url_len = __ec_web_proxy_url_len(skb, payload_offset + url_offset, payload_offset + len);
+        CANCEL(url_len, 0);
+    }
 
-            remoteAddr.as_in4.sin_addr.s_addr = ip_header->daddr;
-            localAddr .as_in4.sin_addr.s_addr = ip_header->saddr;
+    version = skb_header_pointer(skb, payload_offset + url_offset + url_len + 1, HTTP_VERSION_LEN, version_buf);
+    CANCEL(version && __ec_http_is_version(version), 0);
 
-            remoteAddr.as_in4.sin_port = tcp_header->dest;
-            localAddr .as_in4.sin_port = tcp_header->source;
-        } else {
-            struct ipv6hdr *ip_header = (struct ipv6hdr *)skb_network_header(skb);
+    url_len = min(url_len, PROXY_SERVER_MAX_LEN - 1);
+    memcpy(url, data + url_offset, url_len);
+    url[url_len] = 0;
 
-            memcpy(&remoteAddr.as_in6.sin6_addr, &ip_header->daddr, sizeof(struct in6_addr));
-            memcpy(&localAddr.as_in6.sin6_addr, &ip_header->saddr, sizeof(struct in6_addr));
+    return url_len;
+}
 
-            remoteAddr.as_in6.sin6_port = tcp_header->dest;
-            localAddr .as_in6.sin6_port = tcp_header->source;
-        }
+// Returns false if this segment is known not to be the first payload of its connection
+static bool __ec_web_proxy_is_first_segment(struct sk_buff *skb, struct tcphdr *tcp_header, int payload_len)
+{
+    uint32_t    tag  = hash_ptr(skb->sk, 32) | 1;
+    atomic64_t *flow = &s_web_proxy_flows[hash_ptr(skb->sk, WEB_PROXY_FLOW_BITS)];
+    uint64_t    entry;
+
+    if (tcp_header->syn)
+    {
+        atomic64_set(flow, ((uint64_t)tag << 32) | ntohl(tcp_header->seq));
 
-        // We don't track the DNS events
-        ec_event_send_net_proxy(
-            NULL,
-            "PROXY",
-            CB_EVENT_TYPE_WEB_PROXY,
-            &localAddr,
-            &remoteAddr,
-            IPPROTO_TCP,
-            url,
-            0, //TODO: actual_port will be obtained at cbdaemon based on actual_server url.
-            skb->sk,
-            context);
+        // A fast open SYN can carry the request
+        return payload_len > 0;
     }
 
-CATCH_DEFAULT:
-    return 0;
+    entry = atomic64_read(flow);
+
+    // We did not see this connection start, so we can not tell which segment is first
+    if ((uint32_t)(entry >> 32) != tag)
+    {
+        return true;
+    }
+    return (uint32_t)entry + 1 == ntohl(tcp_header->seq);
 }
 
-int __ec_find_char_offset(const struct sk_buff *skb, int offset, char target)
+int __ec_web_proxy_request_check(ProcessContext *context, struct sk_buff *skb)
 {
-    char *ptr;
-    char *frag_addr;
-    int frag_len;
-    int current_offset;
-    int i;
-
-    //There is data inside skb, so search the remaining data before search fragments.
-    if (skb->len - skb->data_len > offset)
+    char url[PROXY_SERVER_MAX_LEN + 1];
+    int family;
+
+    int payload_offset;
+    struct tcphdr *tcp_header;
+    CB_SOCK_ADDR      localAddr;
+    CB_SOCK_ADDR      remoteAddr;
+
+    TRY(skb);
+    TRY(skb->sk);
+
+    family = skb->sk->sk_family;
+
+    // The skb_transport_offset will give me offset of the transport header, skipping any IPv6 extended headers.
+    payload_offset = skb_transport_offset(skb) + tcp_hdrlen(skb);
+    tcp_header     = (struct tcphdr *) skb_transport_header(skb);
+
+    if (g_webproxy_first_segment_only)
     {
-        current_offset = offset;
-        for (ptr = (char *)skb->data + offset; ptr < (char *) skb_tail_pointer(skb); ptr++)
-        {
-            if (*ptr == target)
-            {
-                return current_offset;
-            }
-            current_offset++;
-        }
-    } else {
-        current_offset = skb->len - skb->data_len;
+        TRY(__ec_web_proxy_is_first_segment(skb, tcp_header, (int)skb->len - payload_offset));
     }
 
-    for (i = skb_shinfo(skb)->nr_frags - 1; i >= 0; i--)
+    TRY(ec_web_proxy_parse_skb(skb, payload_offset, url));
+
+    TRACE(DL_INFO, "%s: will send proxy event for pid %lld to %s\n", __func__, (uint64_t)ec_getpid(current), url);
+
+    localAddr. sa_addr.sa_family = family;
+    remoteAddr.sa_addr.sa_family = family;
+
+    if (family == AF_INET)
     {
-        frag_addr = skb_frag_address_safe(&skb_shinfo(skb)->frags[i]);
-        frag_len = skb_frag_size(&skb_shinfo(skb)->frags[i]);
-        for (ptr = frag_addr; ptr <= frag_addr + frag_len; ptr++)
-        {
-            if (current_offset >= offset && *ptr == target)
-            {
-                return current_offset;
-            }
-            current_offset++;
-        }
+        struct iphdr *ip_header = (struct iphdr *)skb_network_header(skb);
+
+        remoteAddr.as_in4.sin_addr.s_addr = ip_header->daddr;
+        localAddr .as_in4.sin_addr.s_addr = ip_header->saddr;
+
+        remoteAddr.as_in4.sin_port = tcp_header->dest;
+        localAddr .as_in4.sin_port = tcp_header->source;
+    } else {
+        struct ipv6hdr *ip_header = (struct ipv6hdr *)skb_network_header(skb);
+
+        memcpy(&remoteAddr.as_in6.sin6_addr, &ip_header->daddr, sizeof(struct in6_addr));
+        memcpy(&localAddr.as_in6.sin6_addr, &ip_header->saddr, sizeof(struct in6_addr));
+
+        remoteAddr.as_in6.sin6_port = tcp_header->dest;
+        localAddr .as_in6.sin6_port = tcp_header->source;
     }
-    return -1;
+
+    // We don't track the DNS events
+    ec_event_send_net_proxy(
+        NULL,
+        "PROXY",
+        CB_EVENT_TYPE_WEB_PROXY,
+        &localAddr,
+        &remoteAddr,
+        IPPROTO_TCP,
+        url,
+        0, //TODO: actual_port will be obtained at cbdaemon based on actual_server url.
+        skb->sk,
+        context);
+
+CATCH_DEFAULT:
+    return 0;
 }
 
 bool ec_netfilter_enable(ProcessContext *context)
@@ -4,9 +4,14 @@
 #pragma once
 
 extern bool g_webproxy_enabled;
+extern bool g_webproxy_first_segment_only;
+
+struct sk_buff;
 
 extern bool ec_netfilter_initialize(ProcessContext *context);
 extern void ec_netfilter_cleanup(ProcessContext *context);
 extern bool ec_netfilter_enable(ProcessContext *context);
 extern void ec_netfilter_disable(ProcessContext *context);
 
+int ec_web_proxy_parse_request(const char *data, int len, int *url_offset);
+int ec_web_proxy_parse_skb(struct sk_buff *skb, int payload_offset, char *url);
@@ -7,32 +7,71 @@
 #include "mem-alloc.h"
 #include "process-context.h"
 #include "task-helper.h"
+#include "cb-test.h"
 
 #include <linux/limits.h>
+#include <linux/percpu.h>
 
 struct STRING_NODE {
     struct list_head  listEntry;
     char  path[PATH_MAX+1];
 };
 
-static CB_MEM_CACHE s_string_pool;
+// Path buffers are large, so keep only a few per CPU
+static CB_MEM_CACHE s_string_pool = {
+    .magazine_size = 8,
+};
+
+// Each CPU also keeps one buffer parked in a lockless slot.  It is filled at init so hooks running
+//  in atomic context find a buffer without allocating, and whoever releases a buffer refills an empty
+//  slot.  The slot is claimed with xchg, so an interrupt on the same CPU simply falls back to the pool.
+static DEFINE_PER_CPU(struct STRING_NODE *, s_string_reserve);
 
 bool ec_path_buffers_init(ProcessContext *context)
 {
-    return ec_mem_cache_create(&s_string_pool, "path_string_pool", sizeof(struct STRING_NODE), context);
+    int cpu;
+
+    TRY(ec_mem_cache_create(&s_string_pool, "path_string_pool", sizeof(struct STRING_NODE), context));
+
+    for_each_possible_cpu(cpu)
+    {
+        per_cpu(s_string_reserve, cpu) = (struct STRING_NODE *)ec_mem_cache_alloc(&s_string_pool, context);
+    }
+
+    return true;
+
+CATCH_DEFAULT:
+    return false;
 }
 
 void ec_path_buffers_shutdown(ProcessContext *context)
 {
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        struct STRING_NODE *node = xchg(per_cpu_ptr(&s_string_reserve, cpu), NULL);
+
+        if (node)
+        {
+            ec_mem_cache_disown(node, context);
+        }
+    }
+
     ec_mem_cache_destroy(&s_string_pool, context);
 }
 
-// Get a string buffer from the list, or alloc a new one.
+// Get a string buffer from this CPU's reserve, or from the pool.
 char *ec_get_path_buffer(ProcessContext *context)
 {
     struct STRING_NODE *node   = NULL;
 
-    node = (struct STRING_NODE *)ec_mem_cache_alloc(&s_string_pool, context);
+    node = this_cpu_xchg(s_string_reserve, NULL);
+    if (!node)
+    {
+        node = (struct STRING_NODE *)ec_mem_cache_alloc(&s_string_pool, context);
+    }
+
     if (node)
     {
         node->path[0]        = 0;
@@ -54,6 +93,12 @@ void ec_put_path_buffer(char *buffer)
 
     if (buffer)
     {
-        ec_mem_cache_disown(container_of((void *)buffer, struct STRING_NODE, path), &context);
+        struct STRING_NODE *node = container_of((void *)buffer, struct STRING_NODE, path);
+
+        // We may have moved CPUs since the buffer was taken, so refill whichever slot we are on
+        if (this_cpu_cmpxchg(s_string_reserve, NULL, node) != NULL)
+        {
+            ec_mem_cache_disown(node, &context);
+        }
     }
 }
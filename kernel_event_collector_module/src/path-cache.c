@@ -11,12 +11,14 @@
 #include "mem-alloc.h"
 
 uint32_t g_file_path_buckets = 65536;
+uint32_t g_file_path_budget_kb = 32768;
 bool g_enable_path_cache;
 
 void __ec_path_cache_delete_callback(void *data, ProcessContext *context);
 int __ec_path_cache_print(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context);
 void __ec_path_cache_print_callback(void *datap, ProcessContext *context);
 bool __ec_path_cache_verify_callback(void *datap, void *key, ProcessContext *context);
+size_t __ec_path_cache_size_callback(void *datap, ProcessContext *context);
 void __ec_path_cache_print_ref(int log_level, const char *calling_func, PathData *path_data, ProcessContext *context);
 
 static HashTbl __read_mostly s_path_cache = {
@@ -27,7 +29,40 @@ static HashTbl __read_mostly s_path_cache = {
     .delete_callback = __ec_path_cache_delete_callback,
     .printval_callback = __ec_path_cache_print_callback,
     .find_verify_callback = __ec_path_cache_verify_callback,
-    .lruSize = 8,
+    .size_callback = __ec_path_cache_size_callback,
+    .rcu_lookup = true,
+};
+
+// Directories that files were recently resolved under.  Each entry stores only its own name and
+//  holds a reference to its parent, so the path below a mount point is rebuilt by walking up the
+//  chain.  Every chain ends at the entry for the mount root, which has an empty name.  Nothing above
+//  a mount root is cached, the caller prepends the mount point from the vfsmount it is resolving.
+//
+// Renaming a directory marks its entry dead.  Anything built on top of it, including file entries
+//  in the path cache, sees the dead entry on its next lookup, so a whole subtree is dropped in O(1).
+//  Renames the hooks never see are caught when a prefix is used, since the chain is checked against
+//  the dentry names (see __ec_path_from_cached_prefix).
+//
+// File entries still keep their own full path, since queued events share that string by reference.
+//  The directory cache saves the dentry walk, not memory.  ec_path_cache_show_memory reports what
+//  each part costs, and how many bytes of the file paths are a prefix that a directory entry holds.
+#define PATH_DIR_ENTRIES 8192
+#define PATH_DIR_NAME_AVG  32
+
+void __ec_path_dir_delete_callback(void *data, ProcessContext *context);
+size_t __ec_path_dir_size_callback(void *datap, ProcessContext *context);
+static bool __ec_path_dir_valid(PathDir *dir);
+
+static HashTbl __read_mostly s_path_dir_cache = {
+    .numberOfBuckets = 1024,
+    .name = "path_dir_cache",
+    .datasize = sizeof(PathDir),
+    .key_len     = sizeof(PathDirKey),
+    .key_offset  = offsetof(PathDir, key),
+    .memoryBudget = PATH_DIR_ENTRIES * (HASHTBL_ENTRY_SIZE(sizeof(PathDir)) + PATH_DIR_NAME_AVG),
+    .delete_callback = __ec_path_dir_delete_callback,
+    .size_callback = __ec_path_dir_size_callback,
+    .rcu_lookup = true,
 };
 
 bool ec_path_cache_init(ProcessContext *context)
@@ -38,26 +73,51 @@ bool ec_path_cache_init(ProcessContext *context)
         s_path_cache.numberOfBuckets = 1;
     } else
     {
-        s_path_cache.numberOfBuckets = g_file_path_buckets;
+        // Start small and let the table grow to the configured size
+        s_path_cache.numberOfBuckets = min_t(uint64_t, g_file_path_buckets, HASHTBL_MIN_BUCKETS);
+        s_path_cache.maxBuckets = g_file_path_buckets;
+        s_path_cache.memoryBudget = (size_t)g_file_path_budget_kb * 1024;
         TRACE(DL_INIT, "Path cache is enabled");
     }
 
-    return ec_hashtbl_init(&s_path_cache, context);
+    TRY(ec_hashtbl_init(&s_path_cache, context));
+
+    TRY_STEP(CACHE, ec_hashtbl_init(&s_path_dir_cache, context));
+
+    return true;
+
+CATCH_CACHE:
+    ec_hashtbl_destroy(&s_path_cache, context);
+CATCH_DEFAULT:
+    return false;
 }
 
 void ec_path_cache_shutdown(ProcessContext *context)
 {
     ec_hashtbl_destroy(&s_path_cache, context);
+    ec_hashtbl_destroy(&s_path_dir_cache, context);
 }
 
 PathData *ec_path_cache_find(
     PathQuery          *query,
     ProcessContext     *context)
 {
+    PathData *path_data = NULL;
+
     CANCEL(g_enable_path_cache, NULL);
     CANCEL(likely(query), NULL);
 
-    return ec_hashtbl_find(&s_path_cache, &query->key, context);
+    path_data = ec_hashtbl_find(&s_path_cache, &query->key, context);
+
+    if (path_data && !__ec_path_dir_valid(path_data->dir))
+    {
+        // A directory above this file was renamed
+        ec_hashtbl_del(&s_path_cache, path_data, context);
+        ec_hashtbl_put(&s_path_cache, path_data, context);
+        path_data = NULL;
+    }
+
+    return path_data;
 }
 
 bool __ec_path_cache_verify_callback(void *datap, void *keyp, ProcessContext *context)
@@ -110,6 +170,7 @@ PathData *ec_path_cache_add(
     value->file_id = ec_get_current_time(); // Use this as a unique ID
     value->is_special_file = ec_is_special_file(value->path, ec_mem_size(value->path));
     value->fs_magic = fs_magic;
+    value->dir = NULL;
 
     TRACE(DL_FILE, "[%llu:%llu] %s was added to path cache.",
         value->key.device,
@@ -164,6 +225,181 @@ void ec_path_cache_put(
     ec_hashtbl_put(&s_path_cache, path_data, context);
 }
 
+static bool __ec_path_dir_valid(PathDir *dir)
+{
+    for (; dir; dir = dir->parent)
+    {
+        if (READ_ONCE(dir->dead))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns the entry for a directory with a reference, or NULL if it is not cached or has been renamed
+PathDir *ec_path_cache_find_dir(
+    uint64_t            device,
+    uint64_t            inode,
+    uint32_t            i_generation,
+    ProcessContext     *context)
+{
+    PathDirKey key = { inode, device };
+    PathDir *dir = NULL;
+
+    CANCEL(g_enable_path_cache, NULL);
+
+    dir = ec_hashtbl_find(&s_path_dir_cache, &key, context);
+    CANCEL(dir, NULL);
+
+    if (dir->i_generation != i_generation || !__ec_path_dir_valid(dir))
+    {
+        // The inode was reused or something above it was renamed
+        ec_hashtbl_del(&s_path_dir_cache, dir, context);
+        ec_hashtbl_put(&s_path_dir_cache, dir, context);
+        dir = NULL;
+    }
+
+    return dir;
+}
+
+// Adds a directory below parent.  The mount root has no parent and an empty name.
+//  Returns the entry with a reference.
+PathDir *ec_path_cache_add_dir(
+    uint64_t            device,
+    uint64_t            inode,
+    uint32_t            i_generation,
+    PathDir            *parent,
+    const char         *name,
+    size_t              len,
+    ProcessContext     *context)
+{
+    PathDir *dir = NULL;
+
+    CANCEL(g_enable_path_cache, NULL);
+    CANCEL(name && (len || !parent) && len < PATH_MAX, NULL);
+
+    dir = ec_hashtbl_alloc(&s_path_dir_cache, context);
+    CANCEL(dir, NULL);
+
+    dir->key.inode = inode;
+    dir->key.device = device;
+    dir->i_generation = i_generation;
+    dir->dead = false;
+    dir->parent = ec_hashtbl_get(&s_path_dir_cache, parent, context);
+    dir->name_len = len;
+    dir->name = ec_mem_alloc(len + 1, context);
+    TRY(dir->name);
+
+    memcpy(dir->name, name, len);
+    dir->name[len] = 0;
+
+    // Only one entry per directory, or invalidating it could leave a copy with the old path behind
+    if (ec_hashtbl_add_safe(&s_path_dir_cache, dir, context) < 0)
+    {
+        // Another thread already added it
+        ec_hashtbl_free(&s_path_dir_cache, dir, context);
+        dir = ec_path_cache_find_dir(device, inode, i_generation, context);
+    }
+
+    return dir;
+
+CATCH_DEFAULT:
+    ec_hashtbl_free(&s_path_dir_cache, dir, context);
+    return NULL;
+}
+
+PathDir *ec_path_cache_get_dir(
+    PathDir            *dir,
+    ProcessContext     *context)
+{
+    return ec_hashtbl_get(&s_path_dir_cache, dir, context);
+}
+
+void ec_path_cache_put_dir(
+    PathDir            *dir,
+    ProcessContext     *context)
+{
+    ec_hashtbl_put(&s_path_dir_cache, dir, context);
+}
+
+// Prepends the path of dir below its mount root to the string that ends at *start, which must
+//  begin with a '/'.  Fails if the chain was invalidated or the buffer is too small.
+bool ec_path_cache_build_dir(
+    PathDir            *dir,
+    char               *buffer,
+    char              **start)
+{
+    char *pos = *start;
+
+    for (; dir; dir = dir->parent)
+    {
+        CANCEL(!READ_ONCE(dir->dead), false);
+
+        // The mount root, the caller adds the mount point
+        if (!dir->parent)
+        {
+            break;
+        }
+
+        CANCEL(pos - buffer >= dir->name_len + 1, false);
+
+        pos -= dir->name_len;
+        memcpy(pos, dir->name, dir->name_len);
+        *--pos = '/';
+    }
+
+    *start = pos;
+    return true;
+}
+
+// Called when a directory is renamed.  Every entry below it is invalid from now on.
+void ec_path_cache_invalidate_dir(
+    uint64_t            device,
+    uint64_t            inode,
+    ProcessContext     *context)
+{
+    PathDirKey key = { inode, device };
+    PathDir *dir = NULL;
+
+    CANCEL_VOID(g_enable_path_cache);
+
+    dir = ec_hashtbl_del_by_key(&s_path_dir_cache, &key, context);
+    CANCEL_VOID(dir);
+
+    WRITE_ONCE(dir->dead, true);
+    ec_hashtbl_put(&s_path_dir_cache, dir, context);
+}
+
+void ec_path_cache_set_dir(
+    PathData           *path_data,
+    PathDir            *dir,
+    ProcessContext     *context)
+{
+    CANCEL_VOID(path_data && dir);
+
+    dir = ec_hashtbl_get(&s_path_dir_cache, dir, context);
+    if (cmpxchg(&path_data->dir, NULL, dir) != NULL)
+    {
+        // Another thread linked it first
+        ec_hashtbl_put(&s_path_dir_cache, dir, context);
+    }
+}
+
+void __ec_path_dir_delete_callback(void *data, ProcessContext *context)
+{
+    if (data)
+    {
+        PathDir *dir = (PathDir *)data;
+
+        ec_hashtbl_put(&s_path_dir_cache, dir->parent, context);
+        dir->parent = NULL;
+        ec_mem_put(dir->name);
+        dir->name = NULL;
+    }
+}
+
 void __ec_path_cache_delete_callback(void *data, ProcessContext *context)
 {
     if (data)
@@ -173,9 +409,86 @@ void __ec_path_cache_delete_callback(void *data, ProcessContext *context)
         __ec_path_cache_print_ref(DL_FILE, __func__, value, context);
         ec_mem_put(value->path);
         value->path = NULL;
+        ec_path_cache_put_dir(value->dir, context);
+        value->dir = NULL;
     }
 }
 
+// The path string is charged to the cache even though events may share it
+size_t __ec_path_cache_size_callback(void *datap, ProcessContext *context)
+{
+    return datap ? ec_mem_size(((PathData *)datap)->path) : 0;
+}
+
+size_t __ec_path_dir_size_callback(void *datap, ProcessContext *context)
+{
+    return datap ? ec_mem_size(((PathDir *)datap)->name) : 0;
+}
+
+typedef struct path_cache_memory {
+    int64_t paths;
+    int64_t path_bytes;
+    int64_t linked;
+    int64_t prefix_bytes;   // Bytes of file paths that are the path of a cached directory
+    int64_t dirs;
+    int64_t name_bytes;
+} PathCacheMemory;
+
+static int __ec_path_cache_count_memory(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context)
+{
+    PathData *path_data = (PathData *)datap;
+    PathCacheMemory *memory = (PathCacheMemory *)priv;
+
+    if (path_data && path_data->path)
+    {
+        char *slash = strrchr(path_data->path, '/');
+
+        memory->paths += 1;
+        memory->path_bytes += ec_mem_size(path_data->path);
+        if (READ_ONCE(path_data->dir) && slash)
+        {
+            memory->linked += 1;
+            memory->prefix_bytes += slash - path_data->path;
+        }
+    }
+
+    return ACTION_CONTINUE;
+}
+
+static int __ec_path_dir_count_memory(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context)
+{
+    PathDir *dir = (PathDir *)datap;
+    PathCacheMemory *memory = (PathCacheMemory *)priv;
+
+    if (dir)
+    {
+        memory->dirs += 1;
+        memory->name_bytes += ec_mem_size(dir->name);
+    }
+
+    return ACTION_CONTINUE;
+}
+
+// Shows what the path strings and directory entries cost.  "Shared Prefixes" is the part of the
+//  file paths a directory entry already holds, which is what storing file entries as (dir, name)
+//  would save at most.  This walks both tables, so it is only for /proc.
+void ec_path_cache_show_memory(struct seq_file *m, ProcessContext *context)
+{
+    PathCacheMemory memory = {};
+
+    CANCEL_VOID(g_enable_path_cache);
+
+    ec_hashtbl_read_for_each(&s_path_cache, __ec_path_cache_count_memory, &memory, context);
+    ec_hashtbl_read_for_each(&s_path_dir_cache, __ec_path_dir_count_memory, &memory, context);
+
+    seq_printf(m, "\n%22s | %10s | %6s | %12s |\n", "Path Cache", "Count", "Size", "Bytes");
+    seq_printf(m, "%22s | %10lld | %6zu | %12lld |\n", "File Entries", memory.paths, sizeof(PathData), memory.paths * (int64_t)sizeof(PathData));
+    seq_printf(m, "%22s | %10lld | %6s | %12lld |\n", "File Paths", memory.paths, "", memory.path_bytes);
+    seq_printf(m, "%22s | %10lld | %6zu | %12lld |\n", "Directory Entries", memory.dirs, sizeof(PathDir), memory.dirs * (int64_t)sizeof(PathDir));
+    seq_printf(m, "%22s | %10lld | %6s | %12lld |\n", "Directory Names", memory.dirs, "", memory.name_bytes);
+    seq_printf(m, "%22s | %10lld | %6s | %12lld |\n", "Shared Prefixes", memory.linked, "", memory.prefix_bytes);
+}
+
 int ec_path_cache_show(struct seq_file *m, void *v)
 {
     DECLARE_NON_ATOMIC_CONTEXT(context, ec_getpid(current));
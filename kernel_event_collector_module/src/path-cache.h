@@ -11,6 +11,21 @@ typedef struct PATH_KEY {
     uint64_t            ns_id;
 } PathKey;
 
+typedef struct PATH_DIR_KEY {
+    uint64_t            inode;
+    uint64_t            device;
+} PathDirKey;
+
+// A cached directory, see path-cache.c
+typedef struct PATH_DIR {
+    PathDirKey          key;
+    struct PATH_DIR    *parent;         // Holds a reference, NULL for the mount root at the top of a chain
+    char               *name;           // Component name, empty for the mount root
+    uint16_t            name_len;
+    bool                dead;           // Set when the directory is renamed
+    uint32_t            i_generation;
+} PathDir;
+
 typedef struct PATH_DATA {
     PathKey             key;
     char               *path;
@@ -18,6 +33,7 @@ typedef struct PATH_DATA {
     bool                is_special_file;
     uint64_t            file_id;
     uint64_t            fs_magic;
+    PathDir            *dir;            // Directory the path was resolved under, if cached
 } PathData;
 
 typedef struct path_query
@@ -28,6 +44,7 @@ typedef struct path_query
 } PathQuery;
 
 extern uint32_t g_file_path_buckets;
+extern uint32_t g_file_path_budget_kb;
 extern bool g_enable_path_cache;
 
 bool ec_path_cache_init(ProcessContext *context);
@@ -52,3 +69,35 @@ PathData *ec_path_cache_get(
 void ec_path_cache_put(
     PathData           *path_data,
     ProcessContext     *context);
+
+PathDir *ec_path_cache_find_dir(
+    uint64_t            device,
+    uint64_t            inode,
+    uint32_t            i_generation,
+    ProcessContext     *context);
+PathDir *ec_path_cache_add_dir(
+    uint64_t            device,
+    uint64_t            inode,
+    uint32_t            i_generation,
+    PathDir            *parent,
+    const char         *name,
+    size_t              len,
+    ProcessContext     *context);
+PathDir *ec_path_cache_get_dir(
+    PathDir            *dir,
+    ProcessContext     *context);
+void ec_path_cache_put_dir(
+    PathDir            *dir,
+    ProcessContext     *context);
+bool ec_path_cache_build_dir(
+    PathDir            *dir,
+    char               *buffer,
+    char              **start);
+void ec_path_cache_invalidate_dir(
+    uint64_t            device,
+    uint64_t            inode,
+    ProcessContext     *context);
+void ec_path_cache_set_dir(
+    PathData           *path_data,
+    PathDir            *dir,
+    ProcessContext     *context);
@@ -13,3 +13,9 @@
 #define ec_percpu_counter_init(fbc, value, gfp)  percpu_counter_init(fbc, value, gfp)
 #define ec_alloc_percpu(type, gfp)               alloc_percpu_gfp(type, gfp)
 #endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0)
+#define ec_percpu_counter_add_batch(fbc, amount, batch)  percpu_counter_add_batch(fbc, amount, batch)
+#else
+#define ec_percpu_counter_add_batch(fbc, amount, batch)  __percpu_counter_add(fbc, amount, batch)
+#endif
@@ -56,6 +56,7 @@ extern uid_t    g_cb_ignored_uids[CB_SENSOR_MAX_UIDS];
 extern bool     g_exiting;
 extern uint32_t g_max_queue_size;
 extern bool     g_process_tracking_ref_debug;
+extern bool     g_process_op_stats;
 extern bool     g_path_cache_ref_debug;
 
 #define MSG_QUEUE_SIZE  8192
@@ -139,12 +140,16 @@ bool ec_stats_proc_initialize(ProcessContext *context);
 void ec_stats_proc_shutdown(ProcessContext *context);
 int ec_proc_track_show_table(struct seq_file *m, void *v);
 int ec_proc_track_show_stats(struct seq_file *m, void *v);
+void ec_proc_track_show_memory(struct seq_file *m, ProcessContext *context);
+void ec_path_cache_show_memory(struct seq_file *m, ProcessContext *context);
 int ec_file_track_show_table(struct seq_file *m, void *v);
 int ec_path_cache_show(struct seq_file *m, void *v);
 
 int ec_proc_current_memory_avg(struct seq_file *m, void *v);
 int ec_proc_current_memory_det(struct seq_file *m, void *v);
 int ec_show_active_hooks(struct seq_file *m, void *v);
+int ec_show_hook_profile(struct seq_file *m, void *v);
+ssize_t ec_reset_hook_profile(struct file *file, const char *buf, size_t size, loff_t *ppos);
 
 // ------------------------------------------------
 // Logging
@@ -153,10 +158,49 @@ extern bool ec_logger_initialize(ProcessContext *context);
 extern void ec_logger_shutdown(ProcessContext *context);
 
 extern PCB_EVENT ec_alloc_event(CB_EVENT_TYPE eventType, ProcessContext *context);
+extern PCB_EVENT ec_alloc_event_inline(CB_EVENT_TYPE eventType, size_t inline_size, ProcessContext *context);
+extern char *ec_event_strdup(PCB_EVENT event, const char *src, uint16_t *size, ProcessContext *context);
 extern void ec_free_event(PCB_EVENT event, ProcessContext *context);
 extern void ec_free_event_on_error(PCB_EVENT event, ProcessContext *context);
 
 extern bool ec_logger_should_log(CB_EVENT_TYPE eventType);
+extern void ec_logger_update_interest(void);
+
+// One bit per event type that we would currently send, compiled from the driver config and
+//  the reader state by ec_logger_update_interest.  Hooks test it before doing any work for an
+//  event.  The top bit is set when there are uid rules, so the uid is only read when needed.
+extern uint64_t g_event_interest;
+
+#define EVENT_INTEREST(type)          (1ULL << (type))
+#define EVENT_INTEREST_UID_FILTER     (1ULL << 63)
+#define EVENT_INTEREST_PROCESS        (EVENT_INTEREST(CB_EVENT_TYPE_PROCESS_START_FORK)     \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_PROCESS_START_EXEC)   \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_DISCOVER)             \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_DISCOVER_COMPLETE)    \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_DISCOVER_FLUSH)       \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_PROCESS_EXIT)         \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_PROCESS_LAST_EXIT))
+#define EVENT_INTEREST_FILE           (EVENT_INTEREST(CB_EVENT_TYPE_FILE_CREATE)            \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_FILE_DELETE)          \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_FILE_WRITE)           \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_FILE_CLOSE)           \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_FILE_OPEN))
+#define EVENT_INTEREST_NET            (EVENT_INTEREST(CB_EVENT_TYPE_NET_CONNECT_PRE)        \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_NET_CONNECT_POST)     \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_NET_ACCEPT)           \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_NET_FLOW_SUMMARY)     \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_DNS_RESPONSE))
+#define EVENT_INTEREST_ALWAYS         (EVENT_INTEREST(CB_EVENT_TYPE_PROCESS_BLOCKED)        \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_PROCESS_NOT_BLOCKED)  \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_PROC_ANALYZE)         \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_HEARTBEAT)            \
+                                       | EVENT_INTEREST(CB_EVENT_TYPE_WEB_PROXY))
+
+// True if any of the event types in mask may be sent
+static inline bool ec_logger_is_interested(uint64_t mask)
+{
+    return (READ_ONCE(g_event_interest) & mask) != 0;
+}
 
 extern int ec_send_event(struct CB_EVENT *msg, ProcessContext *context);
 extern void ec_fops_comm_wake_up_reader(ProcessContext *context);
@@ -192,6 +236,7 @@ time_t ec_get_null_time(void);
 
 extern int     ec_proc_show_events_avg(struct seq_file *m, void *v);
 extern int     ec_proc_show_events_det(struct seq_file *m, void *v);
+extern int     ec_proc_show_events_lat(struct seq_file *m, void *v);
 extern ssize_t ec_proc_show_events_rst(struct file *file, const char *buf, size_t size, loff_t *ppos);
 extern ssize_t ec_net_track_purge(struct file *file, const char *buf, size_t size, loff_t *ppos);
 extern int     ec_net_track_show(struct seq_file *m, void *v);
@@ -392,6 +437,10 @@ typedef struct _CB_EVENT_NODE {
     struct llist_node  llistEntry;
     struct CB_EVENT    data;
     uint16_t           payload; // precomputed size of event data to be sent to userspace
+    uint64_t           enqueue_ns; // monotonic time the event was queued, for the latency histograms
+    uint16_t           inline_size; // room for strings after the node, see ec_event_strdup
+    uint16_t           inline_used;
+    char               inline_buf[];
 } CB_EVENT_NODE;
 
 // Helpers
@@ -9,6 +9,7 @@
 #include <linux/types.h>
 #include <linux/time.h>
 #include <linux/gfp.h>
+#include <linux/ktime.h>
 #include "dbg.h"
 #include <linux/llist.h>
 
@@ -56,6 +57,8 @@ typedef struct process_context {
     bool             allow_send_events;
     struct list_head list;
     bool             decr_active_call_count_on_exit;
+    uint64_t         enter_time_ns; // Monotonic time the hook passed the module disable check
+    uint8_t          hook_profile_slot; // 1-based profiler slot, 0 when not profiling
     HookTracking     hook_tracking;
 } ProcessContext;
 
@@ -66,6 +69,8 @@ typedef struct process_context {
     .allow_wake_up         = true,                                             \
     .allow_send_events     = true,                                             \
     .decr_active_call_count_on_exit = false,                                   \
+    .enter_time_ns         = 0,                                                \
+    .hook_profile_slot     = 0,                                                \
 }
 
 #define CB_ATOMIC        (GFP_ATOMIC | GFP_NOWAIT)
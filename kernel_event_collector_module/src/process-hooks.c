@@ -274,11 +274,7 @@ int ec_lsm_bprm_check_security(struct linux_binprm *bprm)
                 ec_process_tracking_set_path(process_handle, path_data, &context);
 
                 // also need to update the file information
-                ec_process_exec_identity(process_handle)->exec_details.inode = path_data->key.inode;
-                ec_process_exec_identity(process_handle)->exec_details.device = path_data->key.device;
-
-                ec_process_posix_identity(process_handle)->posix_details.inode = path_data->key.inode;
-                ec_process_posix_identity(process_handle)->posix_details.device = path_data->key.device;
+                ec_process_tracking_set_exec_file(process_handle, path_data, &context);
             }
         }
     }
@@ -296,7 +292,7 @@ int ec_lsm_bprm_check_security(struct linux_binprm *bprm)
                              TerminateFailureReasonNone,
                              0, // details
                              ec_process_tracking_should_track_user() ? uid : (uid_t)-1,
-                             path_data->path,
+                             path_data,
                              &context);
         }
         ret = -EPERM;
@@ -7,46 +7,175 @@
 #include "event-factory.h"
 #include "priv.h"
 #include "cb-spinlock.h"
+#include "mem-alloc.h"
 
-void __ec_send_process_discovery(void *data, void *priv, ProcessContext *context);
+#include <linux/mutex.h>
+
+// Discovery is streamed to the reader in chunks.  The first chunk is queued when discovery
+//  is requested, and each following chunk is queued by the reader once it has drained the
+//  event queue.  This keeps a large process table from flooding the queue or starving live
+//  events, and no table lock is held while events are being queued.
+#define DISCOVERY_CHUNK_SIZE  256
+
+typedef struct discovery_cursor {
+    SORTED_PROCESS_ENTRY *entries;
+    size_t                count;
+    size_t                position;
+    bool                  active;
+} DISCOVERY_CURSOR;
+
+static DISCOVERY_CURSOR s_discovery_cursor;
+static DEFINE_MUTEX(s_discovery_lock);
+
+uint64_t __ec_process_tracking_begin_discovery(uint64_t since_generation, ProcessContext *context);
+void __ec_process_tracking_send_discovery_chunk(ProcessContext *context);
+void __ec_process_tracking_reset_discovery_cursor(void);
+void __ec_send_process_discovery(SORTED_PROCESS_ENTRY *entry, ProcessContext *context);
 
 void ec_process_tracking_send_process_discovery(ProcessContext *context)
 {
+    __ec_process_tracking_begin_discovery(0, context);
+}
+
+// Only report processes that were created or exec'd after since_generation.  The returned
+//  generation should be passed back on the next request to pick up where this one ends.
+uint64_t ec_process_tracking_send_process_discovery_delta(uint64_t since_generation, ProcessContext *context)
+{
+    return __ec_process_tracking_begin_discovery(since_generation, context);
+}
+
+void ec_process_tracking_discovery_continue(ProcessContext *context)
+{
+    CANCEL_VOID(ec_process_tracking_discovery_pending());
+
+    MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(context, CATCH_DEFAULT);
+
+    __ec_process_tracking_send_discovery_chunk(context);
+
+CATCH_DEFAULT:
+    MODULE_PUT_AND_FINISH_MODULE_DISABLE_CHECK(context);
+}
+
+bool ec_process_tracking_discovery_pending(void)
+{
+    return READ_ONCE(s_discovery_cursor.active);
+}
+
+void ec_process_tracking_discovery_cancel(ProcessContext *context)
+{
+    mutex_lock(&s_discovery_lock);
+    __ec_process_tracking_reset_discovery_cursor();
+    mutex_unlock(&s_discovery_lock);
+}
+
+uint64_t ec_process_tracking_current_generation(void)
+{
+    return atomic64_read(&g_process_tracking_data.generation);
+}
+
+uint64_t __ec_process_tracking_begin_discovery(uint64_t since_generation, ProcessContext *context)
+{
+    SORTED_PROCESS_ENTRY *entries = NULL;
+    size_t count = 0;
+
+    // Read the generation before taking the snapshot.  Anything that changes while we walk
+    //  the table will be reported again by the next delta, which is harmless.
+    uint64_t generation = ec_process_tracking_current_generation();
+
+    // Until a snapshot is taken the caller is no further along than it was
+    uint64_t result = since_generation;
+
     // Because this can add events to the queue, we want to treat this like a
     // hook and make sure it is done before allowing the module to be disabled.
     // Otherwise, we can leak process entries, hang or crash the system by
     // disabling the driver while this function is in progress.
     MODULE_GET_AND_BEGIN_MODULE_DISABLE_CHECK_IF_DISABLED_GOTO(context, CATCH_DEFAULT);
 
-    // The call below will evqueue events while holding the hash table lack.  We
-    //  observeved a deadlock with this logic in the following condition.
-    //    The user agent triggers a process discover via the ioctl. (This code is called.)
-    //      During this, we are holding a lock on the hash table.
-    //    Meanwhile, we observe a fork and attempt to lock the hash table. But the
-    //      discovery code holds the lock, so the clone hook is blocked.
-    //    The discovery enqueues an event, and attempts to wake up the reader.
-    //      This deadlocks because the clone hook has the scheduler frozen, but is
-    //      waiting on us to release the lock.
-    //    The fix is to ensure that we do not wake up the reader with the lock held.
-    //    We explicitly wake up the reader after we have relased the lock, and
-    //      enable the wake up logic.
+    // The table locks are only held while copying the pid and start time of each process.
+    entries = ec_sorted_tracking_table_snapshot(since_generation, &count, context);
+    TRY(entries);
+
+    TRACE(DL_PROC_TRACKING, "%s: discovering %zu processes after generation %llu",
+          __func__, count, since_generation);
+
+    // A new request replaces any discovery still in progress
+    mutex_lock(&s_discovery_lock);
+    __ec_process_tracking_reset_discovery_cursor();
+    s_discovery_cursor.entries  = entries;
+    s_discovery_cursor.count    = count;
+    s_discovery_cursor.position = 0;
+    WRITE_ONCE(s_discovery_cursor.active, true);
+    mutex_unlock(&s_discovery_lock);
+
+    __ec_process_tracking_send_discovery_chunk(context);
+    result = generation;
+
+CATCH_DEFAULT:
+    MODULE_PUT_AND_FINISH_MODULE_DISABLE_CHECK(context);
+    return result;
+}
+
+void __ec_process_tracking_send_discovery_chunk(ProcessContext *context)
+{
+    size_t end;
+
+    mutex_lock(&s_discovery_lock);
+    TRY(s_discovery_cursor.active);
+
+    // We have observed deadlocks when waking the reader from inside a hook that has the
+    //  scheduler frozen while waiting on a lock we hold.  The tracking table locks are
+    //  only held per-lookup now, but we still wake the reader once after the whole chunk
+    //  is queued instead of once per event.
     DISABLE_WAKE_UP(context);
-    ec_sorted_tracking_table_for_each(__ec_send_process_discovery, NULL, context);
-    ec_event_send_discover_complete(context);
+
+    end = min_t(size_t, s_discovery_cursor.position + DISCOVERY_CHUNK_SIZE, s_discovery_cursor.count);
+    for (; s_discovery_cursor.position < end; ++s_discovery_cursor.position)
+    {
+        IF_MODULE_DISABLED_GOTO(context, CATCH_DISABLED);
+
+        __ec_send_process_discovery(&s_discovery_cursor.entries[s_discovery_cursor.position], context);
+    }
+
+    if (s_discovery_cursor.position >= s_discovery_cursor.count)
+    {
+        ec_event_send_discover_complete(context);
+        __ec_process_tracking_reset_discovery_cursor();
+    }
+
+CATCH_DISABLED:
     ENABLE_WAKE_UP(context);
+    mutex_unlock(&s_discovery_lock);
 
     ec_fops_comm_wake_up_reader(context);
+    return;
 
 CATCH_DEFAULT:
-    MODULE_PUT_AND_FINISH_MODULE_DISABLE_CHECK(context);
+    mutex_unlock(&s_discovery_lock);
+}
+
+// Must be called with s_discovery_lock held
+void __ec_process_tracking_reset_discovery_cursor(void)
+{
+    if (s_discovery_cursor.entries)
+    {
+        ec_mem_free(s_discovery_cursor.entries);
+    }
+    s_discovery_cursor.entries  = NULL;
+    s_discovery_cursor.count    = 0;
+    s_discovery_cursor.position = 0;
+    WRITE_ONCE(s_discovery_cursor.active, false);
 }
 
-void __ec_send_process_discovery(void *data, void *priv, ProcessContext *context)
+void __ec_send_process_discovery(SORTED_PROCESS_ENTRY *entry, ProcessContext *context)
 {
-    ProcessHandle *handle = ec_sorted_tracking_table_get_handle(data, context);
+    ProcessHandle *handle = ec_process_tracking_get_handle(entry->pid, context);
 
     TRY(handle);
 
+    // The pid was reused after the snapshot was taken.  The new process will be
+    //  reported by its own start event.
+    TRY(ec_process_posix_identity(handle)->posix_details.start_time == entry->start_time);
+
     ec_event_send_discover(handle,
                     ec_process_tracking_should_track_user() ? ec_process_posix_identity(handle)->uid : (uid_t)-1,
                     context);
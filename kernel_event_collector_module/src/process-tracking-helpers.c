@@ -273,8 +273,8 @@ void ec_process_tracking_set_event_info(ProcessHandle *process_handle, CB_EVENT_
     TRY(process_handle && event);
 
     event->procInfo.all_process_details.array[FORK]             = ec_process_posix_identity(process_handle)->posix_details;
-    event->procInfo.all_process_details.array[FORK_PARENT]      = ec_process_posix_identity(process_handle)->posix_parent_details;
-    event->procInfo.all_process_details.array[FORK_GRANDPARENT] = ec_process_posix_identity(process_handle)->posix_grandparent_details;
+    event->procInfo.all_process_details.array[FORK_PARENT]      = ec_process_posix_identity(process_handle)->lineage->parent;
+    event->procInfo.all_process_details.array[FORK_GRANDPARENT] = ec_process_posix_identity(process_handle)->lineage->grandparent;
     event->procInfo.all_process_details.array[EXEC]             = ec_process_exec_identity(process_handle)->exec_details;
     event->procInfo.all_process_details.array[EXEC_PARENT]      = ec_process_exec_identity(process_handle)->exec_parent_details;
     event->procInfo.all_process_details.array[EXEC_GRANDPARENT] = ec_process_exec_identity(process_handle)->exec_grandparent_details;
@@ -356,18 +356,23 @@ void ec_process_tracking_set_path(ProcessHandle *process_handle, PathData *path_
      }
 }
 
-void ec_process_tracking_put_path(char *path, ProcessContext *context)
+// Updates the exec image of the process and moves it in the exec inode index
+void ec_process_tracking_set_exec_file(ProcessHandle *process_handle, PathData *path_data, ProcessContext *context)
 {
-    ec_mem_put(path);
-}
+    CANCEL_VOID(process_handle && path_data);
 
-int __ec_hashtbl_search_callback(HashTbl * hashTblp, void *datap, void *priv, ProcessContext *context);
+    ec_process_exec_identity(process_handle)->exec_details.inode = path_data->key.inode;
+    ec_process_exec_identity(process_handle)->exec_details.device = path_data->key.device;
 
-void ec_is_process_tracked_get_state_by_inode(RUNNING_BANNED_INODE_S *psRunningInodesToBan, ProcessContext *context)
-{
-    ec_hashtbl_read_for_each(&g_process_tracking_data.table, __ec_hashtbl_search_callback, psRunningInodesToBan, context);
+    ec_process_posix_identity(process_handle)->posix_details.inode = path_data->key.inode;
+    ec_process_posix_identity(process_handle)->posix_details.device = path_data->key.device;
 
-    return;
+    ec_process_tracking_index_update_exec(ec_process_posix_identity(process_handle), context);
+}
+
+void ec_process_tracking_put_path(char *path, ProcessContext *context)
+{
+    ec_mem_put(path);
 }
 
 bool ec_process_tracking_has_active_process(PosixIdentity *posix_identity, ProcessContext *context)
@@ -384,55 +389,12 @@ CATCH_DEFAULT:
     return result;
 }
 
-// Note: This function is used as a callback by ec_hashtbl_read_for_each called from
-//       ec_is_process_tracked_get_state_by_inode also note that it is called from inside a spinlock.
-//       Therefore, in the future if modifications are required be aware that any function call that may
-//       sleep should be avoided.
-//       We also allocate an array of pointers and it is the responsibility of the caller to free them when done.
-int __ec_hashtbl_search_callback(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context)
-{
-    PosixIdentity *posix_identity = (PosixIdentity *)datap;
-    RUNNING_BANNED_INODE_S *psRunningInodesToBan = NULL;
-    RUNNING_PROCESSES_TO_BAN *temp = NULL;
-
-    TRY(posix_identity);
-
-    // Saftey first
-    // TRY_DO(priv,
-    // {
-    //     TRACE( DL_ERROR, "%s:%d NULL ptr provided as function argument [%p=posix_data %p=priv]. Bailing...",
-    //                      __func__, __LINE__, posix_data, priv);
-    // });
-
-    psRunningInodesToBan = (RUNNING_BANNED_INODE_S *)priv;
-
-    //Did we match based on inode?
-    if (posix_identity->posix_details.device == psRunningInodesToBan->device &&
-        posix_identity->posix_details.inode == psRunningInodesToBan->inode)
-    {
-        //Allocate a new list element for banning to hold this process pointer
-        temp = (RUNNING_PROCESSES_TO_BAN *)ec_mem_alloc(sizeof(RUNNING_PROCESSES_TO_BAN), context);
-        TRY_DO(temp,
-        {
-            TRACE(DL_ERROR, "%s:%d Out of memory!\n", __func__, __LINE__);
-        });
-
-        //Update our structure
-        temp->process_handle = ec_hashtbl_get(hashTblp, posix_identity, context);
-        list_add(&(temp->list), &(psRunningInodesToBan->BanList.list));
-        psRunningInodesToBan->count++;
-    }
-CATCH_DEFAULT:
-    return ACTION_CONTINUE;
-}
-
 void ec_process_tracking_update_op_cnts(PosixIdentity *posix_identity, CB_EVENT_TYPE event_type, int action)
 {
-    switch (event_type)
+    PosixIdentityStats *stats = posix_identity->stats;
+
+    if (event_type == CB_EVENT_TYPE_PROCESS_START)
     {
-    case CB_EVENT_TYPE_PROCESS_START:
-        posix_identity->process_op_cnt += 1;
-        posix_identity->process_create += 1;
         if (action == CB_PROCESS_START_BY_FORK)
         {
             g_process_tracking_data.create_by_fork += 1;
@@ -440,60 +402,70 @@ void ec_process_tracking_update_op_cnts(PosixIdentity *posix_identity, CB_EVENT_
         {
             g_process_tracking_data.create_by_exec += 1;
         }
+    }
+
+    // Per process counters are optional
+    CANCEL_VOID(stats);
+
+    switch (event_type)
+    {
+    case CB_EVENT_TYPE_PROCESS_START:
+        stats->process_op_cnt += 1;
+        stats->process_create += 1;
         break;
 
     case CB_EVENT_TYPE_PROCESS_EXIT:
     case CB_EVENT_TYPE_PROCESS_LAST_EXIT:
-        posix_identity->process_op_cnt += 1;
-        posix_identity->process_exit += 1;
+        stats->process_op_cnt += 1;
+        stats->process_exit += 1;
         break;
 
     case CB_EVENT_TYPE_MODULE_LOAD:
-        posix_identity->file_op_cnt += 1;
-        posix_identity->file_map_exec += 1;
+        stats->file_op_cnt += 1;
+        stats->file_map_exec += 1;
         break;
 
     case CB_EVENT_TYPE_FILE_CREATE:
-        posix_identity->file_op_cnt += 1;
-        posix_identity->file_create += 1;
+        stats->file_op_cnt += 1;
+        stats->file_create += 1;
         break;
 
     case CB_EVENT_TYPE_FILE_DELETE:
-        posix_identity->file_op_cnt += 1;
-        posix_identity->file_delete += 1;
+        stats->file_op_cnt += 1;
+        stats->file_delete += 1;
         break;
 
     case CB_EVENT_TYPE_FILE_WRITE:
-        posix_identity->file_op_cnt += 1;
-        if (posix_identity->file_write == 0)
+        stats->file_op_cnt += 1;
+        if (stats->file_write == 0)
         {
-            posix_identity->file_open += 1;
+            stats->file_open += 1;
         }
-        posix_identity->file_write += 1;
+        stats->file_write += 1;
 
     case CB_EVENT_TYPE_FILE_CLOSE:
-        posix_identity->file_op_cnt += 1;
-        posix_identity->file_close += 1;
+        stats->file_op_cnt += 1;
+        stats->file_close += 1;
         break;
 
     case CB_EVENT_TYPE_NET_CONNECT_PRE:
-        posix_identity->net_op_cnt += 1;
-        posix_identity->net_connect += 1;
+        stats->net_op_cnt += 1;
+        stats->net_connect += 1;
         break;
 
     case CB_EVENT_TYPE_NET_CONNECT_POST:
-        posix_identity->net_op_cnt  += 1;
-        posix_identity->net_connect += 1;
+        stats->net_op_cnt  += 1;
+        stats->net_connect += 1;
         break;
 
     case CB_EVENT_TYPE_NET_ACCEPT:
-        posix_identity->net_op_cnt += 1;
-        posix_identity->net_accept += 1;
+        stats->net_op_cnt += 1;
+        stats->net_accept += 1;
         break;
 
     case CB_EVENT_TYPE_DNS_RESPONSE:
-        posix_identity->net_op_cnt += 1;
-        posix_identity->net_dns += 1;
+        stats->net_op_cnt += 1;
+        stats->net_dns += 1;
         break;
 
     default:
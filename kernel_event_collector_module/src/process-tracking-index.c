@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2019-2020 VMware, Inc. All rights reserved.
+// Copyright (c) 2016-2019 Carbon Black, Inc. All rights reserved.
+
+#include "process-tracking-private.h"
+#include "priv.h"
+#include "cb-test.h"
+#include "cb-spinlock.h"
+#include "mem-alloc.h"
+
+#include <linux/hash.h>
+
+// Index of tracked processes by exec image (device, inode), so the banning kill path visits
+//  only the processes running a banned binary instead of walking the whole table.
+//
+// An entry is linked while it is in the tracking table, and is unlinked before the table drops its
+//  reference.  So any entry found under a bucket lock is safe to take a reference on.
+#define PT_INDEX_BITS     11
+#define PT_INDEX_BUCKETS  (1 << PT_INDEX_BITS)
+
+typedef struct pt_index_bucket {
+    linuxSpinlock_t   lock;
+    struct list_head  head;
+} PT_INDEX_BUCKET;
+
+static PT_INDEX_BUCKET *s_exec_inode_index;
+
+// Matches are collected under the bucket lock and the callback is called after it is released
+typedef struct pt_index_match {
+    struct list_head  list;
+    ProcessHandle    *process_handle;
+} PT_INDEX_MATCH;
+
+static inline PT_INDEX_BUCKET *__ec_pt_index_bucket(uint64_t device, uint64_t inode)
+{
+    return &s_exec_inode_index[hash_64(device ^ (inode * GOLDEN_RATIO_64), PT_INDEX_BITS)];
+}
+
+bool ec_process_tracking_index_init(ProcessContext *context)
+{
+    int i;
+
+    s_exec_inode_index = ec_mem_valloc(PT_INDEX_BUCKETS * sizeof(PT_INDEX_BUCKET), context);
+    TRY_MSG(s_exec_inode_index, DL_ERROR, "%s: failed to allocate process index", __func__);
+
+    for (i = 0; i < PT_INDEX_BUCKETS; ++i)
+    {
+        ec_embedded_lock_init(&s_exec_inode_index[i].lock, context);
+        INIT_LIST_HEAD(&s_exec_inode_index[i].head);
+    }
+
+    return true;
+
+CATCH_DEFAULT:
+    return false;
+}
+
+void ec_process_tracking_index_shutdown(ProcessContext *context)
+{
+    int i;
+
+    CANCEL_VOID(s_exec_inode_index);
+
+    for (i = 0; i < PT_INDEX_BUCKETS; ++i)
+    {
+        ec_embedded_lock_destroy(&s_exec_inode_index[i].lock, context);
+    }
+    ec_mem_free(s_exec_inode_index);
+    s_exec_inode_index = NULL;
+}
+
+static void __ec_pt_index_link(PosixIdentity *posix_identity, ProcessContext *context)
+{
+    PT_INDEX_BUCKET *bucket = NULL;
+
+    posix_identity->indexed_device = posix_identity->posix_details.device;
+    posix_identity->indexed_inode  = posix_identity->posix_details.inode;
+
+    bucket = __ec_pt_index_bucket(posix_identity->indexed_device, posix_identity->indexed_inode);
+
+    ec_embedded_write_lock(&bucket->lock, context);
+    list_add(&posix_identity->exec_inode_entry, &bucket->head);
+    ec_embedded_write_unlock(&bucket->lock, context);
+}
+
+static void __ec_pt_index_unlink(PosixIdentity *posix_identity, ProcessContext *context)
+{
+    PT_INDEX_BUCKET *bucket = __ec_pt_index_bucket(posix_identity->indexed_device, posix_identity->indexed_inode);
+
+    ec_embedded_write_lock(&bucket->lock, context);
+    list_del_init(&posix_identity->exec_inode_entry);
+    ec_embedded_write_unlock(&bucket->lock, context);
+}
+
+// Called once the entry is in the tracking table
+void ec_process_tracking_index_insert(PosixIdentity *posix_identity, ProcessContext *context)
+{
+    CANCEL_VOID(posix_identity && s_exec_inode_index);
+
+    __ec_pt_index_link(posix_identity, context);
+}
+
+// Called before the entry leaves the tracking table.  Safe to call if it was never inserted.
+void ec_process_tracking_index_remove(PosixIdentity *posix_identity, ProcessContext *context)
+{
+    CANCEL_VOID(posix_identity && s_exec_inode_index);
+
+    if (!list_empty(&posix_identity->exec_inode_entry))
+    {
+        __ec_pt_index_unlink(posix_identity, context);
+    }
+}
+
+// Moves the entry to the new exec image.  Exec and exit of a process are serialized by the task,
+//  so the indexed key does not change under us.
+void ec_process_tracking_index_update_exec(PosixIdentity *posix_identity, ProcessContext *context)
+{
+    CANCEL_VOID(posix_identity && s_exec_inode_index);
+    CANCEL_VOID(!list_empty(&posix_identity->exec_inode_entry));
+
+    __ec_pt_index_unlink(posix_identity, context);
+    __ec_pt_index_link(posix_identity, context);
+}
+
+// Calls callback for each tracked process running the given exec image.  Returns the number of processes visited.
+int ec_process_tracking_for_each_by_exec_inode(
+    uint64_t                        device,
+    uint64_t                        inode,
+    process_tracking_index_callback callback,
+    void                           *priv,
+    ProcessContext                 *context)
+{
+    PT_INDEX_BUCKET *bucket = NULL;
+    struct list_head *entry = NULL;
+    struct list_head *safe = NULL;
+    PT_INDEX_MATCH *match = NULL;
+    LIST_HEAD(matches);
+    int count = 0;
+    int action = ACTION_CONTINUE;
+
+    CANCEL(s_exec_inode_index, 0);
+    CANCEL(callback, 0);
+
+    bucket = __ec_pt_index_bucket(device, inode);
+
+    ec_embedded_read_lock(&bucket->lock, context);
+    list_for_each(entry, &bucket->head)
+    {
+        PosixIdentity *posix_identity = list_entry(entry, PosixIdentity, exec_inode_entry);
+
+        if (posix_identity->indexed_device != device || posix_identity->indexed_inode != inode)
+        {
+            continue;
+        }
+
+        match = ec_mem_alloc(sizeof(PT_INDEX_MATCH), context);
+        if (!match)
+        {
+            TRACE(DL_ERROR, "%s: out of memory", __func__);
+            break;
+        }
+
+        // The tracking table holds a reference while the entry is linked
+        match->process_handle = ec_hashtbl_get(&g_process_tracking_data.table, posix_identity, context);
+        list_add_tail(&match->list, &matches);
+    }
+    ec_embedded_read_unlock(&bucket->lock, context);
+
+    list_for_each_safe(entry, safe, &matches)
+    {
+        match = list_entry(entry, PT_INDEX_MATCH, list);
+
+        if (match->process_handle && action == ACTION_CONTINUE)
+        {
+            ++count;
+            action = callback(match->process_handle, priv, context);
+        }
+
+        ec_process_tracking_put_handle(match->process_handle, context);
+        list_del(entry);
+        ec_mem_free(match);
+    }
+
+    return count;
+}
@@ -13,16 +13,35 @@ typedef struct posix_identity_data {
     uint64_t      create_by_fork;
     uint64_t      create_by_exec;
 
+    // Bumped each time a process is created or execs
+    atomic64_t    generation;
+
     bool          initialized;
     HashTbl       table;
     CB_MEM_CACHE  exec_identity_cache;
+
+    // Live ProcessLineage and PosixIdentityStats records
+    atomic64_t    lineage_count;
+    atomic64_t    stats_count;
 } process_tracking_data;
 
 extern process_tracking_data g_process_tracking_data;
 
+bool ec_process_tracking_index_init(ProcessContext *context);
+void ec_process_tracking_index_shutdown(ProcessContext *context);
+void ec_process_tracking_index_insert(PosixIdentity *posix_identity, ProcessContext *context);
+void ec_process_tracking_index_remove(PosixIdentity *posix_identity, ProcessContext *context);
+void ec_process_tracking_index_update_exec(PosixIdentity *posix_identity, ProcessContext *context);
+
+typedef struct sorted_process_entry {
+    time_t             start_time;
+    pid_t              pid;
+} SORTED_PROCESS_ENTRY;
+
 void ec_process_tracking_update_op_cnts(PosixIdentity *posix_identity, CB_EVENT_TYPE event_type, int action);
 void ec_sorted_tracking_table_for_each(for_rbtree_node callback, void *priv, ProcessContext *context);
 ProcessHandle *ec_sorted_tracking_table_get_handle(void *data, ProcessContext *context);
+SORTED_PROCESS_ENTRY *ec_sorted_tracking_table_snapshot(uint64_t since_generation, size_t *count, ProcessContext *context);
 const char *ec_process_tracking_get_proc_name(const char *path);
 
 ExecHandle *ec_process_tracking_get_temp_exec_handle(ProcessHandle *process_handle, ProcessContext *context);
@@ -60,7 +60,7 @@ void __ec_show_process_tracking_table(void *data, void *priv, ProcessContext *co
                   (uint64_t)ec_process_exec_identity(process_handle)->exec_details.pid,
                   (uint64_t)ec_process_exec_identity(process_handle)->exec_parent_details.pid,
                   (uint64_t)ec_process_posix_identity(process_handle)->posix_details.pid,
-                  (uint64_t)ec_process_posix_identity(process_handle)->posix_parent_details.pid,
+                  (uint64_t)ec_process_posix_identity(process_handle)->lineage->parent.pid,
                   (uint64_t)ec_process_posix_identity(process_handle)->tid,
                   ec_process_posix_identity(process_handle)->posix_details.inode,
                   shared_count,
@@ -81,3 +81,21 @@ int ec_proc_track_show_stats(struct seq_file *m, void *v)
 
     return 0;
 }
+
+// Appended to the mem-detail proc output.  Lineage records are shared between siblings, so
+//  the per process cost is the identity plus its share of the other records.
+void ec_proc_track_show_memory(struct seq_file *m, ProcessContext *context)
+{
+    int64_t processes = ec_hashtbl_get_count(&g_process_tracking_data.table, context);
+    int64_t lineages  = atomic64_read(&g_process_tracking_data.lineage_count);
+    int64_t stats     = atomic64_read(&g_process_tracking_data.stats_count);
+    int64_t total     = processes * sizeof(PosixIdentity) +
+                        lineages  * sizeof(ProcessLineage) +
+                        stats     * sizeof(PosixIdentityStats);
+
+    seq_printf(m, "\n%22s | %10s | %6s | %12s |\n", "Process Tracking", "Count", "Size", "Bytes");
+    seq_printf(m, "%22s | %10lld | %6zu | %12lld |\n", "Posix Identities", processes, sizeof(PosixIdentity), processes * (int64_t)sizeof(PosixIdentity));
+    seq_printf(m, "%22s | %10lld | %6zu | %12lld |\n", "Lineage Records", lineages, sizeof(ProcessLineage), lineages * (int64_t)sizeof(ProcessLineage));
+    seq_printf(m, "%22s | %10lld | %6zu | %12lld |\n", "Stat Blocks", stats, sizeof(PosixIdentityStats), stats * (int64_t)sizeof(PosixIdentityStats));
+    seq_printf(m, "%22s | %10s | %6lld | %12lld |\n", "Per Process", "", (processes ? total / processes : 0), total);
+}
@@ -4,9 +4,12 @@
 
 #include "process-tracking-private.h"
 #include "priv.h"
+#include "cb-test.h"
 #include "cb-spinlock.h"
 #include "mem-alloc.h"
 
+#include <linux/sort.h>
+
 // Helper logic to sort the tracking table
 typedef struct SORTED_PROCESS_TREE {
     CB_RBTREE           tree;
@@ -24,6 +27,19 @@ int __ec_rbtree_compare_process_start_time(void *left, void *right);
 void __ec_rbtree_get_ref(void *data, ProcessContext *context);
 void __ec_rbtree_put_ref(void *data, ProcessContext *context);
 int __ec_sort_process_tracking_table(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context);
+int __ec_snapshot_process_tracking_table(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context);
+int __ec_compare_sorted_process_entry(const void *left, const void *right);
+
+// Helper logic to take a flat snapshot of the tracking table
+typedef struct SORTED_PROCESS_SNAPSHOT {
+    SORTED_PROCESS_ENTRY *entries;
+    size_t                capacity;
+    size_t                count;
+    uint64_t              since_generation;
+} SORTED_PROCESS_SNAPSHOT;
+
+// Extra room for processes created between sizing the snapshot and walking the table
+#define SORTED_SNAPSHOT_SLACK 256
 
 void ec_sorted_tracking_table_for_each(for_rbtree_node callback, void *priv, ProcessContext *context)
 {
@@ -45,6 +61,68 @@ void ec_sorted_tracking_table_for_each(for_rbtree_node callback, void *priv, Pro
     ec_rbtree_destroy(&data.tree, context);
 }
 
+// Copy the (start_time, pid) of every process changed after since_generation into a
+//  flat array sorted by start time.  Table locks are only held while copying, so the
+//  caller can walk the result at its own pace.  The caller frees the result with ec_mem_free.
+SORTED_PROCESS_ENTRY *ec_sorted_tracking_table_snapshot(uint64_t since_generation, size_t *count, ProcessContext *context)
+{
+    SORTED_PROCESS_SNAPSHOT data = { 0 };
+    int64_t table_count = ec_hashtbl_get_count(&g_process_tracking_data.table, context);
+
+    *count = 0;
+
+    data.capacity         = (size_t)max_t(int64_t, table_count, 0) + SORTED_SNAPSHOT_SLACK;
+    data.since_generation = since_generation;
+    data.entries          = ec_mem_valloc(data.capacity * sizeof(SORTED_PROCESS_ENTRY), context);
+    TRY_MSG(data.entries, DL_ERROR, "%s: failed to allocate snapshot of %zu entries", __func__, data.capacity);
+
+    ec_hashtbl_read_for_each(&g_process_tracking_data.table, __ec_snapshot_process_tracking_table, &data, context);
+
+    sort(data.entries, data.count, sizeof(SORTED_PROCESS_ENTRY), __ec_compare_sorted_process_entry, NULL);
+
+    *count = data.count;
+
+CATCH_DEFAULT:
+    return data.entries;
+}
+
+int __ec_snapshot_process_tracking_table(HashTbl *hashTblp, void *datap, void *priv, ProcessContext *context)
+{
+    PosixIdentity *posix_identity = (PosixIdentity *)datap;
+    SORTED_PROCESS_SNAPSHOT *data  = (SORTED_PROCESS_SNAPSHOT *)priv;
+
+    IF_MODULE_DISABLED_GOTO(context, CATCH_DISABLED);
+
+    if (posix_identity && posix_identity->generation > data->since_generation)
+    {
+        // Anything that does not fit was created after we sized the snapshot, and
+        //  will be reported by its own start event.
+        TRY_MSG(data->count < data->capacity, DL_PROC_TRACKING, "%s: snapshot full", __func__);
+
+        data->entries[data->count].start_time = posix_identity->posix_details.start_time;
+        data->entries[data->count].pid        = posix_identity->pt_key.pid;
+        ++data->count;
+    }
+
+CATCH_DEFAULT:
+    return ACTION_CONTINUE;
+
+CATCH_DISABLED:
+    return ACTION_STOP;
+}
+
+int __ec_compare_sorted_process_entry(const void *left, const void *right)
+{
+    const SORTED_PROCESS_ENTRY *left_entry  = (const SORTED_PROCESS_ENTRY *)left;
+    const SORTED_PROCESS_ENTRY *right_entry = (const SORTED_PROCESS_ENTRY *)right;
+
+    if (left_entry->start_time != right_entry->start_time)
+    {
+        return left_entry->start_time < right_entry->start_time ? -1 : 1;
+    }
+    return left_entry->pid - right_entry->pid;
+}
+
 ProcessHandle *ec_sorted_tracking_table_get_handle(void *data, ProcessContext *context)
 {
     if (data)
@@ -20,12 +20,17 @@ void __ec_process_exec_identity_print_callback(void *data, ProcessContext *conte
 void __ec_exec_identity_delete_callback(void *value, ProcessContext *context);
 
 ExecIdentity *ec_process_tracking_alloc_exec_identity(ProcessContext *context);
+static ProcessLineage *__ec_process_lineage_alloc(ProcessDetails *parent, ProcessDetails *grandparent, ProcessContext *context);
+static ProcessLineage *__ec_process_lineage_for_child(PosixIdentity *parent, ProcessContext *context);
+static void __ec_process_lineage_put(ProcessLineage *lineage, ProcessContext *context);
+static PosixIdentityStats *__ec_process_stats_alloc(ProcessContext *context);
 void ec_process_tracking_init_exec_identity(ExecIdentity *exec_identity, ProcessContext *context);
 ProcessHandle *ec_process_tracking_add_process(PosixIdentity *posix_identity, ProcessContext *context);
 
 process_tracking_data __read_mostly g_process_tracking_data = {
     .table = {
-        .numberOfBuckets = 8192,
+        .numberOfBuckets = 1024,
+        .maxBuckets = 262144,
         .name = "pt_cache",
         .datasize = sizeof(PosixIdentity),
         .key_len     = sizeof(PT_TBL_KEY),
@@ -47,6 +52,12 @@ char  *static_interpreter_names[] = {
 char **g_interpreter_names = static_interpreter_names;
 int    g_interpreter_names_count = sizeof(static_interpreter_names)/sizeof(char *);
 
+// Used when a lineage record cannot be allocated.  Events for such a process report parent and
+//  grandparent pid 0, the same as a process whose parent was never tracked.  This is never freed.
+static ProcessLineage s_empty_lineage = {
+    .ref_count = ATOMIC64_INIT(1),
+};
+
 bool ec_process_tracking_should_track_user(void)
 {
     return g_driver_config.report_process_user == ENABLE;
@@ -56,6 +67,7 @@ bool ec_process_tracking_initialize(ProcessContext *context)
 {
     ec_hashtbl_init(&g_process_tracking_data.table, context);
 
+    TRY(ec_process_tracking_index_init(context));
     TRY(ec_mem_cache_create(&g_process_tracking_data.exec_identity_cache, "pt_exec_identity_cache", sizeof(ExecIdentity), context));
 
     g_process_tracking_data.initialized = true;
@@ -70,8 +82,13 @@ void ec_process_tracking_shutdown(ProcessContext *context)
 {
     g_process_tracking_data.initialized = false;
 
+    ec_process_tracking_discovery_cancel(context);
+
     ec_hashtbl_destroy(&g_process_tracking_data.table, context);
 
+    // Destroying the table unlinks each entry, so the index goes after it
+    ec_process_tracking_index_shutdown(context);
+
     ec_mem_cache_destroy(&g_process_tracking_data.exec_identity_cache, context);
 }
 
@@ -127,8 +144,7 @@ ProcessHandle *ec_process_tracking_create_process(
     ExecHandle          exec_handle               = { 0 };
     PosixIdentity      *posix_identity            = NULL;
     char               *msg                       = (is_real_start ? "" : "<FAKE> ");
-    ProcessDetails      posix_parent_details      = { 0 };
-    ProcessDetails      posix_grandparent_details = { 0 };
+    ProcessLineage     *lineage                   = NULL;
 
     // If this start is a fork we need to pull the shared struct from the parent
     if (action == CB_PROCESS_START_BY_FORK)
@@ -140,8 +156,7 @@ ProcessHandle *ec_process_tracking_create_process(
         {
             // Increase the reference count on the shared data (for local function)
             ec_process_exec_handle_clone(ec_process_exec_handle(parent_handle), &exec_handle, context);
-            posix_parent_details      = ec_process_posix_identity(parent_handle)->posix_details;
-            posix_grandparent_details = ec_process_posix_identity(parent_handle)->posix_parent_details;
+            lineage = __ec_process_lineage_for_child(ec_process_posix_identity(parent_handle), context);
 
             ec_process_tracking_put_handle(parent_handle, context);
         }
@@ -184,8 +199,8 @@ ProcessHandle *ec_process_tracking_create_process(
 
         exec_identity->exec_count   = 1;
 
-        posix_parent_details      = exec_identity->exec_details;
-        posix_grandparent_details = exec_identity->exec_parent_details;
+        __ec_process_lineage_put(lineage, context);
+        lineage = __ec_process_lineage_alloc(&exec_identity->exec_details, &exec_identity->exec_parent_details, context);
 
         ec_process_exec_handle_set_exec_identity(&exec_handle, exec_identity, context);
 
@@ -204,34 +219,23 @@ ProcessHandle *ec_process_tracking_create_process(
         posix_identity->uid                        = uid;
         posix_identity->euid                       = euid;
         posix_identity->action                     = action;
-        posix_identity->process_op_cnt             =
-            posix_identity->process_create         =
-            posix_identity->process_create_by_fork =
-            posix_identity->process_create_by_exec =
-            posix_identity->childproc_cnt          =
-            posix_identity->file_op_cnt            =
-            posix_identity->file_map_exec          =
-            posix_identity->file_create            =
-            posix_identity->file_delete            =
-            posix_identity->file_open              =
-            posix_identity->file_write             =
-            posix_identity->file_close             =
-            posix_identity->net_op_cnt             =
-            posix_identity->net_connect            =
-            posix_identity->net_accept             =
-            posix_identity->net_dns                = 0;
+        posix_identity->stats                      = __ec_process_stats_alloc(context);
+        posix_identity->child_lineage              = NULL;
         posix_identity->is_real_start              = is_real_start;
+        posix_identity->generation                 = atomic64_inc_return(&g_process_tracking_data.generation);
         posix_identity->exec_identity              = NULL;
         posix_identity->exec_blocked               = false;
         memset(&posix_identity->temp_exec_handle, 0, sizeof(posix_identity->temp_exec_handle));
+        INIT_LIST_HEAD(&posix_identity->exec_inode_entry);
 
         posix_identity->posix_details.pid         = pid;
         posix_identity->posix_details.device      = ec_exec_identity(&exec_handle)->exec_details.device;
         posix_identity->posix_details.inode       = ec_exec_identity(&exec_handle)->exec_details.inode;
         posix_identity->posix_details.start_time  = start_time;
 
-        posix_identity->posix_parent_details      = posix_parent_details;
-        posix_identity->posix_grandparent_details = posix_grandparent_details;
+        // The entry takes over the local reference
+        posix_identity->lineage                   = (lineage ? lineage : &s_empty_lineage);
+        lineage                                   = NULL;
 
         g_process_tracking_data.op_cnt += 1;
         g_process_tracking_data.create += 1;
@@ -273,6 +277,7 @@ ProcessHandle *ec_process_tracking_create_process(
 CATCH_DEFAULT:
     // Always drop the ref held by this local function
     ec_process_tracking_put_exec_handle(&exec_handle, context);
+    __ec_process_lineage_put(lineage, context);
 
     return process_handle;
 }
@@ -418,12 +423,14 @@ ProcessHandle *ec_process_tracking_update_process(
 
     ec_process_posix_identity(process_handle)->posix_details.device  = path_data->key.device;
     ec_process_posix_identity(process_handle)->posix_details.inode   = path_data->key.inode;
+    ec_process_tracking_index_update_exec(ec_process_posix_identity(process_handle), context);
 
     ec_process_posix_identity(process_handle)->tid            = tid;
     ec_process_posix_identity(process_handle)->uid            = uid;
     ec_process_posix_identity(process_handle)->euid           = euid;
     ec_process_posix_identity(process_handle)->action         = action;
     ec_process_posix_identity(process_handle)->is_real_start  = is_real_start;
+    ec_process_posix_identity(process_handle)->generation     = atomic64_inc_return(&g_process_tracking_data.generation);
 
     if (is_real_start)
     {
@@ -472,6 +479,9 @@ void ec_process_tracking_remove_process(ProcessHandle *process_handle, ProcessCo
                g_process_tracking_data.create,
                g_process_tracking_data.exit);
 
+        // Unlink from the indices while the table still holds its reference
+        ec_process_tracking_index_remove(ec_process_posix_identity(process_handle), context);
+
         // In the exec-other and some pid wrap cases this entry may not exist in
         //  hash table.  In this case, it will be a no-op.
         ec_hashtbl_del(&g_process_tracking_data.table, ec_process_posix_identity(process_handle), context);
@@ -491,6 +501,9 @@ ProcessHandle *ec_process_tracking_add_process(PosixIdentity *posix_identity, Pr
             ec_process_tracking_put_handle(process_handle, context);
             ec_hashtbl_free(&g_process_tracking_data.table, posix_identity, context);
             process_handle = NULL;
+        } else
+        {
+            ec_process_tracking_index_insert(posix_identity, context);
         }
     }
 
@@ -624,6 +637,9 @@ void ec_hashtbl_delete_callback(void *data, ProcessContext *context)
     {
         PosixIdentity *posix_identity = (PosixIdentity *)data;
 
+        // Entries dropped by ec_hashtbl_destroy were never removed explicitly
+        ec_process_tracking_index_remove(posix_identity, context);
+
         if (!g_process_tracking_data.initialized)
         {
             ExecIdentity *exec_identity = posix_identity->exec_identity;
@@ -648,7 +664,104 @@ void ec_hashtbl_delete_callback(void *data, ProcessContext *context)
 
         // Just in case, this should have been unset by ec_process_tracking_set_event_info
         ec_process_tracking_put_exec_handle(&posix_identity->temp_exec_handle, context);
+
+        __ec_process_lineage_put(posix_identity->lineage, context);
+        __ec_process_lineage_put(posix_identity->child_lineage, context);
+        posix_identity->lineage       = NULL;
+        posix_identity->child_lineage = NULL;
+
+        if (posix_identity->stats)
+        {
+            ec_mem_free(posix_identity->stats);
+            posix_identity->stats = NULL;
+            atomic64_dec(&g_process_tracking_data.stats_count);
+        }
+    }
+}
+
+static bool __ec_process_details_equal(const ProcessDetails *left, const ProcessDetails *right)
+{
+    return left->pid        == right->pid &&
+           left->start_time == right->start_time &&
+           left->device     == right->device &&
+           left->inode      == right->inode;
+}
+
+static ProcessLineage *__ec_process_lineage_alloc(ProcessDetails *parent, ProcessDetails *grandparent, ProcessContext *context)
+{
+    ProcessLineage *lineage = ec_mem_alloc(sizeof(ProcessLineage), context);
+
+    CANCEL(lineage, NULL);
+
+    lineage->parent      = *parent;
+    lineage->grandparent = *grandparent;
+    atomic64_set(&lineage->ref_count, 1);
+    atomic64_inc(&g_process_tracking_data.lineage_count);
+
+    return lineage;
+}
+
+// Returns a lineage record for a new child of parent.  Children forked between two execs of the
+//  parent share the same record.
+static ProcessLineage *__ec_process_lineage_for_child(PosixIdentity *parent, ProcessContext *context)
+{
+    ProcessLineage *lineage = NULL;
+    ProcessLineage *stale   = NULL;
+
+    ec_hashtbl_write_lock(&g_process_tracking_data.table, &parent->pt_key, context);
+    lineage = parent->child_lineage;
+    if (lineage &&
+        __ec_process_details_equal(&lineage->parent, &parent->posix_details) &&
+        __ec_process_details_equal(&lineage->grandparent, &parent->lineage->parent))
+    {
+        atomic64_inc(&lineage->ref_count);
+    } else
+    {
+        lineage = NULL;
     }
+    ec_hashtbl_write_unlock(&g_process_tracking_data.table, &parent->pt_key, context);
+
+    CANCEL(!lineage, lineage);
+
+    lineage = __ec_process_lineage_alloc(&parent->posix_details, &parent->lineage->parent, context);
+    CANCEL(lineage, NULL);
+
+    // Keep a reference in the parent for the next sibling
+    atomic64_inc(&lineage->ref_count);
+
+    ec_hashtbl_write_lock(&g_process_tracking_data.table, &parent->pt_key, context);
+    stale = parent->child_lineage;
+    parent->child_lineage = lineage;
+    ec_hashtbl_write_unlock(&g_process_tracking_data.table, &parent->pt_key, context);
+
+    __ec_process_lineage_put(stale, context);
+
+    return lineage;
+}
+
+static void __ec_process_lineage_put(ProcessLineage *lineage, ProcessContext *context)
+{
+    CANCEL_VOID(lineage && lineage != &s_empty_lineage);
+
+    IF_ATOMIC64_DEC_AND_TEST__CHECK_NEG(&lineage->ref_count, {
+        ec_mem_free(lineage);
+        atomic64_dec(&g_process_tracking_data.lineage_count);
+    });
+}
+
+static PosixIdentityStats *__ec_process_stats_alloc(ProcessContext *context)
+{
+    PosixIdentityStats *stats = NULL;
+
+    CANCEL(g_process_op_stats, NULL);
+
+    stats = ec_mem_alloc(sizeof(PosixIdentityStats), context);
+    CANCEL(stats, NULL);
+
+    memset(stats, 0, sizeof(PosixIdentityStats));
+    atomic64_inc(&g_process_tracking_data.stats_count);
+
+    return stats;
 }
 
 void *ec_hashtbl_handle_callback(void *data, ProcessContext *context)
@@ -17,19 +17,6 @@ typedef struct pt_table_key {
 #define FAKE_START false
 #define REAL_START true
 
-// List struct for use by RUNNING_BANNED_INODE_S
-typedef struct processes_to_ban {
-    void *process_handle; // Pointer for the process tracking element to ban
-    struct list_head list;
-} RUNNING_PROCESSES_TO_BAN;
-
-typedef struct running_banned_inode_info_s {
-    uint64_t count;
-    uint64_t device;
-    uint64_t inode;
-    RUNNING_PROCESSES_TO_BAN BanList;
-} RUNNING_BANNED_INODE_S;
-
 typedef struct exec_identity {
     ProcessDetails    exec_details;
     ProcessDetails    exec_parent_details;
@@ -65,22 +52,17 @@ typedef struct ExecIdentity_handle {
     char         *cmdline;
 } ExecHandle;
 
-typedef struct posix_identity {
-    PT_TBL_KEY        pt_key;
-
-    ProcessDetails    posix_details;
-    ProcessDetails    posix_parent_details;
-    ProcessDetails    posix_grandparent_details;
-
-    pid_t       tid;
-    uid_t       uid;
-    uid_t       euid;
-    int         action;   // How did we start
-
-    bool        exec_blocked;
-    bool        is_real_start;
-    uint64_t    op_cnt;
-
+// Parent and grandparent of a process as seen when it was forked.  Siblings forked from the
+//  same parent between two of its execs share one record.  If a record cannot be allocated the
+//  process points at an empty one, and its events report parent pid 0.
+typedef struct process_lineage {
+    ProcessDetails    parent;
+    ProcessDetails    grandparent;
+    atomic64_t        ref_count;
+} ProcessLineage;
+
+// Per process operation counters.  These are only allocated when process_op_stats is set.
+typedef struct posix_identity_stats {
     uint64_t    net_op_cnt;
     uint64_t    net_connect;
     uint64_t    net_accept;
@@ -102,13 +84,44 @@ typedef struct posix_identity {
     uint64_t    process_create_by_exec;
 
     uint64_t    childproc_cnt;
+} PosixIdentityStats;
+
+typedef struct posix_identity {
+    // Fields read on every event come first
+    PT_TBL_KEY        pt_key;
+
+    ProcessDetails    posix_details;
+    ProcessLineage   *lineage;
 
     ExecIdentity   *exec_identity;
 
+    pid_t       tid;
+    uid_t       uid;
+    uid_t       euid;
+    int         action;   // How did we start
+
+    bool        exec_blocked;
+    bool        is_real_start;
+
+    // Value of the tracking generation when this process was created or last exec'd.
+    //  This lets discovery report only the processes that changed since a known point.
+    uint64_t    generation;
+
     // This holds a temporary handle to the exec_identity that will be referenced by the next event created for
     // this proc. This is only used when creating events as a result of process execs.
     ExecHandle      temp_exec_handle;
 
+    // Lineage record handed to the children of this process, protected by the bucket lock
+    ProcessLineage     *child_lineage;
+
+    PosixIdentityStats *stats;
+
+    // Link into the exec inode index (see process-tracking-index.c).  The indexed exec
+    //  image is kept separately so an entry can be found in its bucket after posix_details changes.
+    struct list_head  exec_inode_entry;
+    uint64_t          indexed_device;
+    uint64_t          indexed_inode;
+
 } PosixIdentity;
 
 // This handle holds reference counts to the posix_identity
@@ -148,16 +161,30 @@ ProcessHandle *ec_process_tracking_get_handle(pid_t pid, ProcessContext *context
 void ec_process_tracking_put_handle(ProcessHandle *process_handle, ProcessContext *context);
 void ec_process_tracking_remove_process(ProcessHandle *process_handle, ProcessContext *context);
 bool ec_is_process_tracked(pid_t pid, ProcessContext *context);
-void ec_is_process_tracked_get_state_by_inode(RUNNING_BANNED_INODE_S *psRunningInodesToBan, ProcessContext *context);
 bool ec_process_tracking_report_exit(pid_t pid, ProcessContext *context);
 char *ec_process_tracking_get_path(ExecIdentity *exec_identity, ProcessContext *context);
 void ec_process_tracking_set_path(ProcessHandle *process_handle, PathData *path_data, ProcessContext *context);
+void ec_process_tracking_set_exec_file(ProcessHandle *process_handle, PathData *path_data, ProcessContext *context);
 char *ec_process_tracking_get_cmdline(ExecIdentity *exec_identity, ProcessContext *context);
 void ec_process_tracking_set_cmdline(ExecHandle *exec_handle, char *cmdline, ProcessContext *context);
 void ec_process_tracking_set_proc_cmdline(ProcessHandle *process_handle, char *cmdline, ProcessContext *context);
 
 // Discovery
 void ec_process_tracking_send_process_discovery(ProcessContext *context);
+uint64_t ec_process_tracking_send_process_discovery_delta(uint64_t since_generation, ProcessContext *context);
+void ec_process_tracking_discovery_continue(ProcessContext *context);
+bool ec_process_tracking_discovery_pending(void);
+void ec_process_tracking_discovery_cancel(ProcessContext *context);
+uint64_t ec_process_tracking_current_generation(void);
+
+// Index lookups.  The callback is called without any table locks held and returns ACTION_CONTINUE or ACTION_STOP.
+typedef int (*process_tracking_index_callback)(ProcessHandle *process_handle, void *priv, ProcessContext *context);
+int ec_process_tracking_for_each_by_exec_inode(
+        uint64_t                        device,
+        uint64_t                        inode,
+        process_tracking_index_callback callback,
+        void                           *priv,
+        ProcessContext                 *context);
 
 // Hook Helpers
 void ec_process_tracking_mark_as_blocked(ProcessHandle *process_handle);
@@ -11,6 +11,8 @@
 
 #include <linux/binfmts.h>
 #include <linux/printk.h>
+#include <linux/sort.h>
+#include <linux/workqueue.h>
 
 struct file *__ec_get_file_from_mm(struct mm_struct *mm);
 
@@ -281,25 +283,156 @@ struct task_stack {
 // FIRST_TASK and NEXT_TASK provide local dereferenced pointers so we don't need to dereference here
 #define HAS_MORE_TASKS(stack)  (!list_empty((stack)->child->sibling.next) && (&(stack)->child->sibling != &(stack)->task->children))
 
-bool __ec_add_tracking_for_child_and_update_stack(
+// Assuming no system will have > 10000 processes, break out of the loop if we exceed this.
+#define MAX_ENUMERATE_LOOPS 10000
+
+// Tracking a task resolves its path and walks its sockets, which is far more expensive than
+//  finding it.  So the process tree is walked once under rcu_read_lock to collect a reference
+//  to every task and its depth, and the tracking is done afterwards one depth at a time.  This
+//  keeps a parent tracked before its children.  Each depth is split into batches that are
+//  claimed by a pool of workers, and each batch gets its own short RCU read section.
+#define ENUMERATE_BATCH_SIZE   64
+#define ENUMERATE_MAX_WORKERS  32
+
+typedef struct enumerate_entry {
+    struct task_struct *task;
+    time_t              start_time;
+    int                 depth;
+} ENUMERATE_ENTRY;
+
+typedef struct enumerate_state {
+    ENUMERATE_ENTRY *entries;
+    int              count;
+
+    // The batches of the current depth are claimed from next up to level_end
+    atomic_t         next;
+    int              level_end;
+    pid_t            pid;
+} ENUMERATE_STATE;
+
+typedef struct enumerate_worker {
+    struct work_struct  work;
+    ENUMERATE_STATE    *state;
+    char               *path_buffer;
+} ENUMERATE_WORKER;
+
+void __ec_collect_all_tasks(ENUMERATE_STATE *state, ProcessContext *context);
+bool __ec_collect_child_and_update_stack(
     struct task_stack *top,
     struct task_stack *next,
-    char              *path_buffer,
+    ENUMERATE_STATE   *state,
+    int                depth,
     time_t             start_time,
-    ProcessContext *context);
+    ProcessContext    *context);
+int __ec_compare_enumerate_entry(const void *left, const void *right);
+void __ec_enumerate_batches(ENUMERATE_STATE *state, char *path_buffer);
+void __ec_enumerate_work_task(struct work_struct *work);
 void __ec_add_tracking_for_task(
     struct task_struct *task,
     time_t              start_time,
     char               *path_buffer,
     ProcessContext *context);
 
-// Assuming no system will have > 10000 processes, break out of the loop if we exceed this.
-#define MAX_ENUMERATE_LOOPS 10000
-
 void ec_enumerate_and_track_all_tasks(ProcessContext *context)
+{
+    ENUMERATE_STATE   state        = { 0 };
+    ENUMERATE_WORKER *workers      = NULL;
+    char             *path_buffer  = NULL;
+    int               worker_count = 0;
+    int               level_start;
+    int               i;
+
+    // The walk below records at most one task per loop
+    state.entries = ec_mem_valloc(MAX_ENUMERATE_LOOPS * sizeof(ENUMERATE_ENTRY), context);
+    state.pid     = context->pid;
+    path_buffer   = ec_get_path_buffer(context);
+
+    TRY(path_buffer && state.entries);
+
+    __ec_collect_all_tasks(&state, context);
+
+    // The walk visits parents first, so sorting by depth then start time keeps that order
+    sort(state.entries, state.count, sizeof(ENUMERATE_ENTRY), __ec_compare_enumerate_entry, NULL);
+
+    // The calling thread always works too, so a missing worker only costs speed
+    if (state.count > ENUMERATE_BATCH_SIZE)
+    {
+        worker_count = min_t(int, num_online_cpus(), ENUMERATE_MAX_WORKERS) - 1;
+    }
+    if (worker_count > 0)
+    {
+        workers = ec_mem_alloc(worker_count * sizeof(ENUMERATE_WORKER), context);
+        worker_count = workers ? worker_count : 0;
+    }
+    for (i = 0; i < worker_count; ++i)
+    {
+        INIT_WORK(&workers[i].work, __ec_enumerate_work_task);
+        workers[i].state       = &state;
+        workers[i].path_buffer = ec_get_path_buffer(context);
+        if (!workers[i].path_buffer)
+        {
+            worker_count = i;
+            break;
+        }
+    }
+
+    TRACE(DL_INIT, "%s: tracking %d tasks with %d workers", __func__, state.count, worker_count + 1);
+
+    for (level_start = 0; level_start < state.count; level_start = state.level_end)
+    {
+        int depth  = state.entries[level_start].depth;
+        int active = 0;
+
+        state.level_end = level_start;
+        while (state.level_end < state.count && state.entries[state.level_end].depth == depth)
+        {
+            ++state.level_end;
+        }
+        atomic_set(&state.next, level_start);
+
+        // A depth that fits in one batch is not worth waking the workers for
+        if (state.level_end - level_start > ENUMERATE_BATCH_SIZE)
+        {
+            active = worker_count;
+        }
+        for (i = 0; i < active; ++i)
+        {
+            queue_work(system_unbound_wq, &workers[i].work);
+        }
+
+        __ec_enumerate_batches(&state, path_buffer);
+
+        // Every task at this depth must be tracked before we start on their children
+        for (i = 0; i < active; ++i)
+        {
+            flush_work(&workers[i].work);
+        }
+    }
+
+CATCH_DEFAULT:
+    for (i = 0; i < worker_count; ++i)
+    {
+        ec_put_path_buffer(workers[i].path_buffer);
+    }
+    ec_mem_free(workers);
+
+    for (i = 0; i < state.count; ++i)
+    {
+        put_task_struct(state.entries[i].task);
+    }
+    ec_mem_free(state.entries);
+    ec_put_path_buffer(path_buffer);
+
+    // Suppressing false positive coverity issue reporting that variable "path_buffer"
+    // going out of scope leaks the storage it points to which is not the case.
+    // The memory is freed by ec_put_path_buffer() function call above.
+
+    // coverity[leaked_storage:SUPPRESS]
+}
+
+void __ec_collect_all_tasks(ENUMERATE_STATE *state, ProcessContext *context)
 {
     struct task_stack *stack = NULL;
-    char *path_buffer = NULL;
     time_t             start_time = 0;
     int                index = 0;
     int num_loops = 0;
@@ -307,7 +440,6 @@ void ec_enumerate_and_track_all_tasks(ProcessContext *context)
     // Allocate stack space for walking the process tree
     //  We allocate one more than we need, so that the logic never accesses invalid memory
     stack       = ec_mem_alloc((MAX_TASK_STACK + 1) * sizeof(struct task_stack), context);
-    path_buffer = ec_get_path_buffer(context);
     start_time  = ec_get_current_time() - TO_WIN_SEC(2);
 
     // I would prefer to hold the tasklist_lock here, but it causes a softlok
@@ -319,7 +451,7 @@ void ec_enumerate_and_track_all_tasks(ProcessContext *context)
     //  onto the stack.  (This causes the inner loop to start looping over the children.)
     // Once the children are exhausted, it will exit the inner loop.  The outer loop will
     //  pop a layer off the stack and resume enumerating the previous list of children.
-    TRY(path_buffer && stack);
+    TRY(stack);
 
     stack[0].task  = &init_task;
     stack[0].child = FIRST_TASK(&stack[0]);
@@ -332,11 +464,12 @@ void ec_enumerate_and_track_all_tasks(ProcessContext *context)
         // TODO: the infinite looping problem should be fixed, it we don't see it any more remove MAX_ENUMERATE_LOOPS.
         while (num_loops < MAX_ENUMERATE_LOOPS && NEXT_TASK(&stack[index]) && HAS_MORE_TASKS(&stack[index]))
         {
-            if (__ec_add_tracking_for_child_and_update_stack(&stack[index],
-                                                        &stack[index + 1],
-                                                        path_buffer,
-                                                        start_time++,
-                                                        context))
+            if (__ec_collect_child_and_update_stack(&stack[index],
+                                                    &stack[index + 1],
+                                                    state,
+                                                    index,
+                                                    start_time++,
+                                                    context))
             {
                 // If the process tree goes too deep, we print a warning and continue
                 //  enumerating.
@@ -371,33 +504,32 @@ void ec_enumerate_and_track_all_tasks(ProcessContext *context)
 
 CATCH_DEFAULT:
     rcu_read_unlock();
-    ec_put_path_buffer(path_buffer);
     ec_mem_free(stack);
-
-    // Suppressing false positive coverity issue reporting that variable "path_buffer"
-    // going out of scope leaks the storage it points to which is not the case.
-    // The memory is freed by ec_put_path_buffer() function call above.
-
-    // coverity[leaked_storage:SUPPRESS]
 }
 
-bool __ec_add_tracking_for_child_and_update_stack(
+bool __ec_collect_child_and_update_stack(
     struct task_stack *top,
     struct task_stack *next,
-    char              *path_buffer,
+    ENUMERATE_STATE   *state,
+    int                depth,
     time_t             start_time,
-    ProcessContext *context)
+    ProcessContext    *context)
 {
     bool found_child = false;
 
-    if (top && top->child && next && path_buffer)
+    if (top && top->child && next && state->count < MAX_ENUMERATE_LOOPS)
     {
         if (top->child->mm != NULL &&
             top->child->state != TASK_DEAD &&
             top->child->exit_state == 0 &&
             ec_getpid(top->child) == ec_gettid(top->child))
         {
-            __ec_add_tracking_for_task(top->child, start_time, path_buffer, context);
+            // Hold a reference so the task outlives the RCU read section
+            get_task_struct(top->child);
+            state->entries[state->count].task       = top->child;
+            state->entries[state->count].start_time = start_time;
+            state->entries[state->count].depth      = depth;
+            ++state->count;
 
             // initialize the next stack entry so we can enumerate the children
             // of this task
@@ -413,6 +545,57 @@ bool __ec_add_tracking_for_child_and_update_stack(
     return found_child;
 }
 
+int __ec_compare_enumerate_entry(const void *left, const void *right)
+{
+    const ENUMERATE_ENTRY *left_entry  = (const ENUMERATE_ENTRY *)left;
+    const ENUMERATE_ENTRY *right_entry = (const ENUMERATE_ENTRY *)right;
+
+    if (left_entry->depth != right_entry->depth)
+    {
+        return left_entry->depth - right_entry->depth;
+    }
+    if (left_entry->start_time != right_entry->start_time)
+    {
+        return left_entry->start_time < right_entry->start_time ? -1 : 1;
+    }
+    return 0;
+}
+
+// Claim and track batches of the current depth until there are none left
+void __ec_enumerate_batches(ENUMERATE_STATE *state, char *path_buffer)
+{
+    int start;
+
+    DECLARE_ATOMIC_CONTEXT(context, state->pid);
+
+    while ((start = atomic_add_return(ENUMERATE_BATCH_SIZE, &state->next) - ENUMERATE_BATCH_SIZE) < state->level_end)
+    {
+        int end = min(start + ENUMERATE_BATCH_SIZE, state->level_end);
+        int i;
+
+        rcu_read_lock();
+        for (i = start; i < end; ++i)
+        {
+            // The task may have exited since we collected it
+            if (ec_is_task_alive(state->entries[i].task))
+            {
+                __ec_add_tracking_for_task(state->entries[i].task, state->entries[i].start_time, path_buffer, &context);
+            }
+        }
+        rcu_read_unlock();
+
+        // Give RCU and the scheduler a chance between batches
+        cond_resched();
+    }
+}
+
+void __ec_enumerate_work_task(struct work_struct *work)
+{
+    ENUMERATE_WORKER *worker = container_of(work, ENUMERATE_WORKER, work);
+
+    __ec_enumerate_batches(worker->state, worker->path_buffer);
+}
+
 void __ec_add_tracking_for_task(
     struct task_struct *task,
     time_t              start_time,
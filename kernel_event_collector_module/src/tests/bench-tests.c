@@ -0,0 +1,544 @@
+// SPDX-License-Identifier: GPL-2.0
+// Copyright (c) 2022 VMware, Inc. All rights reserved.
+
+#include "priv.h"
+#include "run-tests.h"
+#include "hash-table.h"
+#include "mem-cache.h"
+#include "mem-alloc.h"
+#include "path-cache.h"
+#include "netfilter.h"
+
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/sort.h>
+#include <linux/skbuff.h>
+
+int ec_obtain_next_cbevent(struct CB_EVENT **cb_event, size_t count, ProcessContext *context);
+bool __ec_connect_reader(ProcessContext *context);
+void ec_user_comm_clear_queue(ProcessContext *context);
+struct sk_buff *__make_payload_skb(const char *payload, int linear_len);
+
+// Benchmarks for the hot paths, run after the self-tests when run_benchmarks is set.
+//
+// Each benchmark runs the same operation on 1, 2, 4 .. N kthreads, where N is the number of
+//  online CPUs.  Every thread does BENCH_ITERATIONS operations (fewer for slow operations) and
+//  times up to BENCH_SAMPLES of them, spread over the whole run, for the percentiles.
+#define BENCH_ITERATIONS   200000
+#define BENCH_SAMPLES      12500
+#define BENCH_KEYS         4096
+#define BENCH_DEVICE       0xbe7c4
+
+// Returns false if the operation failed
+typedef bool (*bench_op)(void *priv, int thread, int iteration, ProcessContext *context);
+
+typedef struct bench_thread {
+    bench_op           op;
+    void              *priv;
+    int                id;
+    int                iterations;
+    int                sample_rate;
+    bool               may_sleep;
+    uint64_t           failures;
+    uint32_t          *samples;
+    struct completion  done;
+} BenchThread;
+
+typedef struct bench_entry {
+    uint64_t key;
+    uint64_t value;
+} BenchEntry;
+
+bool __init test__bench_hashtbl(ProcessContext *context);
+bool __init test__bench_hashtbl_find(ProcessContext *context);
+bool __init test__bench_hashtbl_startup(ProcessContext *context);
+bool __init test__bench_mem_cache(ProcessContext *context);
+bool __init test__bench_event_round_trip(ProcessContext *context);
+bool __init test__bench_path_cache(ProcessContext *context);
+bool __init test__bench_web_proxy(ProcessContext *context);
+
+bool __init test__benchmarks(ProcessContext *context)
+{
+    DECLARE_TEST();
+
+    RUN_TEST(test__bench_hashtbl(context));
+    RUN_TEST(test__bench_hashtbl_find(context));
+    RUN_TEST(test__bench_hashtbl_startup(context));
+    RUN_TEST(test__bench_mem_cache(context));
+    RUN_TEST(test__bench_event_round_trip(context));
+    RUN_TEST(test__bench_path_cache(context));
+    RUN_TEST(test__bench_web_proxy(context));
+
+    RETURN_RESULT();
+}
+
+static int __bench_thread(void *data)
+{
+    BenchThread *thread = (BenchThread *)data;
+    ProcessContext *context;
+    int i;
+
+    // Hooks run atomic, but some setup paths need to sleep
+    DECLARE_ATOMIC_CONTEXT(atomic_context, ec_getpid(current));
+    DECLARE_NON_ATOMIC_CONTEXT(sleep_context, ec_getpid(current));
+
+    context = thread->may_sleep ? &sleep_context : &atomic_context;
+
+    // Nobody is waiting on the queue
+    DISABLE_WAKE_UP(context);
+
+    for (i = 0; i < thread->iterations; ++i)
+    {
+        if (i % thread->sample_rate == 0)
+        {
+            uint64_t start = ktime_to_ns(ktime_get());
+
+            if (!thread->op(thread->priv, thread->id, i, context))
+            {
+                ++thread->failures;
+            }
+            thread->samples[i / thread->sample_rate] = (uint32_t)min_t(uint64_t, ktime_to_ns(ktime_get()) - start, U32_MAX);
+        } else if (!thread->op(thread->priv, thread->id, i, context))
+        {
+            ++thread->failures;
+        }
+    }
+
+    complete(&thread->done);
+    return 0;
+}
+
+static int __bench_compare(const void *left, const void *right)
+{
+    uint32_t l = *(const uint32_t *)left;
+    uint32_t r = *(const uint32_t *)right;
+
+    return (l > r) - (l < r);
+}
+
+// samples must be sorted
+static uint32_t __bench_percentile(uint32_t *samples, size_t count, size_t permille)
+{
+    return samples[min_t(size_t, count - 1, (count * permille) / 1000)];
+}
+
+// Runs op iterations times on each of 1, 2, 4 .. N threads and reports the combined throughput and
+//  the latency of a single op.  With may_sleep the op gets a non-atomic context.
+static bool __init __bench_run_n(const char *name, bench_op op, void *priv, int iterations, bool may_sleep, ProcessContext *context)
+{
+    bool passed = false;
+    int cpus = num_online_cpus();
+    int threads = 1;
+    int sample_rate = DIV_ROUND_UP(iterations, BENCH_SAMPLES);
+    int thread_samples = DIV_ROUND_UP(iterations, sample_rate);
+    int i;
+    BenchThread *bench = NULL;
+    uint32_t *samples = NULL;
+
+    bench = ec_mem_alloc(sizeof(BenchThread) * cpus, context);
+    ASSERT_TRY(bench);
+
+    samples = ec_mem_valloc(sizeof(uint32_t) * BENCH_SAMPLES * cpus, context);
+    ASSERT_TRY(samples);
+
+    while (true)
+    {
+        ktime_t start;
+        uint64_t elapsed_ns;
+        uint64_t failures = 0;
+        uint64_t ops = (uint64_t)threads * iterations;
+        size_t sample_count = (size_t)threads * thread_samples;
+
+        memset(samples, 0, sizeof(uint32_t) * sample_count);
+
+        start = ktime_get();
+        for (i = 0; i < threads; ++i)
+        {
+            struct task_struct *task;
+
+            bench[i].op       = op;
+            bench[i].priv     = priv;
+            bench[i].id          = i;
+            bench[i].iterations  = iterations;
+            bench[i].sample_rate = sample_rate;
+            bench[i].may_sleep   = may_sleep;
+            bench[i].failures    = 0;
+            bench[i].samples     = samples + (i * thread_samples);
+            init_completion(&bench[i].done);
+
+            task = kthread_run(&__bench_thread, &bench[i], "ec_bench/%d", i);
+            if (IS_ERR(task))
+            {
+                TRACE(DL_ERROR, "bench %s: failed to start thread %d", name, i);
+                bench[i].failures = iterations;
+                complete(&bench[i].done);
+            }
+        }
+
+        // Wait for every thread before checking results, they are all using the same data
+        for (i = 0; i < threads; ++i)
+        {
+            wait_for_completion(&bench[i].done);
+            failures += bench[i].failures;
+        }
+        elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+        sort(samples, sample_count, sizeof(uint32_t), __bench_compare, NULL);
+
+        TRACE(DL_INFO, "bench %s: threads=%d ops/sec=%llu p50=%u p90=%u p99=%u p99.9=%u max=%u ns failures=%llu",
+              name, threads,
+              elapsed_ns ? div64_u64(ops * NSEC_PER_SEC, elapsed_ns) : 0,
+              __bench_percentile(samples, sample_count, 500),
+              __bench_percentile(samples, sample_count, 900),
+              __bench_percentile(samples, sample_count, 990),
+              __bench_percentile(samples, sample_count, 999),
+              samples[sample_count - 1],
+              failures);
+
+        ASSERT_TRY_MSG(failures == 0, "bench %s: %llu failures on %d threads", name, failures, threads);
+
+        if (threads == cpus)
+        {
+            break;
+        }
+        threads = min(threads * 2, cpus);
+    }
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_mem_free(samples);
+    ec_mem_free(bench);
+    return passed;
+}
+
+static bool __init __bench_run(const char *name, bench_op op, void *priv, ProcessContext *context)
+{
+    return __bench_run_n(name, op, priv, BENCH_ITERATIONS, false, context);
+}
+
+// Each thread works on its own keys so the adds never collide
+static bool __bench_hashtbl_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    HashTbl *hash_table = (HashTbl *)priv;
+    uint64_t key = ((uint64_t)thread << 32) | iteration;
+    BenchEntry *entry = NULL;
+    BenchEntry *found = NULL;
+
+    entry = ec_hashtbl_alloc(hash_table, context);
+    CANCEL(entry, false);
+
+    entry->key = key;
+    if (ec_hashtbl_add(hash_table, entry, context) < 0)
+    {
+        ec_hashtbl_free(hash_table, entry, context);
+        return false;
+    }
+
+    found = ec_hashtbl_find(hash_table, &key, context);
+    ec_hashtbl_put(hash_table, found, context);
+
+    ec_hashtbl_del(hash_table, entry, context);
+    ec_hashtbl_put(hash_table, entry, context);
+
+    return found == entry;
+}
+
+bool __init test__bench_hashtbl(ProcessContext *context)
+{
+    bool passed = false;
+    HashTbl hash_table = {
+        .numberOfBuckets = 1024,
+        .maxBuckets = 65536,
+        .name = "hashtbl_bench",
+        .datasize = sizeof(BenchEntry),
+        .key_len = sizeof(uint64_t),
+        .key_offset = offsetof(BenchEntry, key),
+        .rcu_lookup = true,
+    };
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+
+    passed = __bench_run("hashtbl add/find/del", __bench_hashtbl_op, &hash_table, context);
+
+    ec_hashtbl_destroy(&hash_table, context);
+
+CATCH_DEFAULT:
+    return passed;
+}
+
+// Every thread reads the same keys, so the hot buckets are shared
+static bool __bench_hashtbl_find_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    HashTbl *hash_table = (HashTbl *)priv;
+    uint64_t key = iteration % BENCH_KEYS;
+    BenchEntry *found = ec_hashtbl_find(hash_table, &key, context);
+
+    ec_hashtbl_put(hash_table, found, context);
+
+    return found != NULL;
+}
+
+static bool __bench_hashtbl_miss_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    HashTbl *hash_table = (HashTbl *)priv;
+    uint64_t key = BENCH_KEYS + iteration;
+    BenchEntry *found = ec_hashtbl_find(hash_table, &key, context);
+
+    ec_hashtbl_put(hash_table, found, context);
+
+    return found == NULL;
+}
+
+// Lookups under the bucket lock serialize on the hot buckets, with rcu_lookup they should scale
+static bool __init __bench_hashtbl_find(bool rcu_lookup, ProcessContext *context)
+{
+    bool passed = false;
+    int i;
+    HashTbl hash_table = {
+        .numberOfBuckets = 1024,
+        .name = "hashtbl_bench",
+        .datasize = sizeof(BenchEntry),
+        .key_len = sizeof(uint64_t),
+        .key_offset = offsetof(BenchEntry, key),
+        .rcu_lookup = rcu_lookup,
+    };
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+
+    for (i = 0; i < BENCH_KEYS; ++i)
+    {
+        BenchEntry *entry = ec_hashtbl_alloc(&hash_table, context);
+
+        ASSERT_TRY(entry);
+        entry->key = i;
+        TRY_DO_MSG(ec_hashtbl_add(&hash_table, entry, context) == 0,
+                   { ec_hashtbl_free(&hash_table, entry, context); },
+                   DL_ERROR, "bench hashtbl find: failed to add key %d", i);
+        ec_hashtbl_put(&hash_table, entry, context);
+    }
+
+    passed = __bench_run(rcu_lookup ? "hashtbl find (rcu)" : "hashtbl find (locked)",
+                         __bench_hashtbl_find_op, &hash_table, context);
+    passed &= __bench_run(rcu_lookup ? "hashtbl miss (rcu)" : "hashtbl miss (locked)",
+                          __bench_hashtbl_miss_op, &hash_table, context);
+
+CATCH_DEFAULT:
+    ec_hashtbl_destroy(&hash_table, context);
+    return passed;
+}
+
+bool __init test__bench_hashtbl_find(ProcessContext *context)
+{
+    bool passed = true;
+
+    passed &= __bench_hashtbl_find(false, context);
+    passed &= __bench_hashtbl_find(true, context);
+
+    return passed;
+}
+
+#define BENCH_STARTUP_BUCKETS     65536
+#define BENCH_STARTUP_ITERATIONS  32
+
+// Init and destroy of a table the size of the default path cache
+static bool __bench_hashtbl_startup_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    HashTbl hash_table = {
+        .numberOfBuckets = BENCH_STARTUP_BUCKETS,
+        .name = "hashtbl_startup_bench",
+        .datasize = sizeof(BenchEntry),
+        .key_len = sizeof(uint64_t),
+        .key_offset = offsetof(BenchEntry, key),
+    };
+
+    CANCEL(ec_hashtbl_init(&hash_table, context), false);
+    ec_hashtbl_destroy(&hash_table, context);
+
+    return true;
+}
+
+bool __init test__bench_hashtbl_startup(ProcessContext *context)
+{
+    return __bench_run_n("hashtbl init/destroy", __bench_hashtbl_startup_op, NULL, BENCH_STARTUP_ITERATIONS, true, context);
+}
+
+static bool __bench_mem_cache_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    CB_MEM_CACHE *mem_cache = (CB_MEM_CACHE *)priv;
+    void *value = ec_mem_cache_alloc(mem_cache, context);
+
+    CANCEL(value, false);
+
+    ec_mem_cache_get(value, context);
+    ec_mem_cache_put(value, context);
+    ec_mem_cache_disown(value, context);
+
+    return true;
+}
+
+bool __init test__bench_mem_cache(ProcessContext *context)
+{
+    bool passed = false;
+    CB_MEM_CACHE mem_cache = {
+        .magazine_size = 16,
+    };
+
+    ASSERT_TRY(ec_mem_cache_create(&mem_cache, "bench cache", 64, context));
+
+    passed = __bench_run("mem_cache alloc/put", __bench_mem_cache_op, &mem_cache, context);
+
+    ASSERT_TRY(ec_mem_cache_destroy(&mem_cache, context) == 0);
+
+    return passed;
+
+CATCH_DEFAULT:
+    return false;
+}
+
+// A thread only reads after it has queued its own event, so the queue is never empty when it reads.
+//  The event it reads may belong to another thread.
+static bool __bench_event_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    struct CB_EVENT *event = ec_alloc_event(CB_EVENT_TYPE_HEARTBEAT, context);
+    int rc;
+
+    CANCEL(event, false);
+
+    // ec_send_event frees the event if it is not queued
+    CANCEL(ec_send_event(event, context) == 0, false);
+
+    event = NULL;
+    rc = ec_obtain_next_cbevent(&event, sizeof(struct CB_EVENT_UM_BLOB), context);
+    CANCEL(rc > 0, false);
+
+    ec_free_event(event, context);
+
+    return true;
+}
+
+bool __init test__bench_event_round_trip(ProcessContext *context)
+{
+    bool passed = false;
+
+    ENABLE_SEND_EVENTS(context);
+    ASSERT_TRY(__ec_connect_reader(context));
+
+    passed = __bench_run("send_event/obtain_next_cbevent", __bench_event_op, NULL, context);
+
+    ec_disconnect_reader(context->pid, context);
+
+CATCH_DEFAULT:
+    DISABLE_SEND_EVENTS(context);
+    ec_user_comm_clear_queue(context);
+
+    return passed;
+}
+
+static bool __bench_path_cache_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    PathQuery query = {
+        .key = {
+            .inode = (iteration + thread) % BENCH_KEYS,
+            .device = BENCH_DEVICE,
+            .ns_id = 0,
+        },
+    };
+    PathData *path_data = ec_path_cache_find(&query, context);
+
+    CANCEL(path_data, false);
+
+    ec_path_cache_put(path_data, context);
+
+    return true;
+}
+
+bool __init test__bench_path_cache(ProcessContext *context)
+{
+    bool passed = false;
+    PathData **entries = NULL;
+    char *path = NULL;
+    int i;
+
+    if (!g_enable_path_cache)
+    {
+        TRACE(DL_INFO, "bench path cache: skipped, the path cache is disabled");
+        return true;
+    }
+
+    entries = ec_mem_valloc(sizeof(PathData *) * BENCH_KEYS, context);
+    ASSERT_TRY(entries);
+    memset(entries, 0, sizeof(PathData *) * BENCH_KEYS);
+
+    path = ec_mem_strdup("/usr/lib/bench/file", context);
+    ASSERT_TRY(path);
+
+    for (i = 0; i < BENCH_KEYS; ++i)
+    {
+        entries[i] = ec_path_cache_add(0, BENCH_DEVICE, i, path, 0, context);
+        ASSERT_TRY(entries[i]);
+    }
+
+    passed = __bench_run("path cache lookup", __bench_path_cache_op, NULL, context);
+
+CATCH_DEFAULT:
+    if (entries)
+    {
+        for (i = 0; i < BENCH_KEYS; ++i)
+        {
+            ec_path_cache_delete(entries[i], context);
+            ec_path_cache_put(entries[i], context);
+        }
+        ec_mem_free(entries);
+    }
+    ec_mem_put(path);
+
+    return passed;
+}
+
+typedef struct bench_web_proxy {
+    struct sk_buff *skb;
+    int             expected;
+} BenchWebProxy;
+
+static bool __bench_web_proxy_op(void *priv, int thread, int iteration, ProcessContext *context)
+{
+    BenchWebProxy *bench = (BenchWebProxy *)priv;
+    char url[PROXY_SERVER_MAX_LEN + 1];
+
+    return ec_web_proxy_parse_skb(bench->skb, 0, url) == bench->expected;
+}
+
+// Cost of checking a segment that is a proxy request, a direct request and TLS data
+bool __init test__bench_web_proxy(ProcessContext *context)
+{
+    bool passed = true;
+    const char *names[] = { "web proxy (proxy request)", "web proxy (direct request)", "web proxy (tls)" };
+    const char *payloads[] = {
+        "GET http://example.com/some/longer/path?with=query HTTP/1.1\r\nHost: example.com\r\n\r\n",
+        "GET /some/longer/path?with=query HTTP/1.1\r\nHost: example.com\r\n\r\n",
+        "\x17\x03\x03\x00\x40 encrypted application data that is never a request line",
+    };
+    const int expected[] = { 46, 0, 0 };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(payloads); ++i)
+    {
+        BenchWebProxy bench = {
+            .skb = __make_payload_skb(payloads[i], INT_MAX),
+            .expected = expected[i],
+        };
+
+        if (!bench.skb)
+        {
+            TRACE(DL_ERROR, "bench %s: failed to allocate skb", names[i]);
+            passed = false;
+            continue;
+        }
+
+        passed &= __bench_run(names[i], __bench_web_proxy_op, &bench, context);
+        kfree_skb(bench.skb);
+    }
+
+    return passed;
+}
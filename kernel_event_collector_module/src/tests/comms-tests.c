@@ -5,16 +5,29 @@
 #include "path-buffers.h"
 #include "dns-parser-private.h"
 #include "mem-alloc.h"
+#include "netfilter.h"
 
 #include "run-tests.h"
 
+#include <linux/skbuff.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+
 int ec_obtain_next_cbevent(struct CB_EVENT **cb_event, size_t count, ProcessContext *context);
 bool __ec_connect_reader(ProcessContext *context);
 void ec_user_comm_clear_queue(ProcessContext *context);
+void __ec_fold_event_stats(uint64_t *totals);
+void __ec_event_stats_add(int stat, uint64_t count);
 
 bool __init test__oversize_payload(ProcessContext *context);
 bool __init test__normal_payload(ProcessContext *context);
 bool __init test__parse_large_dns(ProcessContext *context);
+bool __init test__parse_compressed_dns(ProcessContext *context);
+bool __init test__web_proxy_parse(ProcessContext *context);
+bool __init test__event_interest(ProcessContext *context);
+bool __init test__event_inline_strings(ProcessContext *context);
+bool __init test__event_shares_path(ProcessContext *context);
+bool __init test__event_stats_sum(ProcessContext *context);
 
 bool __init test__comms(ProcessContext *context)
 {
@@ -29,6 +42,12 @@ bool __init test__comms(ProcessContext *context)
     RUN_TEST(test__oversize_payload(context));
     RUN_TEST(test__normal_payload(context));
     RUN_TEST(test__parse_large_dns(context));
+    RUN_TEST(test__parse_compressed_dns(context));
+    RUN_TEST(test__web_proxy_parse(context));
+    RUN_TEST(test__event_interest(context));
+    RUN_TEST(test__event_inline_strings(context));
+    RUN_TEST(test__event_shares_path(context));
+    RUN_TEST(test__event_stats_sum(context));
 
     g_traceLevel = origTraceLevel;
 
@@ -267,3 +286,345 @@ CATCH_DEFAULT:
     return passed;
 }
 
+
+// www.example.com is a CNAME for cdn.example.com, with every name after the question compressed,
+//  followed by an EDNS0 OPT record
+bool __init test__parse_compressed_dns(ProcessContext *context)
+{
+    bool passed = false;
+    CB_EVENT_DNS_RESPONSE  response = { 0 };
+    HashTbl report_table = {
+        .numberOfBuckets = 16,
+        .name = "dns_report_test",
+        .datasize = sizeof(DNS_REPORT_NODE),
+        .key_len = sizeof(DNS_REPORT_KEY),
+        .key_offset = offsetof(DNS_REPORT_NODE, key),
+    };
+    uint8_t dns_data[] = {
+        0x12, 0x34, 0x80, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01,
+        // 12: question
+        3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0,
+        0x00, 0x01, 0x00, 0x01,
+        // 33: www.example.com CNAME cdn.example.com
+        0xC0, 12, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2C, 0x00, 0x06,
+        3, 'c', 'd', 'n', 0xC0, 16,
+        // 51: cdn.example.com A 10.0.0.1
+        0xC0, 45, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2C, 0x00, 0x04,
+        10, 0, 0, 1,
+        // 67: OPT
+        0, 0x00, 41, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+    int rc;
+
+    rc = ec_dns_parse_data((char *)dns_data, sizeof(dns_data), &response, context);
+    ASSERT_TRY_MSG(rc == 0, "rc: %d", rc);
+    ASSERT_TRY_MSG(response.record_count == 2, "record_count: %d", response.record_count);
+    ASSERT_TRY(!strcmp(response.qname, "www.example.com"));
+    ASSERT_TRY(!strcmp(response.records[0].name, "www.example.com"));
+    ASSERT_TRY(!strcmp(response.records[0].CNAME, "cdn.example.com"));
+    ASSERT_TRY(!strcmp(response.records[1].name, "cdn.example.com"));
+    ASSERT_TRY(response.records[1].A.as_in4.sin_addr.s_addr == htonl(0x0A000001));
+
+    // The same answers are only reported once per window
+    ASSERT_TRY(ec_hashtbl_init(&report_table, context));
+    ASSERT_TRY(__ec_dns_should_report(&report_table, 60, &response, context));
+    ASSERT_TRY(!__ec_dns_should_report(&report_table, 60, &response, context));
+
+    ec_mem_free(response.records);
+    memset(&response, 0, sizeof(response));
+
+    // An extended response code in the OPT record is an error
+    dns_data[sizeof(dns_data) - 6] = 1;
+    ASSERT_TRY(ec_dns_parse_data((char *)dns_data, sizeof(dns_data), &response, context) != 0);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_hashtbl_destroy(&report_table, context);
+    ec_mem_free(response.records);
+    return passed;
+}
+
+// Build a synthetic skb holding only payload, optionally with part of it in a page fragment
+struct sk_buff * __init __make_payload_skb(const char *payload, int linear_len)
+{
+    int            len = strlen(payload);
+    struct sk_buff *skb = alloc_skb(len, GFP_KERNEL);
+    struct page   *page;
+
+    if (!skb)
+    {
+        return NULL;
+    }
+
+    linear_len = min(linear_len, len);
+    memcpy(skb_put(skb, linear_len), payload, linear_len);
+    if (linear_len < len)
+    {
+        page = alloc_page(GFP_KERNEL);
+        if (!page)
+        {
+            kfree_skb(skb);
+            return NULL;
+        }
+        memcpy(page_address(page), payload + linear_len, len - linear_len);
+        skb_fill_page_desc(skb, 0, page, 0, len - linear_len);
+        skb->len      += len - linear_len;
+        skb->data_len += len - linear_len;
+        skb->truesize += PAGE_SIZE;
+    }
+    return skb;
+}
+
+#define WEB_PROXY_LONG_URL  1000
+
+bool __init test__web_proxy_parse(ProcessContext *context)
+{
+    bool passed = false;
+    char url[PROXY_SERVER_MAX_LEN + 1];
+    char *payload = NULL;
+    struct sk_buff *skb = NULL;
+    int url_offset = 0;
+    int i;
+    const char *rejects[] = {
+        "GET /index.html HTTP/1.1\r\n",
+        "HEAD http://example.com/ HTTP/1.1\r\n",
+        "GET http://example.com/ HTTP/2.0\r\n",
+        "GETX http://example.com/ HTTP/1.1\r\n",
+        "POST http://example.com/",
+        "\x16\x03\x01\x02\x00\x01\x00\x01\xfc\x03\x03\x00\x00\x00",
+    };
+
+    for (i = 0; i < ARRAY_SIZE(rejects); ++i)
+    {
+        ASSERT_TRY_MSG(!ec_web_proxy_parse_request(rejects[i], strlen(rejects[i]), &url_offset), "%d", i);
+    }
+
+    ASSERT_TRY(ec_web_proxy_parse_request("CONNECT example.com:443 HTTP/1.0\r\n", 34, &url_offset) == 15);
+    ASSERT_TRY(url_offset == 8);
+
+    // The request line starts in the linear data and finishes in a fragment
+    skb = __make_payload_skb("POST http://example.com/form HTTP/1.1\r\nHost: example.com\r\n", 16);
+    ASSERT_TRY(skb);
+    ASSERT_TRY(ec_web_proxy_parse_skb(skb, 0, url) == 23);
+    ASSERT_TRY(!strcmp(url, "http://example.com/form"));
+    kfree_skb(skb);
+    skb = NULL;
+
+    // A URL longer than we report, mostly in a fragment, is truncated instead of rejected
+    payload = ec_mem_alloc(WEB_PROXY_LONG_URL + 64, context);
+    ASSERT_TRY(payload);
+    strcpy(payload, "GET http://example.com/");
+    memset(payload + strlen(payload), 'a', WEB_PROXY_LONG_URL - strlen("http://example.com/"));
+    strcpy(payload + strlen("GET ") + WEB_PROXY_LONG_URL, " HTTP/1.1\r\nHost: example.com\r\n");
+
+    skb = __make_payload_skb(payload, 16);
+    ASSERT_TRY(skb);
+    ASSERT_TRY(ec_web_proxy_parse_skb(skb, 0, url) == PROXY_SERVER_MAX_LEN - 1);
+    ASSERT_TRY(!strncmp(url, payload + strlen("GET "), PROXY_SERVER_MAX_LEN - 1));
+
+    passed = true;
+
+CATCH_DEFAULT:
+    if (skb)
+    {
+        kfree_skb(skb);
+    }
+    ec_mem_free(payload);
+    return passed;
+}
+
+bool __init test__event_interest(ProcessContext *context)
+{
+    bool                passed    = false;
+    CB_CONFIG_OPTION    file_mods = g_driver_config.file_mods;
+    struct CB_EVENT     *event    = NULL;
+
+    // Nothing is wanted while there is no reader
+    ASSERT_TRY(!ec_is_reader_connected());
+    ASSERT_TRY(!ec_logger_should_log(CB_EVENT_TYPE_FILE_WRITE));
+    ASSERT_TRY(!ec_logger_is_interested(EVENT_INTEREST_ALWAYS));
+    ASSERT_TRY(!ec_alloc_event(CB_EVENT_TYPE_FILE_WRITE, context));
+
+    __ec_connect_reader(context);
+
+    g_driver_config.file_mods = ENABLE;
+    ec_logger_update_interest();
+    ASSERT_TRY(ec_logger_should_log(CB_EVENT_TYPE_FILE_WRITE));
+    ASSERT_TRY(ec_logger_is_interested(EVENT_INTEREST(CB_EVENT_TYPE_HEARTBEAT)));
+
+    event = ec_alloc_event(CB_EVENT_TYPE_FILE_WRITE, context);
+    ASSERT_TRY(event);
+
+    g_driver_config.file_mods = DISABLE;
+    ec_logger_update_interest();
+    ASSERT_TRY(!ec_logger_is_interested(EVENT_INTEREST_FILE));
+    ASSERT_TRY(ec_logger_is_interested(EVENT_INTEREST(CB_EVENT_TYPE_HEARTBEAT)));
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_free_event(event, context);
+    g_driver_config.file_mods = file_mods;
+    ec_disconnect_reader(context->pid, context);
+
+    return passed;
+}
+
+bool __init test__event_inline_strings(ProcessContext *context)
+{
+    bool            passed = false;
+    struct CB_EVENT *event = NULL;
+    CB_EVENT_NODE   *node;
+    char            *long_path = NULL;
+    uint16_t        size = 0;
+
+    __ec_connect_reader(context);
+
+    event = ec_alloc_event_inline(CB_EVENT_TYPE_PROCESS_BLOCKED, 64, context);
+    ASSERT_TRY(event);
+    node = container_of(event, CB_EVENT_NODE, data);
+    ASSERT_TRY_MSG(node->inline_size >= 64, "inline_size: %u", node->inline_size);
+
+    // This fits in the space after the node
+    event->blockResponse.path = ec_event_strdup(event, "/usr/bin/blocked", &size, context);
+    ASSERT_TRY(event->blockResponse.path);
+    ASSERT_TRY(event->blockResponse.path == node->inline_buf);
+    ASSERT_TRY_MSG(size == sizeof("/usr/bin/blocked"), "size: %u", size);
+    ASSERT_TRY(strcmp(event->blockResponse.path, "/usr/bin/blocked") == 0);
+    ec_free_event(event, context);
+    event = NULL;
+
+    // This does not, so it falls back to a separate allocation which ec_free_event releases
+    long_path = ec_mem_alloc(PATH_MAX + 1, context);
+    ASSERT_TRY(long_path);
+    memset(long_path, 'a', PATH_MAX);
+    long_path[PATH_MAX] = 0;
+
+    event = ec_alloc_event_inline(CB_EVENT_TYPE_WEB_PROXY, PATH_MAX + 1, context);
+    ASSERT_TRY(event);
+    node = container_of(event, CB_EVENT_NODE, data);
+    event->netConnect.actual_server = ec_event_strdup(event, long_path, &size, context);
+    ASSERT_TRY(event->netConnect.actual_server);
+    ASSERT_TRY(event->netConnect.actual_server < node->inline_buf || event->netConnect.actual_server >= node->inline_buf + node->inline_size);
+    ASSERT_TRY_MSG(size == PATH_MAX + 1, "size: %u", size);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_free_event(event, context);
+    ec_mem_free(long_path);
+    ec_disconnect_reader(context->pid, context);
+
+    return passed;
+}
+
+// The block event should hold a reference to the cached path instead of copying it
+bool __init test__event_shares_path(ProcessContext *context)
+{
+    bool               passed    = false;
+    struct CB_EVENT    *msg      = NULL;
+    char               *pathname = NULL;
+    PathData           *path_data = NULL;
+    int64_t            allocated;
+    int                rc;
+
+    pathname = ec_mem_strdup("/usr/bin/shared-path-test", context);
+    ASSERT_TRY(pathname);
+
+    path_data = ec_path_cache_add(0, 0, 0, pathname, 0, context);
+    ASSERT_TRY(path_data);
+
+    allocated = ec_mem_allocated_count(context);
+
+    ENABLE_SEND_EVENTS(context);
+    __ec_connect_reader(context);
+
+    ec_event_send_block(NULL,
+                        ProcessTerminatedAfterStartup,
+                        TerminateFailureReasonNone,
+                        0,
+                        (uid_t)-1,
+                        path_data,
+                        context);
+
+    ec_disconnect_reader(context->pid, context);
+    DISABLE_SEND_EVENTS(context);
+
+    ASSERT_TRY_MSG(ec_mem_allocated_count(context) == allocated, "%lld != %lld",
+                   ec_mem_allocated_count(context), allocated);
+
+    rc = ec_obtain_next_cbevent(&msg, sizeof(struct CB_EVENT_UM_BLOB), context);
+    ASSERT_TRY_MSG(rc > 0, "%d", rc);
+    ASSERT_TRY(msg->blockResponse.path == path_data->path);
+    ASSERT_TRY(msg->blockResponse.path_size == ec_mem_size(path_data->path));
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_free_event(msg, context);
+    ec_user_comm_clear_queue(context);
+    ec_path_cache_delete(path_data, context);
+    ec_path_cache_put(path_data, context);
+    ec_mem_put(pathname);
+
+    return passed;
+}
+
+// EVENT_STATS and TX_OTHER in fops-comm.c.  Other is only counted when an event is copied to a reader.
+#define EVENT_STAT_COUNT  12
+#define EVENT_STAT_OTHER  11
+
+static long __init __count_on_cpu(void *data)
+{
+    __ec_event_stats_add(EVENT_STAT_OTHER, 1);
+    return 0;
+}
+
+bool __init test__event_stats_sum(ProcessContext *context)
+{
+    bool            passed = false;
+    uint64_t        before[EVENT_STAT_COUNT];
+    uint64_t        after[EVENT_STAT_COUNT];
+    uint64_t        shown  = 0;
+    int             cpus   = 0;
+    int             cpu;
+    char           *buffer = NULL;
+    char           *line;
+    struct seq_file m;
+
+    __ec_fold_event_stats(before);
+
+    // Count once on every CPU
+    for_each_online_cpu(cpu)
+    {
+        work_on_cpu(cpu, __count_on_cpu, NULL);
+        ++cpus;
+    }
+
+    __ec_fold_event_stats(after);
+    ASSERT_TRY_MSG(after[EVENT_STAT_OTHER] == before[EVENT_STAT_OTHER] + cpus,
+                   "before: %llu after: %llu cpus: %d", before[EVENT_STAT_OTHER], after[EVENT_STAT_OTHER], cpus);
+
+    // The total shown must include the counts that are still on the CPUs
+    buffer = ec_mem_alloc(PAGE_SIZE, context);
+    ASSERT_TRY(buffer);
+
+    memset(&m, 0, sizeof(m));
+    m.buf  = buffer;
+    m.size = PAGE_SIZE;
+    ec_proc_show_events_avg(&m, NULL);
+    ASSERT_TRY(m.count < m.size);
+    buffer[m.count] = 0;
+
+    line = strstr(buffer, " Other |");
+    ASSERT_TRY(line);
+    ASSERT_TRY(sscanf(line, " Other | %llu", &shown) == 1);
+    ASSERT_TRY_MSG(shown == after[EVENT_STAT_OTHER], "shown: %llu expected: %llu", shown, after[EVENT_STAT_OTHER]);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_mem_free(buffer);
+    return passed;
+}
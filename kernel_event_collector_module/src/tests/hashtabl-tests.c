@@ -43,6 +43,11 @@ bool __init test__hashtbl_lru_lookup(ProcessContext *context);
 bool __init test__hashtbl_lru_one_bucket(ProcessContext *context);
 bool __init test__hashtbl_lru_many_buckets(ProcessContext *context);
 bool __init test__hashtbl_lru_one_bucket_activity(ProcessContext *context);
+bool __init test__hashtbl_rcu_find(ProcessContext *context);
+bool __init test__hashtbl_resize(ProcessContext *context);
+bool __init test__hashtbl_lock_stripes(ProcessContext *context);
+bool __init test__hashtbl_memory_budget(ProcessContext *context);
+bool __init test__hashtbl_memory_budget_attached(ProcessContext *context);
 
 static void __init __vprintk(void *, const char *, ...);
 static void __init __ec_test_hashtbl_delete_callback(void *data, ProcessContext *context);
@@ -64,6 +69,11 @@ bool __init test__hash_table(ProcessContext *context)
     RUN_TEST(test__hashtbl_lru_one_bucket(context));
     RUN_TEST(test__hashtbl_lru_many_buckets(context));
     RUN_TEST(test__hashtbl_lru_one_bucket_activity(context));
+    RUN_TEST(test__hashtbl_rcu_find(context));
+    RUN_TEST(test__hashtbl_resize(context));
+    RUN_TEST(test__hashtbl_lock_stripes(context));
+    RUN_TEST(test__hashtbl_memory_budget(context));
+    RUN_TEST(test__hashtbl_memory_budget_attached(context));
     RETURN_RESULT();
 }
 
@@ -647,6 +657,240 @@ CATCH_DEFAULT:
     return passed;
 }
 
+bool __init test__hashtbl_rcu_find(ProcessContext *context)
+{
+    bool passed = false;
+    Entry *tdata = NULL;
+    TableKey key = { .id = 1 };
+    HashTbl hash_table = HASH_TBL_INIT();
+
+    hash_table.rcu_lookup = true;
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+
+    ASSERT_TRY(__add_entry(1, &hash_table, context));
+    ASSERT_TRY(__add_entry(2, &hash_table, context));
+
+    tdata = ec_hashtbl_find(&hash_table, &key, context);
+    ASSERT_TRY(tdata && tdata->key.id == 1);
+
+    // Deleting while a reader holds a reference must keep the entry alive until the put
+    _delete_callback_called = 0;
+    ec_hashtbl_del(&hash_table, tdata, context);
+    ec_hashtbl_del(&hash_table, tdata, context);
+    ASSERT_TRY(_delete_callback_called == 0);
+    ASSERT_TRY(!__check_entry_exists(&hash_table, 1, context));
+    ASSERT_TRY(__check_entry_exists(&hash_table, 2, context));
+
+    ec_hashtbl_put(&hash_table, tdata, context);
+    tdata = NULL;
+    ASSERT_TRY(_delete_callback_called == 1);
+    ASSERT_TRY(ec_hashtbl_get_count(&hash_table, context) == 1);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_hashtbl_put(&hash_table, tdata, context);
+    ec_hashtbl_destroy(&hash_table, context);
+    return passed;
+}
+
+#define HASHTBL_RESIZE_KEYS  2000
+
+// Keep resizing until the table settles at the size the load calls for
+static uint64_t __init __hashtbl_resize_settle(HashTbl *hash_table, ProcessContext *context)
+{
+    uint64_t numberOfBuckets;
+    int i;
+
+    for (i = 0; i < 32; ++i)
+    {
+        numberOfBuckets = hash_table->numberOfBuckets;
+        ec_hashtbl_resize_sync(hash_table, context);
+        if (numberOfBuckets == hash_table->numberOfBuckets)
+        {
+            break;
+        }
+    }
+
+    return hash_table->numberOfBuckets;
+}
+
+bool __init test__hashtbl_resize(ProcessContext *context)
+{
+    bool passed = false;
+    uint64_t numberOfBuckets;
+    int i;
+    HashTbl hash_table = HASH_TBL_INIT();
+
+    // More stripes than starting buckets, the table should start at the stripe count
+    hash_table.numberOfBuckets = 16;
+    hash_table.maxBuckets = 1024;
+    hash_table.numberOfLocks = 32;
+    hash_table.rcu_lookup = true;
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+    ASSERT_TRY(hash_table.numberOfLocks == 32);
+    ASSERT_TRY(hash_table.numberOfBuckets == 32);
+    ASSERT_TRY(hash_table.minBuckets == 32);
+
+    // Entries must stay reachable while the table grows underneath the adds
+    for (i = 0; i < HASHTBL_RESIZE_KEYS; ++i)
+    {
+        ASSERT_TRY(__add_entry(i, &hash_table, context));
+    }
+
+    numberOfBuckets = __hashtbl_resize_settle(&hash_table, context);
+    ASSERT_TRY_MSG(numberOfBuckets == 1024, "buckets: %llu", numberOfBuckets);
+    ASSERT_TRY(hash_table.resizeCount > 0);
+    ASSERT_TRY(ec_hashtbl_get_count(&hash_table, context) == HASHTBL_RESIZE_KEYS);
+
+    for (i = 0; i < HASHTBL_RESIZE_KEYS; ++i)
+    {
+        ASSERT_TRY_MSG(__check_entry_exists(&hash_table, i, context), "missing: %d", i);
+    }
+
+    // Remove most of the entries and the table should shrink, but not below the stripe count
+    for (i = 8; i < HASHTBL_RESIZE_KEYS; ++i)
+    {
+        TableKey key = { .id = i };
+        Entry *tdata = ec_hashtbl_del_by_key(&hash_table, &key, context);
+
+        ASSERT_TRY(tdata);
+        ec_hashtbl_put(&hash_table, tdata, context);
+    }
+
+    numberOfBuckets = __hashtbl_resize_settle(&hash_table, context);
+    ASSERT_TRY_MSG(numberOfBuckets == 32, "buckets: %llu", numberOfBuckets);
+
+    for (i = 0; i < 8; ++i)
+    {
+        ASSERT_TRY_MSG(__check_entry_exists(&hash_table, i, context), "missing: %d", i);
+    }
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_hashtbl_destroy(&hash_table, context);
+    return passed;
+}
+
+bool __init test__hashtbl_lock_stripes(ProcessContext *context)
+{
+    bool passed = false;
+    HashTbl hash_table = HASH_TBL_INIT();
+
+    // The default stripe count comes from the CPUs, not from the starting or maximum size
+    hash_table.numberOfBuckets = HASHTBL_MIN_BUCKETS;
+    hash_table.maxBuckets = 1 << 20;
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+    ASSERT_TRY_MSG(hash_table.numberOfLocks <= HASHTBL_MAX_LOCKS, "locks: %llu", hash_table.numberOfLocks);
+    ASSERT_TRY(is_power_of_2(hash_table.numberOfLocks));
+    ASSERT_TRY(hash_table.numberOfBuckets == HASHTBL_MIN_BUCKETS);
+    ASSERT_TRY(hash_table.minBuckets == HASHTBL_MIN_BUCKETS);
+    ec_hashtbl_destroy(&hash_table, context);
+
+    // A small fixed size table never has more stripes than buckets
+    hash_table = (HashTbl) HASH_TBL_INIT();
+    hash_table.numberOfBuckets = 2;
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+    ASSERT_TRY_MSG(hash_table.numberOfLocks <= 2, "locks: %llu", hash_table.numberOfLocks);
+    ASSERT_TRY(hash_table.numberOfBuckets == 2);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_hashtbl_destroy(&hash_table, context);
+    return passed;
+}
+
+bool __init test__hashtbl_memory_budget(ProcessContext *context)
+{
+    bool passed = false;
+    int64_t count;
+    int i;
+    HashTbl hash_table = HASH_TBL_INIT();
+
+    // Room for 256 entries spread over many mostly empty buckets
+    hash_table.memoryBudget = 256 * HASHTBL_ENTRY_SIZE(sizeof(Entry));
+    hash_table.rcu_lookup = true;
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+
+    ASSERT_TRY(__add_entry(0, &hash_table, context));
+    for (i = 1; i < 2048; ++i)
+    {
+        ASSERT_TRY(__add_entry(i, &hash_table, context));
+
+        // Keep one entry hot so the sweep always finds it recently used
+        ASSERT_TRY_MSG(__check_entry_exists(&hash_table, 0, context), "hot entry evicted at %d", i);
+    }
+
+    count = ec_hashtbl_get_count(&hash_table, context);
+    ASSERT_TRY_MSG(count < 512, "count: %lld", count);
+    ASSERT_TRY(percpu_counter_sum(&hash_table.memoryUsed) == count * HASHTBL_ENTRY_SIZE(sizeof(Entry)));
+    ASSERT_TRY(percpu_counter_sum_positive(&hash_table.evictions) >= 2048 - count);
+    ASSERT_TRY(percpu_counter_sum_positive(&hash_table.hits) >= 2047);
+
+    // The newest entries should have survived
+    ASSERT_TRY(__check_entry_exists(&hash_table, 2047, context));
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_hashtbl_destroy(&hash_table, context);
+    return passed;
+}
+
+#define HASHTBL_ATTACHED_SIZE  1024
+
+static size_t __init __ec_test_hashtbl_size_callback(void *datap, ProcessContext *context)
+{
+    return HASHTBL_ATTACHED_SIZE;
+}
+
+bool __init test__hashtbl_memory_budget_attached(ProcessContext *context)
+{
+    bool passed = false;
+    int64_t count;
+    int i;
+    HashTbl hash_table = HASH_TBL_INIT();
+    size_t charge = HASHTBL_ENTRY_SIZE(sizeof(Entry)) + HASHTBL_ATTACHED_SIZE;
+
+    // The attached memory counts against the budget, so only 16 entries fit
+    hash_table.memoryBudget = 16 * charge;
+    hash_table.size_callback = __ec_test_hashtbl_size_callback;
+
+    ASSERT_TRY(ec_hashtbl_init(&hash_table, context));
+
+    for (i = 0; i < 256; ++i)
+    {
+        ASSERT_TRY(__add_entry(i, &hash_table, context));
+    }
+
+    count = ec_hashtbl_get_count(&hash_table, context);
+    ASSERT_TRY_MSG(count < 128, "count: %lld", count);
+    ASSERT_TRY(percpu_counter_sum(&hash_table.memoryUsed) == count * charge);
+
+    // Deleting refunds the whole charge
+    for (i = 0; i < 256; ++i)
+    {
+        TableKey key = { .id = i };
+        Entry *tdata = ec_hashtbl_del_by_key(&hash_table, &key, context);
+
+        ec_hashtbl_put(&hash_table, tdata, context);
+    }
+    ASSERT_TRY(percpu_counter_sum(&hash_table.memoryUsed) == 0);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_hashtbl_destroy(&hash_table, context);
+    return passed;
+}
+
 static void __init __ec_test_hashtbl_delete_callback(void *data, ProcessContext *context)
 {
     ++_delete_callback_called;
@@ -7,6 +7,7 @@ bool __init test__mem_cache_create_destroy(ProcessContext *context);
 bool __init test__mem_cache_alloc(ProcessContext *context);
 bool __init test__mem_cache_get_put(ProcessContext *context);
 bool __init test__mem_cache_delete_cb(ProcessContext *context);
+bool __init test__mem_cache_magazine(ProcessContext *context);
 
 bool __init test__mem_cache(ProcessContext *context)
 {
@@ -16,6 +17,7 @@ bool __init test__mem_cache(ProcessContext *context)
     RUN_TEST(test__mem_cache_alloc(context));
     RUN_TEST(test__mem_cache_get_put(context));
     RUN_TEST(test__mem_cache_delete_cb(context));
+    RUN_TEST(test__mem_cache_magazine(context));
 
     RETURN_RESULT();
 }
@@ -131,4 +133,44 @@ bool __init test__mem_cache_delete_cb(ProcessContext *context)
 
 CATCH_DEFAULT:
     return false;
-}
\ No newline at end of file
+}
+
+bool __init test__mem_cache_magazine(ProcessContext *context)
+{
+    bool passed = true;
+    CB_MEM_CACHE mem_cache = {
+        .delete_callback = __delete_cb,
+        .magazine_size = 4,
+    };
+    void *value1 = NULL;
+    void *value2 = NULL;
+
+    DECLARE_ATOMIC_CONTEXT(atomic_context, ec_getpid(current));
+
+    ASSERT_TRY(ec_mem_cache_create(&mem_cache, "test cache", 50, context));
+
+    value1 = ec_mem_cache_alloc(&mem_cache, context);
+    ASSERT_TRY(value1 != NULL);
+
+    // Stay on this CPU so the object comes back out of the same magazine
+    delete_cb_called = 0;
+    preempt_disable();
+    ec_mem_cache_disown(value1, &atomic_context);
+    value2 = ec_mem_cache_alloc(&mem_cache, &atomic_context);
+    preempt_enable();
+
+    ASSERT_TEST(value2 == value1);
+    ASSERT_TEST(delete_cb_called == 1);
+    ASSERT_TEST(ec_mem_cache_get_allocated_count(&mem_cache, context) == 1);
+
+    // Leave the object in the magazine, destroy must hand it back to kmem_cache
+    ec_mem_cache_disown(value2, context);
+    ASSERT_TEST(ec_mem_cache_get_allocated_count(&mem_cache, context) == 0);
+    ASSERT_TEST(ec_mem_cache_destroy(&mem_cache, context) == 0);
+
+    return passed;
+
+CATCH_DEFAULT:
+    ec_mem_cache_destroy(&mem_cache, context);
+    return false;
+}
@@ -2,13 +2,18 @@
 
 #include "cb-spinlock.h"
 #include "run-tests.h"
+#include "hook-tracking.h"
+
+#include <linux/delay.h>
 
 extern bool g_enable_hook_tracking;
+extern bool g_enable_hook_profiling;
 
 int __ec_DoAction(ProcessContext *context, CB_EVENT_ACTION_TYPE action);
 
 bool __init test__begin_finish_macros(ProcessContext *context);
 bool __init test__hook_tracking_add_del(ProcessContext *context);
+bool __init test__hook_profile(ProcessContext *context);
 bool __init test__action_from_module_state(ModuleState current_state, CB_EVENT_ACTION_TYPE action, int expected_rc, ProcessContext *context);
 
 
@@ -18,6 +23,7 @@ bool __init test__module_state(ProcessContext *context)
 
     RUN_TEST(test__begin_finish_macros(context));
     RUN_TEST(test__hook_tracking_add_del(context));
+    RUN_TEST(test__hook_profile(context));
 
     // These tests check return code from invalid or noop enable/disable requests
     RUN_TEST(test__action_from_module_state(ModuleStateDisabling, CB_EVENT_ACTION_ENABLE_EVENT_COLLECTOR, -EPERM, context));
@@ -109,6 +115,59 @@ CATCH_DEFAULT:
     return passed;
 }
 
+bool __init test__hook_profile(ProcessContext *context)
+{
+    bool passed = false;
+    bool orig_hook_profiling = g_enable_hook_profiling;
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    int i;
+
+    g_enable_hook_profiling = true;
+
+    for (i = 0; i < 2; ++i)
+    {
+        DECLARE_NON_ATOMIC_CONTEXT(test_context, ec_getpid(current));
+
+        ec_hook_profile_enter(&test_context, __func__);
+        ASSERT_TRY(test_context.hook_profile_slot != 0);
+        udelay(10);
+        ec_hook_profile_exit(&test_context);
+        ASSERT_TRY(test_context.hook_profile_slot == 0);
+    }
+
+    ASSERT_TRY(ec_hook_profile_get(__func__, &count, &total_ns, &max_ns));
+    ASSERT_TRY_MSG(count == 2, "count: %llu", count);
+    ASSERT_TRY_MSG(max_ns >= 10 * NSEC_PER_USEC && total_ns >= max_ns,
+                   "total: %llu max: %llu", total_ns, max_ns);
+
+    // Nothing is recorded when profiling is off
+    g_enable_hook_profiling = false;
+    {
+        DECLARE_NON_ATOMIC_CONTEXT(test_context, ec_getpid(current));
+
+        ec_hook_profile_enter(&test_context, __func__);
+        ec_hook_profile_exit(&test_context);
+    }
+    ASSERT_TRY(ec_hook_profile_get(__func__, &count, &total_ns, &max_ns));
+    ASSERT_TRY(count == 2);
+
+    // A reset releases the slot
+    ec_hook_profile_reset();
+    ASSERT_TRY(!ec_hook_profile_get(__func__, &count, &total_ns, &max_ns));
+
+    passed = true;
+
+CATCH_DEFAULT:
+    g_enable_hook_profiling = orig_hook_profiling;
+
+    // Give back the slot this test took
+    ec_hook_profile_reset();
+
+    return passed;
+}
+
 bool __init test__action_from_module_state(ModuleState current_state, CB_EVENT_ACTION_TYPE action, int expected_rc, ProcessContext *context)
 {
     bool passed = false;
@@ -2,17 +2,23 @@
 
 #include "path-buffers.h"
 #include "mem-alloc.h"
+#include "file-process-tracking.h"
 
 #include "run-tests.h"
 
 #include <linux/magic.h>
+#include <linux/namei.h>
+#include <linux/version.h>
 
 
 struct file *__ec_get_file_from_mm(struct mm_struct *mm);
+bool __ec_path_from_cached_prefix(struct path const *path, char *buffer, unsigned int buflen, char **pathname, ProcessContext *context);
 
 bool __init test__task_get_path_data__use_comm(ProcessContext *context);
 bool __init test__path_cache_add__ignored_fs(ProcessContext *context);
 bool __init test__get_path_data__invalid(ProcessContext *context);
+bool __init test__file_ignore_cache(ProcessContext *context);
+bool __init test__path_from_cached_prefix(ProcessContext *context);
 
 bool __init test__paths(ProcessContext *context)
 {
@@ -21,6 +27,8 @@ bool __init test__paths(ProcessContext *context)
     RUN_TEST(test__task_get_path_data__use_comm(context));
     RUN_TEST(test__path_cache_add__ignored_fs(context));
     RUN_TEST(test__get_path_data__invalid(context));
+    RUN_TEST(test__file_ignore_cache(context));
+    RUN_TEST(test__path_from_cached_prefix(context));
 
     RETURN_RESULT();
 }
@@ -114,4 +122,188 @@ CATCH_DEFAULT:
     ec_path_cache_put(path_data, context);
 
     return passed;
-}
\ No newline at end of file
+}
+
+bool __init test__file_ignore_cache(ProcessContext *context)
+{
+    bool passed = false;
+    struct file *file = NULL;
+    struct file *dir = NULL;
+    uint64_t device, inode;
+    uint64_t dir_device, dir_inode;
+
+    // A special file with a single link
+    file = filp_open("/proc/version", O_RDONLY, 0);
+    ASSERT_TRY(!IS_ERR_OR_NULL(file));
+
+    ec_get_devinfo_from_file(file, &device, &inode);
+
+    ASSERT_TRY(!ec_file_ignore_check(file, context));
+
+    ec_file_ignore_add(file, context);
+    ASSERT_TRY(ec_file_ignore_check(file, context));
+
+    // A second add must not leave a duplicate behind after the clear
+    ec_file_ignore_add(file, context);
+
+    // Unlink and rename drop the entry
+    ec_file_ignore_clear(device, inode, context);
+    ASSERT_TRY(!ec_file_ignore_check(file, context));
+
+    // Anything with more than one link may be reached through a name that is not ignored
+    dir = filp_open("/tmp", O_RDONLY, 0);
+    ASSERT_TRY(!IS_ERR_OR_NULL(dir));
+    ASSERT_TRY(ec_get_inode_from_file(dir)->i_nlink > 1);
+
+    ec_get_devinfo_from_file(dir, &dir_device, &dir_inode);
+    ec_file_ignore_add(dir, context);
+    ASSERT_TRY(!ec_file_ignore_check(dir, context));
+
+    passed = true;
+
+CATCH_DEFAULT:
+    if (!IS_ERR_OR_NULL(dir))
+    {
+        ec_file_ignore_clear(dir_device, dir_inode, context);
+        filp_close(dir, NULL);
+    }
+    if (!IS_ERR_OR_NULL(file))
+    {
+        ec_file_ignore_clear(device, inode, context);
+        filp_close(file, NULL);
+    }
+
+    return passed;
+}
+
+// The test makes its own directories so nothing it caches or invalidates is a mount point
+#define PATH_TEST_DIR     "/tmp/ec_path_prefix_test"
+#define PATH_TEST_SUBDIR  PATH_TEST_DIR "/sub"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    #define PATH_TEST_IDMAP  &nop_mnt_idmap,
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+    #define PATH_TEST_IDMAP  &init_user_ns,
+#else
+    #define PATH_TEST_IDMAP
+#endif
+
+static int __init __ec_test_mkdir(const char *pathname)
+{
+    struct path parent;
+    struct dentry *dentry = kern_path_create(AT_FDCWD, pathname, &parent, LOOKUP_DIRECTORY);
+    int ret;
+
+    if (IS_ERR(dentry))
+    {
+        return PTR_ERR(dentry);
+    }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+    dentry = vfs_mkdir(PATH_TEST_IDMAP parent.dentry->d_inode, dentry, 0700);
+    ret = PTR_ERR_OR_ZERO(dentry);
+    done_path_create(&parent, IS_ERR(dentry) ? NULL : dentry);
+#else
+    ret = vfs_mkdir(PATH_TEST_IDMAP parent.dentry->d_inode, dentry, 0700);
+    done_path_create(&parent, dentry);
+#endif
+
+    return ret;
+}
+
+static void __init __ec_test_rmdir(const char *pathname)
+{
+    struct path path;
+    struct dentry *parent;
+
+    if (kern_path(pathname, LOOKUP_DIRECTORY, &path))
+    {
+        return;
+    }
+
+    parent = dget_parent(path.dentry);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+    inode_lock_nested(parent->d_inode, I_MUTEX_PARENT);
+    vfs_rmdir(PATH_TEST_IDMAP parent->d_inode, path.dentry);
+    inode_unlock(parent->d_inode);
+#else
+    mutex_lock_nested(&parent->d_inode->i_mutex, I_MUTEX_PARENT);
+    vfs_rmdir(parent->d_inode, path.dentry);
+    mutex_unlock(&parent->d_inode->i_mutex);
+#endif
+    dput(parent);
+    path_put(&path);
+}
+
+bool __init test__path_from_cached_prefix(ProcessContext *context)
+{
+    bool passed = false;
+    struct file *file = NULL;
+    PathData *path_data = NULL;
+    char *buffer = ec_get_path_buffer(context);
+    char *path_str = NULL;
+    struct path_lookup path_lookup = {};
+    struct inode *dir = NULL;
+    PathDir *top = NULL;
+    PathQuery query = {};
+
+    ASSERT_TRY(buffer);
+
+    // Left over from an earlier run that failed
+    __ec_test_rmdir(PATH_TEST_SUBDIR);
+    __ec_test_rmdir(PATH_TEST_DIR);
+
+    ASSERT_TRY(__ec_test_mkdir(PATH_TEST_DIR) == 0);
+    ASSERT_TRY(__ec_test_mkdir(PATH_TEST_SUBDIR) == 0);
+
+    file = filp_open(PATH_TEST_SUBDIR, O_RDONLY, 0);
+    ASSERT_TRY(!IS_ERR_OR_NULL(file));
+
+    // The directory is new, so this resolves the full path and caches the directories above it
+    path_lookup.file = file;
+    path_data = ec_file_get_path_data(&path_lookup, context);
+    ASSERT_TRY(path_data && path_data->path);
+
+    if (g_enable_path_cache)
+    {
+        ASSERT_TRY(path_data->dir);
+
+        // The chain ends at the root of the mount the file is on
+        top = path_data->dir;
+        while (top->parent)
+        {
+            top = top->parent;
+        }
+        ASSERT_TRY(top->name_len == 0 && top->key.inode == file->f_path.mnt->mnt_root->d_inode->i_ino);
+
+        ASSERT_TRY(__ec_path_from_cached_prefix(&file->f_path, buffer, PATH_MAX, &path_str, context));
+        ASSERT_TRY_MSG(strcmp(path_str, path_data->path) == 0, "path: %s expected: %s", path_str, path_data->path);
+
+        // Renaming a directory drops everything cached below it
+        dir = file->f_path.dentry->d_parent->d_inode;
+        ec_path_cache_invalidate_dir(new_encode_dev(dir->i_sb->s_dev), dir->i_ino, context);
+
+        path_str = NULL;
+        ASSERT_TRY(!__ec_path_from_cached_prefix(&file->f_path, buffer, PATH_MAX, &path_str, context));
+
+        query.key = path_data->key;
+        ec_path_cache_put(path_data, context);
+        path_data = ec_path_cache_find(&query, context);
+        ASSERT_TRY(!path_data);
+    }
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_path_cache_delete(path_data, context);
+    ec_path_cache_put(path_data, context);
+    if (!IS_ERR_OR_NULL(file))
+    {
+        filp_close(file, NULL);
+    }
+    __ec_test_rmdir(PATH_TEST_SUBDIR);
+    __ec_test_rmdir(PATH_TEST_DIR);
+    ec_put_path_buffer(buffer);
+
+    return passed;
+}
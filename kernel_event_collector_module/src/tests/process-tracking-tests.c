@@ -1,10 +1,13 @@
 /* Copyright 2020 VMWare, Inc.  All rights reserved. */
 
-#include "process-tracking.h"
+#include "process-tracking-private.h"
 #include "run-tests.h"
 
 bool __init test__proc_track_report_double_exit(ProcessContext *context);
 bool __init test__sys_clone_missing_parent(ProcessContext *context);
+bool __init test__proc_tracking_generation(ProcessContext *context);
+bool __init test__proc_tracking_index(ProcessContext *context);
+bool __init test__proc_tracking_lineage(ProcessContext *context);
 
 bool __init test__proc_tracking(ProcessContext *context)
 {
@@ -13,6 +16,9 @@ bool __init test__proc_tracking(ProcessContext *context)
     // This test is causing a crash after refactoring.  I believe it is not setting something up correctly on the fake path
     //RUN_TEST(test__proc_track_report_double_exit(context));
     RUN_TEST(test__sys_clone_missing_parent(context));
+    RUN_TEST(test__proc_tracking_generation(context));
+    RUN_TEST(test__proc_tracking_index(context));
+    RUN_TEST(test__proc_tracking_lineage(context));
 
     RETURN_RESULT();
 }
@@ -90,3 +96,168 @@ CATCH_DEFAULT:
     return passed;
 }
 
+
+// Verifies that tracked processes are stamped with the tracking generation, and that a
+//  delta discovery from the current generation has nothing left to stream.
+// This depends on test__sys_clone_missing_parent having tracked the current task.
+bool __init test__proc_tracking_generation(ProcessContext *context)
+{
+    bool passed = false;
+    pid_t pid = ec_getpid(current);
+    uint64_t generation = ec_process_tracking_current_generation();
+    ProcessHandle *handle = ec_process_tracking_get_handle(pid, context);
+
+    ASSERT_TRY(handle);
+    ASSERT_TRY(generation > 0);
+    ASSERT_TRY(ec_process_posix_identity(handle)->generation > 0);
+    ASSERT_TRY(ec_process_posix_identity(handle)->generation <= generation);
+
+    ASSERT_TRY(ec_process_tracking_send_process_discovery_delta(generation, context) == generation);
+    ASSERT_TRY(!ec_process_tracking_discovery_pending());
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_process_tracking_put_handle(handle, context);
+
+    return passed;
+}
+
+static int __init __test_index_find_pid(ProcessHandle *process_handle, void *priv, ProcessContext *context)
+{
+    pid_t *pid = (pid_t *)priv;
+
+    if (ec_process_posix_identity(process_handle)->pt_key.pid == *pid)
+    {
+        *pid = 0;
+        return ACTION_STOP;
+    }
+    return ACTION_CONTINUE;
+}
+
+// Verifies that the current task can be found through the exec inode index.
+// This depends on test__sys_clone_missing_parent having tracked the current task.
+bool __init test__proc_tracking_index(ProcessContext *context)
+{
+    bool passed = false;
+    pid_t pid = ec_getpid(current);
+    pid_t found = pid;
+    ProcessHandle *handle = ec_process_tracking_get_handle(pid, context);
+    PosixIdentity *posix_identity = NULL;
+
+    ASSERT_TRY(handle);
+    posix_identity = ec_process_posix_identity(handle);
+
+    ASSERT_TRY(ec_process_tracking_for_each_by_exec_inode(
+        posix_identity->posix_details.device, posix_identity->posix_details.inode, __test_index_find_pid, &found, context) > 0);
+    ASSERT_TRY(found == 0);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    ec_process_tracking_put_handle(handle, context);
+
+    return passed;
+}
+
+// Pids above PID_MAX_LIMIT so they can never collide with a real task
+#define LINEAGE_TEST_PID      0x7f000001
+#define LINEAGE_TEST_DEVICE   0x11e4
+#define LINEAGE_TEST_INODE    0x11e5
+
+static ProcessHandle * __init __test_lineage_fork(pid_t pid, pid_t parent, ProcessContext *context)
+{
+    return ec_process_tracking_create_process(
+        pid, parent, pid, 0, 0, ec_get_current_time(), CB_PROCESS_START_BY_FORK, NULL, FAKE_START, context);
+}
+
+// Verifies that the lineage record of the current task points at its parent, that siblings forked
+//  between two execs of their parent share one record, and that an exec starts a new one.
+// This depends on test__sys_clone_missing_parent having tracked the current task.
+bool __init test__proc_tracking_lineage(ProcessContext *context)
+{
+    bool passed = false;
+    pid_t parent_pid = LINEAGE_TEST_PID;
+    int64_t lineage_count = 0;
+    char *path = NULL;
+    PathData *path_data = NULL;
+    ProcessHandle *handle = NULL;
+    ProcessHandle *parent = NULL;
+    ProcessHandle *children[3] = { NULL };
+    ProcessLineage *lineage = NULL;
+    int i;
+
+    handle = ec_process_tracking_get_handle(ec_getpid(current), context);
+    ASSERT_TRY(handle);
+    ASSERT_TRY(ec_process_posix_identity(handle)->lineage);
+    ASSERT_TRY(ec_process_posix_identity(handle)->lineage->parent.pid == ec_getppid(current));
+
+    // A fake parent forked from this task.  The record it got from this task stays with this task.
+    parent = __test_lineage_fork(parent_pid, ec_getpid(current), context);
+    ASSERT_TRY(parent);
+    lineage_count = atomic64_read(&g_process_tracking_data.lineage_count);
+
+    children[0] = __test_lineage_fork(parent_pid + 1, parent_pid, context);
+    children[1] = __test_lineage_fork(parent_pid + 2, parent_pid, context);
+    ASSERT_TRY(children[0] && children[1]);
+
+    lineage = ec_process_posix_identity(children[0])->lineage;
+    ASSERT_TRY(lineage != NULL && lineage->parent.pid == parent_pid);
+    ASSERT_TRY(ec_process_posix_identity(children[1])->lineage == lineage);
+    ASSERT_TRY(atomic64_read(&g_process_tracking_data.lineage_count) == lineage_count + 1);
+
+    // After the parent execs, the next child sees the new image as its parent
+    path = ec_mem_strdup("/usr/bin/lineage-test", context);
+    ASSERT_TRY(path);
+    path_data = ec_path_cache_add(0, LINEAGE_TEST_DEVICE, LINEAGE_TEST_INODE, path, 0, context);
+    ASSERT_TRY(path_data);
+
+    {
+        ProcessHandle *execed = ec_process_tracking_update_process(
+            parent_pid, parent_pid, 0, 0, path_data, ec_get_current_time(), CB_PROCESS_START_BY_EXEC,
+            current, CB_EVENT_TYPE_PROCESS_START_EXEC, FAKE_START, context);
+
+        ASSERT_TRY(execed);
+        ec_process_tracking_put_handle(parent, context);
+        parent = execed;
+    }
+
+    children[2] = __test_lineage_fork(parent_pid + 3, parent_pid, context);
+    ASSERT_TRY(children[2]);
+    ASSERT_TRY(ec_process_posix_identity(children[2])->lineage != lineage);
+    ASSERT_TRY(ec_process_posix_identity(children[2])->lineage->parent.inode == LINEAGE_TEST_INODE);
+    ASSERT_TRY(ec_process_posix_identity(children[1])->lineage == lineage);
+    ASSERT_TRY(atomic64_read(&g_process_tracking_data.lineage_count) == lineage_count + 2);
+
+    passed = true;
+
+CATCH_DEFAULT:
+    // Exit the fake processes the way the exit hook would, so the active counts stay balanced
+    for (i = 0; i < ARRAY_SIZE(children); ++i)
+    {
+        if (children[i])
+        {
+            ec_process_tracking_report_exit(parent_pid + 1 + i, context);
+            ec_process_tracking_put_handle(children[i], context);
+        }
+    }
+    if (parent)
+    {
+        ec_process_tracking_report_exit(parent_pid, context);
+        ec_process_tracking_put_handle(parent, context);
+    }
+
+    // Every record made for the fake processes is gone
+    if (passed && atomic64_read(&g_process_tracking_data.lineage_count) != lineage_count)
+    {
+        TRACE(DL_ERROR, "%s: lineage_count %lld, expected %lld", __func__,
+              (long long)atomic64_read(&g_process_tracking_data.lineage_count), (long long)lineage_count);
+        passed = false;
+    }
+
+    ec_path_cache_put(path_data, context);
+    ec_mem_put(path);
+    ec_process_tracking_put_handle(handle, context);
+
+    return passed;
+}
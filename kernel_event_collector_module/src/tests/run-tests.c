@@ -21,6 +21,11 @@ bool __init run_tests(ProcessContext *context)
     RUN_TEST(test__comms(context));
     RUN_TEST(test__paths(context));
 
+    if (g_run_benchmarks)
+    {
+        RUN_TEST(test__benchmarks(context));
+    }
+
     TRACE(DL_ERROR, "Self-tests done, %d failures", test_failures);
 
     g_traceLevel = origTraceLevel;
@@ -15,6 +15,9 @@
 // To run self-tests include the g_run_self_tests arg when loading the module:
 //   insmod event_collector_2_0_999999.ko.3.10.0-957 g_run_self_tests
 //
+// To also run the benchmarks (see bench-tests.c) add the run_benchmarks arg:
+//   insmod event_collector_2_0_999999.ko.3.10.0-957 g_run_self_tests run_benchmarks
+//
 // Test functions and global data must use the __init decorator. This allows
 // the kernel to unload these functions and data after initialization.
 //
@@ -38,6 +41,9 @@ bool __init test__proc_tracking(ProcessContext *context);
 bool __init test__module_state(ProcessContext *context);
 bool __init test__comms(ProcessContext *context);
 bool __init test__paths(ProcessContext *context);
+bool __init test__benchmarks(ProcessContext *context);
+
+extern bool g_run_benchmarks;
 
 #define ASSERT_TRY(stmt)  TRY_MSG(stmt, DL_ERROR, "ASSERT FAILED: [%s:%d] %s", __FILE__, __LINE__, #stmt)
 #define ASSERT_TEST(stmt) R_TEST(stmt, { TRACE(DL_ERROR, "ASSERT FAILED: [%s:%d] %s", __FILE__, __LINE__, #stmt); }, { passed = false; } );